@@ -0,0 +1,32 @@
+#!/bin/bash
+# Download a larger OSM extract for benchmarking and build its GOL file
+#
+# Usage: bench/download_extract.sh [geofabrik-region]   (default: europe/germany/berlin)
+#
+# Building the GOL file needs the gol tool (https://www.geodesk.com/download)
+# on the PATH; the PBF is left in bench/data otherwise.
+
+set -e
+
+BENCH_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+DATA_DIR="${BENCH_DIR}/data"
+REGION="${1:-europe/germany/berlin}"
+NAME="$(basename "$REGION")"
+
+mkdir -p "${DATA_DIR}"
+
+if [ ! -f "${DATA_DIR}/${NAME}.osm.pbf" ]; then
+    echo "Downloading ${REGION}..."
+    wget -q -O "${DATA_DIR}/${NAME}.osm.pbf" \
+        "https://download.geofabrik.de/${REGION}-latest.osm.pbf"
+fi
+
+if [ -f "${DATA_DIR}/${NAME}.gol" ]; then
+    echo "GOL file already exists: ${DATA_DIR}/${NAME}.gol"
+elif command -v gol &> /dev/null; then
+    gol build "${DATA_DIR}/${NAME}.gol" "${DATA_DIR}/${NAME}.osm.pbf"
+    echo "Built ${DATA_DIR}/${NAME}.gol"
+else
+    echo "gol tool not found; build the GOL file with:"
+    echo "  gol build ${DATA_DIR}/${NAME}.gol ${DATA_DIR}/${NAME}.osm.pbf"
+fi
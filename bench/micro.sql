@@ -0,0 +1,18 @@
+-- Bridge microbenchmarks, available when the extension is built with
+-- GEODESK_BENCH=1 (make bench)
+
+CREATE FUNCTION geodesk_bench.micro(
+    datasource text,
+    benchmark text,
+    goql text DEFAULT '*',
+    iterations integer DEFAULT 5,
+    OUT name text,
+    OUT pass integer,
+    OUT calls bigint,
+    OUT total_ms float8,
+    OUT ns_per_call float8,
+    OUT output bigint,
+    OUT output_unit text)
+RETURNS SETOF record
+AS '$libdir/geodesk_fdw', 'geodesk_bench_micro'
+LANGUAGE C STRICT VOLATILE;
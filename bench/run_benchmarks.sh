@@ -0,0 +1,148 @@
+#!/bin/bash
+# Benchmark runner for GeoDesk FDW
+#
+# Usage: bench/run_benchmarks.sh [file.gol ...] > results.json
+#
+# Runs the pgbench workloads in bench/workloads and the bridge
+# microbenchmarks against each GOL file (default: test/data/test.gol) and
+# writes the results to stdout as JSON. Progress goes to stderr.
+#
+# Environment:
+#   BENCH_DURATION   Seconds each pgbench workload runs (default 10)
+#   BENCH_ZOOMS      Zoom levels of the tile workloads (default "10 12 14 16")
+#   BENCH_PASSES     Microbenchmark passes; the first is a warm-up (default 5)
+#   BENCH_MICRO      0 to skip the microbenchmarks, for builds without
+#                    GEODESK_BENCH=1
+#   PGHOST, PGPORT, PGDATABASE, PGUSER   Connection, as for psql
+
+set -e
+
+BENCH_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+REPO_DIR="$(dirname "$BENCH_DIR")"
+WORKLOADS="${BENCH_DIR}/workloads"
+
+DURATION="${BENCH_DURATION:-10}"
+ZOOMS="${BENCH_ZOOMS:-10 12 14 16}"
+PASSES="${BENCH_PASSES:-5}"
+MICRO="${BENCH_MICRO:-1}"
+
+# Width of the Web Mercator world in meters
+WORLD_WIDTH=40075016.68557849
+
+MICRO_BENCHMARKS="iterate tags_jsonb build_lwgeom build_gserialized assemble_rings"
+
+PSQL="psql -X -q -A -t -v ON_ERROR_STOP=1"
+
+if [ $# -eq 0 ]; then
+    set -- "${REPO_DIR}/test/data/test.gol"
+fi
+
+RESULTS=()
+
+json_str() {
+    local s="${1//\\/\\\\}"
+    s="${s//\"/\\\"}"
+    printf '"%s"' "$s"
+}
+
+# Run one pgbench workload and record its transactions, latency and tps
+run_workload() {
+    local datasource="$1" name="$2" script="$3"
+    shift 3
+    local out txns latency tps
+
+    echo "  pgbench ${name}" >&2
+    if ! out=$(pgbench -n -c 1 -T "$DURATION" -f "$script" "$@" 2>&1); then
+        echo "$out" >&2
+        exit 1
+    fi
+
+    txns=$(echo "$out" | sed -n 's/^number of transactions actually processed: \([0-9]*\).*/\1/p')
+    latency=$(echo "$out" | sed -n 's/^latency average = \([0-9.]*\) ms.*/\1/p')
+    tps=$(echo "$out" | sed -n 's/^tps = \([0-9.]*\) .*/\1/p')
+
+    RESULTS+=("{\"suite\": \"pgbench\", \"datasource\": $(json_str "$datasource"), \"workload\": \"${name}\", \"duration_s\": ${DURATION}, \"transactions\": ${txns:-0}, \"latency_ms\": ${latency:-null}, \"tps\": ${tps:-null}}")
+}
+
+# Run the microbenchmarks, reporting the median of the passes after the warm-up
+run_micro() {
+    local datasource="$1" name row
+
+    for name in $MICRO_BENCHMARKS; do
+        echo "  micro ${name}" >&2
+        row=$($PSQL -v datasource="$datasource" -v benchmark="$name" -v passes="$PASSES" <<'SQL'
+SELECT json_build_object(
+           'suite', 'micro',
+           'datasource', :'datasource',
+           'benchmark', :'benchmark',
+           'passes', count(*),
+           'calls', max(calls),
+           'median_ms', percentile_cont(0.5) WITHIN GROUP (ORDER BY total_ms),
+           'ns_per_call', percentile_cont(0.5) WITHIN GROUP (ORDER BY ns_per_call),
+           'output', max(output),
+           'output_unit', max(output_unit))
+FROM geodesk_bench.micro(:'datasource', :'benchmark', '*', :passes)
+WHERE pass > 1 OR :passes = 1;
+SQL
+)
+        RESULTS+=("$row")
+    done
+}
+
+for gol in "$@"; do
+    datasource="$(cd "$(dirname "$gol")" && pwd)/$(basename "$gol")"
+    if [ ! -f "$datasource" ]; then
+        echo "GOL file not found: $datasource" >&2
+        exit 1
+    fi
+    echo "Benchmarking ${datasource}" >&2
+
+    $PSQL -v datasource="$datasource" -f "${BENCH_DIR}/setup.sql" > /dev/null
+    if [ "$MICRO" != "0" ]; then
+        $PSQL -f "${BENCH_DIR}/micro.sql" > /dev/null
+    fi
+
+    # Tiles are placed at random within the extent of the nodes
+    read -r min_x min_y max_x max_y < <($PSQL -F ' ' -c \
+        "SELECT floor(ST_XMin(e))::bigint, floor(ST_YMin(e))::bigint,
+                ceil(ST_XMax(e))::bigint, ceil(ST_YMax(e))::bigint
+         FROM (SELECT ST_Extent(geom) AS e FROM geodesk_bench.features WHERE type = 0) s")
+
+    if [ -n "$min_x" ]; then
+        for zoom in $ZOOMS; do
+            tile=$(awk "BEGIN { printf \"%d\", ${WORLD_WIDTH} / 2 ^ ${zoom} }")
+            run_workload "$datasource" "tile_z${zoom}" "${WORKLOADS}/tile_geom.sql" \
+                -D min_x="$min_x" -D min_y="$min_y" -D max_x="$max_x" -D max_y="$max_y" \
+                -D tile="$tile"
+        done
+    else
+        echo "  no nodes, skipping tile workloads" >&2
+    fi
+
+    for workload in tag_count scan_fid scan_geom scan_tags scan_members scan_parents \
+                    multipolygon multipolygon_cached; do
+        run_workload "$datasource" "$workload" "${WORKLOADS}/${workload}.sql"
+    done
+
+    if [ "$MICRO" != "0" ]; then
+        run_micro "$datasource"
+    fi
+done
+
+commit=$(git -C "$REPO_DIR" rev-parse HEAD 2>/dev/null || echo "")
+server_version=$($PSQL -c "SHOW server_version")
+
+echo "{"
+echo "  \"timestamp\": \"$(date -u +%Y-%m-%dT%H:%M:%SZ)\","
+echo "  \"commit\": $(json_str "$commit"),"
+echo "  \"server_version\": $(json_str "$server_version"),"
+echo "  \"results\": ["
+for i in "${!RESULTS[@]}"; do
+    if [ "$i" -lt $((${#RESULTS[@]} - 1)) ]; then
+        echo "    ${RESULTS[$i]},"
+    else
+        echo "    ${RESULTS[$i]}"
+    fi
+done
+echo "  ]"
+echo "}"
@@ -0,0 +1,24 @@
+-- Benchmark tables for GeoDesk FDW
+-- Usage: psql -v datasource=/absolute/path/to/file.gol -f bench/setup.sql
+
+CREATE EXTENSION IF NOT EXISTS postgis;
+CREATE EXTENSION IF NOT EXISTS geodesk_fdw;
+
+DROP SCHEMA IF EXISTS geodesk_bench CASCADE;
+CREATE SCHEMA geodesk_bench;
+
+CREATE SERVER IF NOT EXISTS geodesk_bench_server
+FOREIGN DATA WRAPPER geodesk_fdw;
+
+CREATE FOREIGN TABLE geodesk_bench.features (
+    fid bigint,
+    type integer,
+    tags jsonb,
+    geom geometry(Geometry, 3857),
+    is_area boolean,
+    members jsonb,
+    parents jsonb
+) SERVER geodesk_bench_server
+OPTIONS (
+    datasource :'datasource'
+);
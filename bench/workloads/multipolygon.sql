@@ -0,0 +1,3 @@
+-- Area relations, with ring assembly on every scan
+SET geodesk_fdw.geometry_cache_size = 0;
+SELECT sum(ST_NPoints(geom)) FROM geodesk_bench.features WHERE type = 2 AND is_area;
@@ -0,0 +1,2 @@
+-- Area relations, from the relation geometry cache after the first scan
+SELECT sum(ST_NPoints(geom)) FROM geodesk_bench.features WHERE type = 2 AND is_area;
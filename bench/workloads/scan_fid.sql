@@ -0,0 +1,2 @@
+-- Full scan building no column but fid
+SELECT sum(fid) FROM geodesk_bench.features;
@@ -0,0 +1,2 @@
+-- Full scan building geometries
+SELECT sum(ST_NPoints(geom)) FROM geodesk_bench.features;
@@ -0,0 +1,2 @@
+-- Full scan building members JSONB
+SELECT count(members) FROM geodesk_bench.features;
@@ -0,0 +1,2 @@
+-- Full scan building parents JSONB
+SELECT count(parents) FROM geodesk_bench.features;
@@ -0,0 +1,2 @@
+-- Full scan building tags JSONB
+SELECT count(tags) FROM geodesk_bench.features;
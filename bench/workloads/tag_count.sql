@@ -0,0 +1,3 @@
+-- Counts answered in libgeodesk from pushed-down tag filters
+SELECT count(*) FROM geodesk_bench.features WHERE tags ? 'highway';
+SELECT count(*) FROM geodesk_bench.features WHERE tags->>'building' = 'yes';
@@ -0,0 +1,6 @@
+-- Geometries of a random tile of size :tile inside the extent
+\set x random(:min_x, :max_x)
+\set y random(:min_y, :max_y)
+SELECT sum(ST_NPoints(geom))
+FROM geodesk_bench.features
+WHERE geom && ST_MakeEnvelope(:x, :y, :x + :tile, :y + :tile, 3857);
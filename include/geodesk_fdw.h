@@ -4,7 +4,9 @@
 #include "postgres.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
+#include "fmgr.h"
 #include "nodes/pg_list.h"
+#include "portability/instr_time.h"
 #include "utils/rel.h"
 
 /* Connection handle type (opaque pointer to C++ object) */
@@ -19,16 +21,60 @@ typedef struct GeodeskFeature
     void* internal_ptr;   /* Opaque pointer to C++ Feature object */
 } GeodeskFeature;
 
+/* SRID of geometries when the table has no srid option (Web Mercator) */
+#define GEODESK_DEFAULT_SRID 3857
+
+/* Number of features fetched across the bridge at a time */
+#define GEODESK_BATCH_SIZE 256
+
+/*
+ * A batch of fetched features, one array per property
+ *
+ * Rows are built from the batch one at a time; ptrs are the features' raw
+ * pointers in the store, which stay valid while the connection is open.
+ */
+typedef struct GeodeskFeatureBatch
+{
+    int count;
+    int64_t ids[GEODESK_BATCH_SIZE];
+    int types[GEODESK_BATCH_SIZE];
+    bool is_area[GEODESK_BATCH_SIZE];
+    void *ptrs[GEODESK_BATCH_SIZE];
+} GeodeskFeatureBatch;
+
+/*
+ * Range of tiles a parallel scan is partitioned into
+ *
+ * Tiles are cells of the regular GOL tile grid at the given zoom level;
+ * workers claim them one at a time by their index within the range.
+ */
+typedef struct GeodeskTileRange
+{
+    int32_t zoom;
+    int32_t min_col;
+    int32_t min_row;
+    int32_t max_col;
+    int32_t max_row;
+} GeodeskTileRange;
+
+/* Highest zoom level used to partition a parallel scan */
+#define GEODESK_MAX_PARTITION_ZOOM 12
+
+/* Shared state of a parallel scan (defined in geodesk_fdw.c) */
+struct GeodeskParallelScanState;
+
 /* FDW relation info stored in baserel->fdw_private */
 typedef struct GeodeskFdwRelationInfo
 {
     /* Connection options */
-    char *datasource;     /* Path to GOL file */
+    char *datasource;     /* GOL file, directory or list of files */
+    List *files;          /* GOL files to scan, after footprint pruning */
     char *layer;          /* Layer specification */
     char *query;          /* GOQL query filter */
     
     /* Pushdown info */
     List *pushdown_clauses;
+    List *runtime_bbox_clauses; /* geom && <expr> evaluated at scan start */
     bool has_spatial_filter;
     double bbox_min_x;
     double bbox_min_y;
@@ -36,13 +82,32 @@ typedef struct GeodeskFdwRelationInfo
     double bbox_max_y;
     char *goql_filter;
     char *type_prefix;        /* GOQL type prefix (n, w, r, nw, etc.) */
+    char *goql_alternatives;  /* Complete GOQL of an OR of selectors, or NULL */
+    int srid;                 /* Output SRID of geom, and of bbox filters */
+    double simplify_tolerance; /* Vertex decimation of geom, in srid units */
+    bool pipeline;            /* Iterate on a producer thread */
+    bool async_capable;       /* Usable by asynchronous Append */
+    int early_quals;          /* Trailing fdw_exprs: local quals on cheap columns */
+    
+    /* Distance filter from ST_DWithin(geom, point, d), in Web Mercator */
+    bool has_distance_filter;
+    double distance_x;
+    double distance_y;
+    double distance_max;
     
-    /* ID filter - disabled, libgeodesk doesn't support direct ID lookup
-     * bool has_id_filter;
-     * int64_t filter_id;
-     */
+    /* ID filter: fid = X or fid = ANY(...), answered from the ID index */
+    bool has_id_filter;
+    int num_filter_ids;
+    int64 *filter_ids;
+    
+    /* Aggregate pushdown (grouped upper relations only) */
+    Oid foreigntableid;
+    List *grouped_tlist;      /* Scan tlist: grouping columns and count(*) */
+    List *agg_outputs;        /* GeodeskAggOutput of each grouped_tlist entry */
     
     /* Cost estimates */
+    Cost startup_cost;        /* Of the unparameterized scan path */
+    Cost total_cost;
     double rows;
     int width;
     
@@ -50,6 +115,94 @@ typedef struct GeodeskFdwRelationInfo
     Bitmapset *attrs_used;  /* Bitmap of columns actually referenced in query */
 } GeodeskFdwRelationInfo;
 
+/* Feature counts by group, indexed by type * 2 + is_area */
+#define GEODESK_COUNT_GROUPS 6
+
+/* Output columns of a pushed-down aggregate */
+typedef enum GeodeskAggOutput
+{
+    GEODESK_AGG_COUNT,        /* count(*) */
+    GEODESK_AGG_TYPE,         /* GROUP BY type */
+    GEODESK_AGG_IS_AREA       /* GROUP BY is_area */
+} GeodeskAggOutput;
+
+/* How a retrieved column is filled */
+typedef enum GeodeskColumnKind
+{
+    GEODESK_COL_FID,
+    GEODESK_COL_TYPE,
+    GEODESK_COL_IS_AREA,
+    GEODESK_COL_TAGS,
+    GEODESK_COL_TAG,          /* Single tag, from the column's "tag" option */
+    GEODESK_COL_GEOM,
+    GEODESK_COL_BBOX,         /* Stored bounds, as box2d or geometry */
+    GEODESK_COL_MEMBERS,
+    GEODESK_COL_MEMBER_IDS,   /* bigint[] */
+    GEODESK_COL_MEMBER_TYPES, /* "char"[] */
+    GEODESK_COL_MEMBER_ROLES, /* text[] */
+    GEODESK_COL_PARENTS,
+    GEODESK_COL_SOURCE,       /* Path of the feature's GOL file */
+    GEODESK_COL_UNKNOWN
+} GeodeskColumnKind;
+
+/* Members of a relation as parallel element arrays */
+typedef struct GeodeskMemberArrays
+{
+    int count;
+    Datum *ids;               /* int8 */
+    Datum *types;             /* "char": 'n', 'w' or 'r' */
+    Datum *roles;             /* text */
+} GeodeskMemberArrays;
+
+/* Stages of building a row, timed separately */
+typedef enum GeodeskScanStage
+{
+    GEODESK_STAGE_ITERATE,    /* Fetching features from the bridge */
+    GEODESK_STAGE_TAGS,       /* tags and tag columns */
+    GEODESK_STAGE_GEOMETRY,   /* geom, including ring assembly */
+    GEODESK_STAGE_MEMBERS,    /* members and member_* columns */
+    GEODESK_STAGE_PARENTS,
+    GEODESK_NUM_STAGES
+} GeodeskScanStage;
+
+/* Work done by a scan, shown by EXPLAIN ANALYZE and kept in geodesk_stat_scans */
+typedef struct GeodeskScanStats
+{
+    int64 features_visited;   /* Iterated by the bridge, including skipped ones */
+    int64 features_returned;  /* Returned as rows, before local quals */
+    int64 early_filtered;     /* Rejected by the early quals */
+    int64 tiles;              /* Parallel scan tiles claimed */
+    int64 ways_assembled;     /* Member ways of relations assembled into rings */
+    int64 geometry_bytes;
+    int64 jsonb_bytes;
+    instr_time stage_time[GEODESK_NUM_STAGES];    /* Only with timing */
+} GeodeskScanStats;
+
+/* Counters kept by a connection (geodesk_connection.cpp) */
+typedef struct GeodeskBridgeCounters
+{
+    int64_t features_visited;
+    int64_t ways_assembled;
+} GeodeskBridgeCounters;
+
+/* Projection plan entry for a retrieved column, resolved once per scan */
+typedef struct GeodeskColumn
+{
+    AttrNumber attnum;
+    GeodeskColumnKind kind;
+    
+    /* Typed tag columns */
+    char *tag_key;
+    int key_index;            /* Index of the key registered with the connection */
+    bool is_text;             /* Value is used as is */
+    FmgrInfo typinput;        /* Otherwise parsed by the type's input function */
+    Oid typioparam;
+    int32 typmod;
+    
+    /* bbox column */
+    bool is_box2d;            /* box2d rather than geometry */
+} GeodeskColumn;
+
 /* Execution state stored in node->fdw_state */
 typedef struct GeodeskExecState
 {
@@ -59,19 +212,78 @@ typedef struct GeodeskExecState
     /* Table metadata */
     Oid foreigntableid;
     List *retrieved_attrs;   /* List of target attribute numbers */
+    GeodeskColumn *columns;  /* Projection plan, one per retrieved attribute */
+    int ncolumns;
     
     /* Current feature */
     GeodeskFeature current_feature;
     bool feature_valid;
     
+    /* Features fetched ahead; rows are returned from here */
+    GeodeskFeatureBatch *batch;
+    int batch_pos;            /* Next feature of the batch to return */
+    
     /* Lazy loading optimization */
     bool needs_geometry;      /* True if geom column is requested */
     bool needs_bbox;          /* True if bbox column is requested */
     bool needs_members;       /* True if members column is requested */
     bool needs_parents;       /* True if parents column is requested */
     
+    /* Member arrays of the current feature, shared by the member_* columns */
+    bool member_arrays_loaded;
+    bool has_member_arrays;
+    GeodeskMemberArrays member_arrays;
+    
+    /* Runtime bbox filter, from join clauses of parameterized paths */
+    List *bbox_exprs;         /* ExprStates of geometries the scan must && */
+    bool bbox_pending;        /* Runtime bbox must be (re)applied */
+    bool scan_empty;          /* Runtime bbox is NULL or disjoint: no rows */
+    bool has_plan_bbox;       /* Planning-time bbox to intersect with */
+    double plan_bbox_min_x;
+    double plan_bbox_min_y;
+    double plan_bbox_max_x;
+    double plan_bbox_max_y;
+    
+    /* Local quals on cheap columns, checked before the others are built */
+    ExprState *early_quals;   /* NULL if there are none */
+    
+    /* Pushed-down aggregate: one row per non-empty group */
+    List *agg_outputs;        /* GeodeskAggOutput per scan tlist entry, or NIL */
+    bool agg_by_type;         /* Grouped by type */
+    bool agg_by_area;         /* Grouped by is_area */
+    bool agg_done;            /* Counts have been computed */
+    int agg_next_group;       /* Next group to return */
+    int64 agg_counts[GEODESK_COUNT_GROUPS];
+    
+    /* Pushed-down LIMIT/OFFSET */
+    bool has_limit;
+    int64 limit_skip;         /* Features still to skip for OFFSET */
+    int64 limit_remaining;    /* Rows still to return */
+    int64 limit_count;        /* Restored on rescan */
+    int64 limit_offset;
+    
+    /* Parallel scan */
+    struct GeodeskParallelScanState *pscan;  /* NULL unless parallel-aware */
+    bool tile_active;         /* True while iterating a claimed tile */
+    
+    /* Asynchronous Append */
+    bool async;               /* Plan node is async; pipeline signals an fd */
+    bool pipeline;            /* Files are iterated on a producer thread */
+    MemoryContextCallback pipeline_cleanup;  /* Stops the producer on abort */
+    
+    /* Files of the datasource, scanned one after another */
+    GeodeskFdwRelationInfo *relinfo;  /* Filters of each file's connection */
+    List *files;              /* Paths left after footprint pruning */
+    int file_index;           /* File of the open connection */
+    
+    /* Runtime bbox last applied, for EXPLAIN ANALYZE */
+    int64 runtime_bbox_count;
+    double runtime_bbox[4];
+    
     /* Statistics */
     uint64 rows_fetched;
+    bool timing;              /* Time the stages of each row */
+    GeodeskScanStats stats;
 } GeodeskExecState;
 
 /* Option names */
@@ -81,39 +293,173 @@ typedef struct GeodeskExecState
 #define OPTION_UPDATABLE "updatable"
 #define OPTION_SCHEMA_MODE "schema"
 #define OPTION_GOQL_FILTER "goql_filter"
+#define OPTION_SRID "srid"
+#define OPTION_SIMPLIFY_TOLERANCE "simplify_tolerance"
+#define OPTION_TAG "tag"
+#define OPTION_PIPELINE "pipeline"
+#define OPTION_ASYNC_CAPABLE "async_capable"
+
+/* GUC variables (geodesk_fdw.c) */
+extern int geodesk_store_cache_size;
+extern bool geodesk_enable_id_index;
+extern int geodesk_geometry_cache_size;
+extern bool geodesk_track_timing;
 
 /* C++ Bridge Functions (implemented in geodesk_connection.cpp) */
 extern GeodeskConnectionHandle geodesk_open(const char* path, const char* query);
+extern bool geodesk_set_query(GeodeskConnectionHandle handle, const char* query, char** error);
 extern void geodesk_close(GeodeskConnectionHandle handle);
 extern void geodesk_reset_iteration(GeodeskConnectionHandle handle);
 extern bool geodesk_get_next_feature(GeodeskConnectionHandle handle, GeodeskFeature* out_feature);
+extern int geodesk_next_batch(GeodeskConnectionHandle handle, GeodeskFeatureBatch* batch,
+                              int max_features);
+extern void geodesk_select_feature(GeodeskConnectionHandle handle, const GeodeskFeatureBatch* batch,
+                                   int index, GeodeskFeature* out_feature);
 extern Datum geodesk_get_tags_jsonb_direct(GeodeskConnectionHandle handle, GeodeskFeature* feature);
 extern Datum geodesk_get_parents_jsonb_direct(GeodeskConnectionHandle handle, GeodeskFeature* feature);
 extern Datum geodesk_get_members_jsonb_direct(GeodeskConnectionHandle handle, GeodeskFeature* feature);
+extern bool geodesk_get_member_arrays(GeodeskConnectionHandle handle, GeodeskFeature* feature,
+                                      GeodeskMemberArrays* out);
 extern void* geodesk_build_lwgeom(GeodeskConnectionHandle handle, GeodeskFeature* feature); /* Returns LWGEOM* */
+
+/* Direct GSERIALIZED writer for nodes and ways (geodesk_gserialized.cpp) */
+extern Datum geodesk_build_gserialized(GeodeskConnectionHandle handle, GeodeskFeature* feature);
+
+/* Stored bounds of a feature, without decoding its coordinates */
+extern bool geodesk_get_feature_bounds(GeodeskConnectionHandle handle, GeodeskFeature* feature,
+                                       double* bounds);
+extern Datum geodesk_build_bbox_gserialized(GeodeskConnectionHandle handle, GeodeskFeature* feature);
+extern bool geodesk_count_features(GeodeskConnectionHandle handle, int64_t max_features,
+                                   int64_t* counts);
 extern void geodesk_feature_cleanup(GeodeskFeature* feature);
+extern void geodesk_get_counters(GeodeskConnectionHandle handle, GeodeskBridgeCounters* counters);
+extern void geodesk_set_output_srid(GeodeskConnectionHandle handle, int srid);
+extern void geodesk_set_simplify_tolerance(GeodeskConnectionHandle handle, double tolerance);
 extern void geodesk_set_spatial_filter(GeodeskConnectionHandle handle, 
                                        double min_x, double min_y, 
                                        double max_x, double max_y);
-extern void geodesk_set_goql_filter(GeodeskConnectionHandle handle, const char* goql);
-extern void geodesk_set_goql_filter_with_prefix(GeodeskConnectionHandle handle, const char* goql, const char* type_prefix);
-/* FID pushdown disabled - libgeodesk doesn't support direct ID lookup
- * extern void geodesk_set_id_filter(GeodeskConnectionHandle handle, int64_t id);
- */
+extern void geodesk_set_distance_filter(GeodeskConnectionHandle handle,
+                                        double x, double y, double max_distance);
+extern bool geodesk_set_goql_filter(GeodeskConnectionHandle handle, const char* goql,
+                                    char** error);
+extern bool geodesk_set_goql_filter_with_prefix(GeodeskConnectionHandle handle, const char* goql,
+                                                const char* type_prefix, const char* alternatives,
+                                                char** error);
+extern void geodesk_set_id_filter(GeodeskConnectionHandle handle, const int64_t* ids, int count);
+extern bool geodesk_build_id_index(GeodeskConnectionHandle handle, int64_t max_features);
+extern int geodesk_register_tag_key(GeodeskConnectionHandle handle, const char* key);
+extern const char* geodesk_get_tag_value(GeodeskConnectionHandle handle, int key_index, int* len);
+
+/* Relation geometry cache (geodesk_geom_cache.cpp) */
+typedef struct GeodeskGeomCacheStats
+{
+    int64_t entries;
+    int64_t bytes;
+    int64_t hits;
+    int64_t misses;
+} GeodeskGeomCacheStats;
+
+extern Datum geodesk_geom_cache_lookup(GeodeskConnectionHandle handle, int64_t relation_id);
+extern void geodesk_geom_cache_store(GeodeskConnectionHandle handle, int64_t relation_id,
+                                     const void* gserialized);
+extern void geodesk_geom_cache_get_stats(GeodeskGeomCacheStats* stats);
+
+/* Cumulative scan statistics in shared memory (geodesk_stats.c) */
+extern void geodesk_stats_report(Oid relid, const GeodeskScanStats* stats);
+
+/* Vector tile encoder (geodesk_mvt.cpp) */
+#define GEODESK_MVT_MAX_ZOOM 24
+
+typedef struct GeodeskMvtTile
+{
+    int zoom;
+    int x;
+    int y;                    /* Counted from the north, as in XYZ tiles */
+    int extent;               /* Tile size in MVT coordinate units */
+    int buffer;               /* Clip margin around the tile, in the same units */
+    const char *layer;        /* Layer name */
+} GeodeskMvtTile;
+
+extern bytea* geodesk_build_mvt(GeodeskConnectionHandle handle, const GeodeskMvtTile* tile);
+
+/* Page cache prewarming (geodesk_prewarm.cpp) */
+#define GEODESK_PREWARM_MAX_THREADS 64
+
+typedef struct GeodeskPrewarmResult
+{
+    int64_t tiles;            /* Tiles loaded */
+    int64_t bytes;            /* Size of those tiles */
+    bool interrupted;         /* Stopped early for an interrupt */
+} GeodeskPrewarmResult;
+
+extern bool geodesk_load_tiles(GeodeskConnectionHandle handle, int nthreads,
+                               GeodeskPrewarmResult* result);
+
+/* Producer thread of pipelined and async scans (geodesk_pipeline.cpp) */
+extern void geodesk_set_pipeline(GeodeskConnectionHandle handle, bool enabled, bool async);
+extern int geodesk_pipeline_start(GeodeskConnectionHandle handle);
+extern bool geodesk_pipeline_ready(GeodeskConnectionHandle handle);
+
+/* Bridge microbenchmarks (geodesk_bench_runner.cpp, built with GEODESK_BENCH=1) */
+typedef enum GeodeskBenchKind
+{
+    GEODESK_BENCH_ITERATE,        /* geodesk_get_next_feature */
+    GEODESK_BENCH_TAGS_JSONB,     /* geodesk_get_tags_jsonb_direct */
+    GEODESK_BENCH_LWGEOM,         /* geodesk_build_lwgeom */
+    GEODESK_BENCH_GSERIALIZED,    /* geodesk_build_gserialized, nodes and ways */
+    GEODESK_BENCH_RINGS,          /* geodesk_assemble_rings, area relations */
+    GEODESK_NUM_BENCH
+} GeodeskBenchKind;
+
+typedef struct GeodeskBenchPass
+{
+    int64_t calls;            /* Calls timed */
+    int64_t nanoseconds;      /* Time spent in those calls */
+    int64_t output;           /* Bytes or vertices built, by benchmark */
+} GeodeskBenchPass;
+
+extern bool geodesk_bench_pass(GeodeskConnectionHandle handle, GeodeskBenchKind kind,
+                               MemoryContext scratch, GeodeskBenchPass* out);
+
+/* Planner estimates (geodesk_estimate.cpp) */
 extern int64_t geodesk_estimate_count(GeodeskConnectionHandle handle);
+extern int64_t geodesk_estimate_total(GeodeskConnectionHandle handle);
+extern bool geodesk_file_footprint(const char* path, int srid, double* bounds);
+extern bool geodesk_lookup_file_estimate(const char* path, const char* key,
+                                         int64_t* rows, int64_t* tuples);
+extern void geodesk_store_file_estimate(const char* path, const char* key,
+                                        int64_t rows, int64_t tuples);
+
+extern void geodesk_plan_tile_partition(GeodeskConnectionHandle handle, int target_tiles,
+                                        GeodeskTileRange* range);
+extern void geodesk_set_tile(GeodeskConnectionHandle handle, const GeodeskTileRange* range,
+                             uint32_t tile_index);
 
 /* Option handling functions (geodesk_options.c) */
 extern void geodesk_get_options(Oid foreigntableid, 
                                 GeodeskFdwRelationInfo *fpinfo);
 extern bool geodesk_is_valid_option(const char *option, Oid context);
+extern char *geodesk_get_column_tag(Oid foreigntableid, AttrNumber attnum);
+extern List *geodesk_datasource_files(const char *datasource);
 
 /* Utility functions */
 extern void geodesk_fdw_version_internal(char* version_str);
 
 /* GOQL conversion functions (goql_converter.c) */
-extern char *extract_goql_from_clauses(List *clauses, List **pushed_clauses);
+typedef struct GoqlFilter
+{
+    List *selectors;          /* Alternatives; private to goql_converter.c */
+} GoqlFilter;
+
+extern void goql_filter_init(GoqlFilter *filter, const char *type_prefix);
+extern bool goql_filter_add_clause(GoqlFilter *filter, Expr *clause,
+                                   char **column_tags, int ncolumns, bool *exact);
+extern void goql_filter_finish(GoqlFilter *filter, char **type_prefix, char **tags,
+                               char **alternatives);
 
 /* Type filter functions (type_filter.c) */
+extern char *extract_type_clause_prefix(Expr *expr);
 extern char *extract_type_filter_prefix(List *clauses, List **pushed_clauses);
+extern bool type_prefix_is_exact(const char *prefix);
 
 #endif /* GEODESK_FDW_H */
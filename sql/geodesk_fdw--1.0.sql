@@ -30,4 +30,91 @@ LANGUAGE C STRICT;
 CREATE FUNCTION geodesk_fdw_drivers()
 RETURNS SETOF text
 AS 'MODULE_PATHNAME'
-LANGUAGE C STRICT;
\ No newline at end of file
+LANGUAGE C STRICT;
+
+CREATE FUNCTION geodesk_fdw_geometry_cache_stats(
+    OUT entries bigint,
+    OUT bytes bigint,
+    OUT hits bigint,
+    OUT misses bigint)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+-- Cumulative scan statistics per foreign table, across all backends
+CREATE FUNCTION geodesk_stat_scans_internal(
+    OUT relid oid,
+    OUT dbid oid,
+    OUT scans bigint,
+    OUT features_visited bigint,
+    OUT features_returned bigint,
+    OUT tiles bigint,
+    OUT ways_assembled bigint,
+    OUT geometry_bytes bigint,
+    OUT jsonb_bytes bigint,
+    OUT iterate_time float8,
+    OUT tags_time float8,
+    OUT geometry_time float8,
+    OUT members_time float8,
+    OUT parents_time float8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+-- Tables of the current database; relid 0 collects the tables beyond the
+-- size of the statistics table
+CREATE VIEW geodesk_stat_scans AS
+SELECT relid::regclass AS relid,
+       scans,
+       features_visited,
+       features_returned,
+       tiles,
+       ways_assembled,
+       geometry_bytes,
+       jsonb_bytes,
+       iterate_time,
+       tags_time,
+       geometry_time,
+       members_time,
+       parents_time
+FROM geodesk_stat_scans_internal()
+WHERE dbid = (SELECT oid FROM pg_database WHERE datname = current_database())
+   OR dbid = 0;
+
+CREATE FUNCTION geodesk_stat_reset()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+REVOKE ALL ON FUNCTION geodesk_stat_reset() FROM public;
+
+-- Vector tile of the features in a GOL file, as a single-layer MVT
+CREATE FUNCTION geodesk_mvt(
+    datasource text,
+    z integer,
+    x integer,
+    y integer,
+    goql text DEFAULT '*',
+    layer text DEFAULT 'default',
+    extent integer DEFAULT 4096,
+    buffer integer DEFAULT 64)
+RETURNS bytea
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT STABLE PARALLEL SAFE;
+
+-- Reads any file the server can
+REVOKE ALL ON FUNCTION geodesk_mvt(text, integer, integer, integer, text, text, integer, integer)
+    FROM public;
+
+-- Load the tiles of a region of a GOL file into the page cache
+CREATE FUNCTION geodesk_prewarm(
+    datasource text,
+    bbox geometry DEFAULT NULL,
+    goql text DEFAULT '*',
+    threads integer DEFAULT 1)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+-- Maps any file the server can read, with up to 64 threads
+REVOKE ALL ON FUNCTION geodesk_prewarm(text, geometry, text, integer) FROM public;
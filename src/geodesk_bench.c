@@ -0,0 +1,132 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_bench.c
+ *      SQL entry point of the bridge microbenchmarks
+ *
+ * Only built with GEODESK_BENCH=1. bench/setup.sql declares the function;
+ * the extension script does not.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "geodesk_fdw.h"
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+
+#define GEODESK_BENCH_COLS 7
+
+typedef struct GeodeskBenchInfo
+{
+    const char *name;
+    const char *output_unit;
+} GeodeskBenchInfo;
+
+/* Indexed by GeodeskBenchKind */
+static const GeodeskBenchInfo bench_info[GEODESK_NUM_BENCH] = {
+    {"iterate", NULL},
+    {"tags_jsonb", "bytes"},
+    {"build_lwgeom", "vertices"},
+    {"build_gserialized", "bytes"},
+    {"assemble_rings", "vertices"},
+};
+
+PG_FUNCTION_INFO_V1(geodesk_bench_micro);
+
+static GeodeskBenchKind
+lookup_bench(const char *name)
+{
+    int i;
+
+    for (i = 0; i < GEODESK_NUM_BENCH; i++)
+    {
+        if (strcmp(bench_info[i].name, name) == 0)
+            return (GeodeskBenchKind) i;
+    }
+
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("unknown benchmark \"%s\"", name),
+             errhint("Valid benchmarks are iterate, tags_jsonb, build_lwgeom, "
+                     "build_gserialized and assemble_rings.")));
+    return GEODESK_NUM_BENCH;   /* keep compiler quiet */
+}
+
+/*
+ * Run a benchmark over the features of a GOL file
+ *
+ * geodesk_bench_micro(datasource, benchmark, goql, iterations) makes
+ * iterations passes over the features matching goql and returns one row
+ * per pass, so the caller can discard warm-up passes and take the median.
+ */
+Datum
+geodesk_bench_micro(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    char *datasource = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    GeodeskBenchKind kind = lookup_bench(text_to_cstring(PG_GETARG_TEXT_PP(1)));
+    char *goql = text_to_cstring(PG_GETARG_TEXT_PP(2));
+    int32 iterations = PG_GETARG_INT32(3);
+    GeodeskConnectionHandle conn;
+    MemoryContext scratch;
+    int32 pass;
+
+    if (iterations < 1)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("iterations must be at least 1")));
+
+    InitMaterializedSRF(fcinfo, 0);
+
+    conn = geodesk_open(datasource, (goql[0] != '\0' && strcmp(goql, "*") != 0) ? goql : NULL);
+    if (!conn)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+                 errmsg("failed to open GOL file \"%s\"", datasource)));
+
+    scratch = AllocSetContextCreate(CurrentMemoryContext, "geodesk benchmark",
+                                    ALLOCSET_DEFAULT_SIZES);
+
+    PG_TRY();
+    {
+        for (pass = 1; pass <= iterations; pass++)
+        {
+            GeodeskBenchPass result;
+            Datum values[GEODESK_BENCH_COLS];
+            bool nulls[GEODESK_BENCH_COLS];
+
+            if (!geodesk_bench_pass(conn, kind, scratch, &result))
+                ereport(ERROR,
+                        (errcode(ERRCODE_FDW_ERROR),
+                         errmsg("benchmark \"%s\" failed", bench_info[kind].name)));
+
+            memset(nulls, false, sizeof(nulls));
+            values[0] = CStringGetTextDatum(bench_info[kind].name);
+            values[1] = Int32GetDatum(pass);
+            values[2] = Int64GetDatum(result.calls);
+            values[3] = Float8GetDatum(result.nanoseconds / 1e6);
+            values[4] = Float8GetDatum(result.calls > 0 ?
+                                       (double) result.nanoseconds / result.calls : 0);
+            values[5] = Int64GetDatum(result.output);
+            if (bench_info[kind].output_unit)
+                values[6] = CStringGetTextDatum(bench_info[kind].output_unit);
+            else
+                nulls[6] = true;
+            tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+
+            CHECK_FOR_INTERRUPTS();
+        }
+    }
+    PG_FINALLY();
+    {
+        geodesk_close(conn);
+    }
+    PG_END_TRY();
+
+    MemoryContextDelete(scratch);
+    return (Datum) 0;
+}
@@ -0,0 +1,207 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_bench_runner.cpp
+ *      Microbenchmarks of the bridge functions that build row values
+ *
+ * Each pass iterates the features of an open connection and times only
+ * the call under test, so iteration (itself one of the benchmarks) is
+ * not counted against the others. Only built with GEODESK_BENCH=1, which
+ * "make bench" sets.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <chrono>
+#include <vector>
+#include <geodesk/geodesk.h>
+#include <geodesk/feature/RelationPtr.h>
+#include <geodesk/feature/MemberIterator.h>
+
+extern "C" {
+#include "postgres.h"
+#include "liblwgeom.h"
+#include "utils/memutils.h"
+#include "geodesk_fdw.h"
+}
+
+using namespace geodesk;
+
+#include "geodesk_connection_internal.h"
+
+std::vector<POINTARRAY*> geodesk_assemble_rings(const std::vector<WayPtr>& ways, int32_t srid,
+                                                double tolerance,
+                                                std::vector<GBOX>* bounds);
+
+// Features whose results pile up in the scratch context before it is reset
+static constexpr int BENCH_RESET_INTERVAL = 256;
+
+using BenchClock = std::chrono::steady_clock;
+
+static inline int64_t
+elapsed_ns(BenchClock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - start).count();
+}
+
+/*
+ * Collect the outer and inner member ways of an area relation
+ */
+static void
+collect_area_ways(GeodeskConnection* conn, RelationPtr rel, std::vector<WayPtr>& outer,
+                  std::vector<WayPtr>& inner)
+{
+    FeatureStore* store = conn->features->store();
+    MemberIterator iter(store, rel.bodyptr(), FeatureTypes::WAYS,
+                        store->borrowAllMatcher(), nullptr);
+
+    outer.clear();
+    inner.clear();
+    for (;;)
+    {
+        WayPtr way(iter.next());
+        if (way.isNull()) break;
+        if (way.isPlaceholder()) continue;
+
+        std::string_view role = iter.currentRole();
+        if (role == "outer") outer.push_back(way);
+        else if (role == "inner") inner.push_back(way);
+    }
+}
+
+static int64_t
+count_points(const std::vector<POINTARRAY*>& rings)
+{
+    int64_t n = 0;
+    for (POINTARRAY* pa : rings)
+    {
+        n += pa->npoints;
+        ptarray_free(pa);
+    }
+    return n;
+}
+
+/*
+ * Time one call of the benchmarked function on the current feature
+ */
+static void
+bench_feature(GeodeskConnection* conn, GeodeskBenchKind kind, GeodeskFeature* feature,
+              std::vector<WayPtr>& outer, std::vector<WayPtr>& inner, GeodeskBenchPass* out)
+{
+    auto handle = reinterpret_cast<GeodeskConnectionHandle>(conn);
+    BenchClock::time_point start;
+
+    switch (kind)
+    {
+    case GEODESK_BENCH_TAGS_JSONB:
+    {
+        start = BenchClock::now();
+        Datum tags = geodesk_get_tags_jsonb_direct(handle, feature);
+        out->nanoseconds += elapsed_ns(start);
+        out->calls++;
+        if (tags != (Datum) 0) out->output += VARSIZE(DatumGetPointer(tags));
+        break;
+    }
+    case GEODESK_BENCH_LWGEOM:
+    {
+        start = BenchClock::now();
+        LWGEOM* geom = static_cast<LWGEOM*>(geodesk_build_lwgeom(handle, feature));
+        out->nanoseconds += elapsed_ns(start);
+        out->calls++;
+        if (geom)
+        {
+            out->output += lwgeom_count_vertices(geom);
+            lwgeom_free(geom);
+        }
+        break;
+    }
+    case GEODESK_BENCH_GSERIALIZED:
+    {
+        if (feature->type == 2) break;
+        start = BenchClock::now();
+        Datum geom = geodesk_build_gserialized(handle, feature);
+        out->nanoseconds += elapsed_ns(start);
+        out->calls++;
+        if (geom != (Datum) 0) out->output += VARSIZE(DatumGetPointer(geom));
+        break;
+    }
+    case GEODESK_BENCH_RINGS:
+    {
+        Feature f = *conn->current_feature;
+        if (!f.isRelation() || !f.isArea()) break;
+
+        // Gathering the members is part of building the geometry, but not of ring assembly
+        collect_area_ways(conn, RelationPtr(f.ptr()), outer, inner);
+        start = BenchClock::now();
+        std::vector<POINTARRAY*> outerRings = geodesk_assemble_rings(outer, conn->srid,
+                                                                     conn->simplify_tolerance, nullptr);
+        std::vector<POINTARRAY*> innerRings = geodesk_assemble_rings(inner, conn->srid,
+                                                                     conn->simplify_tolerance, nullptr);
+        out->nanoseconds += elapsed_ns(start);
+        out->calls++;
+        out->output += count_points(outerRings) + count_points(innerRings);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+extern "C" {
+
+/*
+ * Run one pass of a benchmark over all features of the connection
+ *
+ * The values built are allocated in, and periodically freed by resetting,
+ * the scratch context, which must not be the caller's current context.
+ * The iteration is reset afterwards, so passes can be repeated.
+ */
+__attribute__((visibility("default")))
+bool
+geodesk_bench_pass(GeodeskConnectionHandle handle, GeodeskBenchKind kind,
+                   MemoryContext scratch, GeodeskBenchPass* out)
+{
+    if (!handle || !out) return false;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    MemoryContext oldcontext = MemoryContextSwitchTo(scratch);
+    std::vector<WayPtr> outer;
+    std::vector<WayPtr> inner;
+    GeodeskFeature feature;
+    bool ok = true;
+
+    memset(out, 0, sizeof(GeodeskBenchPass));
+
+    try
+    {
+        for (int n = 1; ; n++)
+        {
+            BenchClock::time_point start = BenchClock::now();
+            bool found = geodesk_get_next_feature(handle, &feature);
+            if (kind == GEODESK_BENCH_ITERATE)
+            {
+                out->nanoseconds += elapsed_ns(start);
+                if (found) out->calls++;
+            }
+            if (!found) break;
+
+            bench_feature(conn, kind, &feature, outer, inner, out);
+            geodesk_feature_cleanup(&feature);
+
+            if (n % BENCH_RESET_INTERVAL == 0) MemoryContextReset(scratch);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Benchmark pass failed: %s", e.what())));
+        ok = false;
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextReset(scratch);
+    geodesk_reset_iteration(handle);
+    return ok;
+}
+
+} // extern "C"
@@ -10,12 +10,12 @@
 #include <memory>
 #include <string>
 #include <cstring>      // For strlen, strcpy
-#include <cstdio>       // For fopen
-#include <cerrno>       // For errno
 #include <optional>
 #include <exception>
 #include <concepts>     // For std::integral
 #include <string_view>  // For string_view methods
+#include <algorithm>    // For std::min
+#include <climits>      // For INT32_MIN/INT32_MAX
 
 // Include the full geodesk API with implementations
 #include <geodesk/geodesk.h>
@@ -32,6 +32,86 @@ using namespace geodesk;
 // Include shared connection structure
 #include "geodesk_connection_internal.h"
 
+/*
+ * Make a feature the connection's current one and describe it to the caller
+ */
+static void
+set_current_feature(GeodeskConnection* conn, Feature f, GeodeskFeature* out_feature)
+{
+    // Cache a copy of the feature for tag/geometry access, reusing the
+    // previous row's allocation
+    if (conn->current_feature)
+        *conn->current_feature = f;
+    else
+        conn->current_feature = std::make_unique<Feature>(f);
+    
+    // Extract basic properties
+    out_feature->id = f.id();
+    out_feature->type = static_cast<int>(f.type());
+    out_feature->is_area = f.isArea();
+    
+    // Store the FeaturePtr for later access
+    // Feature.ptr() returns FeaturePtr (T = FeaturePtr)
+    // FeaturePtr.ptr() returns DataPtr
+    // DataPtr.ptr() returns uint8_t*
+    FeaturePtr fptr = f.ptr();
+    DataPtr dptr = fptr.ptr();
+    uint8_t* raw = dptr.ptr();
+    out_feature->internal_ptr = static_cast<void*>(raw);
+}
+
+/*
+ * Append a feature to a batch
+ */
+static inline void
+add_to_batch(GeodeskFeatureBatch* batch, Feature f)
+{
+    int i = batch->count++;
+    batch->ids[i] = f.id();
+    batch->types[i] = static_cast<int>(f.type());
+    batch->is_area[i] = f.isArea();
+    batch->ptrs[i] = static_cast<void*>(f.ptr().ptr().ptr());
+}
+
+/*
+ * Look up the features of a connection's fid filter in the ID index
+ *
+ * A fid matches up to one feature of each type. Lookups bypass the views,
+ * so each match is checked against the most specific view instead, which
+ * carries the table query, pushed-down GOQL and bbox.
+ */
+static void
+resolve_id_matches(GeodeskConnection* conn)
+{
+    conn->id_matches.clear();
+    conn->id_pos = 0;
+    
+    try
+    {
+        const GeodeskIdIndex& index = geodesk_id_index_get(conn->store_entry.get());
+        FeatureStore* store = conn->features->store();
+        Features* view = conn->bbox_filtered_features ? conn->bbox_filtered_features :
+                         conn->filtered_features;
+        
+        for (int64_t id : conn->filter_ids)
+        {
+            for (int type = 0; type <= 2; type++)
+            {
+                uint8_t* raw = geodesk_id_index_find(index, id, type);
+                if (!raw) continue;
+                if (view && !view->contains(Feature(store, FeaturePtr(raw)))) continue;
+                conn->id_matches.push_back(raw);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to look up features by id: %s", e.what())));
+    }
+}
+
 /*
  * C interface functions
  */
@@ -39,35 +119,22 @@ extern "C" {
 
 /*
  * Open a connection to a GOL file
+ *
+ * The store itself comes from the per-backend store cache; only the
+ * connection and its views are created here.
  */
 GeodeskConnectionHandle
 geodesk_open(const char* path, const char* query)
 {
     try
     {
-        ereport(INFO,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("geodesk_open: Attempting to open '%s'", path)));
-        
-        // Check if file exists and is readable
-        FILE* fp = fopen(path, "rb");
-        if (fp) {
-            fclose(fp);
-            ereport(INFO,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("geodesk_open: File is readable via fopen")));
-        } else {
-            int saved_errno = errno;  // Save errno before PostgreSQL macros
-            ereport(WARNING,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("geodesk_open: Cannot open file via fopen: %s", strerror(saved_errno))));
-        }
-        
-        auto conn = new GeodeskConnection();
+        auto conn = std::make_unique<GeodeskConnection>();
         conn->filename = path;
-        
-        // Create a Features object that opens the GOL file
-        conn->features = new Features(path);
+        conn->store_entry = geodesk_store_cache_acquire(path);
+
+        // Each connection gets its own copy of the base view; copies share
+        // the open FeatureStore
+        conn->features = new Features(*conn->store_entry->features);
         
         // Apply GOQL query if provided
         if (query && strlen(query) > 0)
@@ -78,7 +145,7 @@ geodesk_open(const char* path, const char* query)
                 // Create a filtered view using the GOQL query
                 // Use operator() to create a filtered view
                 conn->filtered_features = new Features(conn->features->operator()(query));
-                ereport(INFO,
+                ereport(DEBUG1,
                         (errcode(ERRCODE_FDW_ERROR),
                          errmsg("geodesk_open: Applied GOQL query: '%s'", query)));
             }
@@ -88,14 +155,11 @@ geodesk_open(const char* path, const char* query)
                         (errcode(ERRCODE_FDW_ERROR),
                          errmsg("Failed to apply GOQL query '%s': %s", query, e.what())));
                 // Continue without filter on error
+                conn->query.clear();
             }
         }
         
-        ereport(INFO,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("geodesk_open: Successfully opened '%s'", path)));
-        
-        return reinterpret_cast<GeodeskConnectionHandle>(conn);
+        return reinterpret_cast<GeodeskConnectionHandle>(conn.release());
     }
     catch (const std::exception& e)
     {
@@ -113,6 +177,35 @@ geodesk_open(const char* path, const char* query)
     }
 }
 
+/*
+ * Restrict a connection opened without a query to a GOQL query
+ *
+ * Unlike geodesk_open, which goes on without a query libgeodesk rejects,
+ * returns false and sets *error, if given, to the palloc'd reason, so the
+ * caller can refuse to run unfiltered. Call before setting any filter.
+ */
+bool
+geodesk_set_query(GeodeskConnectionHandle handle, const char* query, char** error)
+{
+    if (!handle) return false;
+    
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    
+    try
+    {
+        auto filtered = std::make_unique<Features>((*conn->features)(query));
+        delete conn->filtered_features;
+        conn->filtered_features = filtered.release();
+        conn->query = query;
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        if (error) *error = pstrdup(e.what());
+        return false;
+    }
+}
+
 /*
  * Close a connection
  */
@@ -134,13 +227,33 @@ geodesk_reset_iteration(GeodeskConnectionHandle handle)
     if (!handle) return;
     
     auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    geodesk_pipeline_stop(conn);
+    
+    // The producer starts with the next batch, and iterates on its own
+    if (conn->pipeline_mode && !conn->has_id_filter && !conn->has_tile)
+    {
+        if (conn->current_iter)
+        {
+            delete conn->current_iter;
+            conn->current_iter = nullptr;
+        }
+        return;
+    }
+    
+    // A fid filter is answered from the ID index instead of a view
+    if (conn->has_id_filter)
+    {
+        resolve_id_matches(conn);
+        conn->iteration_started = true;
+        return;
+    }
     
-    // Priority: bbox filter > GOQL filter > all features
-    // FID filtering disabled - libgeodesk doesn't support direct ID lookup
-    Features* features_to_iterate = conn->bbox_filtered_features ?
+    // Priority: current tile > bbox filter > GOQL filter > all features
+    Features* features_to_iterate = conn->tile_features ? conn->tile_features :
+                                    (conn->bbox_filtered_features ?
                                      conn->bbox_filtered_features :
                                      (conn->filtered_features ? 
-                                      conn->filtered_features : conn->features);
+                                      conn->filtered_features : conn->features));
     
     if (features_to_iterate)
     {
@@ -157,6 +270,44 @@ geodesk_reset_iteration(GeodeskConnectionHandle handle)
     }
 }
 
+/*
+ * Check whether a feature is owned by the connection's current tile
+ */
+static bool
+feature_in_current_tile(GeodeskConnection* conn, Feature f)
+{
+    return tile_owns(conn->tile_cell, conn->has_bbox_filter ? &conn->bbox : nullptr,
+                     f.bounds());
+}
+
+/*
+ * Return the next feature found by a fid lookup
+ */
+static bool
+next_id_match(GeodeskConnection* conn, GeodeskFeature* out_feature)
+{
+    try
+    {
+        FeatureStore* store = conn->features->store();
+        
+        while (conn->id_pos < conn->id_matches.size())
+        {
+            Feature f(store, FeaturePtr(conn->id_matches[conn->id_pos++]));
+            if (conn->has_tile && !feature_in_current_tile(conn, f))
+                continue;
+            set_current_feature(conn, f, out_feature);
+            return true;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Error iterating features: %s", e.what())));
+    }
+    return false;
+}
+
 /*
  * Get next feature - returns true if a feature was found
  */
@@ -176,6 +327,9 @@ geodesk_get_next_feature(GeodeskConnectionHandle handle, GeodeskFeature* out_fea
         geodesk_reset_iteration(handle);
     }
     
+    if (conn->has_id_filter)
+        return next_id_match(conn, out_feature);
+    
     // Check if iterator is valid
     if (!conn->current_iter || *conn->current_iter == nullptr)
     {
@@ -187,31 +341,16 @@ geodesk_get_next_feature(GeodeskConnectionHandle handle, GeodeskFeature* out_fea
     
     try
     {
-        // Get the current feature
-        Feature f = **conn->current_iter;
-        
-        // Cache a copy of the feature for tag/geometry access
-        conn->current_feature = std::make_unique<Feature>(f);
-        
-        // Extract basic properties
-        out_feature->id = f.id();
-        out_feature->type = static_cast<int>(f.type());
-        out_feature->is_area = f.isArea();
-        
-        // Store the FeaturePtr for later access
-        // Feature.ptr() returns FeaturePtr (T = FeaturePtr)
-        // FeaturePtr.ptr() returns DataPtr
-        // DataPtr.ptr() returns uint8_t*
-        FeaturePtr fptr = f.ptr();
-        DataPtr dptr = fptr.ptr();
-        uint8_t* raw = dptr.ptr();
-        out_feature->internal_ptr = static_cast<void*>(raw);
+        // Skip features that belong to another tile of a parallel scan
+        while (conn->has_tile && !feature_in_current_tile(conn, **conn->current_iter))
+        {
+            ++(*conn->current_iter);
+            if (*conn->current_iter == nullptr)
+                return false;
+        }
         
-        ereport(DEBUG1,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("Got feature: id=%lld, type=%d, is_area=%d", 
-                        (long long)out_feature->id, out_feature->type, 
-                        out_feature->is_area ? 1 : 0)));
+        // Get the current feature
+        set_current_feature(conn, **conn->current_iter, out_feature);
         
         // Move to next feature
         ++(*conn->current_iter);
@@ -227,6 +366,169 @@ geodesk_get_next_feature(GeodeskConnectionHandle handle, GeodeskFeature* out_fea
     }
 }
 
+/*
+ * Fetch up to max_features (at most GEODESK_BATCH_SIZE) features of the
+ * iteration into a batch
+ *
+ * Only the features' pointers and scalar properties are stored; a feature
+ * becomes the current one when geodesk_select_feature is called for it.
+ * Returns the number of features fetched, 0 at the end of the iteration.
+ */
+int
+geodesk_next_batch(GeodeskConnectionHandle handle, GeodeskFeatureBatch* batch, int max_features)
+{
+    if (!batch) return 0;
+    batch->count = 0;
+    if (!handle) return 0;
+    
+    int limit = std::min(max_features, GEODESK_BATCH_SIZE);
+    
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    
+    // Falls back to iterating here if the producer can't be started
+    if (conn->pipeline_mode && !conn->has_id_filter && !conn->has_tile)
+    {
+        int count = geodesk_pipeline_next_batch(conn, batch, limit);
+        if (count >= 0) return count;
+    }
+    
+    if (!conn->iteration_started)
+        geodesk_reset_iteration(handle);
+    
+    try
+    {
+        if (conn->has_id_filter)
+        {
+            FeatureStore* store = conn->features->store();
+            
+            while (batch->count < limit && conn->id_pos < conn->id_matches.size())
+            {
+                Feature f(store, FeaturePtr(conn->id_matches[conn->id_pos++]));
+                conn->features_visited++;
+                if (conn->has_tile && !feature_in_current_tile(conn, f))
+                    continue;
+                add_to_batch(batch, f);
+            }
+            return batch->count;
+        }
+        
+        if (!conn->current_iter) return 0;
+        
+        while (batch->count < limit && *conn->current_iter != nullptr)
+        {
+            Feature f = **conn->current_iter;
+            ++(*conn->current_iter);
+            conn->features_visited++;
+            
+            // Skip features that belong to another tile of a parallel scan
+            if (conn->has_tile && !feature_in_current_tile(conn, f))
+                continue;
+            add_to_batch(batch, f);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Error iterating features: %s", e.what())));
+    }
+    return batch->count;
+}
+
+/*
+ * Make the index'th feature of a batch the current one
+ */
+void
+geodesk_select_feature(GeodeskConnectionHandle handle, const GeodeskFeatureBatch* batch,
+                       int index, GeodeskFeature* out_feature)
+{
+    if (!handle || !batch || !out_feature || index < 0 || index >= batch->count) return;
+    
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    Feature f(conn->features->store(), FeaturePtr(static_cast<uint8_t*>(batch->ptrs[index])));
+    
+    if (conn->current_feature)
+        *conn->current_feature = f;
+    else
+        conn->current_feature = std::make_unique<Feature>(f);
+    
+    out_feature->id = batch->ids[index];
+    out_feature->type = batch->types[index];
+    out_feature->is_area = batch->is_area[index];
+    out_feature->internal_ptr = batch->ptrs[index];
+}
+
+/*
+ * Count the remaining features of the iteration by group
+ *
+ * Advances the iteration by up to max_features features without
+ * materializing them, adding each to counts[type * 2 + is_area]. Returns
+ * true if features remain, so callers can check for interrupts between
+ * batches.
+ */
+bool
+geodesk_count_features(GeodeskConnectionHandle handle, int64_t max_features, int64_t* counts)
+{
+    if (!handle || !counts) return false;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+
+    if (!conn->iteration_started)
+        geodesk_reset_iteration(handle);
+
+    try
+    {
+        int64_t n = 0;
+
+        if (conn->has_id_filter)
+        {
+            FeatureStore* store = conn->features->store();
+
+            while (conn->id_pos < conn->id_matches.size())
+            {
+                if (n++ == max_features) return true;
+                Feature f(store, FeaturePtr(conn->id_matches[conn->id_pos++]));
+                conn->features_visited++;
+                counts[static_cast<int>(f.type()) * 2 + (f.isArea() ? 1 : 0)]++;
+            }
+            return false;
+        }
+
+        if (!conn->current_iter) return false;
+
+        while (*conn->current_iter != nullptr)
+        {
+            if (n++ == max_features) return true;
+            Feature f = **conn->current_iter;
+            conn->features_visited++;
+            counts[static_cast<int>(f.type()) * 2 + (f.isArea() ? 1 : 0)]++;
+            ++(*conn->current_iter);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Error counting features: %s", e.what())));
+    }
+    return false;
+}
+
+/*
+ * Get the work counters of a connection, accumulated since it was opened
+ */
+void
+geodesk_get_counters(GeodeskConnectionHandle handle, GeodeskBridgeCounters* counters)
+{
+    if (!counters) return;
+    memset(counters, 0, sizeof(*counters));
+    if (!handle) return;
+    
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    counters->features_visited = conn->features_visited + geodesk_pipeline_visited(conn);
+    counters->ways_assembled = conn->ways_assembled;
+}
+
 /*
  * Clean up feature resources
  */
@@ -236,9 +538,79 @@ geodesk_feature_cleanup(GeodeskFeature* feature)
     // Nothing to do yet
 }
 
+/*
+ * Rebuild the bbox view on top of the current filtered view
+ *
+ * Views are chained base -> filtered -> bbox, so whenever the filtered
+ * view changes, the bbox view has to be derived again.
+ */
+static void
+rebuild_bbox_view(GeodeskConnection* conn)
+{
+    geodesk_pipeline_stop(conn);
+
+    // The iterator may reference the old view; iteration restarts lazily
+    if (conn->current_iter)
+    {
+        delete conn->current_iter;
+        conn->current_iter = nullptr;
+    }
+    conn->iteration_started = false;
+
+    if (conn->bbox_filtered_features)
+    {
+        delete conn->bbox_filtered_features;
+        conn->bbox_filtered_features = nullptr;
+    }
+
+    if (!conn->has_bbox_filter)
+        return;
+
+    Features* base_features = conn->filtered_features ? conn->filtered_features : conn->features;
+    Features bbox_view = (*base_features)(conn->bbox);
+    
+    // The distance test runs on the GOL geometry, before any LWGEOM is built
+    if (conn->has_distance_filter)
+        conn->bbox_filtered_features = new Features(
+            bbox_view.maxMetersFrom(conn->distance_meters, conn->distance_center));
+    else
+        conn->bbox_filtered_features = new Features(bbox_view);
+}
+
+/*
+ * Set the SRID geometries are written in and bbox filters are given in
+ *
+ * Must be set before the spatial filter; only Web Mercator and WGS 84 are
+ * supported, anything else falls back to Web Mercator.
+ */
+void
+geodesk_set_output_srid(GeodeskConnectionHandle handle, int srid)
+{
+    if (!handle) return;
+    
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    conn->srid = (srid == GEODESK_SRID_WGS84) ? GEODESK_SRID_WGS84 : GEODESK_SRID_WEB_MERCATOR;
+}
+
+/*
+ * Set the tolerance, in output SRID units, within which consecutive
+ * vertices of way and relation geometries are merged
+ *
+ * Features smaller than the tolerance get no geometry at all. Must be set
+ * after the output SRID; 0 builds full-resolution geometries.
+ */
+void
+geodesk_set_simplify_tolerance(GeodeskConnectionHandle handle, double tolerance)
+{
+    if (!handle) return;
+    
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    conn->simplify_tolerance = tolerance > 0 ? geodesk_tolerance_to_imp(conn->srid, tolerance) : 0;
+}
+
 /*
  * Set spatial filter (bounding box)
- * Coordinates should be in Web Mercator (EPSG:3857) meters
+ * Coordinates are in the table's output SRID (see geodesk_set_output_srid)
  */
 void
 geodesk_set_spatial_filter(GeodeskConnectionHandle handle, 
@@ -251,37 +623,35 @@ geodesk_set_spatial_filter(GeodeskConnectionHandle handle,
     
     try
     {
-        // Convert Web Mercator meters to GeoDesk imp units
-        // GeoDesk uses full int32 range, Web Mercator uses meters at equator
-        // Conversion factor: MAP_WIDTH / EARTH_CIRCUMFERENCE
-        constexpr double METERS_TO_IMP = 4294967294.9999 / 40075016.68558;
-        
-        int32_t imp_min_x = static_cast<int32_t>(min_x * METERS_TO_IMP);
-        int32_t imp_min_y = static_cast<int32_t>(min_y * METERS_TO_IMP);
-        int32_t imp_max_x = static_cast<int32_t>(max_x * METERS_TO_IMP);
-        int32_t imp_max_y = static_cast<int32_t>(max_y * METERS_TO_IMP);
-        
-        // Create Box for spatial filtering
-        Box bbox(imp_min_x, imp_min_y, imp_max_x, imp_max_y);
+        // Convert the output SRID to GeoDesk imp units
+        double min_imp[2], max_imp[2];
+        geodesk_unproject_point(conn->srid, min_x, min_y, &min_imp[0], &min_imp[1]);
+        geodesk_unproject_point(conn->srid, max_x, max_y, &max_imp[0], &max_imp[1]);
         
-        // Apply bbox filter to features
-        Features* base_features = conn->filtered_features ? conn->filtered_features : conn->features;
-        
-        // Clean up any existing bbox filter
-        if (conn->bbox_filtered_features)
+        // Clamp, since runtime boxes from outer rows may exceed the map
+        auto clamp_imp = [](double imp)
         {
-            delete conn->bbox_filtered_features;
-            conn->bbox_filtered_features = nullptr;
-        }
+            if (!(imp > INT32_MIN)) return static_cast<int32_t>(INT32_MIN);
+            if (imp >= INT32_MAX) return static_cast<int32_t>(INT32_MAX);
+            return static_cast<int32_t>(imp);
+        };
+        
+        int32_t imp_min_x = clamp_imp(min_imp[0]);
+        int32_t imp_min_y = clamp_imp(min_imp[1]);
+        int32_t imp_max_x = clamp_imp(max_imp[0]);
+        int32_t imp_max_y = clamp_imp(max_imp[1]);
         
-        // Apply the bbox filter using operator()
-        conn->bbox_filtered_features = new Features((*base_features)(bbox));
+        // Create Box for spatial filtering
+        conn->bbox = Box(imp_min_x, imp_min_y, imp_max_x, imp_max_y);
         conn->has_bbox_filter = true;
         
-        ereport(INFO,
+        // Apply the bbox filter on top of the filtered view
+        rebuild_bbox_view(conn);
+        
+        ereport(DEBUG1,
                 (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("Applied bbox filter: meters[%.2f,%.2f,%.2f,%.2f] -> imp[%d,%d,%d,%d]", 
-                        min_x, min_y, max_x, max_y,
+                 errmsg("Applied bbox filter: srid %d [%.6f,%.6f,%.6f,%.6f] -> imp[%d,%d,%d,%d]", 
+                        conn->srid, min_x, min_y, max_x, max_y,
                         imp_min_x, imp_min_y, imp_max_x, imp_max_y)));
     }
     catch (const std::exception& e)
@@ -294,34 +664,32 @@ geodesk_set_spatial_filter(GeodeskConnectionHandle handle,
 
 /*
  * Set GOQL filter with type prefix
+ *
+ * The filter is applied on top of the table's query option (if any); an
+ * existing bbox filter is re-derived from the new view. alternatives, if
+ * given, is a complete query ("n[amenity=pub],wa[building]") the features
+ * must also match.
+ *
+ * Returns false, leaving the connection unchanged, if libgeodesk rejects
+ * the query; the planner has dropped the quals the filter stands for, so
+ * the caller must not scan without it. *error, if given, is set to the
+ * palloc'd reason.
  */
-void
-geodesk_set_goql_filter_with_prefix(GeodeskConnectionHandle handle, const char* goql, const char* type_prefix)
+bool
+geodesk_set_goql_filter_with_prefix(GeodeskConnectionHandle handle, const char* goql,
+                                    const char* type_prefix, const char* alternatives,
+                                    char** error)
 {
-    if (!handle) return;
+    if (!handle) return false;
     
     auto conn = reinterpret_cast<GeodeskConnection*>(handle);
     
     try
     {
-        // Apply GOQL filter to the most specific features available
-        Features* base_features = conn->bbox_filtered_features ?
-                                 conn->bbox_filtered_features :
-                                 conn->features;
-        
-        if (!base_features)
-        {
-            ereport(WARNING,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("No base features to apply GOQL filter to")));
-            return;
-        }
-        
-        // Clean up any existing filtered features
-        if (conn->filtered_features)
+        if (!conn->features)
         {
-            delete conn->filtered_features;
-            conn->filtered_features = nullptr;
+            if (error) *error = pstrdup("no base features to apply the filter to");
+            return false;
         }
         
         // Apply the GOQL query with type prefix
@@ -340,85 +708,242 @@ geodesk_set_goql_filter_with_prefix(GeodeskConnectionHandle handle, const char*
             full_query += goql;
         }
         
-        conn->filtered_features = new Features((*base_features)(full_query.c_str()));
+        std::unique_ptr<Features> filtered;
+        if (!conn->query.empty())
+        {
+            Features query_view = (*conn->features)(conn->query.c_str());
+            filtered = std::make_unique<Features>(query_view(full_query.c_str()));
+        }
+        else
+        {
+            filtered = std::make_unique<Features>((*conn->features)(full_query.c_str()));
+        }
+        
+        if (alternatives && strlen(alternatives) > 0)
+        {
+            filtered = std::make_unique<Features>((*filtered)(alternatives));
+            full_query += "|";
+            full_query += alternatives;
+        }
+        
+        // Replace any existing filtered features
+        if (conn->filtered_features)
+            delete conn->filtered_features;
+        conn->filtered_features = filtered.release();
+        conn->goql_query = full_query;
+        
+        rebuild_bbox_view(conn);
         
-        ereport(INFO,
+        ereport(DEBUG1,
                 (errcode(ERRCODE_FDW_ERROR),
                  errmsg("Applied GOQL filter: %s", full_query.c_str())));
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        if (error) *error = pstrdup(e.what());
+        return false;
+    }
+}
+
+/*
+ * Restrict the bbox view to features within a distance of a point
+ *
+ * The point is in Web Mercator meters; the distance is measured in true
+ * meters by libgeodesk. Only takes effect together with a bbox filter.
+ */
+void
+geodesk_set_distance_filter(GeodeskConnectionHandle handle, double x, double y,
+                            double max_distance)
+{
+    if (!handle) return;
+    
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    
+    try
+    {
+        conn->distance_center = Coordinate(static_cast<int32_t>(x * METERS_TO_IMP),
+                                           static_cast<int32_t>(y * METERS_TO_IMP));
+        conn->distance_meters = max_distance;
+        conn->has_distance_filter = true;
+        
+        rebuild_bbox_view(conn);
+        
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Applied distance filter: %.2f m from [%.2f,%.2f]",
+                        max_distance, x, y)));
     }
     catch (const std::exception& e)
     {
         ereport(WARNING,
                 (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("Failed to apply GOQL filter '%s': %s", goql ? goql : "null", e.what())));
+                 errmsg("Failed to set distance filter: %s", e.what())));
     }
 }
 
 /*
  * Set GOQL filter (legacy, uses default prefix)
  */
-void
-geodesk_set_goql_filter(GeodeskConnectionHandle handle, const char* goql)
+bool
+geodesk_set_goql_filter(GeodeskConnectionHandle handle, const char* goql, char** error)
 {
     // Just call the new function with default prefix
-    geodesk_set_goql_filter_with_prefix(handle, goql, "*");
+    return geodesk_set_goql_filter_with_prefix(handle, goql, "*", NULL, error);
+}
+
+/*
+ * Restrict iteration to features with the given ids
+ *
+ * The lookup itself is deferred until iteration starts, so setting the
+ * filter at planning time doesn't build the ID index.
+ */
+void
+geodesk_set_id_filter(GeodeskConnectionHandle handle, const int64_t* ids, int count)
+{
+    if (!handle) return;
+    
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    
+    try
+    {
+        conn->filter_ids.assign(ids, ids + count);
+        conn->has_id_filter = true;
+        conn->iteration_started = false;
+        
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Applied ID filter: %d ids", count)));
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to set ID filter: %s", e.what())));
+    }
+}
+
+/*
+ * Register the tag key of a typed tag column
+ *
+ * Returns the index to pass to geodesk_get_tag_value, or -1 on failure.
+ */
+int
+geodesk_register_tag_key(GeodeskConnectionHandle handle, const char* key)
+{
+    if (!handle || !key) return -1;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+
+    try
+    {
+        conn->tag_key_names.emplace_back(key);
+        conn->tag_keys.push_back(conn->features->key(conn->tag_key_names.back()));
+        return static_cast<int>(conn->tag_keys.size() - 1);
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to resolve tag key '%s': %s", key, e.what())));
+        return -1;
+    }
+}
+
+/*
+ * Get the value of a registered tag key for the current feature
+ *
+ * Returns a NUL-terminated string that stays valid until the next call,
+ * or NULL if the feature doesn't have the tag.
+ */
+const char*
+geodesk_get_tag_value(GeodeskConnectionHandle handle, int key_index, int* len)
+{
+    if (!handle) return nullptr;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    if (!conn->current_feature || key_index < 0 ||
+        key_index >= static_cast<int>(conn->tag_keys.size()))
+        return nullptr;
+
+    try
+    {
+        // Missing tags read as an empty value
+        conn->tag_value = (*conn->current_feature)[conn->tag_keys[key_index]];
+        if (conn->tag_value.empty()) return nullptr;
+
+        *len = static_cast<int>(conn->tag_value.size());
+        return conn->tag_value.c_str();
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to read tag value: %s", e.what())));
+        return nullptr;
+    }
 }
 
-/* FID pushdown disabled - libgeodesk doesn't support direct ID lookup
- * See WIP_fid_pushdown_limitations.md for details
- * 
- * Set ID filter using lambda predicate
+/*
+ * Choose the tiles a parallel scan is split into
  *
- * void
- * geodesk_set_id_filter(GeodeskConnectionHandle handle, int64_t id)
- * {
- *     if (!handle) return;
- *     
- *     auto conn = reinterpret_cast<GeodeskConnection*>(handle);
- *     
- *     try
- *     {
- *         // Create lambda filter for ID matching
- *         auto id_filter = [id](Feature f) { return f.id() == id; };
- *         
- *         // Apply filter to the most specific features available
- *         Features* base_features = conn->bbox_filtered_features ?
- *                                  conn->bbox_filtered_features :
- *                                  (conn->filtered_features ? 
- *                                   conn->filtered_features : conn->features);
- *         
- *         // Clean up any existing ID filter
- *         if (conn->id_filtered_features)
- *         {
- *             delete conn->id_filtered_features;
- *             conn->id_filtered_features = nullptr;
- *         }
- *         
- *         // Apply the ID filter
- *         conn->id_filtered_features = new Features(base_features->filter(id_filter));
- *         conn->has_id_filter = true;
- *         conn->filter_id = id;
- *         
- *         ereport(INFO,
- *                 (errcode(ERRCODE_FDW_ERROR),
- *                  errmsg("Applied ID filter: id=%lld", (long long)id)));
- *     }
- *     catch (const std::exception& e)
- *     {
- *         ereport(WARNING,
- *                 (errcode(ERRCODE_FDW_ERROR),
- *                  errmsg("Failed to set ID filter: %s", e.what())));
- *     }
- * }
+ * Picks the lowest zoom level at which the scan area covers at least
+ * target_tiles tiles, so that workers get enough units of work to balance
+ * uneven feature density without paying for a query per tiny tile.
  */
+void
+geodesk_plan_tile_partition(GeodeskConnectionHandle handle, int target_tiles,
+                            GeodeskTileRange* range)
+{
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    
+    Box area = (conn && conn->has_bbox_filter) ? conn->bbox :
+               Box(INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX);
+    
+    *range = tile_range(area, target_tiles, GEODESK_MAX_PARTITION_ZOOM);
+}
 
 /*
- * Estimate feature count
+ * Restrict iteration to one tile of a parallel scan's partition
  */
-int64_t
-geodesk_estimate_count(GeodeskConnectionHandle handle)
+void
+geodesk_set_tile(GeodeskConnectionHandle handle, const GeodeskTileRange* range,
+                 uint32_t tile_index)
 {
-    return 1000; // Dummy estimate
+    if (!handle || !range) return;
+    
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    geodesk_pipeline_stop(conn);
+    
+    try
+    {
+        conn->tile_cell = tile_cell(*range, tile_index);
+        conn->has_tile = true;
+        
+        // The iterator references the old tile view, so drop it first
+        if (conn->current_iter)
+        {
+            delete conn->current_iter;
+            conn->current_iter = nullptr;
+        }
+        if (conn->tile_features)
+        {
+            delete conn->tile_features;
+            conn->tile_features = nullptr;
+        }
+        
+        Features* base_features = conn->bbox_filtered_features ? conn->bbox_filtered_features :
+                                  (conn->filtered_features ? conn->filtered_features : conn->features);
+        conn->tile_features = new Features((*base_features)(conn->tile_cell));
+        
+        geodesk_reset_iteration(handle);
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to set scan tile: %s", e.what())));
+    }
 }
 
 
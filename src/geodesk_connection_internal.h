@@ -9,53 +9,321 @@
 #ifndef GEODESK_CONNECTION_INTERNAL_H
 #define GEODESK_CONNECTION_INTERNAL_H
 
+#include <algorithm>
+#include <deque>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <ctime>
+#include <sys/types.h>
 #include <geodesk/geodesk.h>
+#include <geodesk/geom/Tile.h>
+
+#include "geodesk_coords.h"
 
 using namespace geodesk;
 
+/*
+ * Planner statistics derived from a store's tile index (geodesk_estimate.cpp)
+ *
+ * Built lazily the first time a scan on the store is planned.
+ */
+struct GeodeskTileStats
+{
+    std::vector<Tile> leaf_tiles;               // Tiles without child tiles
+    std::unordered_set<uint64_t> leaf_keys;     // Same, for membership tests
+    // Sampled average number of features per leaf tile, by filter
+    std::unordered_map<std::string, double> features_per_tile;
+};
+
+/*
+ * Sorted (id, type) -> feature index of a store (geodesk_id_index.cpp)
+ *
+ * Built lazily by the first scan that looks up features by fid.
+ */
+struct GeodeskIdIndex
+{
+    std::vector<std::pair<uint64_t, uint8_t*>> entries;  // Sorted by key
+};
+
+/*
+ * ID index of a store while it is built, a slice of features at a time
+ */
+struct GeodeskIdIndexBuild
+{
+    std::unique_ptr<GeodeskIdIndex> index;
+    FeatureIterator<Feature> iter;     // Over the store's base view
+
+    explicit GeodeskIdIndexBuild(Features& features) :
+        index(new GeodeskIdIndex), iter(features.begin()) {}
+};
+
+static inline uint64_t
+geodesk_id_key(int64_t id, int type)
+{
+    return (static_cast<uint64_t>(id) << 2) | static_cast<uint64_t>(type);
+}
+
+/*
+ * An open GOL store kept in the per-backend store cache
+ *
+ * The entry owns the base Features view, which keeps the underlying
+ * FeatureStore open. Connections hold a shared reference, so an entry
+ * that gets evicted or invalidated stays alive until its last scan ends.
+ */
+struct GeodeskStoreEntry
+{
+    std::string path;
+    std::unique_ptr<Features> features;
+
+    // File identity at the time the store was opened
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+
+    std::unique_ptr<GeodeskTileStats> tile_stats;
+    std::unique_ptr<GeodeskIdIndex> id_index;
+    std::unique_ptr<GeodeskIdIndexBuild> id_index_build;  // Until id_index is done
+
+    GeodeskStoreEntry() : device(0), inode(0), size(0), mtime{0, 0} {}
+};
+
+/* Store cache (geodesk_store_cache.cpp) */
+std::shared_ptr<GeodeskStoreEntry> geodesk_store_cache_acquire(const char* path);
+
+/* File footprints, in imps (geodesk_estimate.cpp) */
+const Box& geodesk_footprint(const char* path);
+
+/* ID index (geodesk_id_index.cpp) */
+bool geodesk_id_index_build(GeodeskStoreEntry* entry, int64_t max_features);
+const GeodeskIdIndex& geodesk_id_index_get(GeodeskStoreEntry* entry);
+uint8_t* geodesk_id_index_find(const GeodeskIdIndex& index, int64_t id, int type);
+
+/*
+ * A relation member, as collected by the members encoders
+ * (geodesk_members_jsonb.cpp)
+ */
+struct GeodeskMember
+{
+    int64_t id;
+    char type;                    // 'n', 'w' or 'r'
+    const std::string* role;      // Interned in GeodeskConnection::member_roles
+};
+
+struct GeodeskConnection;
+
+/* Producer thread of pipelined scans (geodesk_pipeline.cpp) */
+struct GeodeskPipeline;
+void geodesk_pipeline_stop(GeodeskConnection* conn);
+int geodesk_pipeline_next_batch(GeodeskConnection* conn, GeodeskFeatureBatch* batch, int limit);
+int64_t geodesk_pipeline_visited(const GeodeskConnection* conn);
+
 /*
  * Internal connection structure
  */
 struct GeodeskConnection
 {
-    Features* features;
-    Features* filtered_features;  // Filtered view if query is provided
-    Features* bbox_filtered_features; // Filtered view for bbox queries
-    /* FID filtering disabled - libgeodesk doesn't support direct ID lookup
-     * Features* id_filtered_features;   // Filtered view for ID queries
-     */
+    std::shared_ptr<GeodeskStoreEntry> store_entry;  // Shared, already-open store
+    Features* features;               // This scan's copy of the base view
+    Features* filtered_features;      // Table query and pushed-down GOQL view
+    Features* bbox_filtered_features; // Spatial view on top of filtered_features
     std::string filename;
     std::string query;            // GOQL query string
+    std::string goql_query;       // Pushed-down GOQL query (with type prefix)
+    int32_t srid;                 // SRID geometries are written in
+    double simplify_tolerance;    // Decimation tolerance in imp units, 0 for none
     bool has_bbox_filter;         // Whether bbox filter is applied
-    /* FID filtering disabled - libgeodesk doesn't support direct ID lookup
-     * bool has_id_filter;           // Whether ID filter is applied
-     * int64_t filter_id;            // The ID to filter for
-     */
+    Box bbox;                     // Applied bbox in imp units
+    bool has_distance_filter;     // Whether a distance view narrows the bbox view
+    Coordinate distance_center;   // In imp units
+    double distance_meters;
     
+    // Parallel scans iterate one tile of the scan area at a time; a
+    // feature is returned only by the tile containing its anchor point
+    Features* tile_features;      // Current tile's view, if any
+    bool has_tile;
+    Box tile_cell;                // Current tile in imp units
+
+    // A fid filter replaces view iteration with lookups in the ID index;
+    // matches are resolved when iteration starts
+    bool has_id_filter;
+    std::vector<int64_t> filter_ids;
+    std::vector<uint8_t*> id_matches;
+    size_t id_pos;
+
     // Iterator state - heap allocated to avoid issues with move/copy
     FeatureIterator<Feature>* current_iter;
     bool iteration_started;
-    
+
+    // Pipeline mode: a producer thread iterates the view instead, started
+    // by the first batch and stopped whenever the views change
+    bool pipeline_mode;
+    bool pipeline_async;          // The producer signals an eventfd
+    GeodeskPipeline* pipeline;    // Running producer, if any
+
     // Cache the current feature for tag/geometry access
     std::unique_ptr<Feature> current_feature;
-    
-    GeodeskConnection() : features(nullptr), filtered_features(nullptr), 
-                         bbox_filtered_features(nullptr),
-                         /* id_filtered_features(nullptr), */
+
+    // Work counters for EXPLAIN ANALYZE and the scan statistics
+    int64_t features_visited;     // Taken from the iterator or ID matches
+    int64_t ways_assembled;       // Relation member ways assembled into rings
+
+    // Keys of typed tag columns, resolved once per scan; Key refers to
+    // its name, so names live in a deque that never relocates them
+    std::deque<std::string> tag_key_names;
+    std::vector<Key> tag_keys;
+    std::string tag_value;        // Last value returned by geodesk_get_tag_value
+
+    // Jsonb key order of each distinct tag key set, keyed by the addresses
+    // of the keys, which stay valid while the store is open; plus scratch
+    // space for one feature's tags (geodesk_tags_jsonb.cpp)
+    std::unordered_map<std::string, std::vector<uint32_t>> tag_key_orders;
+    std::vector<std::string_view> tags_keys;
+    std::vector<std::string> tags_values;
+
+    // Members of the current relation, and the distinct roles seen so far
+    std::vector<GeodeskMember> members;
+    std::unordered_set<std::string> member_roles;
+
+    // Parents of the current feature; the role is unused
+    std::vector<GeodeskMember> parents;
+
+    // Parent ways of the feature nodes in the scan box, sorted by node,
+    // built once enough nodes have asked for their parents there
+    // (geodesk_parents_jsonb.cpp)
+    std::vector<std::pair<const uint8_t*, int64_t>> parent_ways;
+    Box parent_index_box;
+    bool has_parent_index;
+    bool parent_index_oversized;  // parent_index_box exceeds the pair cap
+    int parent_lookups;           // Way-node lookups in parent_index_box
+
+    GeodeskConnection() : features(nullptr), filtered_features(nullptr),
+                         bbox_filtered_features(nullptr), srid(GEODESK_SRID_WEB_MERCATOR),
+                         simplify_tolerance(0),
                          has_bbox_filter(false),
-                         /* has_id_filter(false), filter_id(0), */
-                         current_iter(nullptr), iteration_started(false) {}
-    ~GeodeskConnection() 
+                         has_distance_filter(false), distance_meters(0),
+                         tile_features(nullptr), has_tile(false),
+                         has_id_filter(false), id_pos(0),
+                         current_iter(nullptr), iteration_started(false),
+                         pipeline_mode(false), pipeline_async(false), pipeline(nullptr),
+                         features_visited(0), ways_assembled(0),
+                         has_parent_index(false), parent_index_oversized(false),
+                         parent_lookups(0) {}
+    ~GeodeskConnection()
     {
-        if (features) delete features;
-        if (filtered_features) delete filtered_features;
-        if (bbox_filtered_features) delete bbox_filtered_features;
-        /* if (id_filtered_features) delete id_filtered_features; */
+        // The producer iterates its own copy of a view
+        geodesk_pipeline_stop(this);
+        // The iterator references the views, so it goes first
         if (current_iter) delete current_iter;
-        // current_feature is automatically cleaned up by unique_ptr
+        if (tile_features) delete tile_features;
+        if (bbox_filtered_features) delete bbox_filtered_features;
+        if (filtered_features) delete filtered_features;
+        if (features) delete features;
+        // current_feature and store_entry are cleaned up automatically
     }
 };
 
-#endif /* GEODESK_CONNECTION_INTERNAL_H */
\ No newline at end of file
+/*
+ * Tile grid helpers for parallel scans
+ *
+ * Tiles follow the GOL tile grid: at zoom z the imp coordinate space is
+ * split into 2^z columns and rows of 2^(32-z) imp units each.
+ */
+static inline int64_t
+tile_of(int32_t v, int zoom)
+{
+    return ((int64_t) v + 2147483648LL) >> (32 - zoom);
+}
+
+static inline int32_t
+tile_start(int64_t tile, int zoom)
+{
+    return static_cast<int32_t>((tile << (32 - zoom)) - 2147483648LL);
+}
+
+/*
+ * Range of the tiles covering an area at the lowest zoom level, up to
+ * max_zoom, at which there are at least target_tiles of them
+ */
+static inline GeodeskTileRange
+tile_range(const Box& area, int target_tiles, int max_zoom)
+{
+    GeodeskTileRange range;
+    int zoom;
+
+    for (zoom = 0; zoom < max_zoom; zoom++)
+    {
+        int64_t cols = tile_of(area.maxX(), zoom) - tile_of(area.minX(), zoom) + 1;
+        int64_t rows = tile_of(area.maxY(), zoom) - tile_of(area.minY(), zoom) + 1;
+        if (cols * rows >= target_tiles)
+            break;
+    }
+
+    range.zoom = zoom;
+    range.min_col = static_cast<int32_t>(tile_of(area.minX(), zoom));
+    range.min_row = static_cast<int32_t>(tile_of(area.minY(), zoom));
+    range.max_col = static_cast<int32_t>(tile_of(area.maxX(), zoom));
+    range.max_row = static_cast<int32_t>(tile_of(area.maxY(), zoom));
+    return range;
+}
+
+/*
+ * Bounds of a tile of a range, by its index in row-major order
+ */
+static inline Box
+tile_cell(const GeodeskTileRange& range, uint32_t index)
+{
+    int64_t ncols = range.max_col - range.min_col + 1;
+    int64_t col = range.min_col + index % ncols;
+    int64_t row = range.min_row + index / ncols;
+    int64_t size = 1LL << (32 - range.zoom);
+
+    return Box(tile_start(col, range.zoom),
+               tile_start(row, range.zoom),
+               static_cast<int32_t>(tile_start(col, range.zoom) + (size - 1)),
+               static_cast<int32_t>(tile_start(row, range.zoom) + (size - 1)));
+}
+
+/*
+ * Check whether a tile owns a feature of a scan over an optional area
+ *
+ * A feature spanning several tiles is returned by each of their views,
+ * so it is only kept by the tile containing its anchor: the lower-left
+ * corner of its bounds, clamped to the scan area. The anchor always lies
+ * inside the feature's bounds and the scan area, so exactly one tile of
+ * the partition owns each feature.
+ */
+static inline bool
+tile_owns(const Box& cell, const Box* area, const Box& bounds)
+{
+    int32_t anchor_x = bounds.minX();
+    int32_t anchor_y = bounds.minY();
+
+    if (area)
+    {
+        anchor_x = std::max(anchor_x, area->minX());
+        anchor_y = std::max(anchor_y, area->minY());
+    }
+
+    return anchor_x >= cell.minX() && anchor_x <= cell.maxX() &&
+           anchor_y >= cell.minY() && anchor_y <= cell.maxY();
+}
+
+/*
+ * Whether a feature's bounds are smaller than the simplification
+ * tolerance in both directions, so its geometry isn't worth building
+ */
+static inline bool
+geodesk_is_sub_pixel(const GeodeskConnection* conn, const Box& bounds)
+{
+    return conn->simplify_tolerance > 0 &&
+           static_cast<double>(bounds.maxX()) - bounds.minX() < conn->simplify_tolerance &&
+           static_cast<double>(bounds.maxY()) - bounds.minY() < conn->simplify_tolerance;
+}
+
+#endif /* GEODESK_CONNECTION_INTERNAL_H */
@@ -0,0 +1,108 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_coords.cpp
+ *      Batch conversion of GeoDesk coordinates to the output SRID
+ *
+ * Web Mercator is a plain scale of the imp coordinates, done here two
+ * coordinates (one point) per SSE2 instruction. For WGS 84, longitude
+ * scales the same way; latitude needs the inverse Mercator formula, which
+ * stays scalar.
+ *
+ * Coordinates can be decimated beforehand for lower-resolution output:
+ * each vertex closer than the tolerance to the previous one kept is
+ * dropped, in a single pass over the imp coordinates.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "geodesk_coords.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void
+geodesk_project_coords(int32_t srid, const int32_t* xy, size_t n, double* out)
+{
+    bool wgs84 = (srid == GEODESK_SRID_WGS84);
+    double scale_x = wgs84 ? IMP_TO_DEGREES : IMP_TO_METERS;
+    double scale_y = wgs84 ? 1.0 : IMP_TO_METERS;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128d scale = _mm_set_pd(scale_y, scale_x);
+
+    // Two points per iteration
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(xy + i * 2));
+        __m128d p0 = _mm_mul_pd(_mm_cvtepi32_pd(raw), scale);
+        __m128d p1 = _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(raw, raw)), scale);
+        _mm_storeu_pd(out + i * 2, p0);
+        _mm_storeu_pd(out + i * 2 + 2, p1);
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        out[i * 2] = xy[i * 2] * scale_x;
+        out[i * 2 + 1] = xy[i * 2 + 1] * scale_y;
+    }
+
+    if (wgs84)
+    {
+        for (i = 0; i < n; i++)
+        {
+            out[i * 2 + 1] = imp_to_latitude(out[i * 2 + 1]);
+        }
+    }
+}
+
+/*
+ * Decimate n interleaved (x, y) imp coordinates in place
+ *
+ * The first and last vertices are always kept, so closed rings stay
+ * closed. If fewer than min_count vertices would be left, the coordinates
+ * are left as they are. Returns the number of vertices kept.
+ */
+size_t
+geodesk_decimate_coords(int32_t* xy, size_t n, double tolerance, size_t min_count)
+{
+    if (tolerance <= 0 || n <= 2) return n;
+
+    double tolerance_sq = tolerance * tolerance;
+    auto far_enough = [&](size_t from, size_t to)
+    {
+        double dx = static_cast<double>(xy[to * 2]) - xy[from * 2];
+        double dy = static_cast<double>(xy[to * 2 + 1]) - xy[from * 2 + 1];
+        return dx * dx + dy * dy >= tolerance_sq;
+    };
+
+    // Count first, so a ring that would collapse is left untouched
+    size_t kept = 1;
+    size_t last = 0;
+    for (size_t i = 1; i + 1 < n; i++)
+    {
+        if (far_enough(last, i))
+        {
+            last = i;
+            kept++;
+        }
+    }
+    kept++;
+    if (kept == n || kept < min_count) return n;
+
+    size_t out = 1;
+    for (size_t i = 1; i + 1 < n; i++)
+    {
+        if (far_enough(out - 1, i))
+        {
+            xy[out * 2] = xy[i * 2];
+            xy[out * 2 + 1] = xy[i * 2 + 1];
+            out++;
+        }
+    }
+    xy[out * 2] = xy[(n - 1) * 2];
+    xy[out * 2 + 1] = xy[(n - 1) * 2 + 1];
+    return out + 1;
+}
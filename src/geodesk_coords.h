@@ -0,0 +1,114 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_coords.h
+ *      Conversion between GeoDesk coordinates and output SRIDs
+ *
+ * GeoDesk stores coordinates as int32 "imp" units, a Mercator projection
+ * spanning the full int32 range. Geometries are written in one of the
+ * SRIDs below, selected by the table's srid option; bbox filters, which
+ * arrive in the same SRID, are converted back to imp units.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef GEODESK_COORDS_H
+#define GEODESK_COORDS_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Output SRIDs
+static constexpr int32_t GEODESK_SRID_WEB_MERCATOR = 3857;
+static constexpr int32_t GEODESK_SRID_WGS84 = 4326;
+
+// Conversion factors between imp units and Web Mercator meters
+// GeoDesk uses full int32 range, Web Mercator uses meters at equator
+// Conversion factor: EARTH_CIRCUMFERENCE / MAP_WIDTH
+static constexpr double IMP_TO_METERS = 40075016.68558 / 4294967294.9999;
+static constexpr double METERS_TO_IMP = 4294967294.9999 / 40075016.68558;
+
+// Earth radius of the Web Mercator projection, in meters
+static constexpr double MERCATOR_RADIUS = 6378137.0;
+
+// Longitude in degrees per imp unit
+static constexpr double IMP_TO_DEGREES = 360.0 / 4294967294.9999;
+
+static constexpr double RADIANS_TO_DEGREES = 180.0 / M_PI;
+
+/*
+ * Latitude in degrees of an imp y coordinate
+ */
+static inline double
+imp_to_latitude(double y)
+{
+    return std::atan(std::sinh(y * (IMP_TO_METERS / MERCATOR_RADIUS))) * RADIANS_TO_DEGREES;
+}
+
+/*
+ * Convert one imp coordinate to the output SRID
+ */
+static inline void
+geodesk_project_point(int32_t srid, int32_t x, int32_t y, double* out)
+{
+    if (srid == GEODESK_SRID_WGS84)
+    {
+        out[0] = x * IMP_TO_DEGREES;
+        out[1] = imp_to_latitude(y);
+    }
+    else
+    {
+        out[0] = x * IMP_TO_METERS;
+        out[1] = y * IMP_TO_METERS;
+    }
+}
+
+/*
+ * Convert n interleaved (x, y) imp coordinates to the output SRID
+ * (geodesk_coords.cpp)
+ */
+void geodesk_project_coords(int32_t srid, const int32_t* xy, size_t n, double* out);
+
+/*
+ * Convert a point in the output SRID to imp units, as doubles; callers
+ * clamp to the int32 range
+ */
+static inline void
+geodesk_unproject_point(int32_t srid, double x, double y, double* imp_x, double* imp_y)
+{
+    if (srid == GEODESK_SRID_WGS84)
+    {
+        // Latitudes beyond the Mercator range map to +/- infinity
+        double lat = y / RADIANS_TO_DEGREES;
+        *imp_x = x / IMP_TO_DEGREES;
+        *imp_y = std::log(std::tan(M_PI / 4 + lat / 2)) * (MERCATOR_RADIUS * METERS_TO_IMP);
+        if (y >= 90) *imp_y = HUGE_VAL;
+        if (y <= -90) *imp_y = -HUGE_VAL;
+    }
+    else
+    {
+        *imp_x = x * METERS_TO_IMP;
+        *imp_y = y * METERS_TO_IMP;
+    }
+}
+
+/*
+ * Convert a simplification tolerance in the output SRID to imp units
+ *
+ * For WGS 84 the longitude scale is used, which in imp units is the
+ * smaller of the two, so latitudes are never decimated more than asked.
+ */
+static inline double
+geodesk_tolerance_to_imp(int32_t srid, double tolerance)
+{
+    if (srid == GEODESK_SRID_WGS84) return tolerance / IMP_TO_DEGREES;
+    return tolerance * METERS_TO_IMP;
+}
+
+/*
+ * Drop the vertices of n interleaved (x, y) imp coordinates that lie
+ * within tolerance of the last vertex kept, in place (geodesk_coords.cpp)
+ */
+size_t geodesk_decimate_coords(int32_t* xy, size_t n, double tolerance, size_t min_count);
+
+#endif /* GEODESK_COORDS_H */
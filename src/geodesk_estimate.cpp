@@ -0,0 +1,472 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_estimate.cpp
+ *      Row count estimates for the planner, based on the GOL tile index
+ *
+ * The tile index is walked once per store to find its leaf tiles. A
+ * filter's density is measured by counting the matching features in a
+ * spread-out sample of leaf tiles; the estimate for a scan is that density
+ * times the (fractional) number of leaf tiles overlapping its bbox. Both
+ * the leaf tiles and the sampled densities are kept with the cached store,
+ * so repeated planning of the same filter only walks the index.
+ *
+ * The footprint of a file, the bounds of its leaf tiles grown to those of
+ * the features reaching past them, lets the planner skip the files of a
+ * multi-file datasource that a bbox doesn't overlap.
+ * Footprints are remembered apart from the store cache, so those files
+ * aren't opened again once it has evicted them. So are the estimates of
+ * each file under the filters it was planned with, since planning a query
+ * of a multi-file datasource would otherwise open every one of its files.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+#include <geodesk/geodesk.h>
+#include <geodesk/feature/TileIndexWalker.h>
+#include <geodesk/geom/Tile.h>
+
+/*
+ * Get the footprint of a GOL file, in imps
+ *
+ * Computed the first time, or after the file changed. An empty file has an
+ * empty box. Throws if the file can't be read.
+ */
+const Box&
+geodesk_footprint(const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        throw std::runtime_error(std::string("could not stat file: ") + strerror(errno));
+
+    auto it = footprints.find(path);
+    if (it == footprints.end() || !same_file(it->second.file, st))
+    {
+        std::shared_ptr<GeodeskStoreEntry> entry = geodesk_store_cache_acquire(path);
+        GeodeskTileStats* stats = get_tile_stats(entry.get());
+        int32_t min_x = INT32_MAX, min_y = INT32_MAX;
+        int32_t max_x = INT32_MIN, max_y = INT32_MIN;
+
+        for (const Tile& tile : stats->leaf_tiles)
+        {
+            Box b = tile.bounds();
+            min_x = std::min(min_x, b.minX());
+            min_y = std::min(min_y, b.minY());
+            max_x = std::max(max_x, b.maxX());
+            max_y = std::max(max_y, b.maxY());
+        }
+        if (min_x <= max_x)
+            expand_to_features(entry->features.get(), min_x, min_y, max_x, max_y);
+
+        // An empty file overlaps nothing
+        GeodeskFootprint fp{{entry->device, entry->inode, entry->size, entry->mtime},
+                            Box(min_x, min_y, max_x, max_y)};
+        it = footprints.insert_or_assign(path, fp).first;
+
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Footprint of '%s': imp[%d,%d,%d,%d]", path,
+                        min_x, min_y, max_x, max_y)));
+    }
+    return it->second.bounds;
+}
+
+extern "C" {
+#include "postgres.h"
+#include "geodesk_fdw.h"
+}
+
+using namespace geodesk;
+
+// Include shared connection structure
+#include "geodesk_connection_internal.h"
+
+// Number of leaf tiles counted to measure a filter's density
+static constexpr size_t MAX_SAMPLE_TILES = 16;
+
+// Bound on the number of distinct filters remembered per store
+static constexpr size_t MAX_CACHED_FILTERS = 256;
+
+// Bound on the number of file estimates remembered
+static constexpr size_t MAX_CACHED_ESTIMATES = 4096;
+
+/*
+ * Identity of a GOL file, which changes when the file is replaced
+ */
+struct GeodeskFileIdentity
+{
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+};
+
+/*
+ * Footprint of a GOL file, with the file identity it was computed for
+ */
+struct GeodeskFootprint
+{
+    GeodeskFileIdentity file;
+    Box bounds;
+};
+
+/*
+ * Estimates of a GOL file under one set of filters
+ */
+struct GeodeskFileEstimate
+{
+    GeodeskFileIdentity file;
+    int64_t rows;
+    int64_t tuples;
+};
+
+// By path; one entry for each file ever planned, which is few
+static std::unordered_map<std::string, GeodeskFootprint> footprints;
+
+// By path and filter key
+static std::unordered_map<std::string, GeodeskFileEstimate> file_estimates;
+
+static inline bool
+same_file(const GeodeskFileIdentity& file, const struct stat& st)
+{
+    return file.device == st.st_dev && file.inode == st.st_ino &&
+           file.size == st.st_size &&
+           file.mtime.tv_sec == st.st_mtim.tv_sec &&
+           file.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+static inline uint64_t
+tile_key(int zoom, int col, int row)
+{
+    return (static_cast<uint64_t>(zoom) << 56) |
+           (static_cast<uint64_t>(col) << 28) |
+           static_cast<uint64_t>(row);
+}
+
+/*
+ * Fraction of a tile's area covered by a box
+ */
+static double
+overlap_fraction(const Box& tile, const Box& area)
+{
+    int64_t w = std::min<int64_t>(tile.maxX(), area.maxX()) -
+                std::max<int64_t>(tile.minX(), area.minX()) + 1;
+    int64_t h = std::min<int64_t>(tile.maxY(), area.maxY()) -
+                std::max<int64_t>(tile.minY(), area.minY()) + 1;
+    if (w <= 0 || h <= 0) return 0.0;
+
+    double tile_w = static_cast<double>(tile.maxX()) - tile.minX() + 1;
+    double tile_h = static_cast<double>(tile.maxY()) - tile.minY() + 1;
+    return (static_cast<double>(w) * h) / (tile_w * tile_h);
+}
+
+/*
+ * Grow a box to the bounds of the features that reach past it
+ *
+ * Features stored in non-leaf tiles, or in leaf tiles at the edge of an
+ * extract, may extend beyond the leaf tiles. Any such feature overlaps one
+ * of the strips around the box, so only those are queried, until the box
+ * stops growing.
+ */
+static void
+expand_to_features(Features* features, int32_t& min_x, int32_t& min_y,
+                   int32_t& max_x, int32_t& max_y)
+{
+    bool grown = true;
+
+    while (grown)
+    {
+        Box strips[4];
+        int n = 0;
+
+        grown = false;
+        if (min_x > INT32_MIN)
+            strips[n++] = Box(INT32_MIN, INT32_MIN, min_x - 1, INT32_MAX);
+        if (max_x < INT32_MAX)
+            strips[n++] = Box(max_x + 1, INT32_MIN, INT32_MAX, INT32_MAX);
+        if (min_y > INT32_MIN)
+            strips[n++] = Box(min_x, INT32_MIN, max_x, min_y - 1);
+        if (max_y < INT32_MAX)
+            strips[n++] = Box(min_x, max_y + 1, max_x, INT32_MAX);
+
+        for (int i = 0; i < n; i++)
+        {
+            for (Feature f : (*features)(strips[i]))
+            {
+                Box b = f.bounds();
+                if (b.minX() < min_x) { min_x = b.minX(); grown = true; }
+                if (b.minY() < min_y) { min_y = b.minY(); grown = true; }
+                if (b.maxX() > max_x) { max_x = b.maxX(); grown = true; }
+                if (b.maxY() > max_y) { max_y = b.maxY(); grown = true; }
+            }
+        }
+    }
+}
+
+/*
+ * Get the tile statistics of a store, walking its tile index if needed
+ */
+static GeodeskTileStats*
+get_tile_stats(GeodeskStoreEntry* entry)
+{
+    if (entry->tile_stats) return entry->tile_stats.get();
+
+    auto stats = std::make_unique<GeodeskTileStats>();
+    FeatureStore* store = entry->features->store();
+    std::vector<Tile> tiles;
+    std::unordered_set<uint64_t> parents;
+
+    TileIndexWalker walker(store->tileIndex(), store->zoomLevels(),
+                           Box(INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX), nullptr);
+    while (walker.next())
+    {
+        Tile tile = walker.currentTile();
+        tiles.push_back(tile);
+
+        // Mark all ancestors; once one is known, so are the ones above it
+        for (int z = tile.zoom() - 1; z >= 0; z--)
+        {
+            int shift = tile.zoom() - z;
+            if (!parents.insert(tile_key(z, tile.column() >> shift, tile.row() >> shift)).second)
+                break;
+        }
+    }
+
+    for (const Tile& tile : tiles)
+    {
+        uint64_t key = tile_key(tile.zoom(), tile.column(), tile.row());
+        if (parents.count(key)) continue;
+        stats->leaf_tiles.push_back(tile);
+        stats->leaf_keys.insert(key);
+    }
+
+    ereport(DEBUG1,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Tile index of '%s': %zu tiles, %zu leaf tiles",
+                    entry->path.c_str(), tiles.size(), stats->leaf_tiles.size())));
+
+    entry->tile_stats = std::move(stats);
+    return entry->tile_stats.get();
+}
+
+/*
+ * Average number of features of a view per leaf tile, sampled once per filter
+ */
+static double
+features_per_tile(GeodeskTileStats* stats, Features* view, const std::string& key)
+{
+    auto it = stats->features_per_tile.find(key);
+    if (it != stats->features_per_tile.end()) return it->second;
+
+    size_t n = stats->leaf_tiles.size();
+    size_t samples = std::min(n, MAX_SAMPLE_TILES);
+    uint64_t total = 0;
+
+    // Evenly spaced in index order, which spreads samples across the store
+    for (size_t i = 0; i < samples; i++)
+    {
+        const Tile& tile = stats->leaf_tiles[i * n / samples];
+        total += (*view)(tile.bounds()).count();
+    }
+
+    double avg = samples ? static_cast<double>(total) / samples : 0.0;
+
+    if (stats->features_per_tile.size() >= MAX_CACHED_FILTERS)
+        stats->features_per_tile.clear();
+    stats->features_per_tile[key] = avg;
+
+    return avg;
+}
+
+/*
+ * Estimate the number of features of a view within an optional bbox
+ */
+static int64_t
+estimate_features(GeodeskConnection* conn, Features* view, const std::string& key,
+                  const Box* bbox)
+{
+    GeodeskTileStats* stats = get_tile_stats(conn->store_entry.get());
+    double per_tile = features_per_tile(stats, view, key);
+    double tiles = 0;
+
+    if (!bbox)
+    {
+        tiles = static_cast<double>(stats->leaf_tiles.size());
+    }
+    else
+    {
+        FeatureStore* store = conn->features->store();
+        TileIndexWalker walker(store->tileIndex(), store->zoomLevels(), *bbox, nullptr);
+        while (walker.next())
+        {
+            Tile tile = walker.currentTile();
+            if (!stats->leaf_keys.count(tile_key(tile.zoom(), tile.column(), tile.row())))
+                continue;
+            tiles += overlap_fraction(tile.bounds(), *bbox);
+        }
+    }
+
+    return static_cast<int64_t>(std::llround(per_tile * tiles));
+}
+
+extern "C" {
+
+/*
+ * Estimate the number of features the connection's filters will return
+ *
+ * Returns -1 if no estimate could be made.
+ */
+int64_t
+geodesk_estimate_count(GeodeskConnectionHandle handle)
+{
+    if (!handle) return -1;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+
+    try
+    {
+        Features* view = conn->filtered_features ? conn->filtered_features : conn->features;
+        std::string key = conn->query + '\x1f' + conn->goql_query;
+        return estimate_features(conn, view, key,
+                                 conn->has_bbox_filter ? &conn->bbox : nullptr);
+    }
+    catch (const std::exception& e)
+    {
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to estimate feature count: %s", e.what())));
+        return -1;
+    }
+}
+
+/*
+ * Estimate the total number of features in the connection's store
+ *
+ * Returns -1 if no estimate could be made.
+ */
+int64_t
+geodesk_estimate_total(GeodeskConnectionHandle handle)
+{
+    if (!handle) return -1;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+
+    try
+    {
+        return estimate_features(conn, conn->features, std::string(), nullptr);
+    }
+    catch (const std::exception& e)
+    {
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to estimate feature count: %s", e.what())));
+        return -1;
+    }
+}
+
+/*
+ * Get the footprint of a GOL file in the given SRID, as min_x, min_y,
+ * max_x and max_y
+ *
+ * Opens the file only the first time, or after it changed. Returns false
+ * if the file couldn't be read, in which case it can't be skipped.
+ */
+bool
+geodesk_file_footprint(const char* path, int srid, double* bounds)
+{
+    if (!path || !bounds) return false;
+
+    try
+    {
+        const Box& box = geodesk_footprint(path);
+        if (box.minX() > box.maxX())
+        {
+            bounds[0] = bounds[1] = 1;
+            bounds[2] = bounds[3] = 0;
+            return true;
+        }
+        geodesk_project_point(srid, box.minX(), box.minY(), &bounds[0]);
+        geodesk_project_point(srid, box.maxX(), box.maxY(), &bounds[2]);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to get footprint of '%s': %s", path, e.what())));
+        return false;
+    }
+}
+
+/*
+ * Look up the estimates of a GOL file under the filters a key describes
+ *
+ * Returns false if there are none, or if the file changed since.
+ */
+bool
+geodesk_lookup_file_estimate(const char* path, const char* key, int64_t* rows, int64_t* tuples)
+{
+    if (!path || !key || !rows || !tuples) return false;
+
+    try
+    {
+        struct stat st;
+        if (stat(path, &st) != 0)
+            return false;
+
+        auto it = file_estimates.find(std::string(path) + '\x1e' + key);
+        if (it == file_estimates.end() || !same_file(it->second.file, st))
+            return false;
+
+        *rows = it->second.rows;
+        *tuples = it->second.tuples;
+        return true;
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+}
+
+/*
+ * Remember the estimates of a GOL file under the filters a key describes
+ */
+void
+geodesk_store_file_estimate(const char* path, const char* key, int64_t rows, int64_t tuples)
+{
+    if (!path || !key) return;
+
+    try
+    {
+        struct stat st;
+        if (stat(path, &st) != 0)
+            return;
+
+        if (file_estimates.size() >= MAX_CACHED_ESTIMATES)
+            file_estimates.clear();
+
+        GeodeskFileEstimate estimate{{st.st_dev, st.st_ino, st.st_size, st.st_mtim},
+                                     rows, tuples};
+        file_estimates.insert_or_assign(std::string(path) + '\x1e' + key, estimate);
+    }
+    catch (const std::exception& e)
+    {
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to remember estimate of '%s': %s", path, e.what())));
+    }
+}
+
+} // extern "C"
@@ -12,34 +12,55 @@
  */
 
 #include "postgres.h"
+
+#include <math.h>
+
 #include "geodesk_fdw.h"
 
 #include "access/htup_details.h"
 #include "access/reloptions.h"
 #include "access/sysattr.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_attribute.h"
 #include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
 #include "commands/vacuum.h"
+#include "executor/execAsync.h"
+#include "executor/executor.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
 #include "funcapi.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
+#include "nodes/miscnodes.h"
 #include "nodes/bitmapset.h"
+#include "nodes/nodeFuncs.h"
 #include "optimizer/clauses.h"
 #include "optimizer/cost.h"
 #include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
 #include "optimizer/planmain.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
 #include "optimizer/optimizer.h"
 #include "parser/parsetree.h"
+#include "port/atomics.h"
+#include "storage/latch.h"
 #include "utils/array.h"
+#include "utils/fmgroids.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
+#include "utils/regproc.h"
 #include "utils/rel.h"
+#include "utils/ruleutils.h"
+#include "utils/sampling.h"
+#include "utils/syscache.h"
 #include "utils/jsonb.h"
 #include "lib/stringinfo.h"
 
@@ -54,6 +75,12 @@ PG_MODULE_MAGIC;
 void _PG_init(void);
 void _PG_fini(void);
 
+/* GUC variables */
+int geodesk_store_cache_size = 8;
+bool geodesk_enable_id_index = false;
+int geodesk_geometry_cache_size = 16384;
+bool geodesk_track_timing = false;
+
 /*
  * Module load callback
  */
@@ -63,6 +90,50 @@ _PG_init(void)
     /* Install PostGIS handlers - safe because we require PostGIS extension */
     pg_install_lwgeom_handlers();
     
+    DefineCustomIntVariable("geodesk_fdw.store_cache_size",
+                            "Maximum number of GOL stores kept open per backend.",
+                            "Scans reuse an open store instead of reopening the GOL file. "
+                            "Set to 0 to open the file for every scan.",
+                            &geodesk_store_cache_size,
+                            8, 0, 1024,
+                            PGC_USERSET,
+                            0,
+                            NULL, NULL, NULL);
+    
+    DefineCustomBoolVariable("geodesk_fdw.enable_id_index",
+                             "Answers fid lookups from an in-memory ID index.",
+                             "The index is built the first time a backend looks up a fid "
+                             "in a GOL file, which reads the whole file once and keeps "
+                             "about 16 bytes per feature for the life of the backend.",
+                             &geodesk_enable_id_index,
+                             false,
+                             PGC_USERSET,
+                             0,
+                             NULL, NULL, NULL);
+    
+    DefineCustomIntVariable("geodesk_fdw.geometry_cache_size",
+                            "Memory for cached relation geometries per backend.",
+                            "Assembled multipolygon and other relation geometries are kept "
+                            "for later scans of the same GOL file. Set to 0 to disable.",
+                            &geodesk_geometry_cache_size,
+                            16384, 0, MAX_KILOBYTES,
+                            PGC_USERSET,
+                            GUC_UNIT_KB,
+                            NULL, NULL, NULL);
+    
+    DefineCustomBoolVariable("geodesk_fdw.track_timing",
+                             "Collects the time scans spend in each stage of building rows.",
+                             "Stage times are always collected under EXPLAIN ANALYZE; this "
+                             "also collects them for geodesk_stat_scans, at the cost of "
+                             "reading the clock several times per row.",
+                             &geodesk_track_timing,
+                             false,
+                             PGC_SUSET,
+                             0,
+                             NULL, NULL, NULL);
+    
+    MarkGUCPrefixReserved("geodesk_fdw");
+    
     elog(DEBUG1, "GeoDesk FDW loaded with PostGIS support");
 }
 
@@ -80,13 +151,64 @@ PG_FUNCTION_INFO_V1(geodesk_fdw_handler);
 PG_FUNCTION_INFO_V1(geodesk_fdw_validator);
 PG_FUNCTION_INFO_V1(geodesk_fdw_version);
 PG_FUNCTION_INFO_V1(geodesk_fdw_drivers);
+PG_FUNCTION_INFO_V1(geodesk_fdw_geometry_cache_stats);
+PG_FUNCTION_INFO_V1(geodesk_mvt);
+PG_FUNCTION_INFO_V1(geodesk_prewarm);
 
-/* Forward declarations */
-static bool extract_bbox_from_expr(Expr *expr, GeodeskFdwRelationInfo *fpinfo);
-/* FID pushdown disabled - libgeodesk doesn't support direct ID lookup
- * See WIP_fid_pushdown_limitations.md for details
- * static bool extract_fid_from_expr(Expr *expr, GeodeskFdwRelationInfo *fpinfo);
+/*
+ * Shared state of a parallel scan, stored in the DSM segment
+ *
+ * The scan area is partitioned into tiles; participants claim the next
+ * unprocessed tile by incrementing next_tile.
  */
+typedef struct GeodeskParallelScanState
+{
+    GeodeskTileRange range;
+    uint32 ntiles;
+    pg_atomic_uint32 next_tile;
+} GeodeskParallelScanState;
+
+/* Number of tiles the world is divided into for ANALYZE sampling */
+#define ANALYZE_SAMPLE_TILES 65536
+
+/* Features ANALYZE looks at per requested sample row before it stops */
+#define ANALYZE_ROWS_PER_SAMPLE 10
+
+/* Features counted by a pushed-down aggregate between interrupt checks */
+#define AGG_COUNT_BATCH 65536
+
+/* Features added to the ID index between interrupt checks */
+#define ID_INDEX_BATCH 65536
+
+/* Per-feature cost of counting in the bridge instead of returning tuples */
+#define AGG_COST_PER_FEATURE 0.001
+
+/* Forward declarations */
+static bool extract_bbox_from_expr(Expr *expr, RelOptInfo *baserel, Oid foreigntableid,
+                                   GeodeskFdwRelationInfo *fpinfo);
+static bool is_bbox_operand(Node *node, RelOptInfo *baserel, Oid foreigntableid);
+static bool is_lossy_bbox_clause(Expr *clause, GeodeskFdwRelationInfo *fpinfo,
+                                 RelOptInfo *baserel, Oid foreigntableid);
+static List *serialize_relation_info(GeodeskFdwRelationInfo *fpinfo);
+static void deserialize_relation_info(List *info, GeodeskFdwRelationInfo *fpinfo);
+static void apply_relation_filters(GeodeskConnectionHandle conn,
+                                   GeodeskFdwRelationInfo *fpinfo);
+static bool extract_spatial_predicate(Expr *expr, RelOptInfo *baserel, Oid foreigntableid,
+                                      GeodeskFdwRelationInfo *fpinfo);
+static Expr *extract_runtime_bbox_expr(PlannerInfo *root, Expr *clause,
+                                       RelOptInfo *baserel, Oid foreigntableid);
+static bool extract_fid_from_expr(Expr *expr, RelOptInfo *baserel, Oid foreigntableid,
+                                  GeodeskFdwRelationInfo *fpinfo);
+static char **get_text_tag_columns(Oid foreigntableid, int *ncolumns);
+static char *rel_column_name(Node *node, RelOptInfo *baserel, Oid foreigntableid);
+static bool is_cheap_column(Oid foreigntableid, AttrNumber attnum);
+static bool is_cheap_clause(RestrictInfo *rinfo, RelOptInfo *baserel, Oid foreigntableid);
+static bool is_early_clause(RestrictInfo *rinfo, Index min_security_level,
+                            RelOptInfo *baserel, Oid foreigntableid);
+static bool is_type_named(Oid typid, const char *name);
+static void resolve_columns(GeodeskExecState *festate, Relation relation);
+static void open_scan_file(GeodeskExecState *festate, int index);
+static void release_scan_connection(void *arg);
 
 /* FDW callback functions */
 static void geodeskGetForeignRelSize(PlannerInfo *root,
@@ -95,6 +217,11 @@ static void geodeskGetForeignRelSize(PlannerInfo *root,
 static void geodeskGetForeignPaths(PlannerInfo *root,
                                    RelOptInfo *baserel,
                                    Oid foreigntableid);
+static void geodeskGetForeignUpperPaths(PlannerInfo *root,
+                                        UpperRelationKind stage,
+                                        RelOptInfo *input_rel,
+                                        RelOptInfo *output_rel,
+                                        void *extra);
 static ForeignScan *geodeskGetForeignPlan(PlannerInfo *root,
                                           RelOptInfo *baserel,
                                           Oid foreigntableid,
@@ -108,9 +235,31 @@ static void geodeskReScanForeignScan(ForeignScanState *node);
 static void geodeskEndForeignScan(ForeignScanState *node);
 static void geodeskExplainForeignScan(ForeignScanState *node,
                                       ExplainState *es);
+static int geodeskAcquireSampleRows(Relation relation, int elevel,
+                                    HeapTuple *rows, int targrows,
+                                    double *totalrows, double *totaldeadrows);
 static bool geodeskAnalyzeForeignTable(Relation relation,
                                        AcquireSampleRowsFunc *func,
                                        BlockNumber *totalpages);
+static bool geodeskIsForeignScanParallelSafe(PlannerInfo *root,
+                                             RelOptInfo *rel,
+                                             RangeTblEntry *rte);
+static Size geodeskEstimateDSMForeignScan(ForeignScanState *node,
+                                          ParallelContext *pcxt);
+static void geodeskInitializeDSMForeignScan(ForeignScanState *node,
+                                            ParallelContext *pcxt,
+                                            void *coordinate);
+static void geodeskReInitializeDSMForeignScan(ForeignScanState *node,
+                                              ParallelContext *pcxt,
+                                              void *coordinate);
+static void geodeskInitializeWorkerForeignScan(ForeignScanState *node,
+                                               shm_toc *toc,
+                                               void *coordinate);
+static List *geodeskImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid);
+static bool geodeskIsForeignPathAsyncCapable(ForeignPath *path);
+static void geodeskForeignAsyncRequest(AsyncRequest *areq);
+static void geodeskForeignAsyncConfigureWait(AsyncRequest *areq);
+static void geodeskForeignAsyncNotify(AsyncRequest *areq);
 
 /*
  * FDW handler function
@@ -130,8 +279,23 @@ geodesk_fdw_handler(PG_FUNCTION_ARGS)
     fdwroutine->EndForeignScan = geodeskEndForeignScan;
 
     /* Optional functions */
+    fdwroutine->GetForeignUpperPaths = geodeskGetForeignUpperPaths;
     fdwroutine->ExplainForeignScan = geodeskExplainForeignScan;
     fdwroutine->AnalyzeForeignTable = geodeskAnalyzeForeignTable;
+    fdwroutine->ImportForeignSchema = geodeskImportForeignSchema;
+
+    /* Parallel scan support */
+    fdwroutine->IsForeignScanParallelSafe = geodeskIsForeignScanParallelSafe;
+    fdwroutine->EstimateDSMForeignScan = geodeskEstimateDSMForeignScan;
+    fdwroutine->InitializeDSMForeignScan = geodeskInitializeDSMForeignScan;
+    fdwroutine->ReInitializeDSMForeignScan = geodeskReInitializeDSMForeignScan;
+    fdwroutine->InitializeWorkerForeignScan = geodeskInitializeWorkerForeignScan;
+
+    /* Asynchronous Append support */
+    fdwroutine->IsForeignPathAsyncCapable = geodeskIsForeignPathAsyncCapable;
+    fdwroutine->ForeignAsyncRequest = geodeskForeignAsyncRequest;
+    fdwroutine->ForeignAsyncConfigureWait = geodeskForeignAsyncConfigureWait;
+    fdwroutine->ForeignAsyncNotify = geodeskForeignAsyncNotify;
 
     /* TODO: Add write support in future phases */
     /* fdwroutine->AddForeignUpdateTargets = geodeskAddForeignUpdateTargets; */
@@ -172,11 +336,21 @@ geodesk_fdw_validator(PG_FUNCTION_ARGS)
                 /* Server options */
                 {OPTION_DATASOURCE, ForeignServerRelationId},
                 {OPTION_UPDATABLE, ForeignServerRelationId},
+                {OPTION_PIPELINE, ForeignServerRelationId},
+                {OPTION_ASYNC_CAPABLE, ForeignServerRelationId},
                 
                 /* Table options */
+                {OPTION_DATASOURCE, ForeignTableRelationId},
                 {OPTION_LAYER, ForeignTableRelationId},
                 {OPTION_SCHEMA_MODE, ForeignTableRelationId},
                 {OPTION_GOQL_FILTER, ForeignTableRelationId},
+                {OPTION_SRID, ForeignTableRelationId},
+                {OPTION_SIMPLIFY_TOLERANCE, ForeignTableRelationId},
+                {OPTION_PIPELINE, ForeignTableRelationId},
+                {OPTION_ASYNC_CAPABLE, ForeignTableRelationId},
+                
+                /* Column options */
+                {OPTION_TAG, AttributeRelationId},
                 
                 {NULL, InvalidOid}
             };
@@ -185,7 +359,8 @@ geodesk_fdw_validator(PG_FUNCTION_ARGS)
             initStringInfo(&buf);
             
             appendStringInfo(&buf, "Valid options for %s are: ",
-                           catalog == ForeignServerRelationId ? "server" : "foreign table");
+                           catalog == ForeignServerRelationId ? "server" :
+                           catalog == AttributeRelationId ? "column" : "foreign table");
             
             for (int i = 0; valid_options[i].optname; i++)
             {
@@ -202,11 +377,112 @@ geodesk_fdw_validator(PG_FUNCTION_ARGS)
                      errmsg("invalid option \"%s\"", def->defname),
                      errhint("%s", buf.data)));
         }
+
+        if (strcmp(def->defname, OPTION_SRID) == 0)
+        {
+            const char *value = defGetString(def);
+
+            if (strcmp(value, "3857") != 0 && strcmp(value, "4326") != 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+                         errmsg("invalid value for option \"%s\": \"%s\"",
+                                OPTION_SRID, value),
+                         errhint("Valid values are 3857 and 4326.")));
+        }
+        else if (strcmp(def->defname, OPTION_SIMPLIFY_TOLERANCE) == 0)
+        {
+            const char *value = defGetString(def);
+            char *end;
+            double tolerance = strtod(value, &end);
+
+            if (end == value || *end != '\0' || !(tolerance >= 0) || isinf(tolerance))
+                ereport(ERROR,
+                        (errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+                         errmsg("invalid value for option \"%s\": \"%s\"",
+                                OPTION_SIMPLIFY_TOLERANCE, value),
+                         errhint("The tolerance must be a non-negative number.")));
+        }
+        else if (strcmp(def->defname, OPTION_PIPELINE) == 0 ||
+                 strcmp(def->defname, OPTION_ASYNC_CAPABLE) == 0)
+        {
+            /* Raises the error on values that aren't booleans */
+            (void) defGetBoolean(def);
+        }
     }
 
     PG_RETURN_VOID();
 }
 
+/*
+ * Get the files of a relation's datasource that its pushed-down bbox
+ * overlaps
+ *
+ * Files are compared by their footprint, so the ones left out are never
+ * opened by the scan. Files whose footprint is unknown are kept.
+ */
+static List *
+footprint_files(GeodeskFdwRelationInfo *fpinfo)
+{
+    List *files = geodesk_datasource_files(fpinfo->datasource);
+    List *kept = NIL;
+    ListCell *lc;
+    
+    if (!fpinfo->has_spatial_filter)
+        return files;
+    
+    foreach(lc, files)
+    {
+        char *path = (char *) lfirst(lc);
+        double bounds[4];
+        
+        if (geodesk_file_footprint(path, fpinfo->srid, bounds) &&
+            (bounds[0] > fpinfo->bbox_max_x || bounds[2] < fpinfo->bbox_min_x ||
+             bounds[1] > fpinfo->bbox_max_y || bounds[3] < fpinfo->bbox_min_y))
+        {
+            ereport(DEBUG1,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Skipping \"%s\": footprint outside the bbox", path)));
+            continue;
+        }
+        kept = lappend(kept, path);
+    }
+    
+    return kept;
+}
+
+/*
+ * Most rows a fid filter can return: one feature of each type per id, in
+ * each file of the scan
+ */
+static double
+id_filter_max_rows(GeodeskFdwRelationInfo *fpinfo)
+{
+    return (double) fpinfo->num_filter_ids * 3 * Max(list_length(fpinfo->files), 1);
+}
+
+/*
+ * Describe the filters the tile index estimates of a relation depend on,
+ * the key its per-file estimates are remembered by
+ */
+static char *
+relation_estimate_key(GeodeskFdwRelationInfo *fpinfo)
+{
+    StringInfoData key;
+    
+    initStringInfo(&key);
+    appendStringInfo(&key, "%s\x1f%s\x1f%s\x1f%s\x1f%d",
+                     fpinfo->query ? fpinfo->query : "",
+                     fpinfo->type_prefix ? fpinfo->type_prefix : "*",
+                     fpinfo->goql_filter ? fpinfo->goql_filter : "",
+                     fpinfo->goql_alternatives ? fpinfo->goql_alternatives : "",
+                     fpinfo->srid);
+    if (fpinfo->has_spatial_filter)
+        appendStringInfo(&key, "\x1f%.17g,%.17g,%.17g,%.17g",
+                         fpinfo->bbox_min_x, fpinfo->bbox_min_y,
+                         fpinfo->bbox_max_x, fpinfo->bbox_max_y);
+    return key.data;
+}
+
 /*
  * Get table size estimates
  */
@@ -217,6 +493,17 @@ geodeskGetForeignRelSize(PlannerInfo *root,
 {
     GeodeskFdwRelationInfo *fpinfo;
     ListCell *lc;
+    int64 estimated_rows;
+    int64 estimated_tuples;
+    char *estimate_key;
+    double base_rows;
+    double selectivity;
+    double runtime_selectivity;
+    char **column_tags;
+    int ncolumns;
+    GoqlFilter goql;
+    bool exact;
+    char *tags;
 
     /* Allocate and initialize relation info */
     fpinfo = (GeodeskFdwRelationInfo *) palloc0(sizeof(GeodeskFdwRelationInfo));
@@ -228,70 +515,93 @@ geodeskGetForeignRelSize(PlannerInfo *root,
     /* Analyze WHERE clauses for pushdown possibilities */
     fpinfo->pushdown_clauses = NIL;
     fpinfo->type_prefix = NULL;
-    /* FID pushdown disabled - libgeodesk doesn't support direct ID lookup */
-    /* fpinfo->has_id_filter = false; */
+    fpinfo->has_id_filter = false;
     
     /* First extract type filter to get GOQL prefix */
     fpinfo->type_prefix = extract_type_filter_prefix(baserel->baserestrictinfo, &fpinfo->pushdown_clauses);
     if (!fpinfo->type_prefix)
         fpinfo->type_prefix = "*";  /* Default to all types */
     
+    /* Conditions on text tag columns are pushed down like tags->>'key' */
+    column_tags = get_text_tag_columns(foreigntableid, &ncolumns);
+    goql_filter_init(&goql, fpinfo->type_prefix);
+    
     foreach(lc, baserel->baserestrictinfo)
     {
         RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
         Expr *expr = rinfo->clause;
         
-        /* FID pushdown disabled - libgeodesk doesn't support direct ID lookup
-         * See WIP_fid_pushdown_limitations.md for details
-         * 
-         * if (extract_fid_from_expr(expr, fpinfo))
-         * {
-         *     fpinfo->pushdown_clauses = lappend(fpinfo->pushdown_clauses, rinfo);
-         *     ereport(DEBUG1,
-         *             (errcode(ERRCODE_FDW_ERROR),
-         *              errmsg("Found pushable FID filter: fid=%lld", (long long)fpinfo->filter_id)));
-         * }
-         */
+        /* Check if this is a fid lookup we can answer from the ID index */
+        if (geodesk_enable_id_index &&
+            extract_fid_from_expr(expr, baserel, foreigntableid, fpinfo))
+        {
+            fpinfo->pushdown_clauses = lappend(fpinfo->pushdown_clauses, rinfo);
+            ereport(DEBUG1,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Found pushable FID filter: %d ids", fpinfo->num_filter_ids)));
+            continue;
+        }
         
         /* Check if this is a spatial filter we can push down */
-        if (extract_bbox_from_expr(expr, fpinfo))
+        if (extract_bbox_from_expr(expr, baserel, foreigntableid, fpinfo))
         {
-            /* Mark this clause as pushed down */
-            fpinfo->pushdown_clauses = lappend(fpinfo->pushdown_clauses, rinfo);
+            /* Mark this clause as pushed down, unless geom is simplified */
+            if (!is_lossy_bbox_clause(expr, fpinfo, baserel, foreigntableid))
+                fpinfo->pushdown_clauses = lappend(fpinfo->pushdown_clauses, rinfo);
             ereport(DEBUG1,
                     (errcode(ERRCODE_FDW_ERROR),
                      errmsg("Found pushable spatial filter in planning phase")));
         }
-        /* Check for tag filters we can convert to GOQL */
-        else
+        /*
+         * geom && <expr> with a box only known at execution time, such as
+         * geom && $1 in a generic plan or geom && ST_TileEnvelope(z, x, y)
+         * with parameters: the box is evaluated when the scan starts
+         */
+        else if (extract_runtime_bbox_expr(root, expr, baserel, foreigntableid))
         {
-            /* Try to extract tag filters for this single clause */
-            List *single_clause = list_make1(rinfo);
-            char *goql = extract_goql_from_clauses(single_clause, NULL);
-            if (goql)
-            {
-                /* If we already have a GOQL filter, combine them */
-                if (fpinfo->goql_filter)
-                {
-                    StringInfoData combined;
-                    initStringInfo(&combined);
-                    appendStringInfo(&combined, "%s%s", fpinfo->goql_filter, goql);
-                    fpinfo->goql_filter = combined.data;
-                }
-                else
-                {
-                    fpinfo->goql_filter = goql;
-                }
-                
-                /* Mark this clause as pushed down */
+            fpinfo->runtime_bbox_clauses = lappend(fpinfo->runtime_bbox_clauses, rinfo);
+            ereport(DEBUG1,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Found spatial filter evaluated at execution time")));
+        }
+        /*
+         * Exact spatial predicates narrow the scan through the spatial
+         * index, but stay local quals for the exact test
+         */
+        else if (extract_spatial_predicate(expr, baserel, foreigntableid, fpinfo))
+        {
+            ereport(DEBUG1,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Found spatial predicate usable as prefilter")));
+        }
+        /*
+         * Check for tag filters we can convert to GOQL. Clauses GOQL only
+         * approximates (numeric comparisons, patterns) narrow the scan but
+         * stay local quals.
+         */
+        else if (!list_member_ptr(fpinfo->pushdown_clauses, rinfo) &&
+                 goql_filter_add_clause(&goql, expr, column_tags, ncolumns, &exact))
+        {
+            if (exact)
                 fpinfo->pushdown_clauses = lappend(fpinfo->pushdown_clauses, rinfo);
-                
-                ereport(DEBUG1,
-                        (errcode(ERRCODE_FDW_ERROR),
-                         errmsg("Found pushable tag filter: %s", goql)));
-            }
+            
+            ereport(DEBUG1,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Found %s tag filter", exact ? "pushable" : "prefilter")));
         }
     }
+    
+    /* Combine the tag filters with the goql_filter table option */
+    goql_filter_finish(&goql, &fpinfo->type_prefix, &tags, &fpinfo->goql_alternatives);
+    if (tags)
+        fpinfo->goql_filter = fpinfo->goql_filter ? psprintf("%s%s", fpinfo->goql_filter, tags) : tags;
+    if (fpinfo->goql_filter || fpinfo->goql_alternatives)
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("GOQL filter: %s%s%s%s", fpinfo->type_prefix,
+                        fpinfo->goql_filter ? fpinfo->goql_filter : "",
+                        fpinfo->goql_alternatives ? " | " : "",
+                        fpinfo->goql_alternatives ? fpinfo->goql_alternatives : "")));
 
     /* Identify which columns are actually needed in the query */
     fpinfo->attrs_used = NULL;
@@ -306,7 +616,9 @@ geodeskGetForeignRelSize(PlannerInfo *root,
         RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
         
         /* Only consider clauses that won't be pushed down */
-        if (!list_member(fpinfo->pushdown_clauses, rinfo))
+        if (!list_member(fpinfo->pushdown_clauses, rinfo) &&
+            (!list_member(fpinfo->runtime_bbox_clauses, rinfo) ||
+             is_lossy_bbox_clause(rinfo->clause, fpinfo, baserel, foreigntableid)))
         {
             pull_varattnos((Node *) rinfo->clause, baserel->relid,
                            &fpinfo->attrs_used);
@@ -333,21 +645,68 @@ geodeskGetForeignRelSize(PlannerInfo *root,
                  errmsg("No specific columns referenced (COUNT(*) case?)")));
     }
     
-    /* Estimate rows based on filters
-     * 
-     * Start with a base estimate and apply selectivity factors for each filter type
+    /*
+     * Estimate rows from the GOL tile index under the pushed-down filters.
+     * Files are only opened for filters they weren't estimated under yet.
      */
-    double base_rows = 100000;  /* Default estimate for unfiltered data */
-    double selectivity = 1.0;
-    
-    /* FID pushdown disabled - libgeodesk doesn't support direct ID lookup
-     * if (fpinfo->has_id_filter)
-     * {
-     *     baserel->rows = 1;
-     *     baserel->tuples = 1;
-     * }
-     * else 
+    fpinfo->files = fpinfo->datasource ? footprint_files(fpinfo) : NIL;
+    estimated_rows = (fpinfo->datasource && fpinfo->files == NIL) ? 0 : -1;
+    estimated_tuples = estimated_rows;
+    estimate_key = fpinfo->files ? relation_estimate_key(fpinfo) : NULL;
+    foreach(lc, fpinfo->files)
+    {
+        char *path = (char *) lfirst(lc);
+        GeodeskConnectionHandle conn;
+        int64_t rows;
+        int64_t tuples;
+
+        if (!geodesk_lookup_file_estimate(path, estimate_key, &rows, &tuples))
+        {
+            conn = geodesk_open(path, fpinfo->query);
+            if (!conn)
+                continue;
+
+            apply_relation_filters(conn, fpinfo);
+            rows = geodesk_estimate_count(conn);
+            tuples = geodesk_estimate_total(conn);
+            geodesk_close(conn);
+            if (rows >= 0 && tuples >= 0)
+                geodesk_store_file_estimate(path, estimate_key, rows, tuples);
+        }
+
+        if (rows >= 0 && tuples >= 0)
+        {
+            estimated_rows = Max(estimated_rows, 0) + rows;
+            estimated_tuples = Max(estimated_tuples, 0) + tuples;
+        }
+    }
+
+    if (fpinfo->has_id_filter && estimated_rows >= 0)
+        estimated_rows = Min(estimated_rows, (int64) id_filter_max_rows(fpinfo));
+
+    /* The tile index can't see boxes known only at execution time */
+    runtime_selectivity = clauselist_selectivity(root, fpinfo->runtime_bbox_clauses,
+                                                 baserel->relid, JOIN_INNER, NULL);
+
+    if (estimated_rows >= 0)
+    {
+        baserel->rows = estimated_rows * runtime_selectivity;
+        if (baserel->rows < 1)
+            baserel->rows = 1;
+        baserel->tuples = Max((double) estimated_tuples, baserel->rows);
+        /* Pages drive the parallel degree, so size them by what's scanned */
+        baserel->pages = baserel->rows / 100;
+        if (baserel->pages < 1)
+            baserel->pages = 1;
+        return;
+    }
+
+    /*
+     * The file couldn't be opened at planning time; start with a base
+     * estimate and apply selectivity factors for each filter type
      */
+    base_rows = 100000;  /* Default estimate for unfiltered data */
+    selectivity = runtime_selectivity;
     
     /* Apply selectivity for spatial filter */
     if (fpinfo->has_spatial_filter)
@@ -383,11 +742,11 @@ geodeskGetForeignRelSize(PlannerInfo *root,
             selectivity *= 0.25;
         else if (strcmp(fpinfo->type_prefix, "wa") == 0 || strcmp(fpinfo->type_prefix, "w") == 0)
             selectivity *= 0.70;
-        else if (strcmp(fpinfo->type_prefix, "r") == 0)
+        else if (strcmp(fpinfo->type_prefix, "ar") == 0 || strcmp(fpinfo->type_prefix, "r") == 0)
             selectivity *= 0.05;
         else if (strcmp(fpinfo->type_prefix, "nwa") == 0)
             selectivity *= 0.95;  /* Nodes + ways */
-        else if (strcmp(fpinfo->type_prefix, "nr") == 0)
+        else if (strcmp(fpinfo->type_prefix, "nar") == 0 || strcmp(fpinfo->type_prefix, "nr") == 0)
             selectivity *= 0.30;  /* Nodes + relations */
         else if (strcmp(fpinfo->type_prefix, "war") == 0)
             selectivity *= 0.75;  /* Ways + relations */
@@ -405,6 +764,9 @@ geodeskGetForeignRelSize(PlannerInfo *root,
     if (baserel->rows > 1000000)
         baserel->rows = 1000000;
     
+    if (fpinfo->has_id_filter)
+        baserel->rows = Min(baserel->rows, id_filter_max_rows(fpinfo));
+    
     baserel->tuples = baserel->rows;
     baserel->pages = baserel->rows / 100;  /* Rough estimate of pages */
     if (baserel->pages < 1)
@@ -422,6 +784,7 @@ geodeskGetForeignPaths(PlannerInfo *root,
     Cost startup_cost;
     Cost total_cost;
     GeodeskFdwRelationInfo *fpinfo = (GeodeskFdwRelationInfo *)baserel->fdw_private;
+    ListCell *lc;
     
     /* Calculate costs based on filters */
     startup_cost = 100;  /* Base cost for opening GOL file */
@@ -446,6 +809,10 @@ geodeskGetForeignPaths(PlannerInfo *root,
     cpu_per_tuple += 0.02;  /* Cost of JSON tag extraction */
     
     total_cost = startup_cost + baserel->rows * cpu_per_tuple;
+    
+    /* Remembered as the cost basis of upper paths (LIMIT pushdown) */
+    fpinfo->startup_cost = startup_cost;
+    fpinfo->total_cost = total_cost;
 
     /* Create a ForeignPath */
     add_path(baserel, (Path *)
@@ -459,389 +826,2289 @@ geodeskGetForeignPaths(PlannerInfo *root,
                                     NULL,    /* no extra plan */
                                     NIL,     /* no private data */
                                     NIL));   /* no fdw_restrictinfo */
-}
-
-/*
- * Create a ForeignScan plan
- */
-static ForeignScan *
-geodeskGetForeignPlan(PlannerInfo *root,
-                      RelOptInfo *baserel,
-                      Oid foreigntableid,
-                      ForeignPath *best_path,
-                      List *tlist,
-                      List *scan_clauses,
-                      Plan *outer_plan)
-{
-    GeodeskFdwRelationInfo *fpinfo = (GeodeskFdwRelationInfo *) baserel->fdw_private;
-    List *fdw_private;
-    List *local_exprs = NIL;
-    List *remote_exprs = NIL;
-    List *params_list = NIL;
-    List *retrieved_attrs;
-    ListCell *lc;
 
-    /* Separate pushed-down clauses from local evaluation */
-    foreach(lc, scan_clauses)
+    /*
+     * Add parameterized paths for join clauses geom && <outer geometry>, so
+     * that a nested loop probes the spatial index once per outer row
+     * instead of scanning the whole file and filtering locally
+     */
+    foreach(lc, baserel->joininfo)
     {
         RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        Relids required_outer;
+        ParamPathInfo *param_info;
+        Cost probe_startup_cost;
         
-        /* Check if this clause was marked for pushdown */
-        if (list_member(fpinfo->pushdown_clauses, rinfo))
-        {
-            /* This clause will be evaluated remotely */
-            remote_exprs = lappend(remote_exprs, rinfo->clause);
-        }
-        else
-        {
-            /* This clause needs local evaluation */
-            local_exprs = lappend(local_exprs, rinfo->clause);
-        }
+        if (!extract_runtime_bbox_expr(root, rinfo->clause, baserel, foreigntableid))
+            continue;
+        
+        required_outer = bms_union(bms_difference(rinfo->clause_relids, baserel->relids),
+                                   baserel->lateral_relids);
+        if (bms_is_empty(required_outer))
+            continue;
+        
+        param_info = get_baserel_parampathinfo(root, baserel, required_outer);
+        
+        /* Every probe rebuilds the bbox view */
+        probe_startup_cost = startup_cost + 10;
+        
+        add_path(baserel, (Path *)
+                 create_foreignscan_path(root, baserel,
+                                         NULL,
+                                         param_info->ppi_rows,
+                                         probe_startup_cost,
+                                         probe_startup_cost + param_info->ppi_rows * cpu_per_tuple,
+                                         NIL,
+                                         required_outer,
+                                         NULL,
+                                         NIL,
+                                         NIL));
     }
 
-    /* Build the list of attributes to retrieve based on attrs_used */
-    retrieved_attrs = NIL;
-    
-    if (fpinfo->attrs_used)
+    /*
+     * Add a partial path for parallel scans. Workers split the scan area
+     * into tiles, so the per-row cost is shared among participants while
+     * every participant pays the startup cost. Tiles are those of a
+     * single file.
+     */
+    if (baserel->consider_parallel && bms_is_empty(baserel->lateral_relids) &&
+        list_length(fpinfo->files) == 1)
     {
-        /* Convert Bitmapset to list of attribute numbers */
-        int col = -1;
-        while ((col = bms_next_member(fpinfo->attrs_used, col)) >= 0)
+        int parallel_workers = compute_parallel_worker(baserel, baserel->pages, -1,
+                                                       max_parallel_workers_per_gather);
+        
+        if (parallel_workers > 0)
         {
-            /* Adjust for system columns and convert to 1-based attribute number */
-            int attnum = col + FirstLowInvalidHeapAttributeNumber;
+            ForeignPath *partial_path;
+            double parallel_divisor = parallel_workers;
             
-            /* Only add user columns (attnum > 0) */
-            if (attnum > 0)
+            /* Same leader contribution estimate as the core planner uses */
+            if (parallel_leader_participation)
             {
-                retrieved_attrs = lappend_int(retrieved_attrs, attnum);
-                ereport(DEBUG1,
-                        (errcode(ERRCODE_FDW_ERROR),
-                         errmsg("Adding column %d from attrs_used", attnum)));
+                double leader_contribution = 1.0 - (0.3 * parallel_workers);
+                if (leader_contribution > 0)
+                    parallel_divisor += leader_contribution;
             }
+            
+            partial_path = create_foreignscan_path(root, baserel,
+                                                   NULL,
+                                                   clamp_row_est(baserel->rows / parallel_divisor),
+                                                   startup_cost,
+                                                   startup_cost + (total_cost - startup_cost) / parallel_divisor,
+                                                   NIL,
+                                                   NULL,
+                                                   NULL,
+                                                   NIL,
+                                                   NIL);
+            partial_path->path.parallel_aware = true;
+            partial_path->path.parallel_workers = parallel_workers;
+            add_partial_path(baserel, (Path *) partial_path);
         }
     }
-    
-    /* If no columns identified (e.g., COUNT(*)), we still need to return something */
-    /* Just return the first column (usually fid) to have valid tuples */
-    if (retrieved_attrs == NIL)
-    {
-        ereport(DEBUG1,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("No columns needed (COUNT(*)?), returning just column 1 for valid tuples")));
-        retrieved_attrs = lappend_int(retrieved_attrs, 1);  /* Just fid */
-    }
+}
 
-    /* Build FDW private list - include pushdown info */
-    fdw_private = list_make3(retrieved_attrs,
-                            makeString(fpinfo->datasource ? fpinfo->datasource : ""),
-                            fpinfo);  /* Pass the entire fpinfo for use in BeginForeignScan */
+/*
+ * Classify a grouping column of a pushed-down aggregate
+ *
+ * Only the type and is_area columns can be grouped by, since they are
+ * all the bridge counts by. Returns false for anything else.
+ */
+static bool
+classify_group_column(Expr *expr, RelOptInfo *baserel, Oid foreigntableid,
+                      GeodeskAggOutput *kind)
+{
+    char *attname = rel_column_name((Node *) expr, baserel, foreigntableid);
+    Var *var = (Var *) expr;
+    
+    if (!attname || geodesk_get_column_tag(foreigntableid, var->varattno))
+        return false;
+    
+    if (strcmp(attname, "type") == 0 && var->vartype == INT4OID)
+        *kind = GEODESK_AGG_TYPE;
+    else if (strcmp(attname, "is_area") == 0 && var->vartype == BOOLOID)
+        *kind = GEODESK_AGG_IS_AREA;
+    else
+        return false;
+    
+    return true;
+}
 
-    return make_foreignscan(tlist,
-                           local_exprs,  /* Only non-pushed clauses */
-                           baserel->relid,
-                           params_list,
-                           fdw_private,
-                           NIL,  /* no custom tlist */
-                           remote_exprs,  /* Pushed-down clauses for EXPLAIN */
-                           outer_plan);
+/*
+ * Check whether an expression is a plain count(*), or the partial count(*)
+ * of a partial aggregate
+ */
+static bool
+is_count_star(Node *node, bool partial)
+{
+    Aggref *agg;
+    
+    if (!IsA(node, Aggref))
+        return false;
+    
+    agg = (Aggref *) node;
+    return agg->aggfnoid == F_COUNT_ && agg->aggstar && !agg->aggfilter &&
+           agg->aggdistinct == NIL && agg->aggorder == NIL &&
+           agg->aggsplit == (partial ? AGGSPLIT_INITIAL_SERIAL : AGGSPLIT_SIMPLE);
 }
 
 /*
- * Helper function to check if an expression contains a bbox operator (&&)
- * and extract the bounding box if possible
+ * Check whether a grouping can be answered by counting in the bridge
+ *
+ * All of the base relation's conditions must be pushed down, and the
+ * output may only consist of count(*) and the type and is_area grouping
+ * columns. On success, fills the scan tlist and the kind of each of its
+ * entries into fpinfo.
+ *
+ * With partial, the counts are the partial aggregates of one partition of
+ * a partitionwise aggregate (or of a parallel one), which the Finalize
+ * Aggregate above sums up. A partition's count(*) is its own partial
+ * count, since both are a bigint. Full partitionwise aggregation needs the
+ * partition key among the grouping columns, so it ends up rejected below.
  */
 static bool
-extract_bbox_from_expr(Expr *expr, GeodeskFdwRelationInfo *fpinfo)
+foreign_grouping_ok(PlannerInfo *root, RelOptInfo *input_rel,
+                    RelOptInfo *grouped_rel, GroupPathExtraData *extra,
+                    bool partial, GeodeskFdwRelationInfo *fpinfo)
 {
-    if (!expr || !fpinfo)
+    GeodeskFdwRelationInfo *ifpinfo = (GeodeskFdwRelationInfo *) input_rel->fdw_private;
+    Query *query = root->parse;
+    PathTarget *grouping_target = grouped_rel->reltarget;
+    Oid foreigntableid = planner_rt_fetch(input_rel->relid, root)->relid;
+    List *tlist = NIL;
+    List *outputs = NIL;
+    ListCell *lc;
+    int i;
+    
+    if (query->groupingSets || extra->havingQual)
         return false;
     
-    /* Check if this is an OpExpr (operator expression) */
-    if (IsA(expr, OpExpr))
+    /* Simplified tables keep && as a local recheck on the decimated geom */
+    if (ifpinfo->simplify_tolerance > 0)
+        return false;
+    
+    /* Rows filtered locally would still be counted */
+    if (!bms_is_empty(input_rel->lateral_relids))
+        return false;
+    foreach(lc, input_rel->baserestrictinfo)
     {
-        OpExpr *op = (OpExpr *) expr;
-        Oid opno = op->opno;
-        char *opname = get_opname(opno);
+        if (!list_member(ifpinfo->pushdown_clauses, lfirst(lc)))
+            return false;
+    }
+    
+    i = 0;
+    foreach(lc, grouping_target->exprs)
+    {
+        Expr *expr = (Expr *) lfirst(lc);
+        Index sgref = get_pathtarget_sortgroupref(grouping_target, i);
+        ListCell *l;
+        
+        i++;
         
-        /* Check for && operator (bbox overlap) */
-        if (opname && strcmp(opname, "&&") == 0)
+        if (sgref && get_sortgroupref_clause_noerr(sgref, query->groupClause))
         {
-            /* Get the arguments */
-            List *args = op->args;
-            if (list_length(args) == 2)
-            {
-                /* Node *arg1 = (Node *) linitial(args); -- column reference */
-                Node *arg2 = (Node *) lsecond(args);
-                
-                /* Try to extract bbox from constant geometry */
-                /* This is simplified - full implementation would handle more cases */
-                if (IsA(arg2, Const))
-                {
-                    Const *c = (Const *) arg2;
-                    if (!c->constisnull)
-                    {
-                        /* Get geometry and extract bounds */
-                        GSERIALIZED *geom = (GSERIALIZED *) DatumGetPointer(c->constvalue);
-                        if (geom)
-                        {
-                            LWGEOM *lwgeom = lwgeom_from_gserialized(geom);
-                            if (lwgeom)
-                            {
-                                GBOX gbox;
-                                if (lwgeom_calculate_gbox(lwgeom, &gbox) == LW_SUCCESS)
-                                {
-                                    fpinfo->has_spatial_filter = true;
-                                    fpinfo->bbox_min_x = gbox.xmin;
-                                    fpinfo->bbox_min_y = gbox.ymin;
-                                    fpinfo->bbox_max_x = gbox.xmax;
-                                    fpinfo->bbox_max_y = gbox.ymax;
-                                    
-                                    ereport(INFO,
-                                            (errcode(ERRCODE_FDW_ERROR),
-                                             errmsg("Extracted bbox: [%.2f,%.2f,%.2f,%.2f]",
-                                                    gbox.xmin, gbox.ymin, gbox.xmax, gbox.ymax)));
-                                    
-                                    lwgeom_free(lwgeom);
-                                    return true;
-                                }
-                                lwgeom_free(lwgeom);
-                            }
-                        }
-                    }
-                }
-            }
+            GeodeskAggOutput kind;
+            TargetEntry *tle;
+            
+            if (!classify_group_column(expr, input_rel, foreigntableid, &kind))
+                return false;
+            if (tlist_member(expr, tlist))
+                continue;
+            
+            tle = makeTargetEntry(expr, list_length(tlist) + 1, NULL, false);
+            tle->ressortgroupref = sgref;
+            tlist = lappend(tlist, tle);
+            outputs = lappend_int(outputs, kind);
+            continue;
+        }
+        
+        /* Anything else must be computed from count(*) alone */
+        foreach(l, pull_var_clause((Node *) expr, PVC_INCLUDE_AGGREGATES))
+        {
+            Node *node = (Node *) lfirst(l);
+            
+            if (!is_count_star(node, partial))
+                return false;
+            if (tlist_member((Expr *) node, tlist))
+                continue;
+            
+            tlist = lappend(tlist, makeTargetEntry((Expr *) node, list_length(tlist) + 1,
+                                                   NULL, false));
+            outputs = lappend_int(outputs, GEODESK_AGG_COUNT);
         }
     }
     
-    return false;
+    fpinfo->foreigntableid = foreigntableid;
+    fpinfo->grouped_tlist = tlist;
+    fpinfo->agg_outputs = outputs;
+    return true;
 }
 
-/* FID pushdown disabled - libgeodesk doesn't support direct ID lookup
- * See WIP_fid_pushdown_limitations.md for details
- *
- * Helper function to check if an expression contains an FID equality condition
- * and extract the ID value if possible
- *
- * static bool
- * extract_fid_from_expr(Expr *expr, GeodeskFdwRelationInfo *fpinfo)
- * {
- *     if (!expr || !fpinfo)
- *         return false;
- *     
- *     ereport(DEBUG1,
- *             (errcode(ERRCODE_FDW_ERROR),
- *              errmsg("extract_fid_from_expr: checking expression type %d", nodeTag(expr))));
- *     
- *     // Check if this is an OpExpr (operator expression)
- *     if (IsA(expr, OpExpr))
- *     {
- *         OpExpr *op = (OpExpr *) expr;
- *         Oid opno = op->opno;
- *         char *opname = get_opname(opno);
- *         
- *         // Check for = operator (equality)
- *         if (opname && strcmp(opname, "=") == 0)
- *         {
- *             // Get the arguments
- *             List *args = op->args;
- *             if (list_length(args) == 2)
- *             {
- *                 Node *arg1 = (Node *) linitial(args);
- *                 Node *arg2 = (Node *) lsecond(args);
- *                 
- *                 // Check if arg1 is a Var referring to the 'fid' column
- *                 if (IsA(arg1, Var))
- *                 {
- *                     Var *var = (Var *) arg1;
- *                     // Get column name - fid is typically the first column (attnum 1)
- *                     // TODO: More robust column name checking
- *                     if (var->varattno == 1)  // Assuming fid is first column
- *                     {
- *                         // Check if arg2 is a constant
- *                         if (IsA(arg2, Const))
- *                         {
- *                             Const *c = (Const *) arg2;
- *                             if (!c->constisnull && c->consttype == INT8OID)
- *                             {
- *                                 fpinfo->has_id_filter = true;
- *                                 fpinfo->filter_id = DatumGetInt64(c->constvalue);
- *                                 
- *                                 ereport(INFO,
- *                                         (errcode(ERRCODE_FDW_ERROR),
- *                                          errmsg("Extracted FID filter: fid=%lld", 
- *                                                 (long long)fpinfo->filter_id)));
- *                                 
- *                                 return true;
- *                             }
- *                         }
- *                     }
- *                 }
- *                 // Also check if args are reversed (constant = column)
- *                 else if (IsA(arg2, Var) && IsA(arg1, Const))
- *                 {
- *                     Var *var = (Var *) arg2;
- *                     if (var->varattno == 1)  // Assuming fid is first column
- *                     {
- *                         Const *c = (Const *) arg1;
- *                         if (!c->constisnull && c->consttype == INT8OID)
- *                         {
- *                             fpinfo->has_id_filter = true;
- *                             fpinfo->filter_id = DatumGetInt64(c->constvalue);
- *                             
- *                             ereport(INFO,
- *                                     (errcode(ERRCODE_FDW_ERROR),
- *                                      errmsg("Extracted FID filter: fid=%lld", 
- *                                             (long long)fpinfo->filter_id)));
- *                             
- *                             return true;
- *                         }
- *                     }
- *                 }
- *             }
- *         }
- *     }
- *     
- *     return false;
- * }
- */
-
 /*
- * Begin foreign scan
+ * Add a path answering count(*), optionally grouped by type and is_area,
+ * by counting the pushed-down filters' features in the bridge
  */
 static void
-geodeskBeginForeignScan(ForeignScanState *node, int eflags)
+add_foreign_grouping_path(PlannerInfo *root, RelOptInfo *input_rel,
+                          RelOptInfo *grouped_rel, GroupPathExtraData *extra,
+                          bool partial)
 {
-    GeodeskExecState *festate;
-    ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
-    GeodeskFdwRelationInfo fpinfo;
-
-    /* Do nothing in EXPLAIN (no ANALYZE) case */
-    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-        return;
+    GeodeskFdwRelationInfo *ifpinfo = (GeodeskFdwRelationInfo *) input_rel->fdw_private;
+    GeodeskFdwRelationInfo *fpinfo;
+    double rows = 1;
+    Cost startup_cost;
+    Cost total_cost;
+    ListCell *lc;
+    
+    fpinfo = (GeodeskFdwRelationInfo *) palloc(sizeof(GeodeskFdwRelationInfo));
+    memcpy(fpinfo, ifpinfo, sizeof(GeodeskFdwRelationInfo));
+    
+    if (!foreign_grouping_ok(root, input_rel, grouped_rel, extra, partial, fpinfo))
+        return;
+    
+    /* At most 3 types, and each of them an area or not */
+    foreach(lc, fpinfo->agg_outputs)
+    {
+        if (lfirst_int(lc) == GEODESK_AGG_TYPE)
+            rows *= 3;
+        else if (lfirst_int(lc) == GEODESK_AGG_IS_AREA)
+            rows *= 2;
+    }
+    rows = Min(rows, Max(input_rel->rows, 1));
+    
+    /* All features are counted before the first row is returned */
+    startup_cost = 100 + input_rel->rows * AGG_COST_PER_FEATURE;
+    total_cost = startup_cost + rows * cpu_tuple_cost;
+    
+    grouped_rel->fdw_private = fpinfo;
+    
+    add_path(grouped_rel, (Path *)
+             create_foreign_upper_path(root, grouped_rel,
+                                       grouped_rel->reltarget,
+                                       rows,
+                                       startup_cost,
+                                       total_cost,
+                                       NIL,     /* no pathkeys */
+                                       NULL,    /* no extra plan */
+                                       NIL,     /* no fdw_restrictinfo */
+                                       NIL));   /* no private data */
+}
+
+/*
+ * Add a path applying the query's LIMIT/OFFSET in the scan
+ *
+ * The scan stops once enough rows have been returned, and skips the
+ * OFFSET rows without building tuples for them. Only possible when all of
+ * the relation's conditions are pushed down, since rows filtered locally
+ * would still count against the limit.
+ */
+static void
+add_foreign_final_path(PlannerInfo *root, RelOptInfo *input_rel,
+                       RelOptInfo *final_rel, FinalPathExtraData *extra)
+{
+    GeodeskFdwRelationInfo *ifpinfo = (GeodeskFdwRelationInfo *) input_rel->fdw_private;
+    Query *parse = root->parse;
+    int64 count;
+    int64 offset = 0;
+    double rows;
+    double per_row;
+    Cost startup_cost;
+    Cost total_cost;
+    ListCell *lc;
+    
+    if (!extra->limit_needed || parse->hasTargetSRFs || parse->rowMarks ||
+        parse->limitOption == LIMIT_OPTION_WITH_TIES)
+        return;
+    
+    /* Only constant bounds; anything else is left to the Limit node */
+    if (!parse->limitCount || !IsA(parse->limitCount, Const) ||
+        ((Const *) parse->limitCount)->constisnull)
+        return;
+    count = DatumGetInt64(((Const *) parse->limitCount)->constvalue);
+    
+    if (parse->limitOffset)
+    {
+        if (!IsA(parse->limitOffset, Const))
+            return;
+        if (!((Const *) parse->limitOffset)->constisnull)
+            offset = DatumGetInt64(((Const *) parse->limitOffset)->constvalue);
+    }
+    
+    /* Negative bounds are errors the Limit node reports */
+    if (count < 0 || offset < 0)
+        return;
+    
+    if (!bms_is_empty(input_rel->lateral_relids))
+        return;
+    foreach(lc, input_rel->baserestrictinfo)
+    {
+        if (!list_member(ifpinfo->pushdown_clauses, lfirst(lc)))
+            return;
+    }
+    
+    rows = Min((double) count, Max(input_rel->rows - offset, 0));
+    per_row = (ifpinfo->total_cost - ifpinfo->startup_cost) / Max(input_rel->rows, 1);
+    
+    /* Skipped rows are only counted, and no Limit node runs on top */
+    startup_cost = ifpinfo->startup_cost + offset * AGG_COST_PER_FEATURE;
+    total_cost = startup_cost + rows * (per_row - cpu_operator_cost);
+    
+    /*
+     * The path belongs to the base relation, so it is planned as a plain
+     * scan of it, but is added to the final relation as the whole query
+     */
+    add_path(final_rel, (Path *)
+             create_foreign_upper_path(root, input_rel,
+                                       root->upper_targets[UPPERREL_FINAL],
+                                       clamp_row_est(rows),
+                                       startup_cost,
+                                       total_cost,
+                                       NIL,     /* no pathkeys */
+                                       NULL,    /* no extra plan */
+                                       NIL,     /* no fdw_restrictinfo */
+                                       list_make2(makeString(psprintf(INT64_FORMAT, count)),
+                                                  makeString(psprintf(INT64_FORMAT, offset)))));
+}
+
+/*
+ * Create paths for post-scan processing done by the FDW
+ *
+ * count(*) over pushed-down filters, optionally grouped by type and
+ * is_area, is answered without producing a tuple per feature, also as
+ * the partial counts of the partitions of a partitionwise aggregate. A
+ * constant LIMIT/OFFSET directly over a scan ends the scan early.
+ */
+static void
+geodeskGetForeignUpperPaths(PlannerInfo *root,
+                            UpperRelationKind stage,
+                            RelOptInfo *input_rel,
+                            RelOptInfo *output_rel,
+                            void *extra)
+{
+    /* Only scans of our own base relations or partitions, and only once */
+    if (!input_rel->fdw_private || !IS_SIMPLE_REL(input_rel) ||
+        output_rel->fdw_private)
+        return;
+    
+    if (stage == UPPERREL_GROUP_AGG || stage == UPPERREL_PARTIAL_GROUP_AGG)
+        add_foreign_grouping_path(root, input_rel, output_rel,
+                                  (GroupPathExtraData *) extra,
+                                  stage == UPPERREL_PARTIAL_GROUP_AGG);
+    else if (stage == UPPERREL_FINAL)
+        add_foreign_final_path(root, input_rel, output_rel,
+                               (FinalPathExtraData *) extra);
+}
+
+/*
+ * Create a ForeignScan plan
+ */
+static ForeignScan *
+geodeskGetForeignPlan(PlannerInfo *root,
+                      RelOptInfo *baserel,
+                      Oid foreigntableid,
+                      ForeignPath *best_path,
+                      List *tlist,
+                      List *scan_clauses,
+                      Plan *outer_plan)
+{
+    GeodeskFdwRelationInfo *fpinfo = (GeodeskFdwRelationInfo *) baserel->fdw_private;
+    List *fdw_private;
+    List *local_exprs = NIL;
+    List *early_exprs = NIL;
+    List *remote_exprs = NIL;
+    Index min_security_level = PG_UINT32_MAX;
+    List *params_list = NIL;
+    List *retrieved_attrs;
+    bool has_expensive = false;
+    ListCell *lc;
+
+    /*
+     * Pushed-down aggregate: the scan returns the grouped tlist, and the
+     * relation's conditions are all applied through the relation info
+     */
+    if (IS_UPPER_REL(baserel))
+    {
+        fdw_private = list_make4(NIL,
+                                 makeString(fpinfo->datasource ? fpinfo->datasource : ""),
+                                 serialize_relation_info(fpinfo),
+                                 fpinfo->agg_outputs);
+        
+        return make_foreignscan(tlist,
+                                NIL,
+                                0,
+                                NIL,
+                                fdw_private,
+                                fpinfo->grouped_tlist,
+                                NIL,
+                                outer_plan);
+    }
+
+    /* Lowest security_level among the clauses that stay local anyway */
+    foreach(lc, scan_clauses)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        
+        if (!list_member(fpinfo->pushdown_clauses, rinfo) &&
+            !is_cheap_clause(rinfo, baserel, foreigntableid))
+            min_security_level = Min(min_security_level, rinfo->security_level);
+    }
+
+    /* Separate pushed-down clauses from local evaluation */
+    foreach(lc, scan_clauses)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        
+        Expr *bbox_expr;
+        
+        /* Check if this clause was marked for pushdown */
+        if (list_member(fpinfo->pushdown_clauses, rinfo))
+        {
+            /* This clause will be evaluated remotely */
+            remote_exprs = lappend(remote_exprs, rinfo->clause);
+        }
+        else if ((best_path->path.param_info ||
+                  list_member(fpinfo->runtime_bbox_clauses, rinfo)) &&
+                 (bbox_expr = extract_runtime_bbox_expr(root, rinfo->clause,
+                                                        baserel, foreigntableid)) != NULL)
+        {
+            /*
+             * Join clause of a parameterized path, or a box from parameters
+             * or stable functions: the geometry is evaluated when the scan
+             * starts and on rescans, and its bbox applied as a spatial filter
+             */
+            params_list = lappend(params_list, bbox_expr);
+            remote_exprs = lappend(remote_exprs, rinfo->clause);
+            if (is_lossy_bbox_clause(rinfo->clause, fpinfo, baserel, foreigntableid))
+                local_exprs = lappend(local_exprs, rinfo->clause);
+        }
+        else if (is_early_clause(rinfo, min_security_level, baserel, foreigntableid))
+        {
+            /* Local clause the scan checks before the expensive columns */
+            early_exprs = lappend(early_exprs, rinfo->clause);
+        }
+        else
+        {
+            /* This clause needs local evaluation */
+            local_exprs = lappend(local_exprs, rinfo->clause);
+        }
+    }
+
+    /* Build the list of attributes to retrieve based on attrs_used */
+    retrieved_attrs = NIL;
+    
+    if (fpinfo->attrs_used)
+    {
+        /* Convert Bitmapset to list of attribute numbers */
+        int col = -1;
+        while ((col = bms_next_member(fpinfo->attrs_used, col)) >= 0)
+        {
+            /* Adjust for system columns and convert to 1-based attribute number */
+            int attnum = col + FirstLowInvalidHeapAttributeNumber;
+            
+            /* Only add user columns (attnum > 0) */
+            if (attnum > 0)
+            {
+                retrieved_attrs = lappend_int(retrieved_attrs, attnum);
+                if (!is_cheap_column(foreigntableid, attnum))
+                    has_expensive = true;
+                ereport(DEBUG1,
+                        (errcode(ERRCODE_FDW_ERROR),
+                         errmsg("Adding column %d from attrs_used", attnum)));
+            }
+        }
+    }
+    
+    /* If no columns identified (e.g., COUNT(*)), we still need to return something */
+    /* Just return the first column (usually fid) to have valid tuples */
+    if (retrieved_attrs == NIL)
+    {
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("No columns needed (COUNT(*)?), returning just column 1 for valid tuples")));
+        retrieved_attrs = lappend_int(retrieved_attrs, 1);  /* Just fid */
+    }
+
+    /*
+     * Late materialization: the early clauses are evaluated by the scan on
+     * the cheap columns, and the others only built for rows that pass.
+     * They are also rechecked with the pushed-down clauses. Without an
+     * expensive column to save, they stay with the executor.
+     */
+    if (has_expensive)
+    {
+        params_list = list_concat(params_list, early_exprs);
+        remote_exprs = list_concat(remote_exprs, early_exprs);
+        fpinfo->early_quals = list_length(early_exprs);
+    }
+    else
+    {
+        local_exprs = list_concat(local_exprs, early_exprs);
+        fpinfo->early_quals = 0;
+    }
+
+    /*
+     * Build FDW private list - include pushdown info. The plan may be
+     * copied or sent to parallel workers, so the relation info is
+     * flattened into plain nodes rather than passed as a pointer.
+     */
+    fdw_private = list_make3(retrieved_attrs,
+                            makeString(fpinfo->datasource ? fpinfo->datasource : ""),
+                            serialize_relation_info(fpinfo));
+    
+    /* A pushed-down LIMIT/OFFSET follows the (empty) aggregate outputs */
+    if (best_path->fdw_private)
+        fdw_private = lappend(lappend(fdw_private, NIL), best_path->fdw_private);
+
+    return make_foreignscan(tlist,
+                           local_exprs,  /* Only non-pushed clauses */
+                           baserel->relid,
+                           params_list,
+                           fdw_private,
+                           NIL,  /* no custom tlist */
+                           remote_exprs,  /* Pushed-down clauses for EXPLAIN */
+                           outer_plan);
+}
+
+/*
+ * Helpers for storing strings and doubles in node lists
+ */
+static Node *
+make_string_or_empty(const char *str)
+{
+    return (Node *) makeString(pstrdup(str ? str : ""));
+}
+
+static char *
+string_or_null(Node *node)
+{
+    char *str = strVal(node);
+    return (str[0] != '\0') ? str : NULL;
+}
+
+static Node *
+make_double(double value)
+{
+    return (Node *) makeFloat(psprintf("%.17g", value));
+}
+
+/*
+ * Flatten the planning-time relation info into a list of nodes
+ *
+ * Only the fields needed to set up the scan are kept; the order must match
+ * deserialize_relation_info().
+ */
+static List *
+serialize_relation_info(GeodeskFdwRelationInfo *fpinfo)
+{
+    List *info = NIL;
+    ListCell *lc;
+    int i;
+    
+    info = lappend(info, make_string_or_empty(fpinfo->datasource));
+    info = lappend(info, make_string_or_empty(fpinfo->layer));
+    info = lappend(info, make_string_or_empty(fpinfo->query));
+    info = lappend(info, make_string_or_empty(fpinfo->goql_filter));
+    info = lappend(info, make_string_or_empty(fpinfo->type_prefix));
+    info = lappend(info, make_string_or_empty(fpinfo->goql_alternatives));
+    info = lappend(info, makeInteger(fpinfo->srid));
+    info = lappend(info, make_double(fpinfo->simplify_tolerance));
+    info = lappend(info, makeBoolean(fpinfo->pipeline));
+    info = lappend(info, makeBoolean(fpinfo->async_capable));
+    info = lappend(info, makeInteger(fpinfo->early_quals));
+    info = lappend(info, makeBoolean(fpinfo->has_spatial_filter));
+    info = lappend(info, make_double(fpinfo->bbox_min_x));
+    info = lappend(info, make_double(fpinfo->bbox_min_y));
+    info = lappend(info, make_double(fpinfo->bbox_max_x));
+    info = lappend(info, make_double(fpinfo->bbox_max_y));
+    info = lappend(info, makeBoolean(fpinfo->has_distance_filter));
+    info = lappend(info, make_double(fpinfo->distance_x));
+    info = lappend(info, make_double(fpinfo->distance_y));
+    info = lappend(info, make_double(fpinfo->distance_max));
+    info = lappend(info, makeInteger(list_length(fpinfo->files)));
+    foreach(lc, fpinfo->files)
+        info = lappend(info, makeString(pstrdup((char *) lfirst(lc))));
+    info = lappend(info, makeBoolean(fpinfo->has_id_filter));
+    
+    /* Ids go last, as many as there are */
+    for (i = 0; i < fpinfo->num_filter_ids; i++)
+        info = lappend(info, makeString(psprintf(INT64_FORMAT, fpinfo->filter_ids[i])));
+    
+    return info;
+}
+
+/*
+ * Restore relation info flattened by serialize_relation_info()
+ */
+static void
+deserialize_relation_info(List *info, GeodeskFdwRelationInfo *fpinfo)
+{
+    int i = 0;
+    int nfiles;
+    
+    memset(fpinfo, 0, sizeof(GeodeskFdwRelationInfo));
+    
+    fpinfo->datasource = string_or_null(list_nth(info, i++));
+    fpinfo->layer = string_or_null(list_nth(info, i++));
+    fpinfo->query = string_or_null(list_nth(info, i++));
+    fpinfo->goql_filter = string_or_null(list_nth(info, i++));
+    fpinfo->type_prefix = string_or_null(list_nth(info, i++));
+    fpinfo->goql_alternatives = string_or_null(list_nth(info, i++));
+    fpinfo->srid = intVal(list_nth(info, i++));
+    fpinfo->simplify_tolerance = floatVal(list_nth(info, i++));
+    fpinfo->pipeline = boolVal(list_nth(info, i++));
+    fpinfo->async_capable = boolVal(list_nth(info, i++));
+    fpinfo->early_quals = intVal(list_nth(info, i++));
+    fpinfo->has_spatial_filter = boolVal(list_nth(info, i++));
+    fpinfo->bbox_min_x = floatVal(list_nth(info, i++));
+    fpinfo->bbox_min_y = floatVal(list_nth(info, i++));
+    fpinfo->bbox_max_x = floatVal(list_nth(info, i++));
+    fpinfo->bbox_max_y = floatVal(list_nth(info, i++));
+    fpinfo->has_distance_filter = boolVal(list_nth(info, i++));
+    fpinfo->distance_x = floatVal(list_nth(info, i++));
+    fpinfo->distance_y = floatVal(list_nth(info, i++));
+    fpinfo->distance_max = floatVal(list_nth(info, i++));
+    nfiles = intVal(list_nth(info, i++));
+    for (int j = 0; j < nfiles; j++)
+        fpinfo->files = lappend(fpinfo->files, strVal(list_nth(info, i++)));
+    fpinfo->has_id_filter = boolVal(list_nth(info, i++));
+    
+    if (fpinfo->has_id_filter)
+    {
+        fpinfo->num_filter_ids = list_length(info) - i;
+        fpinfo->filter_ids = (int64 *) palloc(sizeof(int64) * Max(fpinfo->num_filter_ids, 1));
+        for (int j = 0; j < fpinfo->num_filter_ids; j++)
+            fpinfo->filter_ids[j] = pg_strtoint64(strVal(list_nth(info, i++)));
+    }
+}
+
+/*
+ * Apply a relation's pushed-down filters to an open connection
+ *
+ * The quals a GOQL filter stands for are no longer checked locally, so a
+ * filter libgeodesk rejects closes the connection and raises an ERROR
+ * rather than scanning without it.
+ */
+static void
+apply_relation_filters(GeodeskConnectionHandle conn, GeodeskFdwRelationInfo *fpinfo)
+{
+    /* Bbox filters are given in the output SRID */
+    geodesk_set_output_srid(conn, fpinfo->srid);
+    geodesk_set_simplify_tolerance(conn, fpinfo->simplify_tolerance);
+    
+    if (fpinfo->has_spatial_filter)
+    {
+        geodesk_set_spatial_filter(conn,
+                                   fpinfo->bbox_min_x, fpinfo->bbox_min_y,
+                                   fpinfo->bbox_max_x, fpinfo->bbox_max_y);
+    }
+    
+    if (fpinfo->has_distance_filter)
+    {
+        geodesk_set_distance_filter(conn, fpinfo->distance_x, fpinfo->distance_y,
+                                    fpinfo->distance_max);
+    }
+    
+    if (fpinfo->has_id_filter)
+    {
+        geodesk_set_id_filter(conn, (const int64_t *) fpinfo->filter_ids,
+                              fpinfo->num_filter_ids);
+    }
+    
+    if (fpinfo->goql_filter || fpinfo->type_prefix)
+    {
+        char *error = NULL;
+        
+        if (!geodesk_set_goql_filter_with_prefix(conn,
+                                                 fpinfo->goql_filter,
+                                                 fpinfo->type_prefix ? fpinfo->type_prefix : "*",
+                                                 fpinfo->goql_alternatives,
+                                                 &error))
+        {
+            geodesk_close(conn);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("invalid GOQL filter \"%s%s\"",
+                            fpinfo->type_prefix ? fpinfo->type_prefix : "*",
+                            fpinfo->goql_filter ? fpinfo->goql_filter : ""),
+                     error ? errdetail("%s", error) : 0));
+        }
+    }
+}
+
+/*
+ * Narrow the relation's spatial filter to a box
+ *
+ * Several spatial conditions may apply to the same scan; the features
+ * have to satisfy all of them, so their boxes are intersected.
+ */
+static void
+add_spatial_filter(GeodeskFdwRelationInfo *fpinfo, const GBOX *gbox)
+{
+    if (!fpinfo->has_spatial_filter)
+    {
+        fpinfo->has_spatial_filter = true;
+        fpinfo->bbox_min_x = gbox->xmin;
+        fpinfo->bbox_min_y = gbox->ymin;
+        fpinfo->bbox_max_x = gbox->xmax;
+        fpinfo->bbox_max_y = gbox->ymax;
+        return;
+    }
+    
+    fpinfo->bbox_min_x = Max(fpinfo->bbox_min_x, gbox->xmin);
+    fpinfo->bbox_min_y = Max(fpinfo->bbox_min_y, gbox->ymin);
+    fpinfo->bbox_max_x = Min(fpinfo->bbox_max_x, gbox->xmax);
+    fpinfo->bbox_max_y = Min(fpinfo->bbox_max_y, gbox->ymax);
+}
+
+/*
+ * Check whether an expression is geom && <constant geometry>, or the same
+ * on the bbox column, and extract the bounding box if so
+ *
+ * The spatial index tests the stored bounds of features, so for the bbox
+ * column the pushed-down filter is exact.
+ */
+static bool
+extract_bbox_from_expr(Expr *expr, RelOptInfo *baserel, Oid foreigntableid,
+                       GeodeskFdwRelationInfo *fpinfo)
+{
+    OpExpr *op;
+    char *opname;
+    Node *arg1;
+    Node *arg2;
+    Node *column;
+    Const *c;
+    LWGEOM *lwgeom;
+    GBOX gbox;
+    
+    if (!expr || !fpinfo || !IsA(expr, OpExpr))
+        return false;
+    
+    /* Check for && operator (bbox overlap) */
+    op = (OpExpr *) expr;
+    if (list_length(op->args) != 2)
+        return false;
+    opname = get_opname(op->opno);
+    if (!opname || strcmp(opname, "&&") != 0)
+        return false;
+    
+    /* && is symmetric, so the column may be on either side */
+    arg1 = (Node *) linitial(op->args);
+    arg2 = (Node *) lsecond(op->args);
+    if (is_bbox_operand(arg1, baserel, foreigntableid) && IsA(arg2, Const))
+    {
+        column = arg1;
+        c = (Const *) arg2;
+    }
+    else if (is_bbox_operand(arg2, baserel, foreigntableid) && IsA(arg1, Const))
+    {
+        column = arg2;
+        c = (Const *) arg1;
+    }
+    else
+        return false;
+    
+    /* Only geometry && geometry; other overloads take boxes and geographies */
+    if (c->constisnull || c->consttype != exprType(column))
+        return false;
+    
+    /* Get geometry and extract bounds */
+    lwgeom = lwgeom_from_gserialized((GSERIALIZED *) PG_DETOAST_DATUM(c->constvalue));
+    if (!lwgeom)
+        return false;
+    
+    if (lwgeom_calculate_gbox(lwgeom, &gbox) != LW_SUCCESS)
+    {
+        lwgeom_free(lwgeom);
+        return false;
+    }
+    add_spatial_filter(fpinfo, &gbox);
+    
+    ereport(DEBUG1,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Extracted bbox: [%.2f,%.2f,%.2f,%.2f]",
+                    gbox.xmin, gbox.ymin, gbox.xmax, gbox.ymax)));
+    
+    lwgeom_free(lwgeom);
+    return true;
+}
+
+/*
+ * Get the name of the relation's column a node references, or NULL
+ */
+static char *
+rel_column_name(Node *node, RelOptInfo *baserel, Oid foreigntableid)
+{
+    Var *var;
+    
+    if (!node || !IsA(node, Var))
+        return NULL;
+    
+    var = (Var *) node;
+    if (var->varno != baserel->relid || var->varlevelsup != 0 || var->varattno <= 0)
+        return NULL;
+    
+    return get_attname(foreigntableid, var->varattno, true);
+}
+
+static bool
+is_fid_column(Node *node, RelOptInfo *baserel, Oid foreigntableid)
+{
+    char *attname = rel_column_name(node, baserel, foreigntableid);
+    return attname && strcmp(attname, "fid") == 0;
+}
+
+static bool
+is_geometry_column(Node *node, RelOptInfo *baserel, Oid foreigntableid)
+{
+    char *attname = rel_column_name(node, baserel, foreigntableid);
+    return attname && (strcmp(attname, "geom") == 0 || strcmp(attname, "way") == 0);
+}
+
+/*
+ * Check whether a column is cheap to build: fid, type, is_area, source and
+ * bbox come with the feature, tags and tag columns from its tag table.
+ * Others, geometries, members and parents above all, are built from its
+ * body.
+ */
+static bool
+is_cheap_column(Oid foreigntableid, AttrNumber attnum)
+{
+    char *attname;
+    
+    if (attnum <= 0)
+        return false;
+    if (geodesk_get_column_tag(foreigntableid, attnum))
+        return true;
+    
+    attname = get_attname(foreigntableid, attnum, false);
+    return strcmp(attname, "fid") == 0 || strcmp(attname, "type") == 0 ||
+           strcmp(attname, "is_area") == 0 || strcmp(attname, "source") == 0 ||
+           strcmp(attname, "tags") == 0 || strcmp(attname, "bbox") == 0;
+}
+
+/*
+ * Check whether a local clause reads only cheap columns of the relation,
+ * and has no subplans
+ */
+static bool
+is_cheap_clause(RestrictInfo *rinfo, RelOptInfo *baserel, Oid foreigntableid)
+{
+    Bitmapset *attrs = NULL;
+    int col = -1;
+    
+    if (!bms_equal(rinfo->clause_relids, baserel->relids) ||
+        contain_subplans((Node *) rinfo->clause))
+        return false;
+    
+    pull_varattnos((Node *) rinfo->clause, baserel->relid, &attrs);
+    while ((col = bms_next_member(attrs, col)) >= 0)
+    {
+        if (!is_cheap_column(foreigntableid, col + FirstLowInvalidHeapAttributeNumber))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Check whether a local clause can be evaluated before the expensive
+ * columns are built, ahead of the other local clauses
+ *
+ * Besides being cheap, it must not be a clause that security barrier quals,
+ * of a lower security_level, have to run before, unless it is leakproof.
+ */
+static bool
+is_early_clause(RestrictInfo *rinfo, Index min_security_level,
+                RelOptInfo *baserel, Oid foreigntableid)
+{
+    if (!is_cheap_clause(rinfo, baserel, foreigntableid))
+        return false;
+    
+    return rinfo->security_level <= min_security_level ||
+           !contain_leaked_vars((Node *) rinfo->clause);
+}
+
+/*
+ * Check whether a node is an operand && can be pushed down on: the
+ * geometry column, or the bbox column, cast to geometry if it is a box2d
+ */
+static bool
+is_bbox_operand(Node *node, RelOptInfo *baserel, Oid foreigntableid)
+{
+    char *attname;
+    
+    if (node && IsA(node, FuncExpr) &&
+        ((FuncExpr *) node)->funcformat == COERCE_IMPLICIT_CAST &&
+        list_length(((FuncExpr *) node)->args) == 1)
+        node = (Node *) linitial(((FuncExpr *) node)->args);
+    
+    if (is_geometry_column(node, baserel, foreigntableid))
+        return true;
+    
+    attname = rel_column_name(node, baserel, foreigntableid);
+    return attname && strcmp(attname, "bbox") == 0;
+}
+
+/*
+ * Check whether a geom && <expr> clause has to be rechecked locally
+ *
+ * With simplify_tolerance, geom is decimated, which shrinks its bounds, or
+ * NULL for features below the tolerance, so it may not overlap a box their
+ * stored bounds do. The bbox column keeps the stored bounds.
+ */
+static bool
+is_lossy_bbox_clause(Expr *clause, GeodeskFdwRelationInfo *fpinfo,
+                     RelOptInfo *baserel, Oid foreigntableid)
+{
+    OpExpr *op;
+    
+    if (fpinfo->simplify_tolerance <= 0 || !IsA(clause, OpExpr))
+        return false;
+    
+    op = (OpExpr *) clause;
+    return is_geometry_column((Node *) linitial(op->args), baserel, foreigntableid) ||
+           is_geometry_column((Node *) lsecond(op->args), baserel, foreigntableid);
+}
+
+/*
+ * Get the tag keys of the table's text columns, indexed by attnum - 1
+ *
+ * Columns without a "tag" option, and tag columns of other types, whose
+ * values may not survive the conversion, are NULL.
+ */
+static char **
+get_text_tag_columns(Oid foreigntableid, int *ncolumns)
+{
+    int natts = get_relnatts(foreigntableid);
+    char **column_tags = (char **) palloc0(sizeof(char *) * Max(natts, 1));
+    AttrNumber attnum;
+    
+    for (attnum = 1; attnum <= natts; attnum++)
+    {
+        Oid typid = get_atttype(foreigntableid, attnum);
+        
+        if (typid == TEXTOID || typid == VARCHAROID)
+            column_tags[attnum - 1] = geodesk_get_column_tag(foreigntableid, attnum);
+    }
+    
+    *ncolumns = natts;
+    return column_tags;
+}
+
+/*
+ * Check whether a clause is geom && <expr> (or bbox && <expr>), where
+ * <expr> is a geometry that doesn't depend on the relation itself and can
+ * be evaluated at execution time (e.g. a column of the outer side of a join)
+ *
+ * Returns the expression, or NULL.
+ */
+static Expr *
+extract_runtime_bbox_expr(PlannerInfo *root, Expr *clause,
+                          RelOptInfo *baserel, Oid foreigntableid)
+{
+    OpExpr *op;
+    char *opname;
+    Node *arg1;
+    Node *arg2;
+    Node *geom;
+    Node *other;
+    
+    if (!clause || !IsA(clause, OpExpr))
+        return NULL;
+    
+    op = (OpExpr *) clause;
+    if (list_length(op->args) != 2)
+        return NULL;
+    
+    opname = get_opname(op->opno);
+    if (!opname || strcmp(opname, "&&") != 0)
+        return NULL;
+    
+    /* && is symmetric, so the column may be on either side */
+    arg1 = (Node *) linitial(op->args);
+    arg2 = (Node *) lsecond(op->args);
+    if (is_bbox_operand(arg1, baserel, foreigntableid))
+    {
+        geom = arg1;
+        other = arg2;
+    }
+    else if (is_bbox_operand(arg2, baserel, foreigntableid))
+    {
+        geom = arg2;
+        other = arg1;
+    }
+    else
+        return NULL;
+    
+    /* Only geometry && geometry; other overloads take boxes and geographies */
+    if (exprType(other) != exprType(geom))
+        return NULL;
+    
+    if (bms_is_member(baserel->relid, pull_varnos(root, other)) ||
+        contain_volatile_functions(other))
+        return NULL;
+    
+    return (Expr *) other;
+}
+
+/*
+ * Check whether a function has the signature of a PostGIS predicate,
+ * boolean of two geometries and nfloats float8s, and lives in the schema
+ * of the geometry type, so that same-named functions elsewhere are left
+ * alone
+ */
+static bool
+is_postgis_predicate(Oid funcid, Oid geomtype, int nfloats)
+{
+    HeapTuple proc;
+    HeapTuple type;
+    Form_pg_proc form;
+    bool result;
+    
+    if (!is_type_named(geomtype, "geometry"))
+        return false;
+    
+    proc = SearchSysCache1(PROCOID, ObjectIdGetDatum(funcid));
+    if (!HeapTupleIsValid(proc))
+        return false;
+    type = SearchSysCache1(TYPEOID, ObjectIdGetDatum(geomtype));
+    if (!HeapTupleIsValid(type))
+    {
+        ReleaseSysCache(proc);
+        return false;
+    }
+    
+    form = (Form_pg_proc) GETSTRUCT(proc);
+    result = form->pronamespace == ((Form_pg_type) GETSTRUCT(type))->typnamespace &&
+             form->prorettype == BOOLOID && form->pronargs == 2 + nfloats &&
+             form->proargtypes.values[0] == geomtype &&
+             form->proargtypes.values[1] == geomtype;
+    for (int i = 0; result && i < nfloats; i++)
+        result = form->proargtypes.values[2 + i] == FLOAT8OID;
+    
+    ReleaseSysCache(type);
+    ReleaseSysCache(proc);
+    return result;
+}
+
+/*
+ * Check whether an expression is a spatial predicate between the geometry
+ * column and a constant geometry, and narrow the scan accordingly
+ *
+ * ST_Intersects, ST_Within, ST_Contains, ST_Covers and ST_CoveredBy imply
+ * that the bboxes overlap, in either argument order. ST_DWithin implies
+ * overlap with the constant's bbox expanded by the distance; if the
+ * constant is a point, features farther than the distance are also
+ * rejected by libgeodesk from their compact GOL geometry. Since the
+ * distance is in Web Mercator units, which overstate true distances, the
+ * test in meters only lets through a superset of the matches.
+ *
+ * The predicates themselves are still evaluated locally. Constants in
+ * another SRID than the table's are not pushed down, so PostGIS raises its
+ * mixed-SRID error.
+ */
+static bool
+extract_spatial_predicate(Expr *expr, RelOptInfo *baserel, Oid foreigntableid,
+                          GeodeskFdwRelationInfo *fpinfo)
+{
+    FuncExpr *func;
+    char *funcname;
+    Node *arg1;
+    Node *arg2;
+    Node *geom;
+    Const *c;
+    double distance = 0;
+    bool is_dwithin;
+    GSERIALIZED *gser;
+    LWGEOM *lwgeom;
+    GBOX gbox;
+    
+    if (!expr || !IsA(expr, FuncExpr))
+        return false;
+    
+    func = (FuncExpr *) expr;
+    funcname = get_func_name(func->funcid);
+    if (!funcname)
+        return false;
+    
+    is_dwithin = (strcmp(funcname, "st_dwithin") == 0);
+    if (is_dwithin)
+    {
+        Const *dist;
+        
+        if (list_length(func->args) != 3 || !IsA(lthird(func->args), Const))
+            return false;
+        dist = (Const *) lthird(func->args);
+        if (dist->constisnull || dist->consttype != FLOAT8OID)
+            return false;
+        distance = DatumGetFloat8(dist->constvalue);
+        if (distance < 0)
+            return false;
+    }
+    else if (strcmp(funcname, "st_intersects") != 0 &&
+             strcmp(funcname, "st_within") != 0 &&
+             strcmp(funcname, "st_contains") != 0 &&
+             strcmp(funcname, "st_covers") != 0 &&
+             strcmp(funcname, "st_coveredby") != 0)
+        return false;
+    else if (list_length(func->args) != 2)
+        return false;
+    
+    arg1 = (Node *) linitial(func->args);
+    arg2 = (Node *) lsecond(func->args);
+    if (is_geometry_column(arg1, baserel, foreigntableid) && IsA(arg2, Const))
+    {
+        geom = arg1;
+        c = (Const *) arg2;
+    }
+    else if (is_geometry_column(arg2, baserel, foreigntableid) && IsA(arg1, Const))
+    {
+        geom = arg2;
+        c = (Const *) arg1;
+    }
+    else
+        return false;
+    
+    if (c->constisnull || c->consttype != exprType(geom) ||
+        !is_postgis_predicate(func->funcid, c->consttype, is_dwithin ? 1 : 0))
+        return false;
+    
+    gser = (GSERIALIZED *) PG_DETOAST_DATUM(c->constvalue);
+    if (gserialized_get_srid(gser) != fpinfo->srid)
+        return false;
+    
+    lwgeom = lwgeom_from_gserialized(gser);
+    if (!lwgeom)
+        return false;
+    
+    if (lwgeom_calculate_gbox(lwgeom, &gbox) != LW_SUCCESS)
+    {
+        lwgeom_free(lwgeom);
+        return false;
+    }
+    
+    gbox.xmin -= distance;
+    gbox.ymin -= distance;
+    gbox.xmax += distance;
+    gbox.ymax += distance;
+    add_spatial_filter(fpinfo, &gbox);
+    
+    /*
+     * The first point-distance condition also becomes a distance view; its
+     * center and distance are Web Mercator meters, so not for WGS 84 tables
+     */
+    if (is_dwithin && lwgeom->type == POINTTYPE && !fpinfo->has_distance_filter &&
+        fpinfo->srid == GEODESK_DEFAULT_SRID)
+    {
+        fpinfo->has_distance_filter = true;
+        fpinfo->distance_x = gbox.xmin + distance;
+        fpinfo->distance_y = gbox.ymin + distance;
+        fpinfo->distance_max = distance;
+    }
+    
+    ereport(DEBUG1,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Spatial predicate %s narrows bbox to [%.2f,%.2f,%.2f,%.2f]",
+                    funcname, fpinfo->bbox_min_x, fpinfo->bbox_min_y,
+                    fpinfo->bbox_max_x, fpinfo->bbox_max_y)));
+    
+    lwgeom_free(lwgeom);
+    return true;
+}
+
+/*
+ * Convert an integer datum to int64; returns false for other types
+ */
+static bool
+integer_datum_to_int64(Datum value, Oid type, int64 *result)
+{
+    switch (type)
+    {
+        case INT8OID:
+            *result = DatumGetInt64(value);
+            return true;
+        case INT4OID:
+            *result = DatumGetInt32(value);
+            return true;
+        case INT2OID:
+            *result = DatumGetInt16(value);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Helper function to check if an expression is an fid lookup
+ * (fid = X, X = fid or fid = ANY(array)) and extract the ids
+ *
+ * Only the first such clause is pushed down; others stay local.
+ */
+static bool
+extract_fid_from_expr(Expr *expr, RelOptInfo *baserel, Oid foreigntableid,
+                      GeodeskFdwRelationInfo *fpinfo)
+{
+    if (!expr || !fpinfo || fpinfo->has_id_filter)
+        return false;
+    
+    if (IsA(expr, OpExpr))
+    {
+        OpExpr *op = (OpExpr *) expr;
+        char *opname = get_opname(op->opno);
+        Node *arg1;
+        Node *arg2;
+        Const *c = NULL;
+        int64 id;
+        
+        if (!opname || strcmp(opname, "=") != 0 || list_length(op->args) != 2)
+            return false;
+        
+        arg1 = (Node *) linitial(op->args);
+        arg2 = (Node *) lsecond(op->args);
+        
+        /* Accept both fid = X and X = fid */
+        if (is_fid_column(arg1, baserel, foreigntableid) && IsA(arg2, Const))
+            c = (Const *) arg2;
+        else if (is_fid_column(arg2, baserel, foreigntableid) && IsA(arg1, Const))
+            c = (Const *) arg1;
+        
+        if (!c || c->constisnull ||
+            !integer_datum_to_int64(c->constvalue, c->consttype, &id))
+            return false;
+        
+        fpinfo->filter_ids = (int64 *) palloc(sizeof(int64));
+        fpinfo->filter_ids[0] = id;
+        fpinfo->num_filter_ids = 1;
+        fpinfo->has_id_filter = true;
+        
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Extracted FID filter: fid=" INT64_FORMAT, id)));
+        return true;
+    }
+    
+    if (IsA(expr, ScalarArrayOpExpr))
+    {
+        ScalarArrayOpExpr *op = (ScalarArrayOpExpr *) expr;
+        char *opname = get_opname(op->opno);
+        Const *c;
+        ArrayType *array;
+        Oid elemtype;
+        int16 elmlen;
+        bool elmbyval;
+        char elmalign;
+        Datum *elems;
+        bool *elemnulls;
+        int nelems;
+        int64 *ids;
+        int nids = 0;
+        int i;
+        
+        if (!op->useOr || !opname || strcmp(opname, "=") != 0 || list_length(op->args) != 2)
+            return false;
+        
+        if (!is_fid_column((Node *) linitial(op->args), baserel, foreigntableid) ||
+            !IsA(lsecond(op->args), Const))
+            return false;
+        
+        c = (Const *) lsecond(op->args);
+        if (c->constisnull)
+            return false;
+        
+        array = DatumGetArrayTypeP(c->constvalue);
+        elemtype = ARR_ELEMTYPE(array);
+        get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+        deconstruct_array(array, elemtype, elmlen, elmbyval, elmalign,
+                          &elems, &elemnulls, &nelems);
+        
+        ids = (int64 *) palloc(sizeof(int64) * Max(nelems, 1));
+        for (i = 0; i < nelems; i++)
+        {
+            /* NULL elements never match */
+            if (elemnulls[i])
+                continue;
+            if (!integer_datum_to_int64(elems[i], elemtype, &ids[nids]))
+            {
+                pfree(ids);
+                return false;
+            }
+            nids++;
+        }
+        
+        fpinfo->filter_ids = ids;
+        fpinfo->num_filter_ids = nids;
+        fpinfo->has_id_filter = true;
+        
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Extracted FID filter: fid = ANY(%d ids)", nids)));
+        return true;
+    }
+    
+    return false;
+}
+
+/*
+ * Get the foreign table a scan reads, also for pushed-down aggregates,
+ * which scan no relation of their own
+ */
+static Oid
+scan_relid(ForeignScanState *node)
+{
+    ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+    int rti;
+    
+    if (node->ss.ss_currentRelation)
+        return RelationGetRelid(node->ss.ss_currentRelation);
+    
+    rti = bms_next_member(fsplan->fs_base_relids, -1);
+    if (rti > 0)
+        return exec_rt_fetch(rti, node->ss.ps.state)->relid;
+    return InvalidOid;
+}
+
+/*
+ * Start timing a stage of the scan, if stages are timed
+ */
+static inline void
+stage_start(GeodeskExecState *festate, instr_time *start)
+{
+    if (festate->timing)
+        INSTR_TIME_SET_CURRENT(*start);
+}
+
+/*
+ * Add the time since stage_start() to a stage
+ */
+static inline void
+stage_end(GeodeskExecState *festate, GeodeskScanStage stage, instr_time *start)
+{
+    if (festate->timing)
+    {
+        instr_time end;
+        
+        INSTR_TIME_SET_CURRENT(end);
+        INSTR_TIME_ACCUM_DIFF(festate->stats.stage_time[stage], end, *start);
+    }
+}
+
+/*
+ * Get the stage a column is timed in, or GEODESK_NUM_STAGES for the cheap
+ * columns that are not timed
+ */
+static inline GeodeskScanStage
+column_stage(GeodeskColumnKind kind)
+{
+    switch (kind)
+    {
+        case GEODESK_COL_TAGS:
+        case GEODESK_COL_TAG:
+            return GEODESK_STAGE_TAGS;
+        case GEODESK_COL_GEOM:
+            return GEODESK_STAGE_GEOMETRY;
+        case GEODESK_COL_MEMBERS:
+        case GEODESK_COL_MEMBER_IDS:
+        case GEODESK_COL_MEMBER_TYPES:
+        case GEODESK_COL_MEMBER_ROLES:
+            return GEODESK_STAGE_MEMBERS;
+        case GEODESK_COL_PARENTS:
+            return GEODESK_STAGE_PARENTS;
+        default:
+            return GEODESK_NUM_STAGES;
+    }
+}
+
+/*
+ * Begin foreign scan
+ */
+static void
+geodeskBeginForeignScan(ForeignScanState *node, int eflags)
+{
+    GeodeskExecState *festate;
+    ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+    GeodeskFdwRelationInfo fpinfo;
+
+    /* Do nothing in EXPLAIN (no ANALYZE) case */
+    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+        return;
+
+    /* Allocate state structure */
+    festate = (GeodeskExecState *) palloc0(sizeof(GeodeskExecState));
+    node->fdw_state = festate;
+    festate->batch = (GeodeskFeatureBatch *) palloc0(sizeof(GeodeskFeatureBatch));
+    festate->foreigntableid = scan_relid(node);
+    festate->timing = geodesk_track_timing ||
+        (node->ss.ps.instrument && node->ss.ps.instrument->need_timer);
+
+    /* Get info from plan */
+    festate->retrieved_attrs = (List *) linitial(fsplan->fdw_private);
+    
+    /* Get pushdown info from planning phase */
+    if (list_length(fsplan->fdw_private) >= 3)
+    {
+        /* Use the relation info passed from planning phase */
+        deserialize_relation_info((List *) lthird(fsplan->fdw_private), &fpinfo);
+        
+        if (fpinfo.has_spatial_filter)
+        {
+            ereport(DEBUG1,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Using spatial filter from planning phase: [%.2f,%.2f,%.2f,%.2f]",
+                            fpinfo.bbox_min_x, fpinfo.bbox_min_y,
+                            fpinfo.bbox_max_x, fpinfo.bbox_max_y)));
+        }
+    }
+    else
+    {
+        /* Fallback: get table options if fpinfo wasn't passed */
+        geodesk_get_options(RelationGetRelid(node->ss.ss_currentRelation), &fpinfo);
+        if (fpinfo.datasource)
+            fpinfo.files = geodesk_datasource_files(fpinfo.datasource);
+    }
+
+    /* Open connection to the first GOL file */
+    if (fpinfo.datasource)
+    {
+        festate->relinfo = (GeodeskFdwRelationInfo *) palloc(sizeof(GeodeskFdwRelationInfo));
+        memcpy(festate->relinfo, &fpinfo, sizeof(GeodeskFdwRelationInfo));
+        festate->files = fpinfo.files;
+        
+        /*
+         * A producer thread iterates plain scans in pipeline mode, and
+         * always below an async Append, which waits on its eventfd
+         */
+        festate->async = fsplan->scan.plan.async_capable;
+        festate->pipeline = (fpinfo.pipeline || festate->async) &&
+            (list_length(fsplan->fdw_private) < 4 || lfourth(fsplan->fdw_private) == NIL);
+        
+        /*
+         * A scan that errors out never reaches EndForeignScan, so the
+         * producer is stopped when the executor's memory goes away
+         */
+        if (festate->pipeline)
+        {
+            festate->pipeline_cleanup.func = release_scan_connection;
+            festate->pipeline_cleanup.arg = festate;
+            MemoryContextRegisterResetCallback(CurrentMemoryContext,
+                                               &festate->pipeline_cleanup);
+        }
+        
+        /* Without files left after pruning, the scan returns no rows */
+        if (festate->files != NIL)
+            open_scan_file(festate, 0);
+        
+        /* Pushed-down aggregates scan no relation, and return counts */
+        if (list_length(fsplan->fdw_private) >= 4 && lfourth(fsplan->fdw_private) != NIL)
+        {
+            ListCell *lc;
+            
+            festate->agg_outputs = (List *) lfourth(fsplan->fdw_private);
+            foreach(lc, festate->agg_outputs)
+            {
+                if (lfirst_int(lc) == GEODESK_AGG_TYPE)
+                    festate->agg_by_type = true;
+                else if (lfirst_int(lc) == GEODESK_AGG_IS_AREA)
+                    festate->agg_by_area = true;
+            }
+        }
+        else
+            resolve_columns(festate, node->ss.ss_currentRelation);
+        
+        if (list_length(fsplan->fdw_private) >= 5)
+        {
+            List *limit = (List *) list_nth(fsplan->fdw_private, 4);
+            
+            festate->has_limit = true;
+            festate->limit_count = pg_strtoint64(strVal(linitial(limit)));
+            festate->limit_offset = pg_strtoint64(strVal(lsecond(limit)));
+            festate->limit_remaining = festate->limit_count;
+            festate->limit_skip = festate->limit_offset;
+        }
+        
+        /*
+         * fdw_exprs holds the runtime bbox expressions, then the early
+         * quals. Outer geometries are only known once the scan starts.
+         */
+        {
+            int nearly = (list_length(fsplan->fdw_private) >= 3) ? fpinfo.early_quals : 0;
+            int nbbox = list_length(fsplan->fdw_exprs) - nearly;
+            
+            festate->bbox_exprs = ExecInitExprList(list_copy_head(fsplan->fdw_exprs, nbbox),
+                                                   (PlanState *) node);
+            festate->early_quals = ExecInitQual(list_copy_tail(fsplan->fdw_exprs, nbbox),
+                                                (PlanState *) node);
+        }
+        festate->bbox_pending = (festate->bbox_exprs != NIL);
+        festate->has_plan_bbox = fpinfo.has_spatial_filter;
+        festate->plan_bbox_min_x = fpinfo.bbox_min_x;
+        festate->plan_bbox_min_y = fpinfo.bbox_min_y;
+        festate->plan_bbox_max_x = fpinfo.bbox_max_x;
+        festate->plan_bbox_max_y = fpinfo.bbox_max_y;
+
+        /*
+         * Iteration starts lazily on the first fetch, so that parallel
+         * participants don't start a scan before claiming a tile
+         */
+    }
+    else
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                 errmsg("datasource and layer options are required")));
+    }
+}
+
+/*
+ * Close the connection of the current file, keeping its counters
+ */
+static void
+close_scan_file(GeodeskExecState *festate)
+{
+    GeodeskBridgeCounters counters;
+    
+    if (!festate->connection)
+        return;
+    
+    geodesk_get_counters(festate->connection, &counters);
+    festate->stats.features_visited += counters.features_visited;
+    festate->stats.ways_assembled += counters.ways_assembled;
+    
+    geodesk_close(festate->connection);
+    festate->connection = NULL;
+}
+
+/*
+ * Close the connection of a scan that didn't end, stopping its producer
+ */
+static void
+release_scan_connection(void *arg)
+{
+    GeodeskExecState *festate = (GeodeskExecState *) arg;
+    
+    if (festate->connection)
+    {
+        geodesk_close(festate->connection);
+        festate->connection = NULL;
+    }
+}
+
+/*
+ * Make a file of the datasource the one the scan reads
+ *
+ * The new connection gets the relation's filters, the runtime bbox last
+ * applied and the tag keys of the columns, which are resolved per store.
+ */
+static void
+open_scan_file(GeodeskExecState *festate, int index)
+{
+    const char *path = (const char *) list_nth(festate->files, index);
+    GeodeskConnectionHandle conn;
+    int i;
+    
+    close_scan_file(festate);
+    
+    conn = geodesk_open(path, festate->relinfo->query);
+    if (!conn)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+                 errmsg("failed to open GOL file \"%s\"", path)));
+    
+    /* Sets only a connection that has its filters */
+    apply_relation_filters(conn, festate->relinfo);
+    festate->connection = conn;
+    festate->file_index = index;
+    
+    if (festate->runtime_bbox_count > 0 && !festate->bbox_pending && !festate->scan_empty)
+        geodesk_set_spatial_filter(festate->connection,
+                                   festate->runtime_bbox[0], festate->runtime_bbox[1],
+                                   festate->runtime_bbox[2], festate->runtime_bbox[3]);
+    
+    for (i = 0; i < festate->ncolumns; i++)
+    {
+        GeodeskColumn *col = &festate->columns[i];
+        
+        if (col->kind == GEODESK_COL_TAG)
+            col->key_index = geodesk_register_tag_key(festate->connection, col->tag_key);
+    }
+    
+    if (festate->pipeline)
+        geodesk_set_pipeline(festate->connection, true, festate->async);
+    
+    /* Build the file's ID index here, where the scan can be cancelled */
+    if (festate->relinfo->has_id_filter)
+    {
+        while (!geodesk_build_id_index(festate->connection, ID_INDEX_BATCH))
+            CHECK_FOR_INTERRUPTS();
+    }
+}
+
+/*
+ * Check whether a file of the datasource may have features in the runtime
+ * bbox last applied
+ *
+ * Like at planning time, files whose footprint is unknown are kept.
+ */
+static bool
+file_in_runtime_bbox(GeodeskExecState *festate, int index)
+{
+    double bounds[4];
+    
+    if (festate->runtime_bbox_count == 0 || festate->bbox_pending)
+        return true;
+    if (festate->scan_empty)
+        return false;
+    
+    if (!geodesk_file_footprint((const char *) list_nth(festate->files, index),
+                                festate->relinfo->srid, bounds))
+        return true;
+    return !(bounds[0] > festate->runtime_bbox[2] || bounds[2] < festate->runtime_bbox[0] ||
+             bounds[1] > festate->runtime_bbox[3] || bounds[3] < festate->runtime_bbox[1]);
+}
+
+/*
+ * Move on to the next file of the datasource, if any, skipping the ones
+ * outside the runtime bbox
+ */
+static bool
+next_scan_file(GeodeskExecState *festate)
+{
+    int index = festate->file_index + 1;
+    
+    while (index < list_length(festate->files) && !file_in_runtime_bbox(festate, index))
+        index++;
+    if (index >= list_length(festate->files))
+        return false;
+    
+    open_scan_file(festate, index);
+    return true;
+}
+
+/*
+ * Evaluate the runtime bbox expressions and restrict the scan to the
+ * intersection of their boxes with the planning-time bbox
+ */
+static void
+apply_runtime_bbox(ForeignScanState *node, GeodeskExecState *festate)
+{
+    ExprContext *econtext = node->ss.ps.ps_ExprContext;
+    MemoryContext oldcontext;
+    bool have_box = festate->has_plan_bbox;
+    double min_x = festate->plan_bbox_min_x;
+    double min_y = festate->plan_bbox_min_y;
+    double max_x = festate->plan_bbox_max_x;
+    double max_y = festate->plan_bbox_max_y;
+    ListCell *lc;
+    
+    festate->bbox_pending = false;
+    festate->scan_empty = false;
+    
+    oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+    foreach(lc, festate->bbox_exprs)
+    {
+        ExprState *expr = (ExprState *) lfirst(lc);
+        bool isnull;
+        Datum value = ExecEvalExpr(expr, econtext, &isnull);
+        GBOX gbox;
+        
+        /* geom && NULL, or && an empty geometry, matches nothing */
+        if (isnull ||
+            gserialized_get_gbox_p((GSERIALIZED *) PG_DETOAST_DATUM(value), &gbox) != LW_SUCCESS)
+        {
+            festate->scan_empty = true;
+            break;
+        }
+        
+        if (!have_box)
+        {
+            min_x = gbox.xmin;
+            min_y = gbox.ymin;
+            max_x = gbox.xmax;
+            max_y = gbox.ymax;
+            have_box = true;
+        }
+        else
+        {
+            min_x = Max(min_x, gbox.xmin);
+            min_y = Max(min_y, gbox.ymin);
+            max_x = Min(max_x, gbox.xmax);
+            max_y = Min(max_y, gbox.ymax);
+        }
+    }
+    MemoryContextSwitchTo(oldcontext);
+    
+    if (!festate->scan_empty && (min_x > max_x || min_y > max_y))
+        festate->scan_empty = true;
+    
+    if (!festate->scan_empty)
+        geodesk_set_spatial_filter(festate->connection, min_x, min_y, max_x, max_y);
+    
+    festate->runtime_bbox_count++;
+    festate->runtime_bbox[0] = min_x;
+    festate->runtime_bbox[1] = min_y;
+    festate->runtime_bbox[2] = max_x;
+    festate->runtime_bbox[3] = max_y;
+    
+    ereport(DEBUG1,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Runtime bbox: %s[%.2f,%.2f,%.2f,%.2f]",
+                    festate->scan_empty ? "empty " : "", min_x, min_y, max_x, max_y)));
+}
+
+/*
+ * Fetch the next batch of a parallel scan
+ *
+ * Iterates the current tile and claims the next unprocessed tile of the
+ * shared partition whenever it is exhausted.
+ */
+static bool
+geodesk_next_parallel_batch(GeodeskExecState *festate, int max_features)
+{
+    GeodeskParallelScanState *pscan = festate->pscan;
+    
+    for (;;)
+    {
+        if (!festate->tile_active)
+        {
+            uint32 tile = pg_atomic_fetch_add_u32(&pscan->next_tile, 1);
+            
+            if (tile >= pscan->ntiles)
+                return false;
+            
+            geodesk_set_tile(festate->connection, &pscan->range, tile);
+            festate->tile_active = true;
+            festate->stats.tiles++;
+        }
+        
+        if (geodesk_next_batch(festate->connection, festate->batch, max_features) > 0)
+            return true;
+        
+        festate->tile_active = false;
+        CHECK_FOR_INTERRUPTS();
+    }
+}
+
+/*
+ * Make the next feature of the scan the current one
+ *
+ * Features are fetched from the bridge a batch at a time, but no further
+ * ahead than a pushed-down limit needs.
+ */
+static bool
+next_scan_feature(GeodeskExecState *festate)
+{
+    GeodeskFeatureBatch *batch = festate->batch;
+    
+    if (festate->batch_pos >= batch->count)
+    {
+        int max_features = GEODESK_BATCH_SIZE;
+        
+        if (festate->has_limit)
+            max_features = (int) Min(festate->limit_remaining, (int64) GEODESK_BATCH_SIZE);
+        
+        if (festate->pscan)
+        {
+            if (!geodesk_next_parallel_batch(festate, max_features))
+                return false;
+        }
+        else
+        {
+            while (geodesk_next_batch(festate->connection, batch, max_features) == 0)
+            {
+                if (!next_scan_file(festate))
+                    return false;
+            }
+        }
+        festate->batch_pos = 0;
+    }
+    
+    geodesk_select_feature(festate->connection, batch, festate->batch_pos++,
+                           &festate->current_feature);
+    return true;
+}
+
+/*
+ * Check whether a type has the given name, for types of extensions such
+ * as PostGIS, which have no fixed OIDs
+ */
+static bool
+is_type_named(Oid typid, const char *name)
+{
+    HeapTuple tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(typid));
+    bool result;
+    
+    if (!HeapTupleIsValid(tuple))
+        return false;
+    result = strcmp(NameStr(((Form_pg_type) GETSTRUCT(tuple))->typname), name) == 0;
+    ReleaseSysCache(tuple);
+    return result;
+}
+
+/*
+ * Resolve the requested columns into a projection plan
+ *
+ * Each retrieved column is mapped to its kind once per scan: columns with
+ * a "tag" option are filled from that tag, others by their name. Must be
+ * called after the connection is open, since tag keys are resolved
+ * against the store.
+ */
+static void
+resolve_columns(GeodeskExecState *festate, Relation relation)
+{
+    TupleDesc tupdesc = RelationGetDescr(relation);
+    Oid relid = RelationGetRelid(relation);
+    ListCell *lc;
+    int i = 0;
+    
+    festate->ncolumns = list_length(festate->retrieved_attrs);
+    festate->columns = (GeodeskColumn *) palloc0(sizeof(GeodeskColumn) * Max(festate->ncolumns, 1));
+    
+    festate->needs_geometry = false;
+    festate->needs_bbox = false;
+    festate->needs_members = false;
+    festate->needs_parents = false;
+    
+    foreach(lc, festate->retrieved_attrs)
+    {
+        GeodeskColumn *col = &festate->columns[i++];
+        Form_pg_attribute attr;
+        char *attname;
+        
+        col->attnum = lfirst_int(lc);
+        attr = TupleDescAttr(tupdesc, col->attnum - 1);
+        attname = NameStr(attr->attname);
+        col->tag_key = geodesk_get_column_tag(relid, col->attnum);
+        
+        if (col->tag_key)
+        {
+            col->kind = GEODESK_COL_TAG;
+            col->key_index = geodesk_register_tag_key(festate->connection, col->tag_key);
+            col->is_text = (attr->atttypid == TEXTOID || attr->atttypid == VARCHAROID);
+            if (!col->is_text)
+            {
+                Oid typinput;
+                
+                getTypeInputInfo(attr->atttypid, &typinput, &col->typioparam);
+                fmgr_info(typinput, &col->typinput);
+                col->typmod = attr->atttypmod;
+            }
+        }
+        else if (strcmp(attname, "fid") == 0)
+            col->kind = GEODESK_COL_FID;
+        else if (strcmp(attname, "type") == 0)
+            col->kind = GEODESK_COL_TYPE;
+        else if (strcmp(attname, "is_area") == 0)
+            col->kind = GEODESK_COL_IS_AREA;
+        else if (strcmp(attname, "tags") == 0)
+            col->kind = GEODESK_COL_TAGS;
+        else if (strcmp(attname, "geom") == 0 || strcmp(attname, "way") == 0)
+        {
+            col->kind = GEODESK_COL_GEOM;
+            festate->needs_geometry = true;
+        }
+        else if (strcmp(attname, "bbox") == 0 &&
+                 (is_type_named(attr->atttypid, "box2d") ||
+                  is_type_named(attr->atttypid, "geometry")))
+        {
+            col->kind = GEODESK_COL_BBOX;
+            col->is_box2d = is_type_named(attr->atttypid, "box2d");
+            festate->needs_bbox = true;
+        }
+        else if (strcmp(attname, "members") == 0)
+        {
+            col->kind = GEODESK_COL_MEMBERS;
+            festate->needs_members = true;
+        }
+        else if (strcmp(attname, "member_ids") == 0 && attr->atttypid == INT8ARRAYOID)
+        {
+            col->kind = GEODESK_COL_MEMBER_IDS;
+            festate->needs_members = true;
+        }
+        else if (strcmp(attname, "member_types") == 0 && attr->atttypid == CHARARRAYOID)
+        {
+            col->kind = GEODESK_COL_MEMBER_TYPES;
+            festate->needs_members = true;
+        }
+        else if (strcmp(attname, "member_roles") == 0 && attr->atttypid == TEXTARRAYOID)
+        {
+            col->kind = GEODESK_COL_MEMBER_ROLES;
+            festate->needs_members = true;
+        }
+        else if (strcmp(attname, "parents") == 0)
+        {
+            col->kind = GEODESK_COL_PARENTS;
+            festate->needs_parents = true;
+        }
+        else if (strcmp(attname, "source") == 0 && attr->atttypid == TEXTOID)
+            col->kind = GEODESK_COL_SOURCE;
+        else
+            col->kind = GEODESK_COL_UNKNOWN;
+        
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Column %d (%s) resolved to kind %d%s%s",
+                        col->attnum, attname, (int) col->kind,
+                        col->tag_key ? ", tag " : "",
+                        col->tag_key ? col->tag_key : "")));
+    }
+}
+
+/*
+ * Get the value of a typed tag column
+ */
+static bool
+fill_tag_value(GeodeskExecState *festate, GeodeskColumn *col, Datum *value)
+{
+    int len;
+    const char *str = geodesk_get_tag_value(festate->connection, col->key_index, &len);
+    
+    if (!str)
+        return false;
+    
+    if (col->is_text)
+    {
+        *value = PointerGetDatum(cstring_to_text_with_len(str, len));
+        return true;
+    }
+    
+    /* Values that don't parse as the column's type (e.g. "10 m") read as NULL */
+    {
+        ErrorSaveContext escontext = {T_ErrorSaveContext};
+        
+        return InputFunctionCallSafe(&col->typinput, (char *) str, col->typioparam,
+                                     col->typmod, (Node *) &escontext, value);
+    }
+}
+
+/*
+ * Get the bbox column of the current feature, from its stored bounds
+ */
+static bool
+fill_bbox_value(GeodeskExecState *festate, GeodeskColumn *col, Datum *value)
+{
+    double bounds[4];
+    GBOX *box;
+    
+    if (!col->is_box2d)
+    {
+        *value = geodesk_build_bbox_gserialized(festate->connection, &festate->current_feature);
+        return *value != (Datum) 0;
+    }
+    
+    if (!geodesk_get_feature_bounds(festate->connection, &festate->current_feature, bounds))
+        return false;
+    
+    /* A box2d is a 2D GBOX */
+    box = (GBOX *) palloc0(sizeof(GBOX));
+    box->xmin = bounds[0];
+    box->ymin = bounds[1];
+    box->xmax = bounds[2];
+    box->ymax = bounds[3];
+    *value = PointerGetDatum(box);
+    return true;
+}
+
+/*
+ * Get one of the member arrays of the current feature
+ *
+ * The members are fetched once per feature, for whichever of the
+ * member_ids, member_types and member_roles columns comes first.
+ */
+static bool
+fill_member_array(GeodeskExecState *festate, GeodeskColumnKind kind, Datum *value)
+{
+    GeodeskMemberArrays *m = &festate->member_arrays;
+    
+    if (!festate->member_arrays_loaded)
+    {
+        festate->has_member_arrays = geodesk_get_member_arrays(festate->connection,
+                                                               &festate->current_feature, m);
+        festate->member_arrays_loaded = true;
+    }
+    if (!festate->has_member_arrays)
+        return false;
+    
+    switch (kind)
+    {
+        case GEODESK_COL_MEMBER_IDS:
+            *value = PointerGetDatum(construct_array_builtin(m->ids, m->count, INT8OID));
+            break;
+        case GEODESK_COL_MEMBER_TYPES:
+            *value = PointerGetDatum(construct_array_builtin(m->types, m->count, CHAROID));
+            break;
+        default:
+            *value = PointerGetDatum(construct_array_builtin(m->roles, m->count, TEXTOID));
+            break;
+    }
+    return true;
+}
+
+/*
+ * Check whether a column kind is built without reading the feature's body,
+ * like the columns is_cheap_column() lets early quals read
+ */
+static inline bool
+column_is_cheap(GeodeskColumnKind kind)
+{
+    return column_stage(kind) == GEODESK_NUM_STAGES ||
+           kind == GEODESK_COL_TAGS || kind == GEODESK_COL_TAG;
+}
+
+/*
+ * Fill the values of either the cheap or the expensive requested columns
+ * from the current feature
+ *
+ * Columns not in retrieved_attrs are left untouched.
+ */
+static void
+fill_column_values(GeodeskExecState *festate, Datum *values, bool *nulls, bool cheap)
+{
+    GeodeskFeature *feature = &festate->current_feature;
+    int i;
+    
+    if (!cheap)
+        festate->member_arrays_loaded = false;
+    
+    for (i = 0; i < festate->ncolumns; i++)
+    {
+        GeodeskColumn *col = &festate->columns[i];
+        int idx = col->attnum - 1;
+        GeodeskScanStage stage = column_stage(col->kind);
+        instr_time start;
+        
+        if (column_is_cheap(col->kind) != cheap)
+            continue;
+        
+        nulls[idx] = true;
+        
+        if (stage != GEODESK_NUM_STAGES)
+            stage_start(festate, &start);
+        
+        switch (col->kind)
+        {
+            case GEODESK_COL_FID:
+                values[idx] = Int64GetDatum(feature->id);
+                nulls[idx] = false;
+                break;
+            
+            case GEODESK_COL_SOURCE:
+                values[idx] = CStringGetTextDatum((char *) list_nth(festate->files,
+                                                                    festate->file_index));
+                nulls[idx] = false;
+                break;
+            
+            case GEODESK_COL_TYPE:
+                /* Feature type: 0=node, 1=way, 2=relation */
+                values[idx] = Int32GetDatum(feature->type);
+                nulls[idx] = false;
+                break;
+            
+            case GEODESK_COL_IS_AREA:
+                values[idx] = BoolGetDatum(feature->is_area);
+                nulls[idx] = false;
+                break;
+            
+            case GEODESK_COL_TAGS:
+                /* Get tags as JSONB directly (optimized) */
+                values[idx] = geodesk_get_tags_jsonb_direct(festate->connection, feature);
+                nulls[idx] = (values[idx] == (Datum) 0);
+                break;
+            
+            case GEODESK_COL_TAG:
+                nulls[idx] = !fill_tag_value(festate, col, &values[idx]);
+                break;
+            
+            case GEODESK_COL_GEOM:
+            {
+                LWGEOM *lwgeom;
+                
+                /* Nodes and ways are written as GSERIALIZED directly */
+                if (feature->type != 2)
+                {
+                    values[idx] = geodesk_build_gserialized(festate->connection, feature);
+                    nulls[idx] = (values[idx] == (Datum) 0);
+                    break;
+                }
+                
+                /* Relations need ring assembly, unless built before */
+                values[idx] = geodesk_geom_cache_lookup(festate->connection, feature->id);
+                if (values[idx] != (Datum) 0)
+                {
+                    nulls[idx] = false;
+                    break;
+                }
+                
+                lwgeom = geodesk_build_lwgeom(festate->connection, feature);
+                
+                if (lwgeom)
+                {
+                    /* Serialize LWGEOM to GSERIALIZED for PostGIS */
+                    size_t size;
+                    GSERIALIZED *geom_serialized = gserialized_from_lwgeom(lwgeom, &size);
+                    
+                    if (geom_serialized)
+                    {
+                        values[idx] = PointerGetDatum(geom_serialized);
+                        nulls[idx] = false;
+                        geodesk_geom_cache_store(festate->connection, feature->id,
+                                                 geom_serialized);
+                    }
+                    lwgeom_free(lwgeom);
+                }
+                break;
+            }
+            
+            case GEODESK_COL_MEMBERS:
+                /* Get members as JSONB directly (optimized) */
+                values[idx] = geodesk_get_members_jsonb_direct(festate->connection, feature);
+                nulls[idx] = (values[idx] == (Datum) 0);
+                break;
+            
+            case GEODESK_COL_MEMBER_IDS:
+            case GEODESK_COL_MEMBER_TYPES:
+            case GEODESK_COL_MEMBER_ROLES:
+                nulls[idx] = !fill_member_array(festate, col->kind, &values[idx]);
+                break;
+            
+            case GEODESK_COL_PARENTS:
+                /* Get parents as JSONB directly (optimized) */
+                values[idx] = geodesk_get_parents_jsonb_direct(festate->connection, feature);
+                nulls[idx] = (values[idx] == (Datum) 0);
+                break;
+            
+            case GEODESK_COL_BBOX:
+                nulls[idx] = !fill_bbox_value(festate, col, &values[idx]);
+                break;
+            
+            case GEODESK_COL_UNKNOWN:
+                /* Not produced yet - return NULL */
+                break;
+        }
+        
+        if (stage == GEODESK_NUM_STAGES)
+            continue;
+        stage_end(festate, stage, &start);
+        
+        if (nulls[idx])
+            continue;
+        if (col->kind == GEODESK_COL_GEOM)
+            festate->stats.geometry_bytes += VARSIZE_ANY(DatumGetPointer(values[idx]));
+        else if (col->kind == GEODESK_COL_TAGS || col->kind == GEODESK_COL_MEMBERS ||
+                 col->kind == GEODESK_COL_PARENTS)
+            festate->stats.jsonb_bytes += VARSIZE_ANY(DatumGetPointer(values[idx]));
+    }
+}
 
-    /* Allocate state structure */
-    festate = (GeodeskExecState *) palloc0(sizeof(GeodeskExecState));
-    node->fdw_state = festate;
+/*
+ * Fill the values of all requested columns from the current feature
+ */
+static void
+fill_feature_values(GeodeskExecState *festate, TupleDesc tupdesc,
+                    Datum *values, bool *nulls)
+{
+    fill_column_values(festate, values, nulls, true);
+    fill_column_values(festate, values, nulls, false);
+}
 
-    /* Get info from plan */
-    festate->retrieved_attrs = (List *) linitial(fsplan->fdw_private);
+/*
+ * Return the next group of a pushed-down aggregate
+ *
+ * The features are counted in the bridge on the first call; each call
+ * then returns one non-empty group, or the single row of an ungrouped
+ * count(*).
+ */
+static TupleTableSlot *
+iterate_aggregate(GeodeskExecState *festate, TupleTableSlot *slot)
+{
+    int group;
+    int i;
+    ListCell *lc;
     
-    /* Check if geometry, bbox, or members columns are needed */
-    festate->needs_geometry = false;
-    festate->needs_bbox = false;
-    festate->needs_members = false;
-    if (festate->retrieved_attrs)
+    if (!festate->agg_done)
     {
-        ListCell *lc;
-        TupleDesc tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+        int64 counts[GEODESK_COUNT_GROUPS];
+        instr_time start;
         
-        foreach(lc, festate->retrieved_attrs)
+        memset(counts, 0, sizeof(counts));
+        stage_start(festate, &start);
+        do
         {
-            int attnum = lfirst_int(lc);
-            Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
-            char *attname = NameStr(attr->attname);
+            while (geodesk_count_features(festate->connection, AGG_COUNT_BATCH, counts))
+                CHECK_FOR_INTERRUPTS();
+        } while (next_scan_file(festate));
+        stage_end(festate, GEODESK_STAGE_ITERATE, &start);
+        
+        /* Fold the counts into the groups that were asked for */
+        memset(festate->agg_counts, 0, sizeof(festate->agg_counts));
+        for (group = 0; group < GEODESK_COUNT_GROUPS; group++)
+        {
+            int type = festate->agg_by_type ? group / 2 : 0;
+            int is_area = festate->agg_by_area ? group % 2 : 0;
             
-            if (strcmp(attname, "geom") == 0 || strcmp(attname, "way") == 0)
-            {
-                festate->needs_geometry = true;
-                ereport(DEBUG1,
-                        (errcode(ERRCODE_FDW_ERROR),
-                         errmsg("Geometry column requested - will build geometry")));
-            }
-            else if (strcmp(attname, "bbox") == 0)
-            {
-                festate->needs_bbox = true;
-                ereport(DEBUG1,
-                        (errcode(ERRCODE_FDW_ERROR),
-                         errmsg("Bbox column requested - will extract bounds")));
-            }
-            else if (strcmp(attname, "members") == 0)
-            {
-                festate->needs_members = true;
-                ereport(DEBUG1,
-                        (errcode(ERRCODE_FDW_ERROR),
-                         errmsg("Members column requested - will extract member data")));
-            }
-            else if (strcmp(attname, "parents") == 0)
-            {
-                festate->needs_parents = true;
-                ereport(DEBUG1,
-                        (errcode(ERRCODE_FDW_ERROR),
-                         errmsg("Parents column requested - will extract parent data")));
-            }
+            festate->agg_counts[type * 2 + is_area] += counts[group];
         }
+        
+        festate->agg_done = true;
+        festate->agg_next_group = 0;
     }
     
-    if (!festate->needs_geometry)
+    /* Without GROUP BY there is exactly one row, even if the count is 0 */
+    for (group = festate->agg_next_group; group < GEODESK_COUNT_GROUPS; group++)
     {
-        ereport(DEBUG1,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("Geometry column NOT requested - using lazy geometry optimization")));
+        if (festate->agg_counts[group] > 0 ||
+            (group == 0 && !festate->agg_by_type && !festate->agg_by_area))
+            break;
     }
+    if (group >= GEODESK_COUNT_GROUPS)
+        return NULL;
+    festate->agg_next_group = group + 1;
     
-    /* Get pushdown info from planning phase */
-    if (list_length(fsplan->fdw_private) >= 3)
+    i = 0;
+    foreach(lc, festate->agg_outputs)
     {
-        /* Use the fpinfo passed from planning phase */
-        GeodeskFdwRelationInfo *plan_fpinfo = (GeodeskFdwRelationInfo *) lthird(fsplan->fdw_private);
-        memcpy(&fpinfo, plan_fpinfo, sizeof(GeodeskFdwRelationInfo));
-        
-        if (fpinfo.has_spatial_filter)
+        switch ((GeodeskAggOutput) lfirst_int(lc))
         {
-            ereport(DEBUG1,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("Using spatial filter from planning phase: [%.2f,%.2f,%.2f,%.2f]",
-                            fpinfo.bbox_min_x, fpinfo.bbox_min_y,
-                            fpinfo.bbox_max_x, fpinfo.bbox_max_y)));
+            case GEODESK_AGG_COUNT:
+                slot->tts_values[i] = Int64GetDatum(festate->agg_counts[group]);
+                break;
+            case GEODESK_AGG_TYPE:
+                slot->tts_values[i] = Int32GetDatum(group / 2);
+                break;
+            case GEODESK_AGG_IS_AREA:
+                slot->tts_values[i] = BoolGetDatum(group % 2 == 1);
+                break;
         }
+        slot->tts_isnull[i] = false;
+        i++;
     }
-    else
-    {
-        /* Fallback: get table options if fpinfo wasn't passed */
-        geodesk_get_options(RelationGetRelid(node->ss.ss_currentRelation), &fpinfo);
-    }
+    
+    ExecStoreVirtualTuple(slot);
+    festate->rows_fetched++;
+    return slot;
+}
 
-    /* Open connection to GOL file */
-    if (fpinfo.datasource)
+/*
+ * Skip the OFFSET features of a pushed-down limit, without building them
+ */
+static void
+skip_offset_features(GeodeskExecState *festate)
+{
+    int64 counts[GEODESK_COUNT_GROUPS];
+    
+    while (festate->limit_skip > 0)
     {
-        festate->connection = geodesk_open(fpinfo.datasource, fpinfo.query);
-        if (!festate->connection)
-            ereport(ERROR,
-                    (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-                     errmsg("failed to open GOL file \"%s\"", fpinfo.datasource)));
+        int64 batch = Min(festate->limit_skip, AGG_COUNT_BATCH);
+        bool more;
+        int group;
         
-        /* Apply filters if any */
-        if (fpinfo.has_spatial_filter)
-        {
-            geodesk_set_spatial_filter(festate->connection,
-                                      fpinfo.bbox_min_x, fpinfo.bbox_min_y,
-                                      fpinfo.bbox_max_x, fpinfo.bbox_max_y);
-        }
-        
-        /* FID pushdown disabled - libgeodesk doesn't support direct ID lookup
-         * if (fpinfo.has_id_filter)
-         * {
-         *     geodesk_set_id_filter(festate->connection, fpinfo.filter_id);
-         * }
-         */
-        
-        if (fpinfo.goql_filter || fpinfo.type_prefix)
-        {
-            geodesk_set_goql_filter_with_prefix(festate->connection, 
-                                               fpinfo.goql_filter, 
-                                               fpinfo.type_prefix ? fpinfo.type_prefix : "*");
-        }
+        memset(counts, 0, sizeof(counts));
+        more = geodesk_count_features(festate->connection, batch, counts);
         
-        /* Start iteration */
-        geodesk_reset_iteration(festate->connection);
-    }
-    else
-    {
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-                 errmsg("datasource and layer options are required")));
+        /* A file may end before the batch does */
+        for (group = 0; group < GEODESK_COUNT_GROUPS; group++)
+            festate->limit_skip -= counts[group];
+        if (!more && !next_scan_file(festate))
+            break;
+        CHECK_FOR_INTERRUPTS();
     }
+    festate->limit_skip = 0;
 }
 
 /*
@@ -852,272 +3119,759 @@ geodeskIterateForeignScan(ForeignScanState *node)
 {
     GeodeskExecState *festate = (GeodeskExecState *) node->fdw_state;
     TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+    instr_time start;
     bool found;
 
     /* Clear slot */
     ExecClearTuple(slot);
 
-    /* Get next feature */
-    found = geodesk_get_next_feature(festate->connection, &festate->current_feature);
+    if (festate->agg_outputs != NIL)
+        return iterate_aggregate(festate, slot);
     
-    if (found)
+    if (festate->has_limit)
+    {
+        if (festate->limit_skip > 0)
+            skip_offset_features(festate);
+        if (festate->limit_remaining <= 0)
+            return NULL;
+    }
+
+    if (festate->bbox_pending)
+        apply_runtime_bbox(node, festate);
+    if (festate->scan_empty)
+        return NULL;
+
+    for (;;)
     {
-        /* Build the tuple */
         Datum *values = slot->tts_values;
         bool *nulls = slot->tts_isnull;
-        ListCell *lc;
-
+        
+        stage_start(festate, &start);
+        found = next_scan_feature(festate);
+        stage_end(festate, GEODESK_STAGE_ITERATE, &start);
+        
+        /* No more rows - return NULL to signal end of scan */
+        if (!found)
+            return NULL;
+        
+        /* Build the tuple, the cheap columns first */
         memset(values, 0, sizeof(Datum) * slot->tts_tupleDescriptor->natts);
         memset(nulls, true, sizeof(bool) * slot->tts_tupleDescriptor->natts);
+        
+        fill_column_values(festate, values, nulls, true);
+        ExecStoreVirtualTuple(slot);
+        
+        /*
+         * Rows the early quals reject are dropped before their geometry
+         * and members are built. The values are in the per-tuple memory
+         * the scan runs in, which is reset for the next feature.
+         */
+        if (festate->early_quals)
+        {
+            ExprContext *econtext = node->ss.ps.ps_ExprContext;
+            
+            econtext->ecxt_scantuple = slot;
+            if (!ExecQual(festate->early_quals, econtext))
+            {
+                festate->stats.early_filtered++;
+                geodesk_feature_cleanup(&festate->current_feature);
+                ExecClearTuple(slot);
+                ResetExprContext(econtext);
+                CHECK_FOR_INTERRUPTS();
+                continue;
+            }
+        }
+        
+        /* The slot is virtual, so its values are read in place */
+        fill_column_values(festate, values, nulls, false);
+        
+        festate->rows_fetched++;
+        if (festate->has_limit)
+            festate->limit_remaining--;
+        
+        /* Clean up feature resources */
+        geodesk_feature_cleanup(&festate->current_feature);
+        
+        return slot;
+    }
+}
+
+/*
+ * Rescan foreign table
+ */
+static void
+geodeskReScanForeignScan(ForeignScanState *node)
+{
+    GeodeskExecState *festate = (GeodeskExecState *) node->fdw_state;
+
+    /*
+     * A parallel scan restarts by claiming tiles again once the leader has
+     * reset the shared counter in ReInitializeDSMForeignScan
+     */
+    festate->tile_active = false;
+    
+    festate->agg_done = false;
+    festate->batch->count = 0;
+    festate->batch_pos = 0;
+    festate->limit_remaining = festate->limit_count;
+    festate->limit_skip = festate->limit_offset;
+    
+    /* Only a changed outer geometry requires a new bbox view */
+    if (festate->bbox_exprs && node->ss.ps.chgParam != NULL)
+        festate->bbox_pending = true;
+    
+    /* Scans of several files restart with the first one */
+    if (festate->file_index > 0)
+        open_scan_file(festate, 0);
+    else if (festate->connection)
+        geodesk_reset_iteration(festate->connection);
+}
+
+/*
+ * End foreign scan
+ */
+static void
+geodeskEndForeignScan(ForeignScanState *node)
+{
+    GeodeskExecState *festate = (GeodeskExecState *) node->fdw_state;
+
+    if (festate && festate->relinfo)
+    {
+        close_scan_file(festate);
+        festate->stats.features_returned = festate->rows_fetched;
+        if (OidIsValid(festate->foreigntableid))
+            geodesk_stats_report(festate->foreigntableid, &festate->stats);
+    }
+}
+
+static char *
+format_box(double min_x, double min_y, double max_x, double max_y)
+{
+    return psprintf("BOX(%.15g %.15g,%.15g %.15g)", min_x, min_y, max_x, max_y);
+}
+
+/*
+ * Show the filters pushed down at planning time
+ */
+static void
+explain_relation_filters(GeodeskFdwRelationInfo *fpinfo, ExplainState *es)
+{
+    if (fpinfo->query)
+        ExplainPropertyText("GeoDesk Query", fpinfo->query, es);
+    
+    if (fpinfo->type_prefix || fpinfo->goql_filter)
+        ExplainPropertyText("GOQL Filter",
+                            psprintf("%s%s",
+                                     fpinfo->type_prefix ? fpinfo->type_prefix : "*",
+                                     fpinfo->goql_filter ? fpinfo->goql_filter : ""),
+                            es);
+    
+    if (fpinfo->goql_alternatives)
+        ExplainPropertyText("GOQL Alternatives", fpinfo->goql_alternatives, es);
+    
+    if (fpinfo->has_spatial_filter)
+        ExplainPropertyText("Bbox Filter",
+                            format_box(fpinfo->bbox_min_x, fpinfo->bbox_min_y,
+                                       fpinfo->bbox_max_x, fpinfo->bbox_max_y),
+                            es);
+    
+    if (fpinfo->has_distance_filter)
+        ExplainPropertyText("Distance Filter",
+                            psprintf("%.15g of POINT(%.15g %.15g)", fpinfo->distance_max,
+                                     fpinfo->distance_x, fpinfo->distance_y),
+                            es);
+    
+    if (fpinfo->has_id_filter)
+        ExplainPropertyInteger("ID Filter", "ids", fpinfo->num_filter_ids, es);
+    
+    /* Files left after footprint pruning, unless a single one */
+    if (list_length(fpinfo->files) != 1)
+        ExplainPropertyInteger("GOL Files", NULL, list_length(fpinfo->files), es);
+}
+
+/*
+ * Show the early quals, which are evaluated by the scan rather than as part
+ * of the node's Filter
+ */
+static void
+explain_early_quals(ForeignScan *fsplan, int nquals, ExplainState *es)
+{
+    List *quals = list_copy_tail(fsplan->fdw_exprs, list_length(fsplan->fdw_exprs) - nquals);
+    List *context;
+    
+    context = set_deparse_context_plan(deparse_context_for_plan_tree(es->pstmt,
+                                                                     es->rtable_names),
+                                       (Plan *) fsplan, NIL);
+    ExplainPropertyText("Early Filter",
+                        deparse_expression((Node *) make_ands_explicit(quals), context,
+                                           es->verbose || list_length(es->rtable) > 1,
+                                           false),
+                        es);
+}
+
+/*
+ * Show the work done by the scan, for EXPLAIN ANALYZE
+ *
+ * The bridge counters are read live, since EXPLAIN runs before the scan
+ * ends. Parallel workers report to geodesk_stat_scans only.
+ */
+static void
+explain_scan_stats(GeodeskExecState *festate, ExplainState *es)
+{
+    static const char *const stage_labels[GEODESK_NUM_STAGES] = {
+        "Iterate Time", "Tags Time", "Geometry Time", "Members Time", "Parents Time"
+    };
+    GeodeskBridgeCounters counters;
+    int stage;
+    
+    memset(&counters, 0, sizeof(counters));
+    if (festate->connection)
+        geodesk_get_counters(festate->connection, &counters);
+    
+    /* Plus those of the files already scanned */
+    counters.features_visited += festate->stats.features_visited;
+    counters.ways_assembled += festate->stats.ways_assembled;
+    
+    if (festate->runtime_bbox_count > 0)
+    {
+        ExplainPropertyText("Runtime Bbox Filter",
+                            format_box(festate->runtime_bbox[0], festate->runtime_bbox[1],
+                                       festate->runtime_bbox[2], festate->runtime_bbox[3]),
+                            es);
+        ExplainPropertyInteger("Runtime Bbox Updates", NULL, festate->runtime_bbox_count, es);
+    }
+    
+    ExplainPropertyInteger("Features Visited", NULL, counters.features_visited, es);
+    ExplainPropertyInteger("Features Returned", NULL, festate->rows_fetched, es);
+    if (festate->early_quals)
+        ExplainPropertyInteger("Rows Removed by Early Filter", NULL,
+                               festate->stats.early_filtered, es);
+    if (festate->pscan)
+        ExplainPropertyInteger("Parallel Tiles", NULL, festate->stats.tiles, es);
+    ExplainPropertyInteger("Ways Assembled", NULL, counters.ways_assembled, es);
+    ExplainPropertyInteger("Geometry Bytes", "bytes", festate->stats.geometry_bytes, es);
+    ExplainPropertyInteger("JSONB Bytes", "bytes", festate->stats.jsonb_bytes, es);
+    
+    if (festate->timing && es->timing)
+    {
+        for (stage = 0; stage < GEODESK_NUM_STAGES; stage++)
+            ExplainPropertyFloat(stage_labels[stage], "ms",
+                                 INSTR_TIME_GET_MILLISEC(festate->stats.stage_time[stage]),
+                                 3, es);
+    }
+}
+
+/*
+ * Explain foreign scan
+ */
+static void
+geodeskExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+    GeodeskExecState *festate = (GeodeskExecState *) node->fdw_state;
+    ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+    
+    if (list_length(fsplan->fdw_private) >= 4 && lfourth(fsplan->fdw_private) != NIL)
+    {
+        StringInfoData agg;
+        ListCell *lc;
+        bool grouped = false;
+        
+        initStringInfo(&agg);
+        appendStringInfoString(&agg, "count(*)");
+        foreach(lc, (List *) lfourth(fsplan->fdw_private))
+        {
+            if (lfirst_int(lc) == GEODESK_AGG_COUNT)
+                continue;
+            appendStringInfoString(&agg, grouped ? ", " : " GROUP BY ");
+            appendStringInfoString(&agg, lfirst_int(lc) == GEODESK_AGG_TYPE ? "type" : "is_area");
+            grouped = true;
+        }
+        ExplainPropertyText("Pushed Aggregate", agg.data, es);
+    }
+    
+    if (list_length(fsplan->fdw_private) >= 5)
+    {
+        List *limit = (List *) list_nth(fsplan->fdw_private, 4);
+        
+        ExplainPropertyText("Pushed Limit",
+                            psprintf("LIMIT %s OFFSET %s",
+                                     strVal(linitial(limit)), strVal(lsecond(limit))),
+                            es);
+    }
+    
+    if (list_length(fsplan->fdw_private) >= 3)
+    {
+        GeodeskFdwRelationInfo fpinfo;
+        
+        deserialize_relation_info((List *) lthird(fsplan->fdw_private), &fpinfo);
+        explain_relation_filters(&fpinfo, es);
+        if (fpinfo.early_quals > 0)
+            explain_early_quals(fsplan, fpinfo.early_quals, es);
+    }
+    
+    if (es->analyze && festate)
+        explain_scan_stats(festate, es);
+    
+    if (es->verbose)
+    {
+        if (festate)
+            ExplainPropertyInteger("Rows Fetched", NULL, festate->rows_fetched, es);
+    }
+}
+
+/*
+ * Analyze foreign table
+ */
+static bool
+geodeskAnalyzeForeignTable(Relation relation,
+                           AcquireSampleRowsFunc *func,
+                           BlockNumber *totalpages)
+{
+    GeodeskFdwRelationInfo fpinfo;
+    int64 rows = 0;
+    ListCell *lc;
+
+    memset(&fpinfo, 0, sizeof(GeodeskFdwRelationInfo));
+    geodesk_get_options(RelationGetRelid(relation), &fpinfo);
+    if (!fpinfo.datasource)
+        return false;
+
+    foreach(lc, geodesk_datasource_files(fpinfo.datasource))
+    {
+        GeodeskConnectionHandle conn = geodesk_open((char *) lfirst(lc), fpinfo.query);
+
+        if (!conn)
+            return false;
+
+        apply_relation_filters(conn, &fpinfo);
+        rows += Max(geodesk_estimate_count(conn), 0);
+        geodesk_close(conn);
+    }
+
+    /* Same page size convention as geodeskGetForeignRelSize */
+    *func = geodeskAcquireSampleRows;
+    *totalpages = (rows > 100) ? (BlockNumber) Min(rows / 100, (int64) MaxBlockNumber) : 1;
+    return true;
+}
+
+static uint32
+gcd_uint32(uint32 a, uint32 b)
+{
+    while (b != 0)
+    {
+        uint32 t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * Acquire a random sample of rows for ANALYZE
+ *
+ * The world is divided into a grid of tiles which are visited in random
+ * order until enough features have been seen, so only a fraction of the
+ * file is read. Every feature seen goes through reservoir sampling, but
+ * only the ones that end up in the sample are decoded into tuples. The
+ * total row count is extrapolated from the share of tiles visited. The
+ * files of a multi-file datasource each get an equal share of the features
+ * to see, and what one of them leaves unused goes to the next.
+ */
+static int
+geodeskAcquireSampleRows(Relation relation, int elevel,
+                         HeapTuple *rows, int targrows,
+                         double *totalrows, double *totaldeadrows)
+{
+    GeodeskFdwRelationInfo fpinfo;
+    GeodeskExecState festate;
+    TupleDesc tupdesc = RelationGetDescr(relation);
+    GeodeskTileRange range;
+    ReservoirStateData rstate;
+    MemoryContext tupcontext;
+    Datum *values;
+    bool *nulls;
+    uint32 ntiles = 0;
+    uint32 start;
+    uint32 step;
+    uint32 visited = 0;
+    uint32 total_tiles = 0;
+    uint32 total_visited = 0;
+    double rowstoskip = -1;
+    double samplerows = 0;
+    double estimated_rows = 0;
+    int numrows = 0;
+    int nfiles;
+    int file;
+    int attnum;
+
+    memset(&fpinfo, 0, sizeof(GeodeskFdwRelationInfo));
+    geodesk_get_options(RelationGetRelid(relation), &fpinfo);
+
+    /* Sample every column, so all of them get statistics */
+    memset(&festate, 0, sizeof(GeodeskExecState));
+    festate.foreigntableid = RelationGetRelid(relation);
+    for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+    {
+        if (!TupleDescAttr(tupdesc, attnum - 1)->attisdropped)
+            festate.retrieved_attrs = lappend_int(festate.retrieved_attrs, attnum);
+    }
+    festate.relinfo = &fpinfo;
+    festate.files = geodesk_datasource_files(fpinfo.datasource);
+    nfiles = list_length(festate.files);
+
+    values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+    nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
+    tupcontext = AllocSetContextCreate(CurrentMemoryContext,
+                                       "geodesk_fdw analyze tuple",
+                                       ALLOCSET_DEFAULT_SIZES);
+
+    reservoir_init_selection_state(&rstate, targrows);
+
+    PG_TRY();
+    {
+        for (file = 0; file < nfiles; file++)
+        {
+            double budget = (double) targrows * ANALYZE_ROWS_PER_SAMPLE * (file + 1) / nfiles;
+            double file_rows = 0;
+
+            open_scan_file(&festate, file);
+            if (file == 0)
+                resolve_columns(&festate, relation);
+            geodesk_plan_tile_partition(festate.connection, ANALYZE_SAMPLE_TILES, &range);
+            ntiles = (uint32) ((range.max_col - range.min_col + 1) *
+                               (range.max_row - range.min_row + 1));
 
-        /* Fill in the values */
-        foreach(lc, festate->retrieved_attrs)
-        {
-            int attnum = lfirst_int(lc);
-            Form_pg_attribute attr = TupleDescAttr(slot->tts_tupleDescriptor, attnum - 1);
-            
-            ereport(DEBUG1,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("Processing column %d: %s", attnum, NameStr(attr->attname))));
-            
-            /* Handle different column types */
-            if (strcmp(NameStr(attr->attname), "fid") == 0)
-            {
-                values[attnum - 1] = Int64GetDatum(festate->current_feature.id);
-                nulls[attnum - 1] = false;
-                ereport(DEBUG1,
-                        (errcode(ERRCODE_FDW_ERROR),
-                         errmsg("Set fid = %lld", (long long)festate->current_feature.id)));
-            }
-            else if (strcmp(NameStr(attr->attname), "tags") == 0)
-            {
-                /* Get tags as JSONB directly (optimized) */
-                Datum tags_jsonb = geodesk_get_tags_jsonb_direct(festate->connection, &festate->current_feature);
-                if (tags_jsonb)
-                {
-                    values[attnum - 1] = tags_jsonb;
-                    nulls[attnum - 1] = false;
-                    ereport(DEBUG1,
-                            (errcode(ERRCODE_FDW_ERROR),
-                             errmsg("Tags JSONB built directly (optimized)")));
-                }
-                else
-                {
-                    ereport(DEBUG1,
-                            (errcode(ERRCODE_FDW_ERROR),
-                             errmsg("No tags returned")));
-                    nulls[attnum - 1] = true;
-                }
-            }
-            else if (strcmp(NameStr(attr->attname), "type") == 0)
+            /* A stride coprime to the tile count visits every tile exactly once */
+            start = (uint32) (sampler_random_fract(&rstate.randstate) * ntiles);
+            step = 1;
+            while (ntiles > 1)
             {
-                /* Feature type: 0=node, 1=way, 2=relation */
-                values[attnum - 1] = Int32GetDatum(festate->current_feature.type);
-                nulls[attnum - 1] = false;
-                ereport(DEBUG1,
-                        (errcode(ERRCODE_FDW_ERROR),
-                         errmsg("Set type = %d", festate->current_feature.type)));
-            }
-            else if (strcmp(NameStr(attr->attname), "is_area") == 0)
-            {
-                /* Is this way an area (polygon)? */
-                values[attnum - 1] = BoolGetDatum(festate->current_feature.is_area);
-                nulls[attnum - 1] = false;
-                ereport(DEBUG1,
-                        (errcode(ERRCODE_FDW_ERROR),
-                         errmsg("Set is_area = %s", festate->current_feature.is_area ? "true" : "false")));
-            }
-            else if (strcmp(NameStr(attr->attname), "geom") == 0 ||
-                     strcmp(NameStr(attr->attname), "way") == 0)
-            {
-                /* Check if geometry is actually needed */
-                if (festate->needs_geometry)
-                {
-                    /* Build LWGEOM directly from libgeodesk feature */
-                    LWGEOM* lwgeom = geodesk_build_lwgeom(festate->connection, &festate->current_feature);
-                    
-                    if (lwgeom)
-                    {
-                        /* Serialize LWGEOM to GSERIALIZED for PostGIS */
-                        size_t size;
-                        GSERIALIZED* geom_serialized = gserialized_from_lwgeom(lwgeom, &size);
-                        
-                        if (geom_serialized)
-                        {
-                            values[attnum - 1] = PointerGetDatum(geom_serialized);
-                            nulls[attnum - 1] = false;
-                            ereport(DEBUG1,
-                                    (errcode(ERRCODE_FDW_ERROR),
-                                     errmsg("Geometry set: size = %zu bytes", size)));
-                        }
-                        else
-                        {
-                            nulls[attnum - 1] = true;
-                            ereport(DEBUG1,
-                                    (errcode(ERRCODE_FDW_ERROR),
-                                     errmsg("Failed to serialize LWGEOM")));
-                        }
-                        
-                        /* Clean up LWGEOM */
-                        lwgeom_free(lwgeom);
-                    }
-                    else
-                    {
-                        nulls[attnum - 1] = true;
-                        ereport(DEBUG1,
-                                (errcode(ERRCODE_FDW_ERROR),
-                                 errmsg("Failed to build LWGEOM from feature")));
-                    }
-                }
-                else
-                {
-                    /* Geometry not needed - set NULL to save processing time */
-                    nulls[attnum - 1] = true;
-                    ereport(DEBUG1,
-                            (errcode(ERRCODE_FDW_ERROR),
-                             errmsg("Skipping geometry construction (lazy optimization)")));
-                }
+                step = 1 + (uint32) (sampler_random_fract(&rstate.randstate) * (ntiles - 1));
+                if (gcd_uint32(step, ntiles) == 1)
+                    break;
             }
-            else if (strcmp(NameStr(attr->attname), "members") == 0)
+
+            for (visited = 0; visited < ntiles; visited++)
             {
-                /* Check if members data is actually needed */
-                if (festate->needs_members)
+                uint32 tile = (uint32) ((start + (uint64) visited * step) % ntiles);
+
+                if (samplerows >= budget)
+                    break;
+
+                geodesk_set_tile(festate.connection, &range, tile);
+                while (geodesk_get_next_feature(festate.connection, &festate.current_feature))
                 {
-                    /* Get members as JSONB directly (optimized) */
-                    Datum members_jsonb = geodesk_get_members_jsonb_direct(festate->connection, &festate->current_feature);
-                    if (members_jsonb)
+                    int pos = -1;
+
+                    vacuum_delay_point();
+
+                    if (numrows < targrows)
                     {
-                        values[attnum - 1] = members_jsonb;
-                        nulls[attnum - 1] = false;
-                        
-                        ereport(DEBUG1,
-                                (errcode(ERRCODE_FDW_ERROR),
-                                 errmsg("Got members JSONB for feature %ld", festate->current_feature.id)));
+                        pos = numrows++;
                     }
                     else
                     {
-                        nulls[attnum - 1] = true;
-                        ereport(DEBUG1,
-                                (errcode(ERRCODE_FDW_ERROR),
-                                 errmsg("No members data for this feature")));
-                    }
-                }
-                else
-                {
-                    /* Members not needed - set NULL to save processing time */
-                    nulls[attnum - 1] = true;
-                    ereport(DEBUG1,
-                            (errcode(ERRCODE_FDW_ERROR),
-                             errmsg("Skipping members extraction (lazy optimization)")));
-                }
-            }
-            else if (strcmp(NameStr(attr->attname), "parents") == 0)
-            {
-                /* Check if parents data is actually needed */
-                if (festate->needs_parents)
-                {
-                    /* Get parents as JSONB directly (optimized) */
-                    Datum parents_jsonb = geodesk_get_parents_jsonb_direct(festate->connection, &festate->current_feature);
-                    if (parents_jsonb)
-                    {
-                        values[attnum - 1] = parents_jsonb;
-                        nulls[attnum - 1] = false;
-                        
-                        ereport(DEBUG1,
-                                (errcode(ERRCODE_FDW_ERROR),
-                                 errmsg("Got parents JSONB for feature %ld", festate->current_feature.id)));
+                        if (rowstoskip < 0)
+                            rowstoskip = reservoir_get_next_S(&rstate, samplerows, targrows);
+                        if (rowstoskip <= 0)
+                        {
+                            pos = (int) (targrows * sampler_random_fract(&rstate.randstate));
+                            heap_freetuple(rows[pos]);
+                        }
+                        rowstoskip -= 1;
                     }
-                    else
+                    samplerows += 1;
+                    file_rows += 1;
+
+                    if (pos >= 0)
                     {
-                        nulls[attnum - 1] = true;
-                        ereport(DEBUG1,
-                                (errcode(ERRCODE_FDW_ERROR),
-                                 errmsg("No parents data for this feature")));
+                        MemoryContext oldcontext;
+
+                        MemoryContextReset(tupcontext);
+                        oldcontext = MemoryContextSwitchTo(tupcontext);
+                        memset(values, 0, tupdesc->natts * sizeof(Datum));
+                        memset(nulls, true, tupdesc->natts * sizeof(bool));
+                        fill_feature_values(&festate, tupdesc, values, nulls);
+                        MemoryContextSwitchTo(oldcontext);
+
+                        rows[pos] = heap_form_tuple(tupdesc, values, nulls);
                     }
+
+                    geodesk_feature_cleanup(&festate.current_feature);
                 }
-                else
-                {
-                    /* Parents not needed - set NULL to save processing time */
-                    nulls[attnum - 1] = true;
-                    ereport(DEBUG1,
-                            (errcode(ERRCODE_FDW_ERROR),
-                             errmsg("Skipping parents extraction (lazy optimization)")));
-                }
-            }
-            else
-            {
-                /* Unknown column - return NULL */
-                nulls[attnum - 1] = true;
             }
+
+            estimated_rows += (visited < ntiles && visited > 0) ?
+                              rint(file_rows * ntiles / visited) : file_rows;
+            total_tiles += ntiles;
+            total_visited += visited;
         }
+    }
+    PG_FINALLY();
+    {
+        close_scan_file(&festate);
+    }
+    PG_END_TRY();
 
-        ExecStoreVirtualTuple(slot);
-        festate->rows_fetched++;
+    MemoryContextDelete(tupcontext);
 
-        /* Clean up feature resources */
-        geodesk_feature_cleanup(&festate->current_feature);
+    *totalrows = estimated_rows;
+    *totaldeadrows = 0;
+
+    ereport(elevel,
+            (errmsg("\"%s\": sampled %u of %u tiles containing %.0f features; "
+                    "%d rows in sample, %.0f estimated total rows",
+                    RelationGetRelationName(relation), total_visited, total_tiles,
+                    samplerows, numrows, *totalrows)));
+
+    return numrows;
+}
+
+/*
+ * Create a foreign table for each GOL file of a datasource
+ *
+ * The remote schema names the datasource, a directory or a list of files,
+ * and each table is named after its file. With the partition_of option,
+ * the tables become the partitions of a table partitioned by LIST on a
+ * source text column, one value per file; otherwise they get the standard
+ * columns and a source column of their own. The srid option is passed on
+ * to the tables.
+ */
+static List *
+geodeskImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid)
+{
+    ForeignServer *server = GetForeignServer(serverOid);
+    const char *partition_of = NULL;
+    const char *srid = NULL;
+    List *commands = NIL;
+    ListCell *lc;
+    
+    foreach(lc, stmt->options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
         
-        return slot;
+        if (strcmp(def->defname, "partition_of") == 0)
+            partition_of = defGetString(def);
+        else if (strcmp(def->defname, OPTION_SRID) == 0)
+        {
+            srid = defGetString(def);
+            if (strcmp(srid, "3857") != 0 && strcmp(srid, "4326") != 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+                         errmsg("invalid value for option \"%s\": \"%s\"",
+                                OPTION_SRID, srid),
+                         errhint("Valid values are 3857 and 4326.")));
+        }
+        else
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                     errmsg("invalid option \"%s\"", def->defname),
+                     errhint("Valid options for IMPORT FOREIGN SCHEMA are: partition_of, srid")));
+    }
+    
+    foreach(lc, geodesk_datasource_files(stmt->remote_schema))
+    {
+        char *path = (char *) lfirst(lc);
+        char *name = pstrdup(last_dir_separator(path) ? last_dir_separator(path) + 1 : path);
+        StringInfoData buf;
+        
+        /* berlin.gol becomes berlin */
+        if (strlen(name) > 4 && pg_strcasecmp(name + strlen(name) - 4, ".gol") == 0)
+            name[strlen(name) - 4] = '\0';
+        
+        if (!IsImportableForeignTable(name, stmt))
+            continue;
+        
+        initStringInfo(&buf);
+        appendStringInfo(&buf, "CREATE FOREIGN TABLE %s ", quote_identifier(name));
+        if (partition_of)
+            appendStringInfo(&buf, "PARTITION OF %s FOR VALUES IN (%s) ",
+                             NameListToQuotedString(stringToQualifiedNameList(partition_of, NULL)),
+                             quote_literal_cstr(path));
+        else
+            appendStringInfo(&buf,
+                             "(fid bigint, type integer, tags jsonb, "
+                             "geom geometry(Geometry, %s), is_area boolean, source text) ",
+                             srid ? srid : "3857");
+        appendStringInfo(&buf, "SERVER %s OPTIONS (datasource %s",
+                         quote_identifier(server->servername), quote_literal_cstr(path));
+        if (srid)
+            appendStringInfo(&buf, ", srid %s", quote_literal_cstr(srid));
+        appendStringInfoChar(&buf, ')');
+        
+        commands = lappend(commands, buf.data);
     }
     
-    /* No more rows - return NULL to signal end of scan */
-    return NULL;
+    return commands;
 }
 
 /*
- * Rescan foreign table
+ * Foreign scans can run in parallel workers; the GOL file is read-only and
+ * every participant opens its own connection to it
+ */
+static bool
+geodeskIsForeignScanParallelSafe(PlannerInfo *root,
+                                 RelOptInfo *rel,
+                                 RangeTblEntry *rte)
+{
+    return true;
+}
+
+/*
+ * Estimate the shared memory needed by a parallel scan
+ */
+static Size
+geodeskEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt)
+{
+    return sizeof(GeodeskParallelScanState);
+}
+
+/*
+ * Partition the scan area into tiles and initialize the shared counter
  */
 static void
-geodeskReScanForeignScan(ForeignScanState *node)
+geodeskInitializeDSMForeignScan(ForeignScanState *node,
+                                ParallelContext *pcxt,
+                                void *coordinate)
 {
     GeodeskExecState *festate = (GeodeskExecState *) node->fdw_state;
+    GeodeskParallelScanState *pscan = (GeodeskParallelScanState *) coordinate;
+    
+    /* Aim for enough tiles per participant to even out feature density */
+    geodesk_plan_tile_partition(festate->connection, 16 * (pcxt->nworkers + 1),
+                                &pscan->range);
+    pscan->ntiles = (uint32) ((pscan->range.max_col - pscan->range.min_col + 1) *
+                              (pscan->range.max_row - pscan->range.min_row + 1));
+    pg_atomic_init_u32(&pscan->next_tile, 0);
+    
+    festate->pscan = pscan;
+    festate->tile_active = false;
+    
+    ereport(DEBUG1,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Parallel scan partitioned into %u tiles at zoom %d",
+                    pscan->ntiles, pscan->range.zoom)));
+}
 
-    if (festate->connection)
-        geodesk_reset_iteration(festate->connection);
+/*
+ * Reset the shared counter before a rescan
+ */
+static void
+geodeskReInitializeDSMForeignScan(ForeignScanState *node,
+                                  ParallelContext *pcxt,
+                                  void *coordinate)
+{
+    GeodeskParallelScanState *pscan = (GeodeskParallelScanState *) coordinate;
+    
+    pg_atomic_write_u32(&pscan->next_tile, 0);
 }
 
 /*
- * End foreign scan
+ * Attach a worker to the shared tile partition
  */
 static void
-geodeskEndForeignScan(ForeignScanState *node)
+geodeskInitializeWorkerForeignScan(ForeignScanState *node,
+                                   shm_toc *toc,
+                                   void *coordinate)
 {
     GeodeskExecState *festate = (GeodeskExecState *) node->fdw_state;
+    
+    festate->pscan = (GeodeskParallelScanState *) coordinate;
+    festate->tile_active = false;
+}
 
-    if (festate && festate->connection)
-    {
-        geodesk_close(festate->connection);
-        festate->connection = NULL;
-    }
+/*
+ * Scans of tables with async_capable can run below an async Append;
+ * parallel scans iterate tiles on the backend, so they can't
+ */
+static bool
+geodeskIsForeignPathAsyncCapable(ForeignPath *path)
+{
+    RelOptInfo *rel = path->path.parent;
+    GeodeskFdwRelationInfo *fpinfo = (GeodeskFdwRelationInfo *) rel->fdw_private;
+
+    if (!IS_SIMPLE_REL(rel) || path->path.parallel_aware)
+        return false;
+
+    return fpinfo->async_capable;
 }
 
 /*
- * Explain foreign scan
+ * Check whether the next row can be returned without waiting for the
+ * producer thread
+ *
+ * Starts the producer on the first call. Scans that aren't pipelined
+ * never wait for it, and so are always ready.
+ */
+static bool
+async_fetch_ready(ForeignScanState *node, GeodeskExecState *festate)
+{
+    if (festate->batch_pos < festate->batch->count)
+        return true;
+    if (festate->has_limit && festate->limit_remaining <= 0)
+        return true;
+
+    if (festate->bbox_pending)
+        apply_runtime_bbox(node, festate);
+    if (festate->scan_empty)
+        return true;
+
+    if (geodesk_pipeline_start(festate->connection) < 0)
+        return true;
+    return geodesk_pipeline_ready(festate->connection);
+}
+
+/*
+ * Return the next row to the Append, or leave the request pending until
+ * the producer has features
  */
 static void
-geodeskExplainForeignScan(ForeignScanState *node, ExplainState *es)
+produce_tuple_asynchronously(AsyncRequest *areq)
 {
+    ForeignScanState *node = (ForeignScanState *) areq->requestee;
     GeodeskExecState *festate = (GeodeskExecState *) node->fdw_state;
-    
-    if (es->verbose)
+    TupleTableSlot *result;
+
+    if (!async_fetch_ready(node, festate))
     {
-        if (festate)
-            ExplainPropertyInteger("Rows Fetched", NULL, festate->rows_fetched, es);
+        ExecAsyncRequestPending(areq);
+        return;
     }
+
+    result = areq->requestee->ExecProcNodeReal(areq->requestee);
+    ExecAsyncRequestDone(areq, result);
+}
+
+static void
+geodeskForeignAsyncRequest(AsyncRequest *areq)
+{
+    produce_tuple_asynchronously(areq);
 }
 
 /*
- * Analyze foreign table
+ * Wait on the eventfd the producer signals as features arrive
  */
-static bool
-geodeskAnalyzeForeignTable(Relation relation,
-                           AcquireSampleRowsFunc *func,
-                           BlockNumber *totalpages)
+static void
+geodeskForeignAsyncConfigureWait(AsyncRequest *areq)
 {
-    /* TODO: Implement sampling */
-    *func = NULL;
-    *totalpages = 1;
-    return false;
+    ForeignScanState *node = (ForeignScanState *) areq->requestee;
+    GeodeskExecState *festate = (GeodeskExecState *) node->fdw_state;
+    AppendState *requestor = (AppendState *) areq->requestor;
+    int fd;
+
+    if (!areq->callback_pending)
+        return;
+
+    /* Requests only stay pending while the producer runs */
+    fd = geodesk_pipeline_start(festate->connection);
+    Assert(fd >= 0);
+    AddWaitEventToSet(requestor->as_eventset, WL_SOCKET_READABLE, fd, NULL, areq);
+}
+
+static void
+geodeskForeignAsyncNotify(AsyncRequest *areq)
+{
+    produce_tuple_asynchronously(areq);
 }
 
 /*
@@ -1180,3 +3934,202 @@ geodesk_fdw_drivers(PG_FUNCTION_ARGS)
 
     PG_RETURN_NULL();
 }
+
+/*
+ * Report the relation geometry cache of this backend
+ */
+Datum
+geodesk_fdw_geometry_cache_stats(PG_FUNCTION_ARGS)
+{
+    GeodeskGeomCacheStats stats;
+    TupleDesc tupdesc;
+    Datum values[4];
+    bool nulls[4] = {false, false, false, false};
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    geodesk_geom_cache_get_stats(&stats);
+    values[0] = Int64GetDatum(stats.entries);
+    values[1] = Int64GetDatum(stats.bytes);
+    values[2] = Int64GetDatum(stats.hits);
+    values[3] = Int64GetDatum(stats.misses);
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/*
+ * Open a GOL file for a SQL function, restricted to its goql argument
+ *
+ * An empty query and '*' stand for all features. A query libgeodesk
+ * rejects raises an ERROR rather than leaving the whole file to work on.
+ */
+static GeodeskConnectionHandle
+open_goql_connection(const char *datasource, const char *goql)
+{
+    GeodeskConnectionHandle conn = geodesk_open(datasource, NULL);
+    char *error = NULL;
+
+    if (!conn)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+                 errmsg("failed to open GOL file \"%s\"", datasource)));
+
+    if (goql[0] != '\0' && strcmp(goql, "*") != 0 && !geodesk_set_query(conn, goql, &error))
+    {
+        geodesk_close(conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("invalid GOQL query \"%s\"", goql),
+                 error ? errdetail("%s", error) : 0));
+    }
+
+    return conn;
+}
+
+/*
+ * Encode the features of a GOL file in a vector tile
+ *
+ * geodesk_mvt(datasource, z, x, y, goql, layer, extent, buffer) returns a
+ * single-layer MVT, built directly from the bbox view of the tile without
+ * going through tuples.
+ */
+Datum
+geodesk_mvt(PG_FUNCTION_ARGS)
+{
+    char *datasource = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *goql = text_to_cstring(PG_GETARG_TEXT_PP(4));
+    GeodeskMvtTile tile;
+    GeodeskConnectionHandle conn;
+    bytea *result;
+
+    tile.zoom = PG_GETARG_INT32(1);
+    tile.x = PG_GETARG_INT32(2);
+    tile.y = PG_GETARG_INT32(3);
+    tile.layer = text_to_cstring(PG_GETARG_TEXT_PP(5));
+    tile.extent = PG_GETARG_INT32(6);
+    tile.buffer = PG_GETARG_INT32(7);
+
+    if (tile.zoom < 0 || tile.zoom > GEODESK_MVT_MAX_ZOOM)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("zoom level must be between 0 and %d", GEODESK_MVT_MAX_ZOOM)));
+    if (tile.x < 0 || tile.y < 0 || (int64) tile.x >= ((int64) 1 << tile.zoom) ||
+        (int64) tile.y >= ((int64) 1 << tile.zoom))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("tile %d/%d/%d does not exist", tile.zoom, tile.x, tile.y)));
+    if (tile.extent <= 0 || tile.buffer < 0 || tile.buffer > tile.extent)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("extent must be positive and buffer between 0 and extent")));
+
+    conn = open_goql_connection(datasource, goql);
+
+    PG_TRY();
+    {
+        result = geodesk_build_mvt(conn, &tile);
+    }
+    PG_FINALLY();
+    {
+        geodesk_close(conn);
+    }
+    PG_END_TRY();
+
+    if (!result)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("could not encode tile %d/%d/%d", tile.zoom, tile.x, tile.y)));
+
+    PG_RETURN_BYTEA_P(result);
+}
+
+/*
+ * Load the tiles of a connection's region into the page cache, handling
+ * interrupts
+ *
+ * The bridge stops its threads and returns early for an interrupt. If the
+ * interrupt doesn't end the query, the load starts over; the tiles loaded
+ * so far are quick to go through again.
+ */
+static bool
+load_tiles(GeodeskConnectionHandle conn, int nthreads, GeodeskPrewarmResult *result)
+{
+    for (;;)
+    {
+        bool ok = geodesk_load_tiles(conn, nthreads, result);
+        
+        if (!ok || !result->interrupted)
+            return ok;
+        CHECK_FOR_INTERRUPTS();
+    }
+}
+
+/*
+ * Load the tiles of a region of a GOL file into the page cache
+ *
+ * geodesk_prewarm(datasource, bbox, goql, threads) loads the tiles
+ * overlapping bbox (all tiles if it is NULL) that contain a feature
+ * matching goql, using up to threads threads, and returns their size in
+ * bytes. The bbox is in its own SRID, 4326 or 3857.
+ */
+Datum
+geodesk_prewarm(PG_FUNCTION_ARGS)
+{
+    char *datasource;
+    char *goql;
+    int32 nthreads;
+    GeodeskConnectionHandle conn;
+    GeodeskPrewarmResult result = {0, 0, false};
+    bool ok = true;
+
+    if (PG_ARGISNULL(0))
+        ereport(ERROR,
+                (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                 errmsg("datasource must not be null")));
+    datasource = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    goql = PG_ARGISNULL(2) ? "*" : text_to_cstring(PG_GETARG_TEXT_PP(2));
+    nthreads = PG_ARGISNULL(3) ? 1 : PG_GETARG_INT32(3);
+
+    if (nthreads < 1 || nthreads > GEODESK_PREWARM_MAX_THREADS)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("threads must be between 1 and %d", GEODESK_PREWARM_MAX_THREADS)));
+
+    conn = open_goql_connection(datasource, goql);
+
+    PG_TRY();
+    {
+        if (!PG_ARGISNULL(1))
+        {
+            GSERIALIZED *bbox = PG_GETARG_GSERIALIZED_P(1);
+            GBOX gbox;
+
+            /* An empty box loads nothing */
+            if (gserialized_get_gbox_p(bbox, &gbox) == LW_SUCCESS)
+            {
+                geodesk_set_output_srid(conn, gserialized_get_srid(bbox));
+                geodesk_set_spatial_filter(conn, gbox.xmin, gbox.ymin, gbox.xmax, gbox.ymax);
+                ok = load_tiles(conn, nthreads, &result);
+            }
+        }
+        else
+            ok = load_tiles(conn, nthreads, &result);
+    }
+    PG_FINALLY();
+    {
+        geodesk_close(conn);
+    }
+    PG_END_TRY();
+
+    if (!ok)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("could not prewarm \"%s\"", datasource)));
+
+    ereport(DEBUG1,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Prewarmed " INT64_FORMAT " tiles of \"%s\"", result.tiles, datasource)));
+
+    PG_RETURN_INT64(result.bytes);
+}
@@ -0,0 +1,230 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_geom_cache.cpp
+ *      Per-backend LRU cache of assembled relation geometries
+ *
+ * Building a relation's geometry iterates its members and assembles its
+ * rings, and the same large boundaries and landuse relations come back for
+ * every tile that touches them. Their serialized geometries are kept here,
+ * keyed by datasource path, relation id, output SRID and simplification
+ * tolerance, up to geodesk_fdw.geometry_cache_size kilobytes in LRU
+ * order. Each entry records the identity of the file it was built from,
+ * and is dropped when it is looked up through a store opened on a
+ * different file.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <geodesk/geodesk.h>
+
+extern "C" {
+#include "postgres.h"
+#include "geodesk_fdw.h"
+}
+
+using namespace geodesk;
+
+// Include shared connection structure
+#include "geodesk_connection_internal.h"
+
+struct GeomCacheKey
+{
+    std::string path;
+    int64_t id;
+    int32_t srid;
+    double tolerance;             // Simplification tolerance, in imp units
+
+    bool operator==(const GeomCacheKey& other) const
+    {
+        return id == other.id && srid == other.srid && tolerance == other.tolerance &&
+               path == other.path;
+    }
+};
+
+struct GeomCacheKeyHash
+{
+    size_t operator()(const GeomCacheKey& key) const
+    {
+        int64_t id_srid = key.id * 2 + (key.srid == GEODESK_SRID_WGS84);
+        return std::hash<std::string>()(key.path) ^
+               (std::hash<int64_t>()(id_srid) * 0x9E3779B97F4A7C15ULL);
+    }
+};
+
+struct GeomCacheEntry
+{
+    GeomCacheKey key;
+    std::vector<uint8_t> data;    // GSERIALIZED, including varlena header
+
+    // Identity of the file the geometry was built from
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+};
+
+// Most recently used entry first
+static std::list<GeomCacheEntry> geom_cache;
+static std::unordered_map<GeomCacheKey, std::list<GeomCacheEntry>::iterator,
+                          GeomCacheKeyHash> geom_cache_map;
+static size_t geom_cache_bytes = 0;
+static int64_t geom_cache_hits = 0;
+static int64_t geom_cache_misses = 0;
+
+static size_t
+geom_cache_budget()
+{
+    return static_cast<size_t>(geodesk_geometry_cache_size) * 1024;
+}
+
+static bool
+entry_matches_store(const GeomCacheEntry& entry, const GeodeskStoreEntry& store)
+{
+    return entry.device == store.device &&
+           entry.inode == store.inode &&
+           entry.size == store.size &&
+           entry.mtime.tv_sec == store.mtime.tv_sec &&
+           entry.mtime.tv_nsec == store.mtime.tv_nsec;
+}
+
+static void
+geom_cache_erase(std::list<GeomCacheEntry>::iterator it)
+{
+    geom_cache_bytes -= it->data.size();
+    geom_cache_map.erase(it->key);
+    geom_cache.erase(it);
+}
+
+/*
+ * Drop least recently used entries until the cache fits the budget
+ */
+static void
+geom_cache_trim(size_t budget)
+{
+    while (geom_cache_bytes > budget && !geom_cache.empty())
+    {
+        geom_cache_erase(std::prev(geom_cache.end()));
+    }
+}
+
+/*
+ * Return a palloc'd copy of the cached geometry of a relation, or 0
+ */
+extern "C" Datum
+geodesk_geom_cache_lookup(GeodeskConnectionHandle handle, int64_t relation_id)
+{
+    if (!handle || geodesk_geometry_cache_size <= 0) return (Datum) 0;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    if (!conn->store_entry) return (Datum) 0;
+
+    try
+    {
+        geom_cache_trim(geom_cache_budget());
+
+        GeomCacheKey key{conn->store_entry->path, relation_id, conn->srid,
+                         conn->simplify_tolerance};
+        auto found = geom_cache_map.find(key);
+        if (found == geom_cache_map.end())
+        {
+            geom_cache_misses++;
+            return (Datum) 0;
+        }
+
+        auto it = found->second;
+        if (!entry_matches_store(*it, *conn->store_entry))
+        {
+            // Built from an earlier version of the file
+            geom_cache_erase(it);
+            geom_cache_misses++;
+            return (Datum) 0;
+        }
+
+        geom_cache.splice(geom_cache.begin(), geom_cache, it);
+        geom_cache_hits++;
+
+        void* copy = palloc(it->data.size());
+        memcpy(copy, it->data.data(), it->data.size());
+        return PointerGetDatum(copy);
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Error reading geometry cache: %s", e.what())));
+        return (Datum) 0;
+    }
+}
+
+/*
+ * Add the geometry of a relation to the cache
+ *
+ * Geometries larger than the whole budget are not cached.
+ */
+extern "C" void
+geodesk_geom_cache_store(GeodeskConnectionHandle handle, int64_t relation_id,
+                         const void* gserialized)
+{
+    if (!handle || !gserialized || geodesk_geometry_cache_size <= 0) return;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    if (!conn->store_entry) return;
+
+    size_t len = VARSIZE(gserialized);
+    size_t budget = geom_cache_budget();
+    if (len > budget) return;
+
+    try
+    {
+        GeomCacheKey key{conn->store_entry->path, relation_id, conn->srid,
+                         conn->simplify_tolerance};
+        auto found = geom_cache_map.find(key);
+        if (found != geom_cache_map.end()) geom_cache_erase(found->second);
+
+        const GeodeskStoreEntry& store = *conn->store_entry;
+        const uint8_t* bytes = static_cast<const uint8_t*>(gserialized);
+        geom_cache.push_front(GeomCacheEntry{key, std::vector<uint8_t>(bytes, bytes + len),
+                                             store.device, store.inode, store.size,
+                                             store.mtime});
+        try
+        {
+            geom_cache_map.emplace(std::move(key), geom_cache.begin());
+        }
+        catch (...)
+        {
+            geom_cache.pop_front();
+            throw;
+        }
+        geom_cache_bytes += len;
+
+        geom_cache_trim(budget);
+    }
+    catch (const std::exception& e)
+    {
+        // Out of memory or similar - the cache stays consistent, just smaller
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Could not cache geometry of relation %ld: %s",
+                        static_cast<long>(relation_id), e.what())));
+    }
+}
+
+/*
+ * Report the size and hit rate of the cache
+ */
+extern "C" void
+geodesk_geom_cache_get_stats(GeodeskGeomCacheStats* stats)
+{
+    stats->entries = static_cast<int64_t>(geom_cache.size());
+    stats->bytes = static_cast<int64_t>(geom_cache_bytes);
+    stats->hits = geom_cache_hits;
+    stats->misses = geom_cache_misses;
+}
@@ -0,0 +1,322 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_gserialized.cpp
+ *      Direct GSERIALIZED writer for node and way geometries
+ *
+ * Points, linestrings and polygons of nodes and ways are written straight
+ * into a single palloc'd GSERIALIZED (version 2) varlena, converting the
+ * coordinates to the connection's output SRID once, instead of going
+ * through a POINTARRAY and LWGEOM that gserialized_from_lwgeom then copies
+ * again. Relations, which need ring assembly, still use the LWGEOM builder.
+ * Envelopes for bbox columns are written from the bounds every feature
+ * keeps, without decoding any coordinates.
+ *
+ * Layout (all geometries here are 2D):
+ *
+ *      varlena header      4 bytes
+ *      srid                3 bytes
+ *      flags               1 byte
+ *      bbox                4 floats (xmin, xmax, ymin, ymax), if any
+ *      type                uint32
+ *      npoints / nrings    uint32
+ *      ring sizes          uint32 per ring, padded to 8 bytes (polygons)
+ *      coordinates         2 doubles per point
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <vector>
+
+#include <geodesk/geodesk.h>
+#include <geodesk/feature/WayCoordinateIterator.h>
+#include <geodesk/feature/types.h>  // For FeatureFlags
+
+extern "C" {
+#include "postgres.h"
+#include "liblwgeom.h"
+#include "geodesk_fdw.h"
+}
+
+using namespace geodesk;
+
+// Include shared connection structure
+#include "geodesk_connection_internal.h"
+
+// GSERIALIZED version 2 flags
+static constexpr uint8_t G2FLAG_BBOX = 0x04;
+static constexpr uint8_t G2FLAG_VER_0 = 0x40;
+
+// Imp coordinates of the way being written, converted in one batch
+static std::vector<Coordinate> wayCoords;
+
+/*
+ * Round a double to the nearest float that doesn't exceed it, or isn't
+ * below it, so the float bbox always contains the geometry
+ */
+static inline float
+float_down(double d)
+{
+    float f = static_cast<float>(d);
+    return (f > d) ? std::nextafter(f, -HUGE_VALF) : f;
+}
+
+static inline float
+float_up(double d)
+{
+    float f = static_cast<float>(d);
+    return (f < d) ? std::nextafter(f, HUGE_VALF) : f;
+}
+
+/*
+ * Allocate a GSERIALIZED and fill in its varlena header, SRID and flags
+ */
+static uint8_t*
+alloc_gserialized(size_t size, int32_t srid, bool has_bbox)
+{
+    uint8_t* buf = static_cast<uint8_t*>(palloc(size));
+
+    SET_VARSIZE(buf, size);
+    buf[4] = static_cast<uint8_t>((srid >> 16) & 0x1F);
+    buf[5] = static_cast<uint8_t>((srid >> 8) & 0xFF);
+    buf[6] = static_cast<uint8_t>(srid & 0xFF);
+    buf[7] = G2FLAG_VER_0 | (has_bbox ? G2FLAG_BBOX : 0);
+    return buf;
+}
+
+static inline void
+put_uint32(uint8_t*& p, uint32_t value)
+{
+    memcpy(p, &value, sizeof(value));
+    p += sizeof(value);
+}
+
+/*
+ * Write a point
+ *
+ * PostGIS never stores a bbox for points, so neither do we.
+ */
+static Datum
+write_point(NodePtr node, int32_t srid)
+{
+    size_t size = 8 + 8 + 2 * sizeof(double);
+    uint8_t* buf = alloc_gserialized(size, srid, false);
+    uint8_t* p = buf + 8;
+    double xy[2];
+
+    geodesk_project_point(srid, node.x(), node.y(), xy);
+
+    put_uint32(p, POINTTYPE);
+    put_uint32(p, 1);
+    memcpy(p, xy, sizeof(xy));
+    return PointerGetDatum(buf);
+}
+
+/*
+ * Write a way as a linestring, or as a single-ring polygon if it's an area
+ *
+ * The coordinates are decoded first, decimated to the tolerance (in imp
+ * units, 0 for none), then converted in one batch, and the bbox filled in
+ * from their extent.
+ */
+static Datum
+write_way(WayPtr way, int32_t srid, double tolerance)
+{
+    WayCoordinateIterator iter;
+    int areaFlag = way.flags() & FeatureFlags::AREA;
+    iter.start(way, areaFlag);
+    int count = iter.storedCoordinatesRemaining() + (areaFlag ? 1 : 0);
+
+    if (count <= 0) return (Datum) 0;
+
+    wayCoords.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        wayCoords[i] = iter.next();
+    }
+    count = static_cast<int>(geodesk_decimate_coords(reinterpret_cast<int32_t*>(wayCoords.data()),
+                                                     count, tolerance, areaFlag ? 4 : 2));
+
+    // Polygons have a ring count and one ring size, padded to 8 bytes
+    size_t header = 8 + 16 + 8 + (areaFlag ? 8 : 0);
+    size_t size = header + static_cast<size_t>(count) * 2 * sizeof(double);
+    uint8_t* buf = alloc_gserialized(size, srid, true);
+    uint8_t* p = buf + 8 + 16;
+
+    if (areaFlag)
+    {
+        put_uint32(p, POLYGONTYPE);
+        put_uint32(p, 1);
+        put_uint32(p, static_cast<uint32_t>(count));
+        put_uint32(p, 0);
+    }
+    else
+    {
+        put_uint32(p, LINETYPE);
+        put_uint32(p, static_cast<uint32_t>(count));
+    }
+
+    // The coordinate area is 8-byte aligned within the palloc'd buffer
+    double* coords = reinterpret_cast<double*>(p);
+    int32_t min_x = INT32_MAX, min_y = INT32_MAX;
+    int32_t max_x = INT32_MIN, max_y = INT32_MIN;
+
+    for (int i = 0; i < count; i++)
+    {
+        Coordinate c = wayCoords[i];
+        min_x = std::min(min_x, c.x);
+        min_y = std::min(min_y, c.y);
+        max_x = std::max(max_x, c.x);
+        max_y = std::max(max_y, c.y);
+    }
+    geodesk_project_coords(srid, reinterpret_cast<const int32_t*>(wayCoords.data()),
+                           count, coords);
+
+    // Both conversions are monotonic, so the extent converts corner by corner
+    double lo[2], hi[2];
+    geodesk_project_point(srid, min_x, min_y, lo);
+    geodesk_project_point(srid, max_x, max_y, hi);
+    float bbox[4] = {
+        float_down(lo[0]), float_up(hi[0]),
+        float_down(lo[1]), float_up(hi[1])
+    };
+    memcpy(buf + 8, bbox, sizeof(bbox));
+
+    return PointerGetDatum(buf);
+}
+
+/*
+ * Build the GSERIALIZED geometry of a node or way
+ *
+ * Returns 0 for relations, which the caller builds as LWGEOM, for ways
+ * smaller than the simplification tolerance, and on failure.
+ */
+extern "C" Datum
+geodesk_build_gserialized(GeodeskConnectionHandle handle, GeodeskFeature* feature)
+{
+    if (!handle || !feature) return (Datum) 0;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    if (!conn->current_feature) return (Datum) 0;
+
+    try
+    {
+        Feature f = *conn->current_feature;
+
+        switch (f.type())
+        {
+        case FeatureType::NODE:
+            return write_point(NodePtr(f.ptr()), conn->srid);
+        case FeatureType::WAY:
+            if (geodesk_is_sub_pixel(conn, f.bounds())) return (Datum) 0;
+            return write_way(WayPtr(f.ptr()), conn->srid, conn->simplify_tolerance);
+        default:
+            return (Datum) 0;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Error building geometry: %s", e.what())));
+        return (Datum) 0;
+    }
+}
+
+/*
+ * Convert the stored bounds of the current feature to the output SRID, as
+ * min_x, min_y, max_x, max_y; both conversions are monotonic
+ */
+static void
+project_bounds(GeodeskConnection* conn, double* bounds)
+{
+    Box b = conn->current_feature->bounds();
+
+    geodesk_project_point(conn->srid, b.minX(), b.minY(), bounds);
+    geodesk_project_point(conn->srid, b.maxX(), b.maxY(), bounds + 2);
+}
+
+/*
+ * Get the stored bounds of the current feature, in the output SRID
+ *
+ * bounds receives min_x, min_y, max_x, max_y. Returns false on failure.
+ */
+extern "C" bool
+geodesk_get_feature_bounds(GeodeskConnectionHandle handle, GeodeskFeature* feature,
+                           double* bounds)
+{
+    if (!handle || !feature || !bounds) return false;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    if (!conn->current_feature) return false;
+
+    try
+    {
+        project_bounds(conn, bounds);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Error reading feature bounds: %s", e.what())));
+        return false;
+    }
+}
+
+/*
+ * Build the envelope of the current feature from its stored bounds
+ *
+ * Like ST_Envelope, this is a point for nodes and a polygon otherwise,
+ * with its corners in the order ST_Envelope gives them.
+ */
+extern "C" Datum
+geodesk_build_bbox_gserialized(GeodeskConnectionHandle handle, GeodeskFeature* feature)
+{
+    if (!handle || !feature) return (Datum) 0;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    if (!conn->current_feature) return (Datum) 0;
+
+    try
+    {
+        double b[4];
+
+        if (conn->current_feature->isNode())
+            return write_point(NodePtr(conn->current_feature->ptr()), conn->srid);
+
+        project_bounds(conn, b);
+
+        // Ring count and one ring size, padded to 8 bytes, then 5 points
+        size_t size = 8 + 16 + 8 + 8 + 5 * 2 * sizeof(double);
+        uint8_t* buf = alloc_gserialized(size, conn->srid, true);
+        uint8_t* p = buf + 8;
+        float bbox[4] = {
+            float_down(b[0]), float_up(b[2]),
+            float_down(b[1]), float_up(b[3])
+        };
+        double ring[10] = {
+            b[0], b[1],  b[0], b[3],  b[2], b[3],  b[2], b[1],  b[0], b[1]
+        };
+
+        memcpy(p, bbox, sizeof(bbox));
+        p += sizeof(bbox);
+        put_uint32(p, POLYGONTYPE);
+        put_uint32(p, 1);
+        put_uint32(p, 5);
+        put_uint32(p, 0);
+        memcpy(p, ring, sizeof(ring));
+        return PointerGetDatum(buf);
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Error building feature bounds: %s", e.what())));
+        return (Datum) 0;
+    }
+}
@@ -0,0 +1,135 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_id_index.cpp
+ *      In-memory (type, id) index for fid lookups
+ *
+ * GOL files are organized spatially and have no index by OSM id, so a
+ * lookup by fid would have to scan the whole file. The first scan on a
+ * store that filters by fid therefore walks the store once and builds a
+ * sorted array of (id, type) keys and feature pointers, which is kept with
+ * the cached store and answers later lookups by binary search.
+ *
+ * The walk is done a slice of features at a time, between which the
+ * backend handles interrupts. A build that is cancelled resumes with the
+ * next lookup.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <geodesk/geodesk.h>
+
+extern "C" {
+#include "postgres.h"
+#include "geodesk_fdw.h"
+}
+
+using namespace geodesk;
+
+// Include shared connection structure
+#include "geodesk_connection_internal.h"
+
+/*
+ * Add up to max_features features to the ID index of a store being built
+ *
+ * Returns true once the index is complete. Throws on failure.
+ */
+bool
+geodesk_id_index_build(GeodeskStoreEntry* entry, int64_t max_features)
+{
+    if (entry->id_index) return true;
+
+    if (!entry->id_index_build)
+        entry->id_index_build = std::make_unique<GeodeskIdIndexBuild>(*entry->features);
+
+    GeodeskIdIndexBuild* build = entry->id_index_build.get();
+    auto& entries = build->index->entries;
+
+    for (int64_t n = 0; n < max_features; n++)
+    {
+        if (build->iter == nullptr)
+        {
+            std::sort(entries.begin(), entries.end(),
+                      [](const auto& a, const auto& b) { return a.first < b.first; });
+            entries.shrink_to_fit();
+
+            ereport(DEBUG1,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Built ID index for '%s': %zu features",
+                            entry->path.c_str(), entries.size())));
+
+            entry->id_index = std::move(build->index);
+            entry->id_index_build.reset();
+            return true;
+        }
+
+        Feature f = *build->iter;
+        ++build->iter;
+        entries.emplace_back(geodesk_id_key(f.id(), static_cast<int>(f.type())),
+                             f.ptr().ptr().ptr());
+    }
+    return false;
+}
+
+/*
+ * Get the ID index of a store, building the rest of it if needed
+ *
+ * Throws on failure; callers translate exceptions into PostgreSQL errors.
+ */
+const GeodeskIdIndex&
+geodesk_id_index_get(GeodeskStoreEntry* entry)
+{
+    while (!geodesk_id_index_build(entry, INT64_MAX))
+        ;
+    return *entry->id_index;
+}
+
+/*
+ * Look up the feature with the given id and type, or nullptr
+ */
+uint8_t*
+geodesk_id_index_find(const GeodeskIdIndex& index, int64_t id, int type)
+{
+    uint64_t key = geodesk_id_key(id, type);
+    auto it = std::lower_bound(index.entries.begin(), index.entries.end(), key,
+                               [](const auto& entry, uint64_t k) { return entry.first < k; });
+    if (it == index.entries.end() || it->first != key) return nullptr;
+    return it->second;
+}
+
+extern "C" {
+
+/*
+ * Build the ID index of a connection's store by up to max_features more
+ * features, for a scan about to look up fids
+ *
+ * Returns true once the index is ready, or if it can't be built; the
+ * lookup then reports the error.
+ */
+__attribute__((visibility("default")))
+bool
+geodesk_build_id_index(GeodeskConnectionHandle handle, int64_t max_features)
+{
+    if (!handle) return true;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+
+    try
+    {
+        return geodesk_id_index_build(conn->store_entry.get(), max_features);
+    }
+    catch (const std::exception& e)
+    {
+        conn->store_entry->id_index_build.reset();
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to build ID index: %s", e.what())));
+        return true;
+    }
+}
+
+} // extern "C"
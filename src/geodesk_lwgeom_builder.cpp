@@ -7,6 +7,8 @@
  *-------------------------------------------------------------------------
  */
 
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <vector>
 #include <geodesk/geodesk.h>
@@ -28,7 +30,145 @@ using namespace geodesk;
 #include "geodesk_connection_internal.h"
 
 // Ring assembly function
-std::vector<POINTARRAY*> geodesk_assemble_rings(const std::vector<WayPtr>& ways);
+std::vector<POINTARRAY*> geodesk_assemble_rings(const std::vector<WayPtr>& ways, int32_t srid,
+                                                double tolerance,
+                                                std::vector<GBOX>* bounds);
+
+// Vertices of a ring tested to decide whether it lies inside another ring
+static constexpr uint32_t NESTING_SAMPLE_POINTS = 4;
+
+/*
+ * Check if a point is inside a ring (ray casting algorithm)
+ */
+static bool
+point_in_ring(double x, double y, const POINTARRAY* ring)
+{
+    uint32_t n = ring->npoints;
+    if (n < 3) return false;
+    
+    int crossings = 0;
+    const POINT2D* p1 = getPoint2d_cp(ring, 0);
+    
+    for (uint32_t i = 1; i <= n; i++)
+    {
+        const POINT2D* p2 = getPoint2d_cp(ring, i % n);
+        
+        // Check if ray from point to +infinity crosses this edge
+        if (((p1->y <= y && y < p2->y) || (p2->y <= y && y < p1->y)) &&
+            x < (p2->x - p1->x) * (y - p1->y) / (p2->y - p1->y) + p1->x)
+        {
+            crossings++;
+        }
+        p1 = p2;
+    }
+    return (crossings % 2) == 1;
+}
+
+static inline bool
+box_contains_point(const GBOX& b, double x, double y)
+{
+    return x >= b.xmin && x <= b.xmax && y >= b.ymin && y <= b.ymax;
+}
+
+static inline bool
+box_contains_box(const GBOX& outer, const GBOX& inner)
+{
+    return inner.xmin >= outer.xmin && inner.xmax <= outer.xmax &&
+           inner.ymin >= outer.ymin && inner.ymax <= outer.ymax;
+}
+
+/*
+ * Unsigned area of a ring (shoelace formula)
+ */
+static double
+ring_area(const POINTARRAY* ring)
+{
+    double area = 0;
+    for (uint32_t i = 0; i + 1 < ring->npoints; i++)
+    {
+        const POINT2D* a = getPoint2d_cp(ring, i);
+        const POINT2D* b = getPoint2d_cp(ring, i + 1);
+        area += a->x * b->y - b->x * a->y;
+    }
+    return std::fabs(area) / 2;
+}
+
+/*
+ * Rings with their bounds, indexed for point queries
+ *
+ * Rings are sorted by xmin, along with the running maximum of xmax, so a
+ * query walks back from the last ring starting left of the point and
+ * stops as soon as no earlier ring reaches it. Ray casting only runs on
+ * bbox hits.
+ */
+struct RingIndex
+{
+    const std::vector<POINTARRAY*>& rings;
+    const std::vector<GBOX>& bounds;
+    std::vector<double> areas;
+    std::vector<size_t> order;
+    std::vector<double> max_xmax;
+
+    RingIndex(const std::vector<POINTARRAY*>& r, const std::vector<GBOX>& b) :
+        rings(r), bounds(b), areas(r.size()), order(r.size()), max_xmax(r.size())
+    {
+        for (size_t i = 0; i < rings.size(); i++)
+        {
+            areas[i] = ring_area(rings[i]);
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(),
+                  [&](size_t a, size_t b) { return bounds[a].xmin < bounds[b].xmin; });
+        for (size_t k = 0; k < order.size(); k++)
+        {
+            max_xmax[k] = bounds[order[k]].xmax;
+            if (k > 0) max_xmax[k] = std::max(max_xmax[k], max_xmax[k - 1]);
+        }
+    }
+
+    /*
+     * Smallest ring (other than exclude) whose bbox contains the point and
+     * that accepts the point, or -1
+     */
+    template <typename Accept>
+    long innermost(double x, double y, long exclude, Accept accept) const
+    {
+        long best = -1;
+        size_t k = std::upper_bound(order.begin(), order.end(), x,
+                                    [&](double v, size_t i) { return v < bounds[i].xmin; }) -
+                   order.begin();
+        
+        while (k-- > 0)
+        {
+            if (max_xmax[k] < x) break;
+            long r = static_cast<long>(order[k]);
+            if (r == exclude || !box_contains_point(bounds[r], x, y)) continue;
+            if (best >= 0 && areas[r] >= areas[best]) continue;
+            if (accept(r)) best = r;
+        }
+        return best;
+    }
+};
+
+/*
+ * Check whether a ring lies inside another, testing a few of its vertices
+ *
+ * Rings that merely touch share vertices along the boundary, where the
+ * ray casting result is arbitrary, so one vertex isn't enough.
+ */
+static bool
+ring_in_ring(const POINTARRAY* inner, const POINTARRAY* outer)
+{
+    uint32_t n = inner->npoints > 1 ? inner->npoints - 1 : inner->npoints;
+    uint32_t samples = std::min(n, NESTING_SAMPLE_POINTS);
+    
+    for (uint32_t i = 0; i < samples; i++)
+    {
+        const POINT2D* p = getPoint2d_cp(inner, i * n / samples);
+        if (!point_in_ring(p->x, p->y, outer)) return false;
+    }
+    return samples > 0;
+}
 
 /*
  * Build LWGEOM from a GeoDesk feature
@@ -55,63 +195,59 @@ geodesk_build_lwgeom(GeodeskConnectionHandle handle, GeodeskFeature* feature)
         {
             // Build LWPOINT
             NodePtr node(f.ptr());
-            // Convert GeoDesk coordinates (int32 "imp" units) to Web Mercator meters
-            // GeoDesk uses full int32 range, Web Mercator uses meters at equator
-            // Conversion factor: EARTH_CIRCUMFERENCE / MAP_WIDTH
-            constexpr double IMP_TO_METERS = 40075016.68558 / 4294967294.9999;
-            double x = node.x() * IMP_TO_METERS;
-            double y = node.y() * IMP_TO_METERS;
+            double xy[2];
+            geodesk_project_point(conn->srid, node.x(), node.y(), xy);
             
             // Create POINTARRAY with one point
             POINTARRAY* pa = ptarray_construct(0, 0, 1);  // no Z, no M, 1 point
             if (!pa) return nullptr;
             
             POINT4D pt;
-            pt.x = x;
-            pt.y = y;
+            pt.x = xy[0];
+            pt.y = xy[1];
             ptarray_set_point4d(pa, 0, &pt);
             
             // Create LWPOINT
-            LWPOINT* point = lwpoint_construct(3857, NULL, pa);
+            LWPOINT* point = lwpoint_construct(conn->srid, NULL, pa);
             return lwpoint_as_lwgeom(point);
         }
         else if (ftype == FeatureType::WAY)
         {
             WayPtr way(f.ptr());
+            if (geodesk_is_sub_pixel(conn, f.bounds())) return nullptr;
+            
             WayCoordinateIterator iter;
             int areaFlag = way.flags() & FeatureFlags::AREA;
             iter.start(way, areaFlag);
             int count = iter.storedCoordinatesRemaining() + (areaFlag ? 1 : 0);
             
-            // Create POINTARRAY
-            POINTARRAY* pa = ptarray_construct(0, 0, count);  // no Z, no M
-            if (!pa) return nullptr;
-            
-            // Conversion factor from GeoDesk "imp" units to Web Mercator meters
-            constexpr double IMP_TO_METERS = 40075016.68558 / 4294967294.9999;
-            
-            // Fill coordinates
+            // Decode and decimate, then convert into the POINTARRAY
+            std::vector<Coordinate> coords(count);
             for (int i = 0; i < count; i++)
             {
-                Coordinate c = iter.next();
-                POINT4D pt;
-                pt.x = c.x * IMP_TO_METERS;
-                pt.y = c.y * IMP_TO_METERS;
-                ptarray_set_point4d(pa, i, &pt);
+                coords[i] = iter.next();
             }
+            count = static_cast<int>(geodesk_decimate_coords(reinterpret_cast<int32_t*>(coords.data()),
+                                                             count, conn->simplify_tolerance,
+                                                             areaFlag ? 4 : 2));
+            
+            POINTARRAY* pa = ptarray_construct(0, 0, count);  // no Z, no M
+            if (!pa) return nullptr;
+            geodesk_project_coords(conn->srid, reinterpret_cast<const int32_t*>(coords.data()),
+                                   count, reinterpret_cast<double*>(pa->serialized_pointlist));
             
             if (areaFlag)
             {
                 // Build LWPOLY
                 POINTARRAY** rings = (POINTARRAY**)lwalloc(sizeof(POINTARRAY*));
                 rings[0] = pa;
-                LWPOLY* poly = lwpoly_construct(3857, NULL, 1, rings);
+                LWPOLY* poly = lwpoly_construct(conn->srid, NULL, 1, rings);
                 return lwpoly_as_lwgeom(poly);
             }
             else
             {
                 // Build LWLINE
-                LWLINE* line = lwline_construct(3857, NULL, pa);
+                LWLINE* line = lwline_construct(conn->srid, NULL, pa);
                 return lwline_as_lwgeom(line);
             }
         }
@@ -120,6 +256,9 @@ geodesk_build_lwgeom(GeodeskConnectionHandle handle, GeodeskFeature* feature)
             // Build LWGEOM for relations (multipolygons, routes, etc.)
             geodesk::RelationPtr rel(f.ptr());
             
+            // Too small to show at the simplification tolerance
+            if (geodesk_is_sub_pixel(conn, f.bounds())) return nullptr;
+            
             // Check if it's an area relation (multipolygon)
             if (rel.isArea())
             {
@@ -171,35 +310,14 @@ geodesk_build_lwgeom(GeodeskConnectionHandle handle, GeodeskFeature* feature)
                     }
                 }
                 
-                // Handle multipolygon assembly with ring assembly
-                
-                // Helper lambda to check if a point is inside a ring (ray casting algorithm)
-                auto isPointInRing = [](double x, double y, POINTARRAY* ring) -> bool {
-                    int n = ring->npoints;
-                    if (n < 3) return false;
-                    
-                    int crossings = 0;
-                    POINT4D p1, p2;
-                    getPoint4d_p(ring, 0, &p1);
-                    
-                    for (int i = 1; i <= n; i++)
-                    {
-                        getPoint4d_p(ring, i % n, &p2);
-                        
-                        // Check if ray from point to +infinity crosses this edge
-                        if (((p1.y <= y && y < p2.y) || (p2.y <= y && y < p1.y)) &&
-                            x < (p2.x - p1.x) * (y - p1.y) / (p2.y - p1.y) + p1.x)
-                        {
-                            crossings++;
-                        }
-                        p1 = p2;
-                    }
-                    return (crossings % 2) == 1;
-                };
-                
                 // Use ring assembly to connect ways into complete rings
-                std::vector<POINTARRAY*> outerRings = geodesk_assemble_rings(outerWays);
-                std::vector<POINTARRAY*> innerRings = geodesk_assemble_rings(innerWays);
+                conn->ways_assembled += outerWays.size() + innerWays.size();
+                std::vector<GBOX> outerBounds;
+                std::vector<GBOX> innerBounds;
+                std::vector<POINTARRAY*> outerRings = geodesk_assemble_rings(outerWays, conn->srid,
+                                                                             conn->simplify_tolerance, &outerBounds);
+                std::vector<POINTARRAY*> innerRings = geodesk_assemble_rings(innerWays, conn->srid,
+                                                                             conn->simplify_tolerance, &innerBounds);
                 
                 if (outerRings.empty())
                 {
@@ -207,36 +325,31 @@ geodesk_build_lwgeom(GeodeskConnectionHandle handle, GeodeskFeature* feature)
                     return nullptr;
                 }
                 
-                // Now assign inner rings to outer rings
-                std::vector<std::vector<POINTARRAY*>> polygonRings(outerRings.size());
+                RingIndex outerIndex(outerRings, outerBounds);
+                
+                // Find the innermost outer ring each outer ring is nested in
+                std::vector<long> parent(outerRings.size(), -1);
                 for (size_t i = 0; i < outerRings.size(); i++)
                 {
-                    polygonRings[i].push_back(outerRings[i]);
+                    const POINT2D* p = getPoint2d_cp(outerRings[i], 0);
+                    parent[i] = outerIndex.innermost(p->x, p->y, static_cast<long>(i),
+                        [&](long r) {
+                            return box_contains_box(outerBounds[r], outerBounds[i]) &&
+                                   ring_in_ring(outerRings[i], outerRings[r]);
+                        });
                 }
                 
-                // For each inner ring, find which outer ring contains it
+                // Each inner ring belongs to the innermost outer ring containing it
+                std::vector<long> owner(innerRings.size(), -1);
                 for (size_t innerIdx = 0; innerIdx < innerRings.size(); innerIdx++)
                 {
-                    POINTARRAY* inner = innerRings[innerIdx];
-                    
                     // Use first point of inner ring for point-in-polygon test
-                    POINT4D testPt;
-                    getPoint4d_p(inner, 0, &testPt);
-                    
-                    // Find containing outer ring
-                    bool assigned = false;
-                    for (size_t i = 0; i < outerRings.size(); i++)
-                    {
-                        if (isPointInRing(testPt.x, testPt.y, outerRings[i]))
-                        {
-                            polygonRings[i].push_back(inner);
-                            assigned = true;
-                            break; // Inner ring can only belong to one outer
-                        }
-                    }
+                    const POINT2D* p = getPoint2d_cp(innerRings[innerIdx], 0);
+                    owner[innerIdx] = outerIndex.innermost(p->x, p->y, -1,
+                        [&](long r) { return point_in_ring(p->x, p->y, outerRings[r]); });
                     
                     // Warn if inner ring couldn't be assigned to any outer ring
-                    if (!assigned)
+                    if (owner[innerIdx] < 0)
                     {
                         ereport(WARNING,
                                 (errcode(ERRCODE_FDW_ERROR),
@@ -245,6 +358,60 @@ geodesk_build_lwgeom(GeodeskConnectionHandle handle, GeodeskFeature* feature)
                     }
                 }
                 
+                /*
+                 * A nested outer ring is an island if it lies in a hole of
+                 * its parent. Otherwise it overlaps the parent's area, and
+                 * is taken as a hole of it (missing or wrong role); larger
+                 * rings are resolved first, so islands of demoted rings
+                 * stay islands.
+                 */
+                std::vector<size_t> bySize(outerRings.size());
+                for (size_t i = 0; i < bySize.size(); i++) bySize[i] = i;
+                std::sort(bySize.begin(), bySize.end(),
+                          [&](size_t a, size_t b) { return outerIndex.areas[a] > outerIndex.areas[b]; });
+                
+                std::vector<bool> demoted(outerRings.size(), false);
+                for (size_t i : bySize)
+                {
+                    long a = parent[i];
+                    if (a < 0 || demoted[a]) continue;
+                    
+                    const POINT2D* p = getPoint2d_cp(outerRings[i], 0);
+                    bool inHole = false;
+                    for (size_t h = 0; h < innerRings.size() && !inHole; h++)
+                    {
+                        inHole = owner[h] == a && box_contains_point(innerBounds[h], p->x, p->y) &&
+                                 point_in_ring(p->x, p->y, innerRings[h]);
+                    }
+                    if (!inHole) demoted[i] = true;
+                }
+                
+                // Assemble each remaining outer ring with its holes
+                std::vector<std::vector<POINTARRAY*>> polygonRings(outerRings.size());
+                for (size_t i = 0; i < outerRings.size(); i++)
+                {
+                    if (!demoted[i]) polygonRings[i].push_back(outerRings[i]);
+                }
+                for (size_t innerIdx = 0; innerIdx < innerRings.size(); innerIdx++)
+                {
+                    long o = owner[innerIdx];
+                    if (o < 0)
+                    {
+                        ptarray_free(innerRings[innerIdx]);
+                        continue;
+                    }
+                    
+                    // Holes of a demoted ring are islands in the hole it became
+                    if (demoted[o])
+                        polygonRings.push_back({innerRings[innerIdx]});
+                    else
+                        polygonRings[o].push_back(innerRings[innerIdx]);
+                }
+                for (size_t i = 0; i < outerRings.size(); i++)
+                {
+                    if (demoted[i]) polygonRings[parent[i]].push_back(outerRings[i]);
+                }
+                
                 // Create polygons with their holes
                 for (const auto& rings : polygonRings)
                 {
@@ -256,7 +423,7 @@ geodesk_build_lwgeom(GeodeskConnectionHandle handle, GeodeskFeature* feature)
                         ringArray[i] = rings[i];
                     }
                     
-                    LWPOLY* poly = lwpoly_construct(3857, NULL, rings.size(), ringArray);
+                    LWPOLY* poly = lwpoly_construct(conn->srid, NULL, rings.size(), ringArray);
                     if (poly)
                     {
                         polygons.push_back(poly);
@@ -271,7 +438,7 @@ geodesk_build_lwgeom(GeodeskConnectionHandle handle, GeodeskFeature* feature)
                     {
                         geoms[i] = lwpoly_as_lwgeom(polygons[i]);
                     }
-                    LWCOLLECTION* coll = lwcollection_construct(MULTIPOLYGONTYPE, 3857, 
+                    LWCOLLECTION* coll = lwcollection_construct(MULTIPOLYGONTYPE, conn->srid, 
                                                                NULL, polygons.size(), geoms);
                     return (void*)coll;
                 }
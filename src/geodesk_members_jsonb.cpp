@@ -3,6 +3,11 @@
  * geodesk_members_jsonb.cpp
  *      Direct JSONB construction for OSM relation members (optimized)
  *
+ * Members are collected in a single pass, with their roles interned on
+ * the connection, and then written either as a JSONB array of
+ * {"id", "role", "type"} objects or as parallel arrays for the
+ * member_ids, member_types and member_roles columns.
+ *
  *-------------------------------------------------------------------------
  */
 
@@ -10,6 +15,7 @@
 #include <string>
 #include <exception>
 #include <cstring>
+#include <unordered_map>
 
 // Include libgeodesk BEFORE PostgreSQL headers to avoid macro conflicts
 // Temporarily rename conflicting types
@@ -29,188 +35,203 @@ extern "C" {
 #include "postgres.h"
 #include "utils/jsonb.h"
 #include "utils/builtins.h"
+#include "utils/numeric.h"
 #include "geodesk_fdw.h"
 }
 
+// Distinct roles kept interned per connection
+static constexpr size_t MAX_INTERNED_ROLES = 4096;
+
+/*
+ * Collect the members of the current feature into conn->members
+ *
+ * Returns false if the feature is not a relation or has no members.
+ */
+static bool
+collect_members(GeodeskConnection* conn, GeodeskFeature* feature)
+{
+    geodesk::Feature f = *conn->current_feature;
+
+    /* Only relations have members */
+    if (!f.isRelation()) return false;
+
+    /* Interned roles are only referenced by the previous relation's members */
+    conn->members.clear();
+    if (conn->member_roles.size() > MAX_INTERNED_ROLES) conn->member_roles.clear();
+
+    for (geodesk::Feature member : f.members())
+    {
+        char type;
+        if (member.isNode()) type = 'n';
+        else if (member.isWay()) type = 'w';
+        else type = 'r';
+
+        std::string role;
+        try
+        {
+            role = member.role();
+        }
+        catch (const std::exception& e)
+        {
+            ereport(DEBUG1,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Failed to get role for member in relation %ld: %s",
+                            feature->id, e.what())));
+        }
+
+        const std::string* interned = &*conn->member_roles.insert(std::move(role)).first;
+        conn->members.push_back(GeodeskMember{member.id(), type, interned});
+    }
+
+    return !conn->members.empty();
+}
+
+static inline void
+set_jsonb_string(JsonbValue* v, const char* str, size_t len)
+{
+    v->type = jbvString;
+    v->val.string.val = const_cast<char*>(str);
+    v->val.string.len = len;
+}
+
 extern "C" {
 
 /*
  * Build JSONB directly from relation members without intermediate JSON string
- * This is much more efficient than building a string and parsing it
- * 
- * Returns a JSONB Datum that can be directly stored in a tuple
+ *
+ * The JsonbValue tree is built in place, with each object's keys already
+ * in Jsonb order, so it is serialized once by JsonbValueToJsonb without
+ * going through pushJsonbValue.
+ *
+ * Returns a JSONB Datum that can be directly stored in a tuple, or 0 if
+ * the feature has no members
  */
 __attribute__((visibility("default")))
 Datum
 geodesk_get_members_jsonb_direct(GeodeskConnectionHandle handle, GeodeskFeature* feature)
 {
-    if (!handle || !feature) 
+    if (!handle || !feature)
     {
         /* Return NULL for invalid input */
         return (Datum) 0;
     }
-    
+
     auto conn = reinterpret_cast<GeodeskConnection*>(handle);
-    
+
     /* Return NULL for null feature */
-    if (!conn->current_feature) 
+    if (!conn->current_feature)
     {
         return (Datum) 0;
     }
-    
+
     try
     {
-        geodesk::Feature f = *conn->current_feature;
-        
-        /* Only relations have members */
-        if (!f.isRelation())
+        if (!collect_members(conn, feature)) return (Datum) 0;
+
+        size_t count = conn->members.size();
+        JsonbValue* elems = static_cast<JsonbValue*>(palloc(sizeof(JsonbValue) * count));
+        JsonbPair* pairs = static_cast<JsonbPair*>(palloc(sizeof(JsonbPair) * 3 * count));
+
+        for (size_t i = 0; i < count; i++)
         {
-            /* Return NULL for non-relations */
-            return (Datum) 0;
+            const GeodeskMember& m = conn->members[i];
+            JsonbPair* p = &pairs[i * 3];
+            const char* type_str = (m.type == 'n') ? "node" :
+                                   (m.type == 'w') ? "way" : "relation";
+
+            /* Keys sorted by length, then bytewise: id, role, type */
+            set_jsonb_string(&p[0].key, "id", 2);
+            p[0].value.type = jbvNumeric;
+            p[0].value.val.numeric = int64_to_numeric(m.id);
+            p[0].order = 0;
+
+            set_jsonb_string(&p[1].key, "role", 4);
+            set_jsonb_string(&p[1].value, m.role->data(), m.role->length());
+            p[1].order = 1;
+
+            set_jsonb_string(&p[2].key, "type", 4);
+            set_jsonb_string(&p[2].value, type_str, strlen(type_str));
+            p[2].order = 2;
+
+            elems[i].type = jbvObject;
+            elems[i].val.object.nPairs = 3;
+            elems[i].val.object.pairs = p;
         }
-        
-        /* Check if there are any members first */
-        try 
+
+        JsonbValue array;
+        array.type = jbvArray;
+        array.val.array.nElems = count;
+        array.val.array.elems = elems;
+        array.val.array.rawScalar = false;
+
+        /* Convert to Jsonb datum */
+        return JsonbPGetDatum(JsonbValueToJsonb(&array));
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to build members JSONB: %s", e.what())));
+
+        /* Return NULL on error */
+        return (Datum) 0;
+    }
+}
+
+/*
+ * Get the members of the current relation as parallel arrays of ids,
+ * types ('n', 'w' or 'r') and roles
+ *
+ * Each distinct role is converted to text once. Returns false if the
+ * feature has no members.
+ */
+__attribute__((visibility("default")))
+bool
+geodesk_get_member_arrays(GeodeskConnectionHandle handle, GeodeskFeature* feature,
+                          GeodeskMemberArrays* out)
+{
+    if (!handle || !feature || !out) return false;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    if (!conn->current_feature) return false;
+
+    try
+    {
+        if (!collect_members(conn, feature)) return false;
+
+        size_t count = conn->members.size();
+        std::unordered_map<const std::string*, Datum> role_texts;
+
+        out->count = static_cast<int>(count);
+        out->ids = static_cast<Datum*>(palloc(sizeof(Datum) * count));
+        out->types = static_cast<Datum*>(palloc(sizeof(Datum) * count));
+        out->roles = static_cast<Datum*>(palloc(sizeof(Datum) * count));
+
+        for (size_t i = 0; i < count; i++)
         {
-            geodesk::Features members = f.members();
-            
-            /* Check if there are any members */
-            bool has_members = false;
-            for (geodesk::Feature member : members)
-            {
-                has_members = true;
-                break;
-            }
-            
-            /* If no members, return NULL */
-            if (!has_members)
-            {
-                return (Datum) 0;
-            }
-            
-            /* Build JSONB directly */
-            JsonbParseState *state = NULL;
-            JsonbValue jb_val;
-            
-            /* Start the JSONB array */
-            pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
-            
-            /* Reset iterator and process members */
-            members = f.members();
-            
-            int member_count = 0;
-            const int MAX_MEMBERS = 1000;  /* Safety limit */
-            
-            for (geodesk::Feature member : members)
+            const GeodeskMember& m = conn->members[i];
+
+            out->ids[i] = Int64GetDatum(m.id);
+            out->types[i] = CharGetDatum(m.type);
+
+            auto found = role_texts.find(m.role);
+            if (found == role_texts.end())
             {
-                /* Safety check to prevent infinite loops */
-                if (++member_count > MAX_MEMBERS)
-                {
-                    ereport(WARNING,
-                            (errcode(ERRCODE_FDW_ERROR),
-                             errmsg("Relation %ld has more than %d members, truncating", 
-                                    feature->id, MAX_MEMBERS)));
-                    break;
-                }
-                
-                /* Start member object */
-                pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-                
-                /* Add type field */
-                jb_val.type = jbvString;
-                jb_val.val.string.val = (char*)"type";
-                jb_val.val.string.len = 4;
-                pushJsonbValue(&state, WJB_KEY, &jb_val);
-                
-                const char* type_str;
-                if (member.isNode()) type_str = "node";
-                else if (member.isWay()) type_str = "way";
-                else if (member.isRelation()) type_str = "relation";
-                else type_str = "unknown";
-                
-                jb_val.val.string.val = (char*)type_str;
-                jb_val.val.string.len = strlen(type_str);
-                pushJsonbValue(&state, WJB_VALUE, &jb_val);
-                
-                /* Add id field */
-                jb_val.type = jbvString;
-                jb_val.val.string.val = (char*)"id";
-                jb_val.val.string.len = 2;
-                pushJsonbValue(&state, WJB_KEY, &jb_val);
-                
-                /* Convert ID to string */
-                char id_str[32];
-                snprintf(id_str, sizeof(id_str), "%ld", member.id());
-                
-                /* Allocate string in current memory context */
-                char* id_copy = (char*)palloc(strlen(id_str) + 1);
-                strcpy(id_copy, id_str);
-                
-                jb_val.type = jbvString;
-                jb_val.val.string.val = id_copy;
-                jb_val.val.string.len = strlen(id_str);
-                pushJsonbValue(&state, WJB_VALUE, &jb_val);
-                
-                /* Add role field */
-                jb_val.type = jbvString;
-                jb_val.val.string.val = (char*)"role";
-                jb_val.val.string.len = 4;
-                pushJsonbValue(&state, WJB_KEY, &jb_val);
-                
-                /* Get the role */
-                std::string role_str;
-                try 
-                {
-                    role_str = member.role();
-                }
-                catch (const std::exception& e)
-                {
-                    ereport(DEBUG1,
-                            (errcode(ERRCODE_FDW_ERROR),
-                             errmsg("Failed to get role for member in relation %ld: %s", 
-                                    feature->id, e.what())));
-                    role_str = "";
-                }
-                
-                /* Allocate role string in current memory context */
-                char* role_copy = (char*)palloc(role_str.length() + 1);
-                memcpy(role_copy, role_str.c_str(), role_str.length());
-                role_copy[role_str.length()] = '\0';
-                
-                jb_val.val.string.val = role_copy;
-                jb_val.val.string.len = role_str.length();
-                pushJsonbValue(&state, WJB_VALUE, &jb_val);
-                
-                /* End member object */
-                pushJsonbValue(&state, WJB_END_OBJECT, NULL);
+                Datum text = PointerGetDatum(cstring_to_text_with_len(m.role->data(),
+                                                                      m.role->length()));
+                found = role_texts.emplace(m.role, text).first;
             }
-            
-            /* End the JSONB array */
-            JsonbValue *result = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
-            
-            /* Convert to Jsonb datum */
-            return JsonbPGetDatum(JsonbValueToJsonb(result));
-        }
-        catch (const std::exception& e)
-        {
-            ereport(DEBUG1,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("Failed to get members for relation %ld: %s", 
-                            feature->id, e.what())));
-            
-            /* Return NULL on inner exception */
-            return (Datum) 0;
+            out->roles[i] = found->second;
         }
+        return true;
     }
     catch (const std::exception& e)
     {
         ereport(WARNING,
                 (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("Failed to build members JSONB: %s", e.what())));
-        
-        /* Return NULL on error */
-        return (Datum) 0;
+                 errmsg("Failed to get members of relation %ld: %s", feature->id, e.what())));
+        return false;
     }
 }
 
-} // extern "C"
\ No newline at end of file
+} // extern "C"
@@ -0,0 +1,584 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_mvt.cpp
+ *      Mapbox Vector Tile encoder for GeoDesk features
+ *
+ * A tile is written straight from the connection's bbox view into an MVT
+ * (version 2) protobuf, without building tuples: each feature's
+ * coordinates are transformed to tile space, clipped to the buffered
+ * tile, quantized and delta-encoded in one pass, and its tags are added
+ * to the layer's key and value dictionaries as they are read.
+ *
+ * Ways are decoded directly; relations go through the LWGEOM builder for
+ * their ring assembly. Both are decimated to one tile pixel first, which
+ * also drops features smaller than a pixel.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <geodesk/geodesk.h>
+#include <geodesk/feature/WayCoordinateIterator.h>
+#include <geodesk/feature/types.h>  // For FeatureFlags
+
+extern "C" {
+#include "postgres.h"
+#include "liblwgeom.h"
+#include "geodesk_fdw.h"
+}
+
+using namespace geodesk;
+
+// Include shared connection structure
+#include "geodesk_connection_internal.h"
+
+// MVT geometry types
+static constexpr uint32_t MVT_POINT = 1;
+static constexpr uint32_t MVT_LINESTRING = 2;
+static constexpr uint32_t MVT_POLYGON = 3;
+
+// MVT geometry commands
+static constexpr uint32_t CMD_MOVE_TO = 1;
+static constexpr uint32_t CMD_LINE_TO = 2;
+static constexpr uint32_t CMD_CLOSE_PATH = 7;
+
+// Protobuf wire types
+static constexpr uint32_t WIRE_VARINT = 0;
+static constexpr uint32_t WIRE_LENGTH = 2;
+
+// Width of the map in imp units
+static constexpr double MAP_WIDTH_IMP = 4294967296.0;
+
+struct TilePoint
+{
+    double x;
+    double y;
+};
+
+/*
+ * Writer for the protobuf messages of a tile
+ */
+class ProtoWriter
+{
+public:
+    std::string buf;
+
+    void varint(uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            buf.push_back(static_cast<char>((v & 0x7F) | 0x80));
+            v >>= 7;
+        }
+        buf.push_back(static_cast<char>(v));
+    }
+
+    void key(uint32_t field, uint32_t wire)
+    {
+        varint((field << 3) | wire);
+    }
+
+    void uintField(uint32_t field, uint64_t v)
+    {
+        key(field, WIRE_VARINT);
+        varint(v);
+    }
+
+    void bytesField(uint32_t field, std::string_view data)
+    {
+        key(field, WIRE_LENGTH);
+        varint(data.size());
+        buf.append(data.data(), data.size());
+    }
+
+    void packedField(uint32_t field, const std::vector<uint32_t>& values)
+    {
+        size_t len = 0;
+        for (uint32_t v : values)
+        {
+            do { len++; v >>= 7; } while (v);
+        }
+        key(field, WIRE_LENGTH);
+        varint(len);
+        for (uint32_t v : values) varint(v);
+    }
+};
+
+static inline uint32_t
+zigzag(int32_t v)
+{
+    return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+static inline uint32_t
+command(uint32_t id, uint32_t count)
+{
+    return (id & 0x7) | (count << 3);
+}
+
+/*
+ * State of the tile being encoded
+ */
+struct MvtEncoder
+{
+    // Tile space: px = (x - origin_x) * scale, py = (origin_y - y) * scale,
+    // for x and y in imp units
+    double origin_x;
+    double origin_y;
+    double scale;
+    double clip_min;
+    double clip_max;
+
+    std::unordered_map<std::string, uint32_t> key_index;
+    std::unordered_map<std::string, uint32_t> value_index;
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+
+    // Per-feature buffers, reused
+    std::vector<Coordinate> coords;
+    std::vector<TilePoint> points;
+    std::vector<TilePoint> clipped;
+    std::vector<uint32_t> geometry;
+    std::vector<uint32_t> tags;
+    int32_t cursor_x;
+    int32_t cursor_y;
+
+    ProtoWriter features;
+    int64_t feature_count;
+
+    TilePoint fromImp(int32_t x, int32_t y) const
+    {
+        return { (x - origin_x) * scale, (origin_y - y) * scale };
+    }
+
+    TilePoint fromMeters(double x, double y) const
+    {
+        return { (x * METERS_TO_IMP - origin_x) * scale, (origin_y - y * METERS_TO_IMP) * scale };
+    }
+};
+
+static uint32_t
+intern_string(std::unordered_map<std::string, uint32_t>& index, std::vector<std::string>& list,
+              std::string&& s)
+{
+    auto found = index.find(s);
+    if (found != index.end()) return found->second;
+    uint32_t i = static_cast<uint32_t>(list.size());
+    list.push_back(s);
+    index.emplace(std::move(s), i);
+    return i;
+}
+
+/*
+ * Clip a closed ring (without its closing point) to the clip square,
+ * one edge at a time (Sutherland-Hodgman)
+ *
+ * The result may run along the clip border, which renderers handle; it
+ * is a correct clip of the polygon's area.
+ */
+static void
+clip_ring(const MvtEncoder& enc, std::vector<TilePoint>& ring, std::vector<TilePoint>& tmp)
+{
+    for (int edge = 0; edge < 4 && !ring.empty(); edge++)
+    {
+        bool is_x = (edge & 1) == 0;
+        double bound = (edge < 2) ? enc.clip_min : enc.clip_max;
+        bool keep_above = edge < 2;
+        auto inside = [&](const TilePoint& p)
+        {
+            double v = is_x ? p.x : p.y;
+            return keep_above ? v >= bound : v <= bound;
+        };
+        auto intersect = [&](const TilePoint& a, const TilePoint& b)
+        {
+            double t = is_x ? (bound - a.x) / (b.x - a.x) : (bound - a.y) / (b.y - a.y);
+            TilePoint p{ a.x + t * (b.x - a.x), a.y + t * (b.y - a.y) };
+            if (is_x) p.x = bound; else p.y = bound;
+            return p;
+        };
+
+        tmp.clear();
+        TilePoint prev = ring.back();
+        bool prev_inside = inside(prev);
+        for (const TilePoint& p : ring)
+        {
+            bool p_inside = inside(p);
+            if (p_inside != prev_inside) tmp.push_back(intersect(prev, p));
+            if (p_inside) tmp.push_back(p);
+            prev = p;
+            prev_inside = p_inside;
+        }
+        ring.swap(tmp);
+    }
+}
+
+static inline bool
+in_clip(const MvtEncoder& enc, const TilePoint& p)
+{
+    return p.x >= enc.clip_min && p.x <= enc.clip_max &&
+           p.y >= enc.clip_min && p.y <= enc.clip_max;
+}
+
+/*
+ * Clip a segment to the clip square (Liang-Barsky)
+ *
+ * Returns false if no part of it is inside.
+ */
+static bool
+clip_segment(const MvtEncoder& enc, TilePoint& a, TilePoint& b)
+{
+    double t0 = 0, t1 = 1;
+    double dx = b.x - a.x, dy = b.y - a.y;
+    double p[4] = { -dx, dx, -dy, dy };
+    double q[4] = { a.x - enc.clip_min, enc.clip_max - a.x,
+                    a.y - enc.clip_min, enc.clip_max - a.y };
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (p[i] == 0)
+        {
+            if (q[i] < 0) return false;
+            continue;
+        }
+        double t = q[i] / p[i];
+        if (p[i] < 0) t0 = std::max(t0, t);
+        else t1 = std::min(t1, t);
+        if (t0 > t1) return false;
+    }
+    TilePoint start{ a.x + t0 * dx, a.y + t0 * dy };
+    TilePoint end{ a.x + t1 * dx, a.y + t1 * dy };
+    a = start;
+    b = end;
+    return true;
+}
+
+/*
+ * Quantize tile points, dropping consecutive duplicates
+ */
+static void
+quantize(const std::vector<TilePoint>& in, std::vector<std::pair<int32_t, int32_t>>& out)
+{
+    out.clear();
+    for (const TilePoint& p : in)
+    {
+        std::pair<int32_t, int32_t> q(static_cast<int32_t>(std::lround(p.x)),
+                                      static_cast<int32_t>(std::lround(p.y)));
+        if (out.empty() || out.back() != q) out.push_back(q);
+    }
+}
+
+/*
+ * Append a path of quantized points to the feature geometry, as MoveTo
+ * and LineTo (and ClosePath for rings)
+ */
+static void
+encode_path(MvtEncoder& enc, const std::vector<std::pair<int32_t, int32_t>>& path, bool ring)
+{
+    enc.geometry.push_back(command(CMD_MOVE_TO, 1));
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        if (i == 1) enc.geometry.push_back(command(CMD_LINE_TO, path.size() - 1));
+        enc.geometry.push_back(zigzag(path[i].first - enc.cursor_x));
+        enc.geometry.push_back(zigzag(path[i].second - enc.cursor_y));
+        enc.cursor_x = path[i].first;
+        enc.cursor_y = path[i].second;
+    }
+    if (ring) enc.geometry.push_back(command(CMD_CLOSE_PATH, 1));
+}
+
+/*
+ * Encode a ring of tile points (closing point included); exterior rings
+ * are wound to a positive area in tile coordinates, interior rings to a
+ * negative one, as MVT 2 requires
+ */
+static void
+encode_ring(MvtEncoder& enc, std::vector<TilePoint>& ring, bool exterior,
+            std::vector<std::pair<int32_t, int32_t>>& path)
+{
+    if (ring.size() < 4) return;
+    ring.pop_back();
+
+    bool inside = std::all_of(ring.begin(), ring.end(),
+                              [&](const TilePoint& p) { return in_clip(enc, p); });
+    if (!inside) clip_ring(enc, ring, enc.clipped);
+
+    quantize(ring, path);
+    while (path.size() > 1 && path.back() == path.front()) path.pop_back();
+    if (path.size() < 3) return;
+
+    int64_t area2 = 0;
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        const auto& a = path[i];
+        const auto& b = path[(i + 1) % path.size()];
+        area2 += static_cast<int64_t>(a.first) * b.second - static_cast<int64_t>(b.first) * a.second;
+    }
+    if (area2 == 0) return;
+    if ((area2 > 0) != exterior) std::reverse(path.begin(), path.end());
+
+    encode_path(enc, path, true);
+}
+
+/*
+ * Encode a line of tile points, split into the parts inside the clip
+ * square
+ */
+static void
+encode_line(MvtEncoder& enc, const std::vector<TilePoint>& line,
+            std::vector<std::pair<int32_t, int32_t>>& path)
+{
+    std::vector<TilePoint>& part = enc.clipped;
+    part.clear();
+
+    auto flush = [&]()
+    {
+        quantize(part, path);
+        if (path.size() >= 2) encode_path(enc, path, false);
+        part.clear();
+    };
+
+    for (size_t i = 1; i < line.size(); i++)
+    {
+        TilePoint a = line[i - 1], b = line[i];
+        bool b_inside = in_clip(enc, b);
+        if (in_clip(enc, a) && b_inside)
+        {
+            if (part.empty()) part.push_back(a);
+            part.push_back(b);
+            continue;
+        }
+        if (!clip_segment(enc, a, b))
+        {
+            flush();
+            continue;
+        }
+        if (part.empty()) part.push_back(a);
+        part.push_back(b);
+        if (!b_inside) flush();
+    }
+    flush();
+}
+
+/*
+ * Encode the geometry of a way; returns its MVT type, or 0 if nothing of
+ * it is left
+ */
+static uint32_t
+encode_way(MvtEncoder& enc, GeodeskConnection* conn, WayPtr way)
+{
+    WayCoordinateIterator iter;
+    int areaFlag = way.flags() & FeatureFlags::AREA;
+    iter.start(way, areaFlag);
+    int count = iter.storedCoordinatesRemaining() + (areaFlag ? 1 : 0);
+    if (count < 2) return 0;
+
+    enc.coords.resize(count);
+    for (int i = 0; i < count; i++) enc.coords[i] = iter.next();
+    count = static_cast<int>(geodesk_decimate_coords(reinterpret_cast<int32_t*>(enc.coords.data()),
+                                                     count, conn->simplify_tolerance,
+                                                     areaFlag ? 4 : 2));
+
+    enc.points.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        enc.points[i] = enc.fromImp(enc.coords[i].x, enc.coords[i].y);
+    }
+
+    std::vector<std::pair<int32_t, int32_t>> path;
+    if (areaFlag)
+    {
+        encode_ring(enc, enc.points, true, path);
+        return enc.geometry.empty() ? 0 : MVT_POLYGON;
+    }
+    encode_line(enc, enc.points, path);
+    return enc.geometry.empty() ? 0 : MVT_LINESTRING;
+}
+
+/*
+ * Encode the polygons of an assembled relation geometry
+ */
+static void
+encode_lwpoly(MvtEncoder& enc, const LWPOLY* poly, std::vector<std::pair<int32_t, int32_t>>& path)
+{
+    for (uint32_t r = 0; r < poly->nrings; r++)
+    {
+        const POINTARRAY* pa = poly->rings[r];
+        enc.points.resize(pa->npoints);
+        for (uint32_t i = 0; i < pa->npoints; i++)
+        {
+            const POINT2D* p = getPoint2d_cp(pa, i);
+            enc.points[i] = enc.fromMeters(p->x, p->y);
+        }
+
+        size_t before = enc.geometry.size();
+        encode_ring(enc, enc.points, r == 0, path);
+
+        // Without its exterior ring, a polygon's holes would attach to the
+        // previous polygon
+        if (r == 0 && enc.geometry.size() == before) return;
+    }
+}
+
+static uint32_t
+encode_relation(MvtEncoder& enc, GeodeskConnection* conn, GeodeskFeature* feature)
+{
+    LWGEOM* geom = static_cast<LWGEOM*>(geodesk_build_lwgeom(
+        reinterpret_cast<GeodeskConnectionHandle>(conn), feature));
+    if (!geom) return 0;
+
+    std::vector<std::pair<int32_t, int32_t>> path;
+    if (geom->type == POLYGONTYPE)
+    {
+        encode_lwpoly(enc, lwgeom_as_lwpoly(geom), path);
+    }
+    else if (geom->type == MULTIPOLYGONTYPE)
+    {
+        const LWCOLLECTION* coll = lwgeom_as_lwcollection(geom);
+        for (uint32_t i = 0; i < coll->ngeoms; i++)
+        {
+            encode_lwpoly(enc, lwgeom_as_lwpoly(coll->geoms[i]), path);
+        }
+    }
+    lwgeom_free(geom);
+    return enc.geometry.empty() ? 0 : MVT_POLYGON;
+}
+
+/*
+ * Encode the current feature into the layer
+ */
+static void
+encode_feature(MvtEncoder& enc, GeodeskConnection* conn, GeodeskFeature* feature)
+{
+    Feature f = *conn->current_feature;
+    uint32_t type = 0;
+
+    enc.geometry.clear();
+    enc.cursor_x = 0;
+    enc.cursor_y = 0;
+
+    if (f.isNode())
+    {
+        NodePtr node(f.ptr());
+        TilePoint p = enc.fromImp(node.x(), node.y());
+        if (!in_clip(enc, p)) return;
+        enc.geometry.push_back(command(CMD_MOVE_TO, 1));
+        enc.geometry.push_back(zigzag(static_cast<int32_t>(std::lround(p.x))));
+        enc.geometry.push_back(zigzag(static_cast<int32_t>(std::lround(p.y))));
+        type = MVT_POINT;
+    }
+    else
+    {
+        if (geodesk_is_sub_pixel(conn, f.bounds())) return;
+        type = f.isWay() ? encode_way(enc, conn, WayPtr(f.ptr())) :
+                           encode_relation(enc, conn, feature);
+    }
+    if (type == 0) return;
+
+    enc.tags.clear();
+    for (Tag tag : f.tags())
+    {
+        std::string_view k = tag.key();
+        enc.tags.push_back(intern_string(enc.key_index, enc.keys, std::string(k)));
+        enc.tags.push_back(intern_string(enc.value_index, enc.values, tag.value()));
+    }
+
+    ProtoWriter msg;
+    msg.uintField(1, static_cast<uint64_t>(f.id()));
+    if (!enc.tags.empty()) msg.packedField(2, enc.tags);
+    msg.uintField(3, type);
+    msg.packedField(4, enc.geometry);
+
+    enc.features.bytesField(2, msg.buf);
+    enc.feature_count++;
+}
+
+extern "C" {
+
+/*
+ * Encode the features of a connection in a tile as a single-layer MVT
+ *
+ * Sets the connection's bbox filter to the buffered tile and its
+ * simplification tolerance to one pixel; any GOQL filter must already be
+ * applied. Returns a palloc'd bytea, or NULL on failure.
+ */
+__attribute__((visibility("default")))
+bytea*
+geodesk_build_mvt(GeodeskConnectionHandle handle, const GeodeskMvtTile* tile)
+{
+    if (!handle || !tile) return nullptr;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+
+    try
+    {
+        MvtEncoder enc;
+        double tile_size = MAP_WIDTH_IMP / std::ldexp(1.0, tile->zoom);
+        enc.origin_x = -MAP_WIDTH_IMP / 2 + tile->x * tile_size;
+        enc.origin_y = MAP_WIDTH_IMP / 2 - tile->y * tile_size;
+        enc.scale = tile->extent / tile_size;
+        enc.clip_min = -tile->buffer;
+        enc.clip_max = tile->extent + tile->buffer;
+        enc.feature_count = 0;
+
+        double pixel_meters = tile_size / tile->extent * IMP_TO_METERS;
+        double buffer_meters = tile->buffer * pixel_meters;
+        geodesk_set_output_srid(handle, GEODESK_SRID_WEB_MERCATOR);
+        geodesk_set_simplify_tolerance(handle, pixel_meters);
+        geodesk_set_spatial_filter(handle,
+                                   enc.origin_x * IMP_TO_METERS - buffer_meters,
+                                   (enc.origin_y - tile_size) * IMP_TO_METERS - buffer_meters,
+                                   (enc.origin_x + tile_size) * IMP_TO_METERS + buffer_meters,
+                                   enc.origin_y * IMP_TO_METERS + buffer_meters);
+
+        GeodeskFeature feature;
+        while (geodesk_get_next_feature(handle, &feature))
+        {
+            encode_feature(enc, conn, &feature);
+        }
+
+        ProtoWriter layer;
+        layer.uintField(15, 2);                       // version
+        layer.bytesField(1, tile->layer);             // name
+        layer.buf += enc.features.buf;                // features
+        for (const std::string& k : enc.keys) layer.bytesField(3, k);
+        for (const std::string& v : enc.values)
+        {
+            ProtoWriter value;
+            value.bytesField(1, v);                   // string_value
+            layer.bytesField(4, value.buf);
+        }
+        layer.uintField(5, static_cast<uint32_t>(tile->extent));
+
+        ProtoWriter out;
+        if (enc.feature_count > 0) out.bytesField(3, layer.buf);
+
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Encoded tile %d/%d/%d: %ld features, %zu keys, %zu values, %zu bytes",
+                        tile->zoom, tile->x, tile->y, static_cast<long>(enc.feature_count),
+                        enc.keys.size(), enc.values.size(), out.buf.size())));
+
+        bytea* result = static_cast<bytea*>(palloc(VARHDRSZ + out.buf.size()));
+        SET_VARSIZE(result, VARHDRSZ + out.buf.size());
+        memcpy(VARDATA(result), out.buf.data(), out.buf.size());
+        return result;
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to encode tile %d/%d/%d: %s",
+                        tile->zoom, tile->x, tile->y, e.what())));
+        return nullptr;
+    }
+}
+
+} // extern "C"
@@ -9,13 +9,17 @@
 #include "postgres.h"
 #include "geodesk_fdw.h"
 
+#include <sys/stat.h>
+
 #include "access/reloptions.h"
+#include "catalog/pg_attribute.h"
 #include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
 #include "catalog/pg_user_mapping.h"
 #include "commands/defrem.h"
 #include "foreign/foreign.h"
 #include "miscadmin.h"
+#include "storage/fd.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 
@@ -33,12 +37,22 @@ static GeodeskFdwOption valid_options[] =
     /* Connection options */
     {OPTION_DATASOURCE, ForeignServerRelationId},
     {OPTION_UPDATABLE, ForeignServerRelationId},
+    {OPTION_PIPELINE, ForeignServerRelationId},
+    {OPTION_ASYNC_CAPABLE, ForeignServerRelationId},
     
     /* Table options */
+    {OPTION_DATASOURCE, ForeignTableRelationId},
     {OPTION_LAYER, ForeignTableRelationId},
     {OPTION_QUERY, ForeignTableRelationId},
     {OPTION_SCHEMA_MODE, ForeignTableRelationId},
     {OPTION_GOQL_FILTER, ForeignTableRelationId},
+    {OPTION_SRID, ForeignTableRelationId},
+    {OPTION_SIMPLIFY_TOLERANCE, ForeignTableRelationId},
+    {OPTION_PIPELINE, ForeignTableRelationId},
+    {OPTION_ASYNC_CAPABLE, ForeignTableRelationId},
+    
+    /* Column options */
+    {OPTION_TAG, AttributeRelationId},
     
     /* Sentinel */
     {NULL, InvalidOid}
@@ -91,6 +105,10 @@ geodesk_get_options_impl(Oid foreignoid, GeodeskFdwRelationInfo *fpinfo, bool is
     fpinfo->layer = "all";
     fpinfo->query = NULL;
     fpinfo->goql_filter = NULL;
+    fpinfo->srid = GEODESK_DEFAULT_SRID;
+    fpinfo->simplify_tolerance = 0;
+    fpinfo->pipeline = false;
+    fpinfo->async_capable = false;
     fpinfo->has_spatial_filter = false;
     
     /* Process options */
@@ -100,6 +118,7 @@ geodesk_get_options_impl(Oid foreignoid, GeodeskFdwRelationInfo *fpinfo, bool is
         
         if (strcmp(def->defname, OPTION_DATASOURCE) == 0)
         {
+            /* A table's datasource overrides its server's */
             fpinfo->datasource = defGetString(def);
         }
         else if (strcmp(def->defname, OPTION_LAYER) == 0)
@@ -114,6 +133,23 @@ geodesk_get_options_impl(Oid foreignoid, GeodeskFdwRelationInfo *fpinfo, bool is
         {
             fpinfo->goql_filter = defGetString(def);
         }
+        else if (strcmp(def->defname, OPTION_SRID) == 0)
+        {
+            fpinfo->srid = atoi(defGetString(def));
+        }
+        else if (strcmp(def->defname, OPTION_SIMPLIFY_TOLERANCE) == 0)
+        {
+            fpinfo->simplify_tolerance = strtod(defGetString(def), NULL);
+        }
+        else if (strcmp(def->defname, OPTION_PIPELINE) == 0)
+        {
+            /* Table options come last, and override the server's */
+            fpinfo->pipeline = defGetBoolean(def);
+        }
+        else if (strcmp(def->defname, OPTION_ASYNC_CAPABLE) == 0)
+        {
+            fpinfo->async_capable = defGetBoolean(def);
+        }
         else if (strcmp(def->defname, OPTION_SCHEMA_MODE) == 0)
         {
             /* Handle schema mode in future */
@@ -132,4 +168,100 @@ void
 geodesk_get_options(Oid foreigntableid, GeodeskFdwRelationInfo *fpinfo)
 {
     geodesk_get_options_impl(foreigntableid, fpinfo, false);
-}
\ No newline at end of file
+}
+
+/*
+ * Get the tag key a column is mapped to by its "tag" option, or NULL
+ */
+char *
+geodesk_get_column_tag(Oid foreigntableid, AttrNumber attnum)
+{
+    List *options = GetForeignColumnOptions(foreigntableid, attnum);
+    ListCell *lc;
+    
+    foreach(lc, options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
+        
+        if (strcmp(def->defname, OPTION_TAG) == 0)
+            return defGetString(def);
+    }
+    
+    return NULL;
+}
+
+static int
+compare_paths(const ListCell *a, const ListCell *b)
+{
+    return strcmp((const char *) lfirst(a), (const char *) lfirst(b));
+}
+
+/*
+ * Check whether a file name has the .gol extension
+ */
+static bool
+is_gol_file(const char *name)
+{
+    size_t len = strlen(name);
+    
+    return len > 4 && pg_strcasecmp(name + len - 4, ".gol") == 0;
+}
+
+/*
+ * Expand a datasource into the GOL files it names
+ *
+ * A datasource is a GOL file, a directory, standing for the GOL files in
+ * it in name order, or a comma-separated list of files. Returns a List of
+ * paths; a directory without GOL files is an error.
+ */
+List *
+geodesk_datasource_files(const char *datasource)
+{
+    List *files = NIL;
+    struct stat st;
+    
+    if (strchr(datasource, ',') != NULL)
+    {
+        char *list = pstrdup(datasource);
+        char *item;
+        char *save;
+        
+        for (item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save))
+        {
+            char *end;
+            
+            while (*item == ' ')
+                item++;
+            end = item + strlen(item);
+            while (end > item && end[-1] == ' ')
+                *--end = '\0';
+            if (*item != '\0')
+                files = lappend(files, item);
+        }
+        return files;
+    }
+    
+    if (stat(datasource, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        DIR *dir = AllocateDir(datasource);
+        struct dirent *de;
+        
+        while ((de = ReadDir(dir, datasource)) != NULL)
+        {
+            if (is_gol_file(de->d_name))
+                files = lappend(files, psprintf("%s/%s", datasource, de->d_name));
+        }
+        FreeDir(dir);
+        
+        if (files == NIL)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+                     errmsg("datasource directory \"%s\" contains no GOL files",
+                            datasource)));
+        
+        list_sort(files, compare_paths);
+        return files;
+    }
+    
+    return list_make1(pstrdup(datasource));
+}
@@ -3,14 +3,23 @@
  * geodesk_parents_jsonb.cpp
  *      Direct JSONB construction for OSM parent relations (optimized)
  *
+ * The parent ways of a node are found by a spatial search for ways that
+ * contain it, so a bbox scan selecting parents would rediscover the same
+ * ways for each of their nodes. Once enough way-nodes in the scan box
+ * have asked for their parents, the ways intersecting the box are walked
+ * once into a node -> parent ways index, which answers the remaining
+ * nodes; their parent relations still come from the node itself. A box
+ * whose ways have too many nodes for the index falls back to the search.
+ *
  *-------------------------------------------------------------------------
  */
 
 // Standard library includes first
+#include <algorithm>
 #include <string>
 #include <exception>
-#include <sstream>
 #include <cstring>
+#include <vector>
 
 // Include libgeodesk BEFORE PostgreSQL headers to avoid macro conflicts
 // Temporarily rename conflicting types
@@ -19,6 +28,7 @@
 #define RelationPtr GEODESK_RELATIONPTR_AVOID_CONFLICT
 #define Query GEODESK_QUERY_AVOID_CONFLICT
 #include <geodesk/geodesk.h>
+#include <geodesk/feature/types.h>  // For FeatureFlags
 #undef Node
 #undef Relation
 #undef RelationPtr
@@ -33,161 +43,257 @@ extern "C" {
 #include "geodesk_fdw.h"
 }
 
+// Way-node parent lookups in a scan box before its parent index is built
+static constexpr int PARENT_INDEX_MIN_LOOKUPS = 32;
+
+// Most node-way pairs in a parent index, 64 MB
+static constexpr size_t PARENT_INDEX_MAX_PAIRS = size_t(1) << 22;
+
+// Longest decimal int64, with sign
+static constexpr size_t MAX_ID_CHARS = 20;
+
+static inline char
+feature_type_char(const geodesk::Feature& f)
+{
+    if (f.isNode()) return 'n';
+    if (f.isWay()) return 'w';
+    return 'r';
+}
+
+/*
+ * Get the box the current scan's features lie in, if it has one
+ */
+static bool
+get_scan_box(GeodeskConnection* conn, Box* box)
+{
+    if (conn->has_tile && conn->has_bbox_filter)
+    {
+        *box = Box(std::max(conn->tile_cell.minX(), conn->bbox.minX()),
+                   std::max(conn->tile_cell.minY(), conn->bbox.minY()),
+                   std::min(conn->tile_cell.maxX(), conn->bbox.maxX()),
+                   std::min(conn->tile_cell.maxY(), conn->bbox.maxY()));
+        return true;
+    }
+    if (conn->has_tile)
+    {
+        *box = conn->tile_cell;
+        return true;
+    }
+    if (conn->has_bbox_filter)
+    {
+        *box = conn->bbox;
+        return true;
+    }
+    return false;
+}
+
+static inline bool
+same_box(const Box& a, const Box& b)
+{
+    return a.minX() == b.minX() && a.minY() == b.minY() &&
+           a.maxX() == b.maxX() && a.maxY() == b.maxY();
+}
+
+/*
+ * Index the feature nodes of all ways intersecting the box
+ *
+ * A way containing a node in the box intersects it, so every parent way
+ * of those nodes is found. Returns false, leaving no index, if the ways
+ * have more than PARENT_INDEX_MAX_PAIRS nodes.
+ */
+static bool
+build_parent_index(GeodeskConnection* conn, const Box& box)
+{
+    conn->parent_ways.clear();
+    conn->parent_index_box = box;
+
+    for (geodesk::Feature way : conn->features->ways()(box))
+    {
+        int64_t way_id = way.id();
+        for (geodesk::Feature node : way.nodes())
+        {
+            if (conn->parent_ways.size() == PARENT_INDEX_MAX_PAIRS)
+            {
+                std::vector<std::pair<const uint8_t*, int64_t>>().swap(conn->parent_ways);
+                conn->parent_index_oversized = true;
+
+                ereport(DEBUG1,
+                        (errcode(ERRCODE_FDW_ERROR),
+                         errmsg("Parent index over %zu node-way pairs, not built",
+                                PARENT_INDEX_MAX_PAIRS)));
+                return false;
+            }
+            conn->parent_ways.emplace_back(node.ptr().ptr().ptr(), way_id);
+        }
+    }
+
+    // A closed way lists its first node twice
+    std::sort(conn->parent_ways.begin(), conn->parent_ways.end());
+    conn->parent_ways.erase(std::unique(conn->parent_ways.begin(), conn->parent_ways.end()),
+                            conn->parent_ways.end());
+
+    conn->has_parent_index = true;
+
+    ereport(DEBUG1,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Built parent index: %zu node-way pairs", conn->parent_ways.size())));
+    return true;
+}
+
+/*
+ * Collect the parents of a node from the parent index, if the scan box
+ * has one or is due for one
+ */
+static bool
+collect_indexed_node_parents(GeodeskConnection* conn, const geodesk::Feature& f)
+{
+    Box box;
+    if (!get_scan_box(conn, &box)) return false;
+
+    // A new box (rescan, runtime bbox or parallel tile) starts over
+    if (!same_box(conn->parent_index_box, box))
+    {
+        conn->has_parent_index = false;
+        conn->parent_index_oversized = false;
+        conn->parent_ways.clear();
+        conn->parent_index_box = box;
+        conn->parent_lookups = 0;
+    }
+    if (!conn->has_parent_index)
+    {
+        if (conn->parent_index_oversized) return false;
+        if (++conn->parent_lookups < PARENT_INDEX_MIN_LOOKUPS) return false;
+        if (!build_parent_index(conn, box)) return false;
+    }
+
+    for (geodesk::Feature rel : f.parents().relations())
+    {
+        conn->parents.push_back(GeodeskMember{rel.id(), 'r', nullptr});
+    }
+
+    const uint8_t* ptr = f.ptr().ptr().ptr();
+    auto it = std::lower_bound(conn->parent_ways.begin(), conn->parent_ways.end(),
+                               std::make_pair(ptr, INT64_MIN));
+    for (; it != conn->parent_ways.end() && it->first == ptr; ++it)
+    {
+        conn->parents.push_back(GeodeskMember{it->second, 'w', nullptr});
+    }
+    return true;
+}
+
+/*
+ * Collect the parents of the current feature into conn->parents
+ */
+static void
+collect_parents(GeodeskConnection* conn)
+{
+    geodesk::Feature f = *conn->current_feature;
+
+    conn->parents.clear();
+
+    // Only way-nodes have parent ways, which need the spatial search
+    if (f.isNode() && (f.ptr().flags() & FeatureFlags::WAYNODE) &&
+        collect_indexed_node_parents(conn, f))
+    {
+        return;
+    }
+
+    for (geodesk::Feature parent : f.parents())
+    {
+        conn->parents.push_back(GeodeskMember{parent.id(), feature_type_char(parent), nullptr});
+    }
+}
+
+static inline void
+set_jsonb_string(JsonbValue* v, const char* str, size_t len)
+{
+    v->type = jbvString;
+    v->val.string.val = const_cast<char*>(str);
+    v->val.string.len = len;
+}
+
 extern "C" {
 
 /*
  * Build JSONB directly from parent relations without intermediate JSON string
- * This is much more efficient than building a string and parsing it
- * 
- * Returns a JSONB Datum that can be directly stored in a tuple
+ *
+ * The JsonbValue tree is built in place, with each object's keys already
+ * in Jsonb order, and serialized once by JsonbValueToJsonb.
+ *
+ * Returns a JSONB Datum that can be directly stored in a tuple, or 0 if
+ * the feature has no parents
  */
 __attribute__((visibility("default")))
 Datum
 geodesk_get_parents_jsonb_direct(GeodeskConnectionHandle handle, GeodeskFeature* feature)
 {
-    if (!handle || !feature) 
+    if (!handle || !feature)
     {
         /* Return NULL for invalid input */
         return (Datum) 0;
     }
-    
+
     auto conn = reinterpret_cast<GeodeskConnection*>(handle);
-    
+
     /* Return NULL for null feature */
-    if (!conn->current_feature) 
+    if (!conn->current_feature)
     {
         return (Datum) 0;
     }
-    
+
     try
     {
-        geodesk::Feature f = *conn->current_feature;
-        
-        /* Get parent relations first to check if empty */
-        try 
-        {
-            geodesk::Features parents = f.parents();
-            
-            /* Check if there are any parents */
-            bool has_parents = false;
-            for (geodesk::Feature parent : parents)
-            {
-                has_parents = true;
-                break;
-            }
-            
-            /* If no parents, return NULL */
-            if (!has_parents)
-            {
-                return (Datum) 0;
-            }
-            
-            /* Build JSONB directly */
-            JsonbParseState *state = NULL;
-            JsonbValue jb_val;
-            
-            /* Start the JSONB array */
-            pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
-            
-            /* Reset iterator and process parents */
-            parents = f.parents();
-            
-            int parent_count = 0;
-            const int MAX_PARENTS = 100;  /* Safety limit */
-            
-            for (geodesk::Feature parent : parents)
-            {
-                /* Safety check to prevent infinite loops */
-                if (++parent_count > MAX_PARENTS)
-                {
-                    ereport(WARNING,
-                            (errcode(ERRCODE_FDW_ERROR),
-                             errmsg("Feature %ld has more than %d parents, truncating", 
-                                    feature->id, MAX_PARENTS)));
-                    break;
-                }
-                
-                /* Debug logging for problematic nodes */
-                if (feature->id == 259654373 || feature->id == 259654332 || 
-                    feature->id == 259654265 || feature->id == 259654266)
-                {
-                    ereport(DEBUG1,
-                            (errcode(ERRCODE_FDW_ERROR),
-                             errmsg("Processing parent %d for problematic node %ld",
-                                    parent_count, feature->id)));
-                }
-                
-                /* Start parent object */
-                pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-                
-                /* Add type field */
-                jb_val.type = jbvString;
-                jb_val.val.string.val = (char*)"type";
-                jb_val.val.string.len = 4;
-                pushJsonbValue(&state, WJB_KEY, &jb_val);
-                
-                const char* type_str;
-                if (parent.isNode()) type_str = "node";
-                else if (parent.isWay()) type_str = "way";
-                else if (parent.isRelation()) type_str = "relation";
-                else type_str = "unknown";
-                
-                jb_val.val.string.val = (char*)type_str;
-                jb_val.val.string.len = strlen(type_str);
-                pushJsonbValue(&state, WJB_VALUE, &jb_val);
-                
-                /* Add id field */
-                jb_val.type = jbvString;
-                jb_val.val.string.val = (char*)"id";
-                jb_val.val.string.len = 2;
-                pushJsonbValue(&state, WJB_KEY, &jb_val);
-                
-                /* Convert ID to string instead of numeric to avoid memory issues */
-                char id_str[32];
-                snprintf(id_str, sizeof(id_str), "%ld", parent.id());
-                
-                /* Allocate string in current memory context */
-                char* id_copy = (char*)palloc(strlen(id_str) + 1);
-                strcpy(id_copy, id_str);
-                
-                jb_val.type = jbvString;
-                jb_val.val.string.val = id_copy;
-                jb_val.val.string.len = strlen(id_str);
-                pushJsonbValue(&state, WJB_VALUE, &jb_val);
-                
-                /* Skip role extraction for now to avoid crashes */
-                /* TODO: Re-enable role extraction after fixing the crash issue */
-                
-                /* End parent object */
-                pushJsonbValue(&state, WJB_END_OBJECT, NULL);
-            }
-            
-            /* End the JSONB array */
-            JsonbValue *result = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
-            
-            /* Convert to Jsonb datum */
-            return JsonbPGetDatum(JsonbValueToJsonb(result));
-        }
-        catch (const std::exception& e)
-        {
-            ereport(DEBUG1,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("Failed to get parents for feature %ld: %s", 
-                            feature->id, e.what())));
-            
-            /* Return NULL on inner exception */
-            return (Datum) 0;
-        }
+        collect_parents(conn);
     }
     catch (const std::exception& e)
     {
-        ereport(WARNING,
+        ereport(DEBUG1,
                 (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("Failed to build parents JSONB: %s", e.what())));
-        
+                 errmsg("Failed to get parents for feature %ld: %s",
+                        feature->id, e.what())));
+
         /* Return NULL on error */
         return (Datum) 0;
     }
+
+    size_t count = conn->parents.size();
+    if (count == 0) return (Datum) 0;
+
+    JsonbValue* elems = static_cast<JsonbValue*>(palloc(sizeof(JsonbValue) * count));
+    JsonbPair* pairs = static_cast<JsonbPair*>(palloc(sizeof(JsonbPair) * 2 * count));
+    char* ids = static_cast<char*>(palloc((MAX_ID_CHARS + 1) * count));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const GeodeskMember& parent = conn->parents[i];
+        JsonbPair* p = &pairs[i * 2];
+        char* id_str = ids + i * (MAX_ID_CHARS + 1);
+        int id_len = snprintf(id_str, MAX_ID_CHARS + 1, "%ld", static_cast<long>(parent.id));
+        const char* type_str = (parent.type == 'n') ? "node" :
+                               (parent.type == 'w') ? "way" : "relation";
+
+        /* Keys sorted by length, then bytewise: id, type */
+        set_jsonb_string(&p[0].key, "id", 2);
+        set_jsonb_string(&p[0].value, id_str, id_len);
+        p[0].order = 0;
+
+        set_jsonb_string(&p[1].key, "type", 4);
+        set_jsonb_string(&p[1].value, type_str, strlen(type_str));
+        p[1].order = 1;
+
+        elems[i].type = jbvObject;
+        elems[i].val.object.nPairs = 2;
+        elems[i].val.object.pairs = p;
+    }
+
+    JsonbValue array;
+    array.type = jbvArray;
+    array.val.array.nElems = count;
+    array.val.array.elems = elems;
+    array.val.array.rawScalar = false;
+
+    /* Convert to Jsonb datum */
+    return JsonbPGetDatum(JsonbValueToJsonb(&array));
 }
 
-} // extern "C"
\ No newline at end of file
+} // extern "C"
@@ -0,0 +1,479 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_pipeline.cpp
+ *      Background producer thread for pipelined scans
+ *
+ * In pipeline mode, a thread of its own iterates the scan's view, which
+ * is where the spatial index is walked and the GOQL filter evaluated, and
+ * hands the matching features to the backend through a single-producer,
+ * single-consumer ring of feature pointers. It also touches each
+ * feature's body, so its page faults happen on the producer as well. The
+ * backend is left with building the row values, which allocate in
+ * PostgreSQL memory contexts and so can't move to another thread.
+ *
+ * The producer walks the scan area a tile at a time, keeping the features
+ * whose anchor is in the tile as parallel scans do, so a stop request is
+ * seen at each tile boundary even while nothing matches. The area is that
+ * of the file's footprint within the scan's bbox.
+ *
+ * The producer never calls into PostgreSQL, and runs with all signals
+ * blocked; an error ends it and is reported by the backend. The ring
+ * indexes carry a flag in their top bit: the producer sets it on the tail
+ * when it is done, the backend on the head to stop the producer. The
+ * backend waits for features a bounded time at once, so that it handles
+ * interrupts while the producer searches.
+ *
+ * For asynchronous Append, the producer also signals an eventfd whenever
+ * features arrive while the backend waits for them, which the executor
+ * waits on alongside other async scans.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <geodesk/geodesk.h>
+
+extern "C" {
+#include "postgres.h"
+#include "miscadmin.h"
+#include "geodesk_fdw.h"
+}
+
+using namespace geodesk;
+
+// Include shared connection structure
+#include "geodesk_connection_internal.h"
+
+// Features in flight between producer and backend; a power of 2
+static constexpr size_t PIPELINE_CAPACITY = 4096;
+
+// Set on the tail when the producer is done, on the head to stop it
+static constexpr size_t PIPELINE_FLAG = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+// Tiles the producer splits its area into, at zoom levels up to the max
+static constexpr int PIPELINE_TILES = 256;
+static constexpr int PIPELINE_MAX_ZOOM = 16;
+
+// Longest the backend waits for features between interrupt checks
+static constexpr auto PIPELINE_WAIT = std::chrono::milliseconds(100);
+
+struct GeodeskPipeline
+{
+    std::unique_ptr<uint8_t*[]> slots{new uint8_t*[PIPELINE_CAPACITY]};
+    std::atomic<size_t> head{0};          // Next slot the backend reads
+    std::atomic<size_t> tail{0};          // Next slot the producer writes
+    std::atomic<int64_t> visited{0};      // Features taken from the iterator
+    std::atomic<bool> waiting{false};     // An async backend waits on event_fd
+    std::atomic<bool> sleeping{false};    // The backend waits on arrived
+    std::mutex mutex;                     // Guards waits on arrived
+    std::condition_variable arrived;      // Signaled as the tail moves
+    std::string error;                    // Set before the done flag, if failed
+    int event_fd = -1;                    // Signaled as features arrive, or -1
+    std::thread thread;
+};
+
+/*
+ * Move the tail of the ring, waking the backend if it waits
+ */
+static void
+publish_tail(GeodeskPipeline* p, size_t tail)
+{
+    p->tail.store(tail);
+
+    // Pairs with wait_for_features: either it sees the new tail, or this
+    // sees it sleeping and signals it once it waits
+    if (p->sleeping.load())
+    {
+        std::lock_guard<std::mutex> lock(p->mutex);
+        p->arrived.notify_one();
+    }
+}
+
+/*
+ * Signal the eventfd of an async scan
+ */
+static void
+notify_event(GeodeskPipeline* p)
+{
+    if (p->event_fd < 0) return;
+
+    uint64_t one = 1;
+    ssize_t n = write(p->event_fd, &one, sizeof(one));
+    (void) n;   // EAGAIN only means a signal is already pending
+}
+
+/*
+ * Touch a feature's data, so the backend finds it in memory
+ */
+static void
+touch_feature(Feature f)
+{
+    FeaturePtr ptr = f.ptr();
+    volatile uint8_t sink = *ptr.ptr().ptr();
+
+    // Ways keep their coordinates, relations their members in the body
+    if (!f.isNode())
+        sink = *ptr.bodyptr().ptr();
+    (void) sink;
+}
+
+/*
+ * Wait for room in the ring for the slot at tail
+ *
+ * Returns false if the backend stops the producer.
+ */
+static bool
+wait_for_room(GeodeskPipeline* p, size_t tail)
+{
+    size_t head = p->head.load(std::memory_order_acquire);
+    while (!(head & PIPELINE_FLAG) && tail - head == PIPELINE_CAPACITY)
+    {
+        p->head.wait(head, std::memory_order_acquire);
+        head = p->head.load(std::memory_order_acquire);
+    }
+    return !(head & PIPELINE_FLAG);
+}
+
+/*
+ * Producer thread: iterate the view a tile at a time into the ring until
+ * done or stopped
+ */
+static void
+produce(GeodeskPipeline* p, Features view, GeodeskTileRange range, uint32_t ntiles, Box area)
+{
+    size_t tail = 0;
+
+    try
+    {
+        for (uint32_t t = 0; t < ntiles; t++)
+        {
+            if (p->head.load(std::memory_order_acquire) & PIPELINE_FLAG) break;
+
+            Box cell = tile_cell(range, t);
+            for (Feature f : view(cell))
+            {
+                if (!tile_owns(cell, &area, f.bounds())) continue;
+                if (!wait_for_room(p, tail)) break;
+
+                p->visited.fetch_add(1, std::memory_order_relaxed);
+                touch_feature(f);
+
+                p->slots[tail % PIPELINE_CAPACITY] = f.ptr().ptr().ptr();
+                tail++;
+                publish_tail(p, tail);
+
+                // Pairs with geodesk_pipeline_ready: either it sees this
+                // feature, or this sees it waiting
+                if (p->waiting.load() && p->waiting.exchange(false))
+                    notify_event(p);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        p->error = e.what();
+    }
+    catch (...)
+    {
+        p->error = "unknown error";
+    }
+
+    publish_tail(p, tail | PIPELINE_FLAG);
+    notify_event(p);
+}
+
+/*
+ * Wait for the producer to move the tail on from a value, at most for
+ * PIPELINE_WAIT, and return the tail
+ */
+static size_t
+wait_for_features(GeodeskPipeline* p, size_t tail)
+{
+    try
+    {
+        std::unique_lock<std::mutex> lock(p->mutex);
+        p->sleeping.store(true);
+        p->arrived.wait_for(lock, PIPELINE_WAIT, [&] { return p->tail.load() != tail; });
+        p->sleeping.store(false);
+    }
+    catch (const std::system_error&)
+    {
+        p->sleeping.store(false);
+    }
+    return p->tail.load(std::memory_order_acquire);
+}
+
+/*
+ * Get the area the producer of a connection walks: the file's footprint
+ * within the scan's bbox
+ *
+ * Every feature of the view overlaps it, so each is owned by one tile.
+ * Returns false if the scan can't match anything.
+ */
+static bool
+pipeline_area(GeodeskConnection* conn, Box* area)
+{
+    Box box = conn->has_bbox_filter ? conn->bbox :
+              Box(INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX);
+
+    try
+    {
+        const Box& footprint = geodesk_footprint(conn->store_entry->path.c_str());
+        if (footprint.minX() > footprint.maxX())
+            return false;
+        box = Box(std::max(box.minX(), footprint.minX()), std::max(box.minY(), footprint.minY()),
+                  std::min(box.maxX(), footprint.maxX()), std::min(box.maxY(), footprint.maxY()));
+    }
+    catch (const std::exception& e)
+    {
+        // Without a footprint, the bbox alone
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("No footprint for pipelined scan: %s", e.what())));
+    }
+
+    if (box.minX() > box.maxX() || box.minY() > box.maxY())
+        return false;
+    *area = box;
+    return true;
+}
+
+/*
+ * Get the view a scan iterates, as geodesk_reset_iteration does
+ */
+static Features*
+scan_view(GeodeskConnection* conn)
+{
+    if (conn->bbox_filtered_features) return conn->bbox_filtered_features;
+    if (conn->filtered_features) return conn->filtered_features;
+    return conn->features;
+}
+
+/*
+ * Start the producer of a connection, unless it is running
+ *
+ * Returns false if the thread couldn't be started; the scan then iterates
+ * on the backend as usual.
+ */
+static bool
+start_pipeline(GeodeskConnection* conn)
+{
+    if (conn->pipeline) return true;
+
+    auto p = std::make_unique<GeodeskPipeline>();
+    Box area;
+    GeodeskTileRange range{};
+    uint32_t ntiles = 0;
+
+    if (pipeline_area(conn, &area))
+    {
+        range = tile_range(area, PIPELINE_TILES, PIPELINE_MAX_ZOOM);
+        ntiles = static_cast<uint32_t>((int64_t(range.max_col) - range.min_col + 1) *
+                                       (int64_t(range.max_row) - range.min_row + 1));
+    }
+
+    try
+    {
+        if (conn->pipeline_async)
+            p->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        // The thread inherits the signal mask; signals are the backend's
+        sigset_t blocked, saved;
+        sigfillset(&blocked);
+        pthread_sigmask(SIG_SETMASK, &blocked, &saved);
+        try
+        {
+            p->thread = std::thread(produce, p.get(), *scan_view(conn), range, ntiles, area);
+        }
+        catch (...)
+        {
+            pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+            throw;
+        }
+        pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+    }
+    catch (const std::exception& e)
+    {
+        if (p->event_fd >= 0) close(p->event_fd);
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Could not start producer thread: %s", e.what())));
+        conn->pipeline_mode = false;
+        return false;
+    }
+
+    conn->pipeline = p.release();
+    conn->iteration_started = true;
+    return true;
+}
+
+/*
+ * Stop the producer of a connection, if any, and wait for it to exit
+ *
+ * Called whenever the views it iterates change, and on close.
+ */
+void
+geodesk_pipeline_stop(GeodeskConnection* conn)
+{
+    GeodeskPipeline* p = conn->pipeline;
+    if (!p) return;
+
+    p->head.fetch_or(PIPELINE_FLAG, std::memory_order_release);
+    p->head.notify_one();
+    if (p->thread.joinable()) p->thread.join();
+
+    conn->features_visited += p->visited.load(std::memory_order_relaxed);
+    if (p->event_fd >= 0) close(p->event_fd);
+    delete p;
+    conn->pipeline = nullptr;
+    conn->iteration_started = false;
+}
+
+/*
+ * Features the running producer has taken from the iterator so far
+ */
+int64_t
+geodesk_pipeline_visited(const GeodeskConnection* conn)
+{
+    return conn->pipeline ? conn->pipeline->visited.load(std::memory_order_relaxed) : 0;
+}
+
+/*
+ * Take up to limit features from the producer, waiting for at least one
+ *
+ * Returns the number of features added to the batch, 0 at the end of the
+ * iteration. Returns -1 if the producer can't be used.
+ */
+int
+geodesk_pipeline_next_batch(GeodeskConnection* conn, GeodeskFeatureBatch* batch, int limit)
+{
+    if (!start_pipeline(conn)) return -1;
+
+    GeodeskPipeline* p = conn->pipeline;
+    FeatureStore* store = conn->features->store();
+    size_t head = p->head.load(std::memory_order_relaxed);
+    size_t tail = p->tail.load(std::memory_order_acquire);
+
+    // No C++ objects live here, since an interrupt may throw an ERROR
+    while ((tail & ~PIPELINE_FLAG) == head && !(tail & PIPELINE_FLAG))
+    {
+        tail = wait_for_features(p, tail);
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    if ((tail & PIPELINE_FLAG) && !p->error.empty())
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Error iterating features: %s", p->error.c_str())));
+        p->error.clear();
+    }
+
+    size_t available = (tail & ~PIPELINE_FLAG) - head;
+    for (size_t i = 0; i < available && batch->count < limit; i++)
+    {
+        Feature f(store, FeaturePtr(p->slots[head % PIPELINE_CAPACITY]));
+        int n = batch->count++;
+        batch->ids[n] = f.id();
+        batch->types[n] = static_cast<int>(f.type());
+        batch->is_area[n] = f.isArea();
+        batch->ptrs[n] = static_cast<void*>(p->slots[head % PIPELINE_CAPACITY]);
+        head++;
+    }
+
+    p->head.store(head, std::memory_order_release);
+    p->head.notify_one();
+    return batch->count;
+}
+
+extern "C" {
+
+/*
+ * Enable pipeline mode, in which a producer thread iterates the scan
+ *
+ * With async, the producer also signals the file descriptor returned by
+ * geodesk_pipeline_start. Only plain view scans are pipelined: fid lookups
+ * and the tiles of parallel scans iterate on the backend.
+ */
+__attribute__((visibility("default")))
+void
+geodesk_set_pipeline(GeodeskConnectionHandle handle, bool enabled, bool async)
+{
+    if (!handle) return;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    geodesk_pipeline_stop(conn);
+    conn->pipeline_mode = enabled;
+    conn->pipeline_async = enabled && async;
+}
+
+/*
+ * Start the producer ahead of the first fetch
+ *
+ * Returns the eventfd that becomes readable as features arrive, or -1 if
+ * the scan isn't pipelined or asynchronous.
+ */
+__attribute__((visibility("default")))
+int
+geodesk_pipeline_start(GeodeskConnectionHandle handle)
+{
+    if (!handle) return -1;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    if (!conn->pipeline_mode || conn->has_id_filter || conn->has_tile)
+        return -1;
+    if (!start_pipeline(conn))
+        return -1;
+    return conn->pipeline->event_fd;
+}
+
+/*
+ * Check whether a fetch would return without waiting for the producer:
+ * features are waiting in the ring, or the producer is done
+ *
+ * If not, the eventfd becomes readable once that changes. Clears earlier
+ * signals of the eventfd.
+ */
+__attribute__((visibility("default")))
+bool
+geodesk_pipeline_ready(GeodeskConnectionHandle handle)
+{
+    if (!handle) return true;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    GeodeskPipeline* p = conn->pipeline;
+    if (!p) return true;
+
+    if (p->event_fd >= 0)
+    {
+        uint64_t count;
+        ssize_t n = read(p->event_fd, &count, sizeof(count));
+        (void) n;
+    }
+
+    p->waiting.store(true);
+    size_t tail = p->tail.load();
+    bool ready = (tail & PIPELINE_FLAG) ||
+                 (tail & ~PIPELINE_FLAG) != p->head.load(std::memory_order_relaxed);
+    if (ready)
+        p->waiting.store(false);
+    return ready;
+}
+
+} // extern "C"
@@ -0,0 +1,222 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_prewarm.cpp
+ *      Load the GOL tiles of a region into the page cache
+ *
+ * The tiles overlapping the connection's bbox (all tiles without one) are
+ * found through the tile index. Each tile's pages are then advised with
+ * MADV_WILLNEED and touched, so they are resident once the call returns.
+ * If the connection has a GOQL filter, tiles without a matching feature
+ * are left out; the workers test that as they go, through the view, like
+ * the producer of pipelined scans. They never call into PostgreSQL, and
+ * run with all signals blocked.
+ *
+ * The calling thread works through the tiles as well and checks for
+ * interrupts between them. On one, every worker stops at its next tile and
+ * the call returns early, so that the caller can handle it.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <geodesk/geodesk.h>
+#include <geodesk/feature/TileIndexWalker.h>
+#include <geodesk/feature/TilePtr.h>
+
+extern "C" {
+#include "postgres.h"
+#include "miscadmin.h"
+#include "geodesk_fdw.h"
+}
+
+using namespace geodesk;
+
+// Include shared connection structure
+#include "geodesk_connection_internal.h"
+
+struct PrewarmRange
+{
+    const uint8_t* start;
+    size_t size;
+    Box bounds;             // Of the tile, for the GOQL test
+};
+
+/*
+ * Check whether the backend has an interrupt it can handle now
+ */
+static inline bool
+interrupt_pending()
+{
+    return INTERRUPTS_PENDING_CONDITION() && INTERRUPTS_CAN_BE_PROCESSED();
+}
+
+/*
+ * Check whether a tile has a feature of a view, assuming so if that
+ * can't be told
+ */
+static bool
+tile_has_match(const Features* view, const Box& bounds)
+{
+    try
+    {
+        return static_cast<bool>((*view)(bounds).first());
+    }
+    catch (...)
+    {
+        return true;
+    }
+}
+
+/*
+ * Fault in the pages of a tile, returning the bytes of the tile
+ */
+static uint64_t
+prewarm_range(const PrewarmRange& range, size_t page_size)
+{
+    uintptr_t start = reinterpret_cast<uintptr_t>(range.start);
+    uintptr_t first = start & ~(page_size - 1);
+    const volatile uint8_t* data = range.start;
+    uint8_t sink = 0;
+
+    if (range.size == 0) return 0;
+
+    // Lets the kernel read ahead the whole tile instead of page by page
+    madvise(reinterpret_cast<void*>(first), start + range.size - first, MADV_WILLNEED);
+
+    // One byte of every page the tile spans
+    for (size_t offset = 0; offset < range.size; offset += page_size)
+        sink += data[offset];
+    sink += data[range.size - 1];
+    (void) sink;
+
+    return range.size;
+}
+
+extern "C" {
+
+/*
+ * Load the tiles of the connection's region into the page cache
+ *
+ * Uses up to nthreads threads. Returns false (with a warning) if the tile
+ * index couldn't be read; *result is filled in either way. If an interrupt
+ * arrives, returns early with result->interrupted set.
+ */
+__attribute__((visibility("default")))
+bool
+geodesk_load_tiles(GeodeskConnectionHandle handle, int nthreads, GeodeskPrewarmResult* result)
+{
+    if (!handle || !result) return false;
+
+    auto conn = reinterpret_cast<GeodeskConnection*>(handle);
+    std::vector<PrewarmRange> ranges;
+
+    result->tiles = 0;
+    result->bytes = 0;
+    result->interrupted = false;
+
+    try
+    {
+        FeatureStore* store = conn->features->store();
+        Box bounds = conn->has_bbox_filter ? conn->bbox :
+                     Box(INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX);
+        TileIndexWalker walker(store->tileIndex(), store->zoomLevels(), bounds, nullptr);
+
+        while (walker.next())
+        {
+            if (interrupt_pending())
+            {
+                result->interrupted = true;
+                return true;
+            }
+
+            TilePtr tile = store->fetchTile(walker.currentTip());
+            ranges.push_back({tile.ptr(), tile.totalSize(), walker.currentTile().bounds()});
+        }
+    }
+    catch (const std::exception& e)
+    {
+        ereport(WARNING,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Failed to read tile index: %s", e.what())));
+        return false;
+    }
+
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const Features* view = conn->filtered_features;
+    std::atomic<size_t> next{0};
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> tiles{0};
+    std::atomic<uint64_t> bytes{0};
+    auto work = [&](bool caller)
+    {
+        uint64_t loaded = 0;
+        uint64_t done = 0;
+        for (size_t i; !stop.load(std::memory_order_relaxed) &&
+                       (i = next.fetch_add(1)) < ranges.size(); )
+        {
+            if (caller && interrupt_pending())
+            {
+                stop.store(true);
+                break;
+            }
+            if (view && !tile_has_match(view, ranges[i].bounds))
+                continue;
+            done += prewarm_range(ranges[i], page_size);
+            loaded++;
+        }
+        tiles += loaded;
+        bytes += done;
+    };
+
+    nthreads = std::clamp(nthreads, 1, static_cast<int>(std::max<size_t>(ranges.size(), 1)));
+
+    // The threads inherit the signal mask; signals are the backend's
+    std::vector<std::thread> threads;
+    sigset_t blocked, saved;
+    sigfillset(&blocked);
+    pthread_sigmask(SIG_SETMASK, &blocked, &saved);
+    try
+    {
+        for (int i = 1; i < nthreads; i++)
+            threads.emplace_back(work, false);
+    }
+    catch (const std::exception& e)
+    {
+        // Carry on with the threads that did start
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Prewarming with %zu of %d threads: %s",
+                        threads.size() + 1, nthreads, e.what())));
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+
+    // The calling thread is one of the workers
+    work(true);
+    for (std::thread& t : threads)
+        t.join();
+
+    result->tiles = static_cast<int64_t>(tiles.load());
+    result->bytes = static_cast<int64_t>(bytes.load());
+    result->interrupted = stop.load();
+
+    ereport(DEBUG1,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Prewarmed %llu of %zu tiles, %llu bytes%s",
+                    static_cast<unsigned long long>(tiles.load()), ranges.size(),
+                    static_cast<unsigned long long>(bytes.load()),
+                    result->interrupted ? ", interrupted" : "")));
+    return true;
+}
+
+} // extern "C"
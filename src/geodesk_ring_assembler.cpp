@@ -9,10 +9,11 @@
 
 #include <vector>
 #include <unordered_map>
-#include <set>
 #include <algorithm>
 #include <cstring>
 #include <cstdlib>
+#include <cstdint>
+#include <climits>
 
 extern "C" {
 #include "postgres.h"
@@ -23,212 +24,276 @@ extern "C" {
 #include <geodesk/feature/WayCoordinateIterator.h>
 #include <geodesk/feature/types.h>
 
+#include "geodesk_coords.h"
+
 using namespace geodesk;
 
 // Hash function for Coordinate
 struct CoordinateHash {
     std::size_t operator()(const Coordinate& c) const {
-        return std::hash<int64_t>()(((int64_t)c.x << 32) | c.y);
+        return std::hash<int64_t>()(((int64_t)c.x << 32) | (uint32_t)c.y);
     }
 };
 
-// Ring structure to hold ways that form a ring
-struct Ring {
-    std::vector<WayPtr> ways;
-    std::vector<Coordinate> coords;
-    
-    Coordinate firstCoord() const {
-        return coords.empty() ? Coordinate(0, 0) : coords.front();
-    }
-    
-    Coordinate lastCoord() const {
-        return coords.empty() ? Coordinate(0, 0) : coords.back();
-    }
+// A way's coordinates within the flat coordinate buffer
+struct Piece {
+    uint32_t start;
+    uint32_t length;
+    bool reversed;
+};
+
+// Ring being assembled, as a chain of pieces
+struct AssemblyRing {
+    std::vector<Piece> pieces;
+    Coordinate first = Coordinate(0, 0);
+    Coordinate last = Coordinate(0, 0);
+    size_t count = 0;       // Coordinates, not counting duplicated junctions
+    bool alive = true;
     
     bool isClosed() const {
-        return coords.size() >= 4 && coords.front() == coords.back();
+        return count >= 4 && first == last;
     }
+};
+
+// Coordinates of all ways being assembled; reused across calls
+static std::vector<Coordinate> coordBuffer;
+
+// Coordinates of the ring being written; reused across calls
+static std::vector<Coordinate> ringCoords;
+
+static inline Coordinate
+pieceFront(const Piece& p)
+{
+    return coordBuffer[p.reversed ? p.start + p.length - 1 : p.start];
+}
+
+static inline Coordinate
+pieceBack(const Piece& p)
+{
+    return coordBuffer[p.reversed ? p.start : p.start + p.length - 1];
+}
+
+/*
+ * Append a piece to a ring, dropping its first coordinate if it repeats
+ * the ring's last one
+ */
+static void
+appendPiece(AssemblyRing& ring, Piece p)
+{
+    if (p.length == 0) return;
     
-    void appendWay(WayPtr way, bool reverse) {
-        ways.push_back(way);
-        
-        WayCoordinateIterator iter;
-        // If the way already has AREA flag, it's a complete area - keep its closing coordinate
-        // Otherwise, get raw coordinates for assembly
-        int flags = way.flags();
-        bool isCompleteArea = (flags & AREA) != 0;
-        iter.start(way, flags);
-        int count = isCompleteArea ? iter.coordinatesRemaining() : iter.storedCoordinatesRemaining();
-        
-        std::vector<Coordinate> wayCoords;
-        wayCoords.reserve(count + 1);  // Reserve space for potential closing coordinate
-        
-        // Extract coordinates - including closing if way is already a complete area
-        if (isCompleteArea) {
-            // Way is already a complete area - get all coordinates including closing
-            while (iter.coordinatesRemaining() > 0) {
-                wayCoords.push_back(iter.next());
-            }
-        } else {
-            // Way needs assembly - get stored coordinates only
-            while (iter.storedCoordinatesRemaining() > 0) {
-                wayCoords.push_back(iter.next());
-            }
-        }
-        
-        if (reverse) {
-            std::reverse(wayCoords.begin(), wayCoords.end());
+    Coordinate front = pieceFront(p);
+    if (ring.count == 0) {
+        ring.first = front;
+        ring.count = p.length;
+    } else {
+        ring.count += (ring.last == front) ? p.length - 1 : p.length;
+    }
+    ring.last = pieceBack(p);
+    ring.pieces.push_back(p);
+}
+
+/*
+ * Append another ring to a ring's end, reversing it if needed
+ */
+static void
+mergeRing(AssemblyRing& ring, AssemblyRing& other, bool reverseOther)
+{
+    if (reverseOther) {
+        for (auto it = other.pieces.rbegin(); it != other.pieces.rend(); ++it) {
+            Piece p = *it;
+            p.reversed = !p.reversed;
+            appendPiece(ring, p);
         }
-        
-        // Skip first coordinate if it matches our last coordinate (avoid duplicates)
-        size_t startIdx = 0;
-        if (!coords.empty() && !wayCoords.empty() && coords.back() == wayCoords.front()) {
-            startIdx = 1;
+    } else {
+        for (const Piece& p : other.pieces) {
+            appendPiece(ring, p);
         }
-        
-        coords.insert(coords.end(), wayCoords.begin() + startIdx, wayCoords.end());
     }
+    other.alive = false;
+    other.pieces.clear();
+}
+
+/*
+ * Copy a way's coordinates into the coordinate buffer
+ */
+static Piece
+readWay(WayPtr way)
+{
+    WayCoordinateIterator iter;
+    // If the way already has AREA flag, it's a complete area - keep its closing coordinate
+    // Otherwise, get raw coordinates for assembly
+    int flags = way.flags();
+    bool isCompleteArea = (flags & AREA) != 0;
+    iter.start(way, flags);
     
-    void reverse() {
-        std::reverse(coords.begin(), coords.end());
-        std::reverse(ways.begin(), ways.end());
-    }
+    Piece p;
+    p.start = static_cast<uint32_t>(coordBuffer.size());
+    p.reversed = false;
     
-    void mergeRing(Ring* other, bool reverseOther) {
-        if (reverseOther) {
-            other->reverse();
+    if (isCompleteArea) {
+        while (iter.coordinatesRemaining() > 0) {
+            coordBuffer.push_back(iter.next());
         }
-        
-        // Skip first coordinate if it matches our last coordinate
-        size_t startIdx = 0;
-        if (!coords.empty() && !other->coords.empty() && coords.back() == other->coords.front()) {
-            startIdx = 1;
+    } else {
+        while (iter.storedCoordinatesRemaining() > 0) {
+            coordBuffer.push_back(iter.next());
         }
-        
-        coords.insert(coords.end(), other->coords.begin() + startIdx, other->coords.end());
-        ways.insert(ways.end(), other->ways.begin(), other->ways.end());
     }
-};
+    
+    p.length = static_cast<uint32_t>(coordBuffer.size() - p.start);
+    return p;
+}
 
-// Assembly function following imposm3 algorithm
+// Endpoint index: open rings that start or end at a coordinate. Entries
+// are added as ring ends move and never removed, so lookups skip stale ones.
+typedef std::unordered_map<Coordinate, std::vector<uint32_t>, CoordinateHash> EndpointIndex;
+
+/*
+ * Find the open ring with the lowest index, other than the given one, that
+ * starts or ends at a coordinate
+ */
+static size_t
+findPartner(const std::vector<AssemblyRing>& rings, const EndpointIndex& endpoints,
+            size_t self, Coordinate c)
+{
+    auto it = endpoints.find(c);
+    if (it == endpoints.end()) return SIZE_MAX;
+    
+    size_t best = SIZE_MAX;
+    for (uint32_t j : it->second) {
+        const AssemblyRing& other = rings[j];
+        if (j == self || j >= best || !other.alive || other.isClosed()) continue;
+        if (other.first == c || other.last == c) best = j;
+    }
+    return best;
+}
+
+/*
+ * Assemble ways into rings
+ *
+ * Each ring in turn is extended at its end with the lowest-numbered open
+ * ring that touches it, until it closes or nothing touches it. This gives
+ * the same rings as merging one pair at a time and starting over, but
+ * keeps the endpoint index up to date instead of rebuilding it. Each ring's
+ * coordinates are gathered from the buffer and converted to the output
+ * SRID into its POINTARRAY in one batch, after dropping vertices within
+ * tolerance imp units of each other (0 keeps them all). Rings smaller than
+ * the tolerance are dropped.
+ *
+ * If bounds is given, the bbox of each returned ring is added to it.
+ */
 std::vector<POINTARRAY*>
-geodesk_assemble_rings(const std::vector<WayPtr>& ways)
+geodesk_assemble_rings(const std::vector<WayPtr>& ways, int32_t srid, double tolerance,
+                       std::vector<GBOX>* bounds)
 {
     std::vector<POINTARRAY*> result;
     if (ways.empty()) return result;
     
+    coordBuffer.clear();
+    
     // Create initial rings from ways
-    std::vector<Ring*> rings;
-    for (const auto& way : ways) {
-        Ring* ring = new Ring();
-        ring->appendWay(way, false);
-        rings.push_back(ring);
+    std::vector<AssemblyRing> rings(ways.size());
+    EndpointIndex endpoints;
+    for (size_t i = 0; i < ways.size(); i++) {
+        appendPiece(rings[i], readWay(ways[i]));
+        if (rings[i].count > 0 && !rings[i].isClosed()) {
+            endpoints[rings[i].first].push_back(static_cast<uint32_t>(i));
+            endpoints[rings[i].last].push_back(static_cast<uint32_t>(i));
+        }
     }
     
-    // Merge rings iteratively until no more merges are possible
-    bool merged = true;
-    while (merged) {
-        merged = false;
+    // Extend each ring at its end as far as possible
+    for (size_t i = 0; i < rings.size(); i++) {
+        AssemblyRing& ring = rings[i];
+        if (!ring.alive || ring.count == 0) continue;
         
-        // Build endpoint index for quick lookup
-        std::unordered_map<Coordinate, std::vector<size_t>, CoordinateHash> endpoints;
-        for (size_t i = 0; i < rings.size(); i++) {
-            if (rings[i] && !rings[i]->isClosed()) {
-                endpoints[rings[i]->firstCoord()].push_back(i);
-                endpoints[rings[i]->lastCoord()].push_back(i);
-            }
-        }
-        
-        // Try to merge rings
-        for (size_t i = 0; i < rings.size(); i++) {
-            if (!rings[i] || rings[i]->isClosed()) continue;
-            
-            Coordinate first = rings[i]->firstCoord();
-            Coordinate last = rings[i]->lastCoord();
+        while (!ring.isClosed()) {
+            size_t j = findPartner(rings, endpoints, i, ring.last);
+            if (j == SIZE_MAX) break;
             
-            // Look for another ring to connect with
-            auto it = endpoints.find(last);
-            if (it != endpoints.end()) {
-                for (size_t j : it->second) {
-                    if (j == i || !rings[j]) continue;
-                    
-                    Ring* other = rings[j];
-                    if (last == other->firstCoord()) {
-                        // Connect end-to-start
-                        rings[i]->mergeRing(other, false);
-                        delete rings[j];
-                        rings[j] = nullptr;
-                        merged = true;
-                        break;
-                    } else if (last == other->lastCoord()) {
-                        // Connect end-to-end (need to reverse other)
-                        rings[i]->mergeRing(other, true);
-                        delete rings[j];
-                        rings[j] = nullptr;
-                        merged = true;
-                        break;
-                    }
-                }
-            }
-            
-            if (merged) break;
+            // Connect end-to-start, or end-to-end (reversing the other)
+            mergeRing(ring, rings[j], !(ring.last == rings[j].first));
+            endpoints[ring.last].push_back(static_cast<uint32_t>(i));
         }
     }
     
     // Collect completed rings and try to close nearly-closed rings
     const int32_t MAX_GAP = 100; // Small gap tolerance in imp units (about 1cm)
-    std::vector<Ring*> completeRings;
     
-    for (Ring* ring : rings) {
-        if (!ring) continue;
+    for (const AssemblyRing& ring : rings) {
+        if (!ring.alive || ring.count == 0) continue;
         
-        if (ring->isClosed()) {
-            completeRings.push_back(ring);
-        } else if (ring->coords.size() >= 3) {
-            // Try to close if endpoints are very close
-            Coordinate first = ring->firstCoord();
-            Coordinate last = ring->lastCoord();
-            int32_t dx = std::abs(first.x - last.x);
-            int32_t dy = std::abs(first.y - last.y);
+        bool close = false;
+        if (!ring.isClosed()) {
+            int32_t dx = std::abs(ring.first.x - ring.last.x);
+            int32_t dy = std::abs(ring.first.y - ring.last.y);
             
-            if (dx < MAX_GAP && dy < MAX_GAP) {
-                ring->coords.push_back(first);
-                completeRings.push_back(ring);
-            } else {
-                // Can't close, discard
-                if (!ring->ways.empty()) {
-                    elog(DEBUG1, "Discarding unclosed ring with %zu coords, gap: dx=%d, dy=%d", 
-                         ring->coords.size(), dx, dy);
-                }
-                delete ring;
+            if (ring.count < 3) {
+                elog(DEBUG1, "Discarding ring with too few points: %zu", ring.count);
+                continue;
             }
-        } else {
-            // Too few points
-            if (!ring->ways.empty()) {
-                elog(DEBUG1, "Discarding ring with too few points: %zu", ring->coords.size());
+            if (dx >= MAX_GAP || dy >= MAX_GAP) {
+                elog(DEBUG1, "Discarding unclosed ring with %zu coords, gap: dx=%d, dy=%d",
+                     ring.count, dx, dy);
+                continue;
             }
-            delete ring;
+            close = true;
         }
-    }
-    
-    // Convert complete rings to POINTARRAY
-    constexpr double IMP_TO_METERS = 40075016.68558 / 4294967294.9999;
-    
-    for (Ring* ring : completeRings) {
-        if (ring->coords.size() >= 4) { // Minimum for a valid ring
-            POINTARRAY* pa = ptarray_construct(0, 0, ring->coords.size());
-            if (pa) {
-                for (size_t i = 0; i < ring->coords.size(); i++) {
-                    POINT4D pt;
-                    pt.x = ring->coords[i].x * IMP_TO_METERS;
-                    pt.y = ring->coords[i].y * IMP_TO_METERS;
-                    ptarray_set_point4d(pa, i, &pt);
-                }
-                result.push_back(pa);
+        
+        size_t count = ring.count + (close ? 1 : 0);
+        if (count < 4) continue; // Minimum for a valid ring
+        
+        // Gather the pieces, then convert them straight into the POINTARRAY
+        ringCoords.clear();
+        Coordinate prev(0, 0);
+        
+        for (const Piece& p : ring.pieces) {
+            for (uint32_t k = 0; k < p.length; k++) {
+                Coordinate c = coordBuffer[p.reversed ? p.start + p.length - 1 - k : p.start + k];
+                if (k == 0 && !ringCoords.empty() && c == prev) continue;
+                ringCoords.push_back(c);
+                prev = c;
             }
         }
-        delete ring;
+        if (close) ringCoords.push_back(ring.first);
+        
+        size_t n = geodesk_decimate_coords(reinterpret_cast<int32_t*>(ringCoords.data()),
+                                           ringCoords.size(), tolerance, 4);
+        int32_t minX = INT32_MAX, minY = INT32_MAX;
+        int32_t maxX = INT32_MIN, maxY = INT32_MIN;
+        for (size_t k = 0; k < n; k++) {
+            minX = std::min(minX, ringCoords[k].x);
+            minY = std::min(minY, ringCoords[k].y);
+            maxX = std::max(maxX, ringCoords[k].x);
+            maxY = std::max(maxY, ringCoords[k].y);
+        }
+        if (tolerance > 0 &&
+            static_cast<double>(maxX) - minX < tolerance &&
+            static_cast<double>(maxY) - minY < tolerance) {
+            continue;
+        }
+        
+        POINTARRAY* pa = ptarray_construct(0, 0, n);
+        if (!pa) continue;
+        geodesk_project_coords(srid, reinterpret_cast<const int32_t*>(ringCoords.data()),
+                               n, reinterpret_cast<double*>(pa->serialized_pointlist));
+        
+        result.push_back(pa);
+        
+        if (bounds) {
+            GBOX box;
+            memset(&box, 0, sizeof(box));
+            double lo[2], hi[2];
+            geodesk_project_point(srid, minX, minY, lo);
+            geodesk_project_point(srid, maxX, maxY, hi);
+            box.xmin = lo[0];
+            box.ymin = lo[1];
+            box.xmax = hi[0];
+            box.ymax = hi[1];
+            bounds->push_back(box);
+        }
     }
     
     return result;
-}
\ No newline at end of file
+}
@@ -0,0 +1,197 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_stats.c
+ *      Cumulative scan statistics for GeoDesk FDW
+ *
+ * Each scan adds its work counters and stage times to a per-table entry
+ * in a shared segment from the DSM registry, so the statistics are kept
+ * across backends without shared_preload_libraries. The table is small
+ * and fixed-size; scans of tables beyond GEODESK_STAT_MAX_TABLES are
+ * only counted in the overflow entry (relid 0).
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "geodesk_fdw.h"
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/dsm_registry.h"
+#include "storage/lwlock.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+
+/* Tables with their own statistics entry */
+#define GEODESK_STAT_MAX_TABLES 512
+
+/* Columns of geodesk_stat_scans_internal() */
+#define GEODESK_STAT_COLS (9 + GEODESK_NUM_STAGES)
+
+typedef struct GeodeskStatEntry
+{
+    Oid dbid;
+    Oid relid;
+    int64 scans;
+    int64 features_visited;
+    int64 features_returned;
+    int64 tiles;
+    int64 ways_assembled;
+    int64 geometry_bytes;
+    int64 jsonb_bytes;
+    double stage_ms[GEODESK_NUM_STAGES];
+} GeodeskStatEntry;
+
+typedef struct GeodeskStatShared
+{
+    int tranche_id;
+    LWLock lock;
+    int nentries;
+    GeodeskStatEntry overflow;
+    GeodeskStatEntry entries[GEODESK_STAT_MAX_TABLES];
+} GeodeskStatShared;
+
+static GeodeskStatShared *geodesk_stat_shared = NULL;
+
+PG_FUNCTION_INFO_V1(geodesk_stat_scans_internal);
+PG_FUNCTION_INFO_V1(geodesk_stat_reset);
+
+static void
+geodesk_stat_init_shared(void *ptr)
+{
+    GeodeskStatShared *shared = (GeodeskStatShared *) ptr;
+
+    memset(shared, 0, sizeof(GeodeskStatShared));
+    shared->tranche_id = LWLockNewTrancheId();
+    LWLockInitialize(&shared->lock, shared->tranche_id);
+}
+
+/*
+ * Attach to the shared statistics, creating them on first use
+ */
+static GeodeskStatShared *
+get_stat_shared(void)
+{
+    bool found;
+
+    if (geodesk_stat_shared)
+        return geodesk_stat_shared;
+
+    geodesk_stat_shared = GetNamedDSMSegment("geodesk_fdw_stats", sizeof(GeodeskStatShared),
+                                             geodesk_stat_init_shared, &found);
+    LWLockRegisterTranche(geodesk_stat_shared->tranche_id, "geodesk_fdw_stats");
+    return geodesk_stat_shared;
+}
+
+/*
+ * Find the entry of a table, adding it if there is room; caller holds
+ * the lock exclusively
+ */
+static GeodeskStatEntry *
+get_stat_entry(GeodeskStatShared *shared, Oid relid)
+{
+    GeodeskStatEntry *entry;
+    int i;
+
+    for (i = 0; i < shared->nentries; i++)
+    {
+        entry = &shared->entries[i];
+        if (entry->relid == relid && entry->dbid == MyDatabaseId)
+            return entry;
+    }
+
+    if (shared->nentries >= GEODESK_STAT_MAX_TABLES)
+        return &shared->overflow;
+
+    entry = &shared->entries[shared->nentries++];
+    memset(entry, 0, sizeof(GeodeskStatEntry));
+    entry->dbid = MyDatabaseId;
+    entry->relid = relid;
+    return entry;
+}
+
+/*
+ * Add the statistics of a finished scan to its table's entry
+ */
+void
+geodesk_stats_report(Oid relid, const GeodeskScanStats *stats)
+{
+    GeodeskStatShared *shared = get_stat_shared();
+    GeodeskStatEntry *entry;
+    int i;
+
+    LWLockAcquire(&shared->lock, LW_EXCLUSIVE);
+    entry = get_stat_entry(shared, relid);
+    entry->scans++;
+    entry->features_visited += stats->features_visited;
+    entry->features_returned += stats->features_returned;
+    entry->tiles += stats->tiles;
+    entry->ways_assembled += stats->ways_assembled;
+    entry->geometry_bytes += stats->geometry_bytes;
+    entry->jsonb_bytes += stats->jsonb_bytes;
+    for (i = 0; i < GEODESK_NUM_STAGES; i++)
+        entry->stage_ms[i] += INSTR_TIME_GET_MILLISEC(stats->stage_time[i]);
+    LWLockRelease(&shared->lock);
+}
+
+static void
+put_stat_entry(ReturnSetInfo *rsinfo, const GeodeskStatEntry *entry)
+{
+    Datum values[GEODESK_STAT_COLS];
+    bool nulls[GEODESK_STAT_COLS];
+    int i = 0;
+    int s;
+
+    memset(nulls, false, sizeof(nulls));
+    values[i++] = ObjectIdGetDatum(entry->relid);
+    values[i++] = ObjectIdGetDatum(entry->dbid);
+    values[i++] = Int64GetDatum(entry->scans);
+    values[i++] = Int64GetDatum(entry->features_visited);
+    values[i++] = Int64GetDatum(entry->features_returned);
+    values[i++] = Int64GetDatum(entry->tiles);
+    values[i++] = Int64GetDatum(entry->ways_assembled);
+    values[i++] = Int64GetDatum(entry->geometry_bytes);
+    values[i++] = Int64GetDatum(entry->jsonb_bytes);
+    for (s = 0; s < GEODESK_NUM_STAGES; s++)
+        values[i++] = Float8GetDatum(entry->stage_ms[s]);
+
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+}
+
+/*
+ * Return the statistics of all tables, for the geodesk_stat_scans view
+ */
+Datum
+geodesk_stat_scans_internal(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    GeodeskStatShared *shared = get_stat_shared();
+    int i;
+
+    InitMaterializedSRF(fcinfo, 0);
+
+    LWLockAcquire(&shared->lock, LW_SHARED);
+    for (i = 0; i < shared->nentries; i++)
+        put_stat_entry(rsinfo, &shared->entries[i]);
+    if (shared->overflow.scans > 0)
+        put_stat_entry(rsinfo, &shared->overflow);
+    LWLockRelease(&shared->lock);
+
+    return (Datum) 0;
+}
+
+/*
+ * Discard all scan statistics
+ */
+Datum
+geodesk_stat_reset(PG_FUNCTION_ARGS)
+{
+    GeodeskStatShared *shared = get_stat_shared();
+
+    LWLockAcquire(&shared->lock, LW_EXCLUSIVE);
+    shared->nentries = 0;
+    memset(&shared->overflow, 0, sizeof(GeodeskStatEntry));
+    LWLockRelease(&shared->lock);
+
+    PG_RETURN_VOID();
+}
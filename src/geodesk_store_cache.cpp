@@ -0,0 +1,130 @@
+/*-------------------------------------------------------------------------
+ *
+ * geodesk_store_cache.cpp
+ *      Per-backend cache of open GOL stores
+ *
+ * Opening a GOL file maps it and reads its header and tile index, which
+ * dominates the cost of short bbox queries. Stores are kept open here,
+ * keyed by datasource path, so that scans only need to build their
+ * filtered views on top of an already-open store. An entry is reopened
+ * when the file's device, inode, size or mtime changes, and the cache is
+ * trimmed to geodesk_fdw.store_cache_size entries in LRU order.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <list>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include <geodesk/geodesk.h>
+
+extern "C" {
+#include "postgres.h"
+#include "geodesk_fdw.h"
+}
+
+using namespace geodesk;
+
+// Include shared connection structure
+#include "geodesk_connection_internal.h"
+
+// Most recently used entry first
+static std::list<std::shared_ptr<GeodeskStoreEntry>> store_cache;
+
+/*
+ * Check whether an entry still refers to the file currently at its path
+ */
+static bool
+store_entry_is_current(const GeodeskStoreEntry& entry, const struct stat& st)
+{
+    return entry.device == st.st_dev &&
+           entry.inode == st.st_ino &&
+           entry.size == st.st_size &&
+           entry.mtime.tv_sec == st.st_mtim.tv_sec &&
+           entry.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+/*
+ * Drop least recently used entries beyond the configured limit
+ */
+static void
+store_cache_trim(size_t limit)
+{
+    while (store_cache.size() > limit)
+    {
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("geodesk store cache: evicting '%s'",
+                        store_cache.back()->path.c_str())));
+        store_cache.pop_back();
+    }
+}
+
+/*
+ * Return an open store for the given path, opening it if necessary
+ *
+ * Throws on failure; callers translate exceptions into PostgreSQL errors.
+ */
+std::shared_ptr<GeodeskStoreEntry>
+geodesk_store_cache_acquire(const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        int saved_errno = errno;
+        throw std::runtime_error(strerror(saved_errno));
+    }
+
+    for (auto it = store_cache.begin(); it != store_cache.end(); ++it)
+    {
+        if ((*it)->path != path) continue;
+
+        if (store_entry_is_current(**it, st))
+        {
+            // Move to front
+            std::shared_ptr<GeodeskStoreEntry> entry = *it;
+            store_cache.erase(it);
+            store_cache.push_front(entry);
+            store_cache_trim(geodesk_store_cache_size);
+            return entry;
+        }
+
+        // File was replaced or modified; scans still using the old
+        // store keep their reference until they finish
+        ereport(DEBUG1,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("geodesk store cache: '%s' changed on disk, reopening", path)));
+        store_cache.erase(it);
+        break;
+    }
+
+    auto entry = std::make_shared<GeodeskStoreEntry>();
+    entry->path = path;
+    entry->device = st.st_dev;
+    entry->inode = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    entry->features = std::make_unique<Features>(path);
+
+    ereport(DEBUG1,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("geodesk store cache: opened '%s'", path)));
+
+    if (geodesk_store_cache_size > 0)
+    {
+        store_cache.push_front(entry);
+        store_cache_trim(geodesk_store_cache_size);
+    }
+    else
+    {
+        // Caching disabled - the store closes with the last scan using it
+        store_cache.clear();
+    }
+
+    return entry;
+}
@@ -3,11 +3,23 @@
  * geodesk_tags_jsonb.cpp
  *      Direct JSONB construction for OSM tags (optimized)
  *
+ * Tags are written straight into the Jsonb binary format rather than
+ * going through pushJsonbValue, which builds a JsonbValue tree, sorts and
+ * deduplicates its keys, and then serializes it with JsonbValueToJsonb.
+ * A Jsonb object stores its keys sorted by length and then bytewise, so
+ * the order is computed once per distinct set of keys and cached on the
+ * connection. Keys are identified by address: global-string keys are
+ * shared by all features of a store, so the few common key sets are
+ * sorted once per scan.
+ *
  *-------------------------------------------------------------------------
  */
 
 // Standard library includes first
+#include <algorithm>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <exception>
 
 // Include libgeodesk BEFORE PostgreSQL headers to avoid macro conflicts
@@ -31,95 +43,206 @@ extern "C" {
 #include "geodesk_fdw.h"
 }
 
+// Distinct key sets whose order is kept per connection
+static constexpr size_t MAX_CACHED_KEY_ORDERS = 4096;
+
+/*
+ * Build an empty JSONB object {}
+ */
+static Datum
+empty_jsonb_object()
+{
+    JsonbParseState *state = NULL;
+    pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
+    JsonbValue *result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
+    return JsonbPGetDatum(JsonbValueToJsonb(result));
+}
+
+/*
+ * Jsonb key order: shorter keys first, then bytewise
+ */
+static inline bool
+jsonb_key_less(std::string_view a, std::string_view b)
+{
+    if (a.length() != b.length()) return a.length() < b.length();
+    return memcmp(a.data(), b.data(), a.length()) < 0;
+}
+
+/*
+ * Get the Jsonb order of the current feature's keys, computing it if this
+ * key set hasn't been seen yet
+ *
+ * Returns nullptr if two keys are equal, which the binary writer doesn't
+ * handle.
+ */
+static const std::vector<uint32_t>*
+get_key_order(GeodeskConnection* conn)
+{
+    const std::vector<std::string_view>& keys = conn->tags_keys;
+
+    std::string signature;
+    signature.reserve(keys.size() * sizeof(const char*));
+    for (std::string_view key : keys)
+    {
+        const char* addr = key.data();
+        signature.append(reinterpret_cast<const char*>(&addr), sizeof(addr));
+    }
+
+    auto found = conn->tag_key_orders.find(signature);
+    if (found != conn->tag_key_orders.end()) return &found->second;
+
+    std::vector<uint32_t> order(keys.size());
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [&](uint32_t a, uint32_t b) { return jsonb_key_less(keys[a], keys[b]); });
+
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        if (keys[order[i - 1]] == keys[order[i]]) return nullptr;
+    }
+
+    if (conn->tag_key_orders.size() >= MAX_CACHED_KEY_ORDERS) conn->tag_key_orders.clear();
+    return &conn->tag_key_orders.emplace(std::move(signature), std::move(order)).first->second;
+}
+
+/*
+ * Fill in the JEntry of the i-th child of an object
+ *
+ * Every JB_OFFSET_STRIDE'th entry stores the end offset of its data, the
+ * others its length, as convertJsonbObject does.
+ */
+static inline void
+set_jentry(JEntry* children, size_t i, uint32 len, uint32 end)
+{
+    children[i] = (i % JB_OFFSET_STRIDE == 0) ?
+        (JENTRY_ISSTRING | JENTRY_HAS_OFF | end) :
+        (JENTRY_ISSTRING | len);
+}
+
+/*
+ * Write the current feature's tags as a Jsonb object of strings
+ *
+ * Returns 0 if the tags can't be written this way.
+ */
+static Datum
+write_tags_jsonb(GeodeskConnection* conn)
+{
+    const std::vector<std::string_view>& keys = conn->tags_keys;
+    const std::vector<std::string>& values = conn->tags_values;
+    size_t count = keys.size();
+
+    const std::vector<uint32_t>* order = get_key_order(conn);
+    if (!order) return (Datum) 0;
+
+    size_t data_len = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        data_len += keys[i].length() + values[i].length();
+    }
+    if (data_len > JENTRY_OFFLENMASK || count > JB_CMASK) return (Datum) 0;
+
+    size_t size = VARHDRSZ + sizeof(uint32) + 2 * count * sizeof(JEntry) + data_len;
+    char* buf = static_cast<char*>(palloc(size));
+    SET_VARSIZE(buf, size);
+
+    uint32 header = static_cast<uint32>(count) | JB_FOBJECT;
+    memcpy(buf + VARHDRSZ, &header, sizeof(header));
+
+    JEntry* children = reinterpret_cast<JEntry*>(buf + VARHDRSZ + sizeof(uint32));
+    char* data = reinterpret_cast<char*>(children + 2 * count);
+    uint32 end = 0;
+
+    // All keys in sorted order, then the values in the same order
+    for (size_t i = 0; i < count; i++)
+    {
+        std::string_view key = keys[(*order)[i]];
+        memcpy(data + end, key.data(), key.length());
+        end += key.length();
+        set_jentry(children, i, key.length(), end);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        const std::string& value = values[(*order)[i]];
+        memcpy(data + end, value.data(), value.length());
+        end += value.length();
+        set_jentry(children, count + i, value.length(), end);
+    }
+
+    return PointerGetDatum(buf);
+}
+
+/*
+ * Build the tags JSONB through pushJsonbValue, for tags the binary writer
+ * can't handle
+ */
+static Datum
+build_tags_jsonb(GeodeskConnection* conn)
+{
+    JsonbParseState *state = NULL;
+    JsonbValue key_val, value_val;
+
+    pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
+    for (size_t i = 0; i < conn->tags_keys.size(); i++)
+    {
+        key_val.type = jbvString;
+        key_val.val.string.val = const_cast<char*>(conn->tags_keys[i].data());
+        key_val.val.string.len = conn->tags_keys[i].length();
+        pushJsonbValue(&state, WJB_KEY, &key_val);
+
+        value_val.type = jbvString;
+        value_val.val.string.val = const_cast<char*>(conn->tags_values[i].data());
+        value_val.val.string.len = conn->tags_values[i].length();
+        pushJsonbValue(&state, WJB_VALUE, &value_val);
+    }
+    JsonbValue *result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
+    return JsonbPGetDatum(JsonbValueToJsonb(result));
+}
+
 extern "C" {
 
 /*
  * Build JSONB directly from tags without intermediate JSON string
  * This is much more efficient than building a string and parsing it
- * 
+ *
  * Returns a JSONB Datum that can be directly stored in a tuple
  */
 __attribute__((visibility("default")))
 Datum
 geodesk_get_tags_jsonb_direct(GeodeskConnectionHandle handle, GeodeskFeature* feature)
 {
-    if (!handle || !feature) 
-    {
-        /* Return empty JSONB object {} */
-        JsonbParseState *state = NULL;
-        pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-        JsonbValue *result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
-        return JsonbPGetDatum(JsonbValueToJsonb(result));
-    }
-    
+    if (!handle || !feature) return empty_jsonb_object();
+
     auto conn = reinterpret_cast<GeodeskConnection*>(handle);
-    
+
     /* Return empty object for null feature */
-    if (!conn->current_feature) 
-    {
-        JsonbParseState *state = NULL;
-        pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-        JsonbValue *result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
-        return JsonbPGetDatum(JsonbValueToJsonb(result));
-    }
-    
+    if (!conn->current_feature) return empty_jsonb_object();
+
     try
     {
         geodesk::Feature f = *conn->current_feature;
         geodesk::Tags tags = f.tags();
-        
-        /* Build JSONB directly */
-        JsonbParseState *state = NULL;
-        JsonbValue key_val, value_val;
-        
-        /* Start the JSONB object */
-        pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-        
-        /* Iterate through tags */
-        for(geodesk::Tag tag : tags)
+
+        /* Collect keys and values; keys point into the store */
+        conn->tags_keys.clear();
+        conn->tags_values.clear();
+        for (geodesk::Tag tag : tags)
         {
-            /* Add the key */
-            std::string_view key_sv = tag.key();
-            key_val.type = jbvString;
-            key_val.val.string.val = const_cast<char*>(key_sv.data());
-            key_val.val.string.len = key_sv.length();
-            pushJsonbValue(&state, WJB_KEY, &key_val);
-            
-            /* Add the value */
-            std::string value_str = tag.value();  /* TagValue converts to std::string */
-            value_val.type = jbvString;
-            
-            /* 
-             * We need to ensure the string stays valid during JSONB construction
-             * PostgreSQL will copy the data when building the final JSONB
-             */
-            char* value_copy = (char*)palloc(value_str.length() + 1);
-            memcpy(value_copy, value_str.c_str(), value_str.length());
-            value_copy[value_str.length()] = '\0';
-            
-            value_val.val.string.val = value_copy;
-            value_val.val.string.len = value_str.length();
-            pushJsonbValue(&state, WJB_VALUE, &value_val);
+            conn->tags_keys.push_back(tag.key());
+            conn->tags_values.push_back(tag.value());  /* TagValue converts to std::string */
         }
-        
-        /* End the JSONB object */
-        JsonbValue *result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
-        
-        /* Convert to Jsonb datum */
-        return JsonbPGetDatum(JsonbValueToJsonb(result));
+
+        Datum result = write_tags_jsonb(conn);
+        return result ? result : build_tags_jsonb(conn);
     }
     catch (const std::exception& e)
     {
         ereport(WARNING,
                 (errcode(ERRCODE_FDW_ERROR),
                  errmsg("Failed to build tags JSONB: %s", e.what())));
-        
+
         /* Return empty object on error */
-        JsonbParseState *state = NULL;
-        pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-        JsonbValue *result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
-        return JsonbPGetDatum(JsonbValueToJsonb(result));
+        return empty_jsonb_object();
     }
 }
 
-} // extern "C"
\ No newline at end of file
+} // extern "C"
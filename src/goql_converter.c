@@ -2,15 +2,32 @@
  * goql_converter.c
  *
  * Convert PostgreSQL WHERE clauses to GOQL queries for tag filtering
+ *
+ * Clauses are converted into a disjunction of GOQL selectors, each a set
+ * of feature types and a conjunction of tag conditions. AND combines two
+ * disjunctions selector by selector, OR concatenates them, and NOT is
+ * pushed down to the conditions (De Morgan), which each have a GOQL form
+ * for being true and one for being false, so SQL's NULL results and
+ * GOQL's missing tags line up.
+ *
+ * Most conditions convert exactly and are not rechecked. Numeric
+ * comparisons and patterns only narrow the scan: GOQL may read numbers
+ * and match patterns a little differently, so the clause stays a local
+ * qual. So do missing tags, which GOQL can't tell from tags valued "no",
+ * and conditions on ways or relations alone, which GOQL's areas mix.
  */
 
 #include "postgres.h"
+
+#include <ctype.h>
+
 #include "catalog/pg_type.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "nodes/primnodes.h"
 #include "optimizer/optimizer.h"
 #include "optimizer/restrictinfo.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/jsonb.h"
@@ -18,6 +35,31 @@
 
 #include "geodesk_fdw.h"
 
+/* Feature types of a selector, by GOQL type letter */
+#define GOQL_TYPE_NODE      0x01    /* n */
+#define GOQL_TYPE_WAY       0x02    /* w */
+#define GOQL_TYPE_AREA      0x04    /* a */
+#define GOQL_TYPE_RELATION  0x08    /* r */
+#define GOQL_TYPE_ALL       0x0F    /* * */
+
+/* Selectors a filter may expand to; larger ORs are left to PostgreSQL */
+#define GOQL_MAX_SELECTORS 16
+
+typedef struct GoqlSelector
+{
+    int types;                /* GOQL_TYPE_* */
+    char *tags;               /* Tag conditions, e.g. [highway=primary][name] */
+    int eq_len;               /* Length of "[key=" if tags is a single equality, else 0 */
+} GoqlSelector;
+
+typedef struct GoqlContext
+{
+    char **column_tags;       /* Tag key of each text tag column, by attnum - 1 */
+    int ncolumns;
+} GoqlContext;
+
+static bool convert_expr(Expr *expr, GoqlContext *cxt, bool negate, List **out, bool *exact);
+
 /*
  * Check if an expression is a JSONB field access (tags->>'key')
  */
@@ -27,336 +69,921 @@ is_jsonb_field_access(Expr *expr, char **key_out, Var **var_out)
     OpExpr *op;
     List *args;
     Expr *arg1, *arg2;
-    
+
     if (!IsA(expr, OpExpr))
         return false;
-    
+
     op = (OpExpr *)expr;
-    
+
     /* Check if this is the ->> operator (jsonb_get_text) */
     if (get_func_name(op->opfuncid) == NULL ||
         strcmp(get_func_name(op->opfuncid), "jsonb_object_field_text") != 0)
         return false;
-    
+
     args = op->args;
     if (list_length(args) != 2)
         return false;
-    
+
     arg1 = (Expr *)linitial(args);
     arg2 = (Expr *)lsecond(args);
-    
+
     /* First argument should be a Var (the tags column) */
     if (!IsA(arg1, Var))
         return false;
-    
+
     /* Second argument should be a Const (the key) */
     if (!IsA(arg2, Const))
         return false;
-    
+
     {
         Const *key_const = (Const *)arg2;
         if (key_const->consttype != TEXTOID || key_const->constisnull)
             return false;
-        
+
         /* Extract the key */
         if (key_out)
             *key_out = TextDatumGetCString(key_const->constvalue);
-        
+
         if (var_out)
             *var_out = (Var *)arg1;
     }
-    
+
     return true;
 }
 
 /*
- * Extract tag filter from equality expression
- * Returns allocated GOQL string or NULL if not a tag filter
+ * Check if an expression is a tag reference: tags->>'key', or a text
+ * column mapped to a tag by its "tag" option
  */
-static char *
-extract_tag_equality(Expr *expr)
+static bool
+is_tag_reference(Expr *expr, GoqlContext *cxt, char **key_out)
 {
-    OpExpr *op;
-    List *args;
+    Var *var;
+
+    if (is_jsonb_field_access(expr, key_out, NULL))
+        return true;
+
+    /* varchar columns are compared as text */
+    if (expr && IsA(expr, RelabelType))
+        expr = ((RelabelType *) expr)->arg;
+
+    if (!cxt->column_tags || !expr || !IsA(expr, Var))
+        return false;
+
+    var = (Var *) expr;
+    if (var->varlevelsup != 0 || var->varattno <= 0 || var->varattno > cxt->ncolumns ||
+        !cxt->column_tags[var->varattno - 1])
+        return false;
+
+    if (key_out)
+        *key_out = cxt->column_tags[var->varattno - 1];
+    return true;
+}
+
+static bool
+is_numeric_type(Oid typid)
+{
+    return typid == INT2OID || typid == INT4OID || typid == INT8OID ||
+           typid == FLOAT4OID || typid == FLOAT8OID || typid == NUMERICOID;
+}
+
+/*
+ * Check if an expression is a tag reference cast to a number, as in
+ * (tags->>'height')::numeric
+ */
+static bool
+is_numeric_tag_reference(Expr *expr, GoqlContext *cxt, char **key_out)
+{
+    CoerceViaIO *coerce;
+
+    if (!expr || !IsA(expr, CoerceViaIO))
+        return false;
+
+    coerce = (CoerceViaIO *) expr;
+    return is_numeric_type(coerce->resulttype) &&
+           is_tag_reference(coerce->arg, cxt, key_out);
+}
+
+/*
+ * Append a tag key or value, quoted unless it is a plain word
+ *
+ * Returns false for strings GOQL can't match literally: quoted strings
+ * take * as a wildcard, and there is no escape for quotes.
+ */
+static bool
+append_goql_string(StringInfo buf, const char *s)
+{
+    const char *p;
+    bool plain = (isalpha((unsigned char) s[0]) || s[0] == '_');
+
+    for (p = s; *p; p++)
+    {
+        if (*p == '"' || *p == '\\' || *p == '*' || (unsigned char) *p < ' ')
+            return false;
+        if (!isalnum((unsigned char) *p) && *p != '_' && *p != ':')
+            plain = false;
+    }
+
+    if (plain)
+        appendStringInfoString(buf, s);
+    else
+    {
+        if (s[0] == '\0')
+            return false;
+        appendStringInfoChar(buf, '"');
+        appendStringInfoString(buf, s);
+        appendStringInfoChar(buf, '"');
+    }
+    return true;
+}
+
+/*
+ * Get the text values of an IN list, which the planner has usually folded
+ * into an array constant
+ */
+static List *
+text_array_values(Expr *expr)
+{
+    List *values = NIL;
+
+    if (IsA(expr, ArrayExpr))
+    {
+        ListCell *lc;
+
+        foreach(lc, ((ArrayExpr *) expr)->elements)
+        {
+            Const *elem = (Const *) lfirst(lc);
+
+            if (!IsA(elem, Const) || elem->consttype != TEXTOID || elem->constisnull)
+                return NIL;
+            values = lappend(values, TextDatumGetCString(elem->constvalue));
+        }
+    }
+    else if (IsA(expr, Const) && ((Const *) expr)->consttype == TEXTARRAYOID &&
+             !((Const *) expr)->constisnull)
+    {
+        Datum *elems;
+        bool *nulls;
+        int nelems;
+        int i;
+
+        deconstruct_array_builtin(DatumGetArrayTypeP(((Const *) expr)->constvalue), TEXTOID,
+                                  &elems, &nulls, &nelems);
+        for (i = 0; i < nelems; i++)
+        {
+            if (nulls[i])
+                return NIL;
+            values = lappend(values, TextDatumGetCString(elems[i]));
+        }
+    }
+
+    return values;
+}
+
+/*
+ * Append [key=v1,v2,...], or when negated [key=*][key!=v1,v2,...]: SQL
+ * compares a missing tag as NULL, while GOQL's != matches it
+ */
+static bool
+append_tag_values(StringInfo cond, const char *key, List *values, bool equal)
+{
+    ListCell *lc;
+
+    if (values == NIL)
+        return false;
+
+    appendStringInfoChar(cond, '[');
+    if (!equal)
+    {
+        if (!append_goql_string(cond, key))
+            return false;
+        appendStringInfoString(cond, "=*][");
+    }
+    if (!append_goql_string(cond, key))
+        return false;
+    appendStringInfoString(cond, equal ? "=" : "!=");
+
+    foreach(lc, values)
+    {
+        if (lc != list_head(values))
+            appendStringInfoChar(cond, ',');
+        if (!append_goql_string(cond, (char *) lfirst(lc)))
+            return false;
+    }
+
+    appendStringInfoChar(cond, ']');
+    return true;
+}
+
+/*
+ * Convert tags->>'key' = 'value' and <>; a tag column may stand for
+ * tags->>'key'
+ */
+static bool
+convert_tag_equality(OpExpr *op, GoqlContext *cxt, bool negate, StringInfo cond)
+{
+    char *opname = get_opname(op->opno);
     Expr *left, *right;
     char *key = NULL;
-    Var *var = NULL;
     Const *value_const;
-    char *value;
-    StringInfoData goql;
-    
-    if (!IsA(expr, OpExpr))
-        return NULL;
-    
-    op = (OpExpr *)expr;
-    
-    /* Check if this is an equality operator */
-    {
-        char *opname = get_opname(op->opno);
-        if (opname == NULL || strcmp(opname, "=") != 0)
-            return NULL;
-    }
-    
-    args = op->args;
-    if (list_length(args) != 2)
-        return NULL;
-    
-    left = (Expr *)linitial(args);
-    right = (Expr *)lsecond(args);
-    
-    /* Check if left side is tags->>'key' */
-    if (!is_jsonb_field_access(left, &key, &var))
+
+    if (opname == NULL || (strcmp(opname, "=") != 0 && strcmp(opname, "<>") != 0))
+        return false;
+
+    left = (Expr *) linitial(op->args);
+    right = (Expr *) lsecond(op->args);
+
+    /* Check if left side is tags->>'key' or a tag column */
+    if (!is_tag_reference(left, cxt, &key))
     {
         Expr *temp;
-        
+
         /* Maybe it's on the right side */
-        if (!is_jsonb_field_access(right, &key, &var))
-            return NULL;
-        
+        if (!is_tag_reference(right, cxt, &key))
+            return false;
+
         /* Swap so value is on the right */
         temp = left;
         left = right;
         right = temp;
     }
-    
+
     /* Right side should be a constant */
     if (!IsA(right, Const))
-        return NULL;
-    
-    value_const = (Const *)right;
+        return false;
+
+    value_const = (Const *) right;
     if (value_const->consttype != TEXTOID || value_const->constisnull)
-        return NULL;
-    
-    value = TextDatumGetCString(value_const->constvalue);
-    
-    /* Build GOQL expression: [key=value] */
-    initStringInfo(&goql);
-    appendStringInfo(&goql, "[%s=%s]", key, value);
-    
-    return goql.data;
+        return false;
+
+    return append_tag_values(cond, key,
+                             list_make1(TextDatumGetCString(value_const->constvalue)),
+                             (strcmp(opname, "=") == 0) != negate);
 }
 
 /*
- * Extract tag filter from IN expression
- * Returns allocated GOQL string or NULL if not a tag filter
+ * Convert tags->>'key' IN (...) and NOT IN (...)
  */
-static char *
-extract_tag_in_list(Expr *expr)
+static bool
+convert_tag_in_list(ScalarArrayOpExpr *saop, GoqlContext *cxt, bool negate, StringInfo cond)
 {
-    ScalarArrayOpExpr *saop;
-    Expr *left, *right;
+    char *opname = get_opname(saop->opno);
     char *key = NULL;
-    Var *var = NULL;
-    ArrayExpr *arr;
-    ListCell *lc;
-    StringInfoData goql;
-    bool first = true;
-    
-    if (!IsA(expr, ScalarArrayOpExpr))
-        return NULL;
-    
-    saop = (ScalarArrayOpExpr *)expr;
-    
-    /* IN uses the = operator with useOr=true */
-    if (!saop->useOr)
-        return NULL;
-    
-    if (list_length(saop->args) != 2)
-        return NULL;
-    
-    left = (Expr *)linitial(saop->args);
-    right = (Expr *)lsecond(saop->args);
-    
-    /* Check if left side is tags->>'key' */
-    if (!is_jsonb_field_access(left, &key, &var))
-        return NULL;
-    
-    /* Right side should be an array */
-    if (!IsA(right, ArrayExpr))
-        return NULL;
-    
-    arr = (ArrayExpr *)right;
-    
-    /* Build GOQL expression: [key=value1,value2,...] */
-    initStringInfo(&goql);
-    appendStringInfo(&goql, "[%s=", key);
-    
-    foreach(lc, arr->elements)
-    {
-        Const *elem = (Const *)lfirst(lc);
-        
-        if (!IsA(elem, Const) || elem->consttype != TEXTOID || elem->constisnull)
-            continue;
-        
-        if (!first)
-            appendStringInfoChar(&goql, ',');
-        
-        appendStringInfoString(&goql, TextDatumGetCString(elem->constvalue));
-        first = false;
-    }
-    
-    appendStringInfoChar(&goql, ']');
-    
-    return goql.data;
+    bool in;
+
+    if (list_length(saop->args) != 2 || opname == NULL)
+        return false;
+
+    /* IN is = ANY (...), NOT IN is <> ALL (...) */
+    if (saop->useOr && strcmp(opname, "=") == 0)
+        in = true;
+    else if (!saop->useOr && strcmp(opname, "<>") == 0)
+        in = false;
+    else
+        return false;
+
+    /* Check if left side is tags->>'key' or a tag column */
+    if (!is_tag_reference((Expr *) linitial(saop->args), cxt, &key))
+        return false;
+
+    return append_tag_values(cond, key, text_array_values((Expr *) lsecond(saop->args)),
+                             in != negate);
 }
 
 /*
- * Extract tag existence check: tags ? 'key' (jsonb_exists operator)
- * Returns GOQL filter [key=*] or NULL if not a tag existence check
+ * Append [key=*] if present, else [!key]
+ *
+ * GOQL's [key] and [!key] read a value of "no" like a missing tag, while
+ * [key=*] matches any value. A tag that is truly missing has no GOQL form,
+ * so [!key] also lets through the features tagged key=no, and *inexact is
+ * set for the clause to be rechecked.
  */
-static char *
-extract_tag_exists(Expr *expr)
+static bool
+append_tag_presence(StringInfo cond, const char *key, bool present, bool *inexact)
 {
-    OpExpr *op;
-    List *args;
-    Expr *left, *right;
+    appendStringInfoString(cond, present ? "[" : "[!");
+    if (!append_goql_string(cond, key))
+        return false;
+    appendStringInfoString(cond, present ? "=*]" : "]");
+    if (!present)
+        *inexact = true;
+    return true;
+}
+
+/*
+ * Convert tag existence: tags ? 'key', and its negation
+ */
+static bool
+convert_tag_exists(OpExpr *op, bool negate, StringInfo cond, bool *inexact)
+{
+    Expr *left = (Expr *) linitial(op->args);
+    Expr *right = (Expr *) lsecond(op->args);
     Const *key_const;
-    char *key;
-    StringInfoData goql;
-    
-    if (!IsA(expr, OpExpr))
-        return NULL;
-    
-    op = (OpExpr *)expr;
-    
+
     /* Check if this is the ? operator (jsonb_exists) */
     if (get_func_name(op->opfuncid) == NULL ||
         strcmp(get_func_name(op->opfuncid), "jsonb_exists") != 0)
-        return NULL;
-    
-    args = op->args;
-    if (list_length(args) != 2)
-        return NULL;
-    
-    left = (Expr *)linitial(args);
-    right = (Expr *)lsecond(args);
-    
+        return false;
+
     /* Check if left side is 'tags' column */
-    if (!IsA(left, Var))
-        return NULL;
-    
-    /* Var is verified to be tags column, no need to save it */
     /* TODO: More robust column identification */
-    
+    if (!IsA(left, Var))
+        return false;
+
     /* Right side should be a text constant (the key) */
     if (!IsA(right, Const))
-        return NULL;
-    
-    key_const = (Const *)right;
+        return false;
+
+    key_const = (Const *) right;
     if (key_const->consttype != TEXTOID || key_const->constisnull)
-        return NULL;
-    
-    key = TextDatumGetCString(key_const->constvalue);
-    
-    /* Build GOQL filter for key existence: [key=*] */
-    initStringInfo(&goql);
-    appendStringInfo(&goql, "[%s=*]", key);
-    
-    return goql.data;
+        return false;
+
+    return append_tag_presence(cond, TextDatumGetCString(key_const->constvalue), !negate,
+                               inexact);
 }
 
 /*
- * Extract tag IS NOT NULL check: tags->>'key' IS NOT NULL
- * Returns GOQL filter [key=*] or NULL if not a tag null check
+ * Convert tags->>'key' IS [NOT] NULL
+ *
+ * The tags object itself is never NULL, so the key is missing exactly
+ * when the value is NULL.
  */
-static char *
-extract_tag_is_not_null(Expr *expr)
+static bool
+convert_tag_null_test(NullTest *nulltest, GoqlContext *cxt, bool negate, StringInfo cond,
+                      bool *inexact)
 {
-    NullTest *nulltest;
     char *key;
-    Var *var;
-    StringInfoData goql;
-    
-    if (!IsA(expr, NullTest))
-        return NULL;
-    
-    nulltest = (NullTest *)expr;
-    
-    /* We want IS NOT NULL, not IS NULL */
-    if (nulltest->nulltesttype != IS_NOT_NULL)
-        return NULL;
-    
-    /* Check if the argument is tags->>'key' */
-    if (!is_jsonb_field_access((Expr *)nulltest->arg, &key, &var))
-        return NULL;
-    
-    /* Build GOQL filter for key existence: [key=*] */
-    initStringInfo(&goql);
-    appendStringInfo(&goql, "[%s=*]", key);
-    
-    return goql.data;
+    bool present = (nulltest->nulltesttype == IS_NOT_NULL) != negate;
+
+    if (!is_tag_reference((Expr *) nulltest->arg, cxt, &key))
+        return false;
+
+    return append_tag_presence(cond, key, present, inexact);
 }
 
 /*
- * Combine multiple GOQL filters with AND logic
- * GOQL uses concatenation for AND: [key1=value1][key2=value2]
+ * Convert a numeric comparison of a tag, e.g. (tags->>'height')::numeric > 50
+ */
+static bool
+convert_tag_comparison(OpExpr *op, GoqlContext *cxt, bool negate, StringInfo cond)
+{
+    /* Flipping the sides is i ^ 2, negating 3 - i */
+    static const char *const ops[] = {"<", "<=", ">", ">="};
+    char *opname = get_opname(op->opno);
+    Expr *left = (Expr *) linitial(op->args);
+    Expr *right = (Expr *) lsecond(op->args);
+    char *key = NULL;
+    Const *value_const;
+    Oid typoutput;
+    bool typisvarlena;
+    char *value;
+    const char *p;
+    int i;
+
+    if (opname == NULL)
+        return false;
+    for (i = 0; i < lengthof(ops); i++)
+    {
+        if (strcmp(opname, ops[i]) == 0)
+            break;
+    }
+    if (i == lengthof(ops))
+        return false;
+
+    if (!is_numeric_tag_reference(left, cxt, &key))
+    {
+        /* 50 < x is x > 50 */
+        if (!is_numeric_tag_reference(right, cxt, &key))
+            return false;
+        right = left;
+        i ^= 2;
+    }
+    if (negate)
+        i = 3 - i;
+
+    if (!IsA(right, Const) || ((Const *) right)->constisnull ||
+        !is_numeric_type(((Const *) right)->consttype))
+        return false;
+
+    /* Only plain decimals, which read the same in GOQL */
+    value_const = (Const *) right;
+    getTypeOutputInfo(value_const->consttype, &typoutput, &typisvarlena);
+    value = OidOutputFunctionCall(typoutput, value_const->constvalue);
+    p = (value[0] == '-') ? value + 1 : value;
+    if (!isdigit((unsigned char) *p))
+        return false;
+    while (isdigit((unsigned char) *p))
+        p++;
+    if (*p == '.')
+    {
+        p++;
+        while (isdigit((unsigned char) *p))
+            p++;
+    }
+    if (*p != '\0')
+        return false;
+
+    appendStringInfoChar(cond, '[');
+    if (!append_goql_string(cond, key))
+        return false;
+    appendStringInfo(cond, "%s%s]", ops[i], value);
+    return true;
+}
+
+/*
+ * Any one byte of a value, newlines included, which ECMAScript's . leaves
+ * out
+ */
+#define GOQL_ANY_BYTE "(.|[^.])"
+
+/*
+ * Translate a LIKE pattern into a regular expression
+ *
+ * libgeodesk matches the UTF-8 bytes of a value, so _ stands for the one
+ * to four bytes of a character. Regex characters are matched literally as
+ * one-character brackets, so the result needs no backslashes; returns NULL
+ * for patterns that would.
  */
 static char *
-combine_goql_filters(List *filters)
+like_to_regex(const char *pattern)
 {
-    StringInfoData result;
-    ListCell *lc;
-    
-    if (filters == NIL)
-        return NULL;
-    
-    initStringInfo(&result);
-    
-    foreach(lc, filters)
+    StringInfoData re;
+    const char *p;
+
+    initStringInfo(&re);
+    appendStringInfoChar(&re, '^');
+    for (p = pattern; *p; p++)
     {
-        char *filter = (char *)lfirst(lc);
-        appendStringInfoString(&result, filter);
+        switch (*p)
+        {
+            case '%':
+                appendStringInfoString(&re, GOQL_ANY_BYTE "*");
+                break;
+            case '_':
+                appendStringInfoString(&re, GOQL_ANY_BYTE "{1,4}");
+                break;
+            case '.': case '$': case '|': case '(': case ')':
+            case '*': case '+': case '?': case '{': case '}': case '[':
+                appendStringInfo(&re, "[%c]", *p);
+                break;
+            case '\\': case ']': case '^': case '"':
+                return NULL;
+            default:
+                appendStringInfoChar(&re, *p);
+                break;
+        }
     }
-    
-    return result.data;
+    appendStringInfoChar(&re, '$');
+    return re.data;
 }
 
 /*
- * Extract tag filters from WHERE clause and convert to GOQL
- * Returns allocated GOQL string or NULL if no tag filters found
+ * Check that a regular expression reads the same in PostgreSQL and GOQL:
+ * no escapes or (?...) groups, which differ between POSIX and ECMAScript
+ * regexes, and nothing that matches characters, which libgeodesk would
+ * match as bytes: no . or brackets, and no multibyte characters a
+ * quantifier could follow
  */
-char *
-extract_goql_from_clauses(List *clauses, List **pushed_clauses)
+static bool
+is_portable_regex(const char *pattern)
 {
-    List *goql_filters = NIL;
-    ListCell *lc;
-    
-    foreach(lc, clauses)
+    const char *p;
+
+    if (pattern[0] == '\0')
+        return false;
+    if (strchr(pattern, '\\') || strchr(pattern, '"') || strchr(pattern, '.') ||
+        strchr(pattern, '[') || strstr(pattern, "(?"))
+        return false;
+    for (p = pattern; *p; p++)
     {
-        RestrictInfo *rinfo = (RestrictInfo *)lfirst(lc);
-        Expr *expr = rinfo->clause;
-        char *goql = NULL;
-        
-        /* Try to extract tag equality filter */
-        goql = extract_tag_equality(expr);
-        
-        /* Try to extract tag IN list filter */
-        if (!goql)
-            goql = extract_tag_in_list(expr);
-        
-        /* Try to extract tag existence check (? operator) */
-        if (!goql)
-            goql = extract_tag_exists(expr);
-        
-        /* Try to extract tag IS NOT NULL check */
-        if (!goql)
-            goql = extract_tag_is_not_null(expr);
+        if (IS_HIGHBIT_SET(*p))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Convert tags->>'key' ~ 'regex' and LIKE 'pattern'
+ *
+ * PostgreSQL's ~ matches anywhere in the value, so the regex is wrapped in
+ * any bytes on either side for GOQL. Negated patterns are not converted.
+ */
+static bool
+convert_tag_pattern(OpExpr *op, GoqlContext *cxt, bool negate, StringInfo cond)
+{
+    char *opname = get_opname(op->opno);
+    Expr *right = (Expr *) lsecond(op->args);
+    char *key = NULL;
+    char *pattern;
+    char *regex;
+
+    if (negate || opname == NULL ||
+        (strcmp(opname, "~") != 0 && strcmp(opname, "~~") != 0))
+        return false;
+
+    if (!is_tag_reference((Expr *) linitial(op->args), cxt, &key))
+        return false;
+
+    if (!IsA(right, Const) || ((Const *) right)->consttype != TEXTOID ||
+        ((Const *) right)->constisnull)
+        return false;
+
+    pattern = TextDatumGetCString(((Const *) right)->constvalue);
+    if (strcmp(opname, "~~") == 0)
+        regex = like_to_regex(pattern);
+    else
+        regex = is_portable_regex(pattern) ?
+            psprintf(GOQL_ANY_BYTE "*(%s)" GOQL_ANY_BYTE "*", pattern) : NULL;
+    if (!regex)
+        return false;
+
+    appendStringInfoChar(cond, '[');
+    if (!append_goql_string(cond, key))
+        return false;
+    appendStringInfo(cond, "~\"%s\"]", regex);
+    return true;
+}
+
+static GoqlSelector *
+make_selector(int types, char *tags, int eq_len)
+{
+    GoqlSelector *sel = (GoqlSelector *) palloc(sizeof(GoqlSelector));
+
+    sel->types = types;
+    sel->tags = tags;
+    sel->eq_len = eq_len;
+    return sel;
+}
+
+static int
+prefix_types(const char *prefix)
+{
+    int types = 0;
+    const char *p;
+
+    for (p = prefix; *p; p++)
+    {
+        switch (*p)
+        {
+            case 'n': types |= GOQL_TYPE_NODE; break;
+            case 'w': types |= GOQL_TYPE_WAY; break;
+            case 'a': types |= GOQL_TYPE_AREA; break;
+            case 'r': types |= GOQL_TYPE_RELATION; break;
+            default: types |= GOQL_TYPE_ALL; break;
+        }
+    }
+    return types;
+}
+
+static char *
+types_prefix(int types)
+{
+    StringInfoData prefix;
+
+    if (types == GOQL_TYPE_ALL)
+        return pstrdup("*");
+
+    initStringInfo(&prefix);
+    if (types & GOQL_TYPE_NODE)
+        appendStringInfoChar(&prefix, 'n');
+    if (types & GOQL_TYPE_WAY)
+        appendStringInfoChar(&prefix, 'w');
+    if (types & GOQL_TYPE_AREA)
+        appendStringInfoChar(&prefix, 'a');
+    if (types & GOQL_TYPE_RELATION)
+        appendStringInfoChar(&prefix, 'r');
+    return prefix.data;
+}
+
+/*
+ * Convert a single condition into one selector
+ */
+static bool
+convert_atom(Expr *expr, GoqlContext *cxt, bool negate, List **out, bool *exact)
+{
+    StringInfoData cond;
+    char *prefix;
+    bool converted = false;
+    bool inexact = false;
+    int eq_len = 0;
+
+    /* A type condition restricts the selector's types instead */
+    prefix = extract_type_clause_prefix(expr);
+    if (prefix)
+    {
+        /* Its complement would also have to split areas by type */
+        if (negate)
+            return false;
         
-        if (goql)
+        /* Areas of the other type, for ways or relations alone */
+        if (!type_prefix_is_exact(prefix))
+            *exact = false;
+        *out = list_make1(make_selector(prefix_types(prefix), "", 0));
+        return true;
+    }
+
+    initStringInfo(&cond);
+
+    if (IsA(expr, OpExpr) && list_length(((OpExpr *) expr)->args) == 2)
+    {
+        OpExpr *op = (OpExpr *) expr;
+
+        converted = convert_tag_equality(op, cxt, negate, &cond);
+        if (converted)
+            eq_len = strchr(cond.data, '=') - cond.data + 1;
+        if (!converted)
+        {
+            resetStringInfo(&cond);
+            converted = convert_tag_exists(op, negate, &cond, &inexact);
+        }
+        if (!converted)
+        {
+            resetStringInfo(&cond);
+            converted = inexact = convert_tag_comparison(op, cxt, negate, &cond);
+        }
+        if (!converted)
         {
-            goql_filters = lappend(goql_filters, goql);
-            if (pushed_clauses)
-                *pushed_clauses = lappend(*pushed_clauses, rinfo);
-            
-            ereport(DEBUG1,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("Extracted GOQL filter: %s", goql)));
+            resetStringInfo(&cond);
+            converted = inexact = convert_tag_pattern(op, cxt, negate, &cond);
         }
     }
-    
-    if (goql_filters == NIL)
-        return NULL;
-    
-    /* Combine all filters with AND logic */
-    return combine_goql_filters(goql_filters);
-}
\ No newline at end of file
+    else if (IsA(expr, ScalarArrayOpExpr))
+    {
+        converted = convert_tag_in_list((ScalarArrayOpExpr *) expr, cxt, negate, &cond);
+        if (converted)
+            eq_len = strchr(cond.data, '=') - cond.data + 1;
+    }
+    else if (IsA(expr, NullTest))
+        converted = convert_tag_null_test((NullTest *) expr, cxt, negate, &cond, &inexact);
+
+    if (!converted)
+        return false;
+
+    /* Only a single [key=values] may be merged with others on the same key */
+    if (eq_len > 0 && (cond.data[1] == '"' || cond.data[eq_len - 2] == '!' ||
+                       strchr(cond.data + 1, '[') != NULL))
+        eq_len = 0;
+    if (inexact)
+        *exact = false;
+
+    *out = list_make1(make_selector(GOQL_TYPE_ALL, cond.data, eq_len));
+    return true;
+}
+
+/*
+ * Both a and b; NULL if that takes more than GOQL_MAX_SELECTORS selectors.
+ * Selectors with no types in common drop out, so the result may be empty.
+ */
+static List *
+goql_and(List *a, List *b, bool *overflow)
+{
+    List *result = NIL;
+    ListCell *la;
+    ListCell *lb;
+
+    *overflow = false;
+    foreach(la, a)
+    {
+        GoqlSelector *sa = (GoqlSelector *) lfirst(la);
+
+        foreach(lb, b)
+        {
+            GoqlSelector *sb = (GoqlSelector *) lfirst(lb);
+            int types = sa->types & sb->types;
+
+            if (types == 0)
+                continue;
+            if (list_length(result) >= GOQL_MAX_SELECTORS)
+            {
+                *overflow = true;
+                return NIL;
+            }
+            result = lappend(result,
+                             make_selector(types, psprintf("%s%s", sa->tags, sb->tags),
+                                           sa->tags[0] == '\0' ? sb->eq_len :
+                                           sb->tags[0] == '\0' ? sa->eq_len : 0));
+        }
+    }
+    return result;
+}
+
+/*
+ * Either a or b; equalities on the same key and types merge into one
+ * selector, as in [highway=primary,secondary]
+ */
+static List *
+goql_or(List *a, List *b, bool *overflow)
+{
+    List *result = list_copy(a);
+    ListCell *lb;
+
+    *overflow = false;
+    foreach(lb, b)
+    {
+        GoqlSelector *sb = (GoqlSelector *) lfirst(lb);
+        ListCell *la;
+        bool merged = false;
+
+        foreach(la, result)
+        {
+            GoqlSelector *sa = (GoqlSelector *) lfirst(la);
+
+            if (sa->types == sb->types && sa->eq_len > 0 && sa->eq_len == sb->eq_len &&
+                strncmp(sa->tags, sb->tags, sa->eq_len) == 0)
+            {
+                /* Drop the closing bracket and append the other values */
+                lfirst(la) = make_selector(sa->types,
+                                           psprintf("%.*s,%s", (int) strlen(sa->tags) - 1,
+                                                    sa->tags, sb->tags + sb->eq_len),
+                                           sa->eq_len);
+                merged = true;
+                break;
+            }
+        }
+        if (merged)
+            continue;
+
+        if (list_length(result) >= GOQL_MAX_SELECTORS)
+        {
+            *overflow = true;
+            return NIL;
+        }
+        result = lappend(result, sb);
+    }
+    return result;
+}
+
+/*
+ * Convert the arguments of an AND
+ *
+ * Arguments that don't convert are left out, which only widens the
+ * result; it is then no longer exact.
+ */
+static bool
+convert_and(List *args, GoqlContext *cxt, bool negate, List **out, bool *exact)
+{
+    List *result = list_make1(make_selector(GOQL_TYPE_ALL, "", 0));
+    bool converted = false;
+    ListCell *lc;
+
+    foreach(lc, args)
+    {
+        List *arg;
+        List *combined;
+        bool overflow;
+
+        if (!convert_expr((Expr *) lfirst(lc), cxt, negate, &arg, exact))
+        {
+            *exact = false;
+            continue;
+        }
+
+        combined = goql_and(result, arg, &overflow);
+        if (overflow)
+        {
+            *exact = false;
+            continue;
+        }
+        result = combined;
+        converted = true;
+    }
+
+    *out = result;
+    return converted;
+}
+
+/*
+ * Convert the arguments of an OR, all of which must convert
+ */
+static bool
+convert_or(List *args, GoqlContext *cxt, bool negate, List **out, bool *exact)
+{
+    List *result = NIL;
+    ListCell *lc;
+
+    foreach(lc, args)
+    {
+        List *arg;
+        bool overflow;
+
+        if (!convert_expr((Expr *) lfirst(lc), cxt, negate, &arg, exact))
+            return false;
+
+        result = goql_or(result, arg, &overflow);
+        if (overflow)
+            return false;
+    }
+
+    *out = result;
+    return true;
+}
+
+/*
+ * Convert an expression into selectors matching the features for which it
+ * is true, or with negate, false
+ *
+ * *exact is cleared if the selectors may also match other features.
+ */
+static bool
+convert_expr(Expr *expr, GoqlContext *cxt, bool negate, List **out, bool *exact)
+{
+    if (IsA(expr, BoolExpr))
+    {
+        BoolExpr *b = (BoolExpr *) expr;
+
+        if (b->boolop == NOT_EXPR)
+            return convert_expr((Expr *) linitial(b->args), cxt, !negate, out, exact);
+
+        /* NOT (a AND b) is NOT a OR NOT b, and the other way around */
+        if ((b->boolop == AND_EXPR) != negate)
+            return convert_and(b->args, cxt, negate, out, exact);
+        return convert_or(b->args, cxt, negate, out, exact);
+    }
+
+    return convert_atom(expr, cxt, negate, out, exact);
+}
+
+/*
+ * Start a filter of all features of the given GOQL type prefix
+ */
+void
+goql_filter_init(GoqlFilter *filter, const char *type_prefix)
+{
+    filter->selectors = list_make1(make_selector(prefix_types(type_prefix ? type_prefix : "*"),
+                                                 "", 0));
+}
+
+/*
+ * Add a WHERE clause to the filter
+ *
+ * Returns false if the clause can't be converted (or would match no
+ * feature at all, which GOQL can't express); the filter is unchanged then.
+ * *exact tells whether the clause is fully answered by the filter, or
+ * still needs to be checked locally.
+ *
+ * column_tags maps text columns with a "tag" option to their tag key
+ * (indexed by attnum - 1); it may be NULL.
+ */
+bool
+goql_filter_add_clause(GoqlFilter *filter, Expr *clause, char **column_tags, int ncolumns,
+                       bool *exact)
+{
+    GoqlContext cxt;
+    List *selectors;
+    List *combined;
+    bool overflow;
+
+    cxt.column_tags = column_tags;
+    cxt.ncolumns = ncolumns;
+
+    *exact = true;
+    if (!convert_expr(clause, &cxt, false, &selectors, exact))
+        return false;
+
+    combined = goql_and(filter->selectors, selectors, &overflow);
+    if (overflow || combined == NIL)
+        return false;
+
+    filter->selectors = combined;
+    return true;
+}
+
+/*
+ * Write the filter as GOQL
+ *
+ * A single selector gives a type prefix and tag conditions; several give
+ * their combined types as the prefix, and the complete query of the
+ * alternatives ("n[amenity=pub],wa[building]") in *alternatives.
+ */
+void
+goql_filter_finish(GoqlFilter *filter, char **type_prefix, char **tags, char **alternatives)
+{
+    StringInfoData query;
+    ListCell *lc;
+    int types = 0;
+
+    if (list_length(filter->selectors) == 1)
+    {
+        GoqlSelector *sel = (GoqlSelector *) linitial(filter->selectors);
+
+        *type_prefix = types_prefix(sel->types);
+        *tags = (sel->tags[0] != '\0') ? sel->tags : NULL;
+        *alternatives = NULL;
+        return;
+    }
+
+    initStringInfo(&query);
+    foreach(lc, filter->selectors)
+    {
+        GoqlSelector *sel = (GoqlSelector *) lfirst(lc);
+
+        if (lc != list_head(filter->selectors))
+            appendStringInfoChar(&query, ',');
+        appendStringInfo(&query, "%s%s", types_prefix(sel->types), sel->tags);
+        types |= sel->types;
+    }
+
+    *type_prefix = types_prefix(types);
+    *tags = NULL;
+    *alternatives = query.data;
+}
@@ -10,6 +10,7 @@
 #include "nodes/nodeFuncs.h"
 #include "optimizer/optimizer.h"
 #include "optimizer/restrictinfo.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 
@@ -112,9 +113,9 @@ extract_type_equality(Expr *expr)
     type_value = DatumGetInt32(value_const->constvalue);
     
     /* Convert type value to GOQL prefix
-     * Note: For ways (type=1), we use "wa" to include both linear ways
-     * and area ways (closed ways with area semantics like buildings).
-     * This ensures we don't miss features like buildings which are areas.
+     * Note: GOQL's "a" holds both area ways (closed ways with area
+     * semantics like buildings) and area relations (multipolygons), so
+     * ways and relations each include it, and are supersets of the type.
      */
     switch (type_value)
     {
@@ -122,13 +123,30 @@ extract_type_equality(Expr *expr)
             return pstrdup("n");
         case 1:  /* Way - includes both linear ways and areas */
             return pstrdup("wa");
-        case 2:  /* Relation */
-            return pstrdup("r");
+        case 2:  /* Relation - includes both other relations and areas */
+            return pstrdup("ar");
         default:
             return NULL;
     }
 }
 
+static void
+note_type_value(int type_value, bool *has_nodes, bool *has_ways, bool *has_relations)
+{
+    switch (type_value)
+    {
+        case 0:
+            *has_nodes = true;
+            break;
+        case 1:
+            *has_ways = true;
+            break;
+        case 2:
+            *has_relations = true;
+            break;
+    }
+}
+
 /*
  * Extract type filter from IN expression
  * Returns GOQL prefix or NULL if not a type filter
@@ -168,44 +186,49 @@ extract_type_in_list(Expr *expr)
     if (var->varattno != 2)  /* type column */
         return NULL;
     
-    /* Right side should be an array */
-    if (!IsA(right, ArrayExpr))
-        return NULL;
-    
-    arr = (ArrayExpr *)right;
-    
-    /* Check which types are in the list */
-    foreach(lc, arr->elements)
+    /* Right side should be an array, usually folded into a constant */
+    if (IsA(right, Const) && ((Const *)right)->consttype == INT4ARRAYOID &&
+        !((Const *)right)->constisnull)
     {
-        Const *elem = (Const *)lfirst(lc);
+        Datum *elems;
+        bool *nulls;
+        int nelems;
         
-        if (!IsA(elem, Const) || elem->consttype != INT4OID || elem->constisnull)
-            continue;
+        deconstruct_array_builtin(DatumGetArrayTypeP(((Const *)right)->constvalue), INT4OID,
+                                  &elems, &nulls, &nelems);
+        for (int i = 0; i < nelems; i++)
+        {
+            if (!nulls[i])
+                note_type_value(DatumGetInt32(elems[i]), &has_nodes, &has_ways, &has_relations);
+        }
+    }
+    else if (IsA(right, ArrayExpr))
+    {
+        arr = (ArrayExpr *)right;
         
-        int type_value = DatumGetInt32(elem->constvalue);
-        switch (type_value)
+        /* Check which types are in the list */
+        foreach(lc, arr->elements)
         {
-            case 0:
-                has_nodes = true;
-                break;
-            case 1:
-                has_ways = true;
-                break;
-            case 2:
-                has_relations = true;
-                break;
+            Const *elem = (Const *)lfirst(lc);
+            
+            if (!IsA(elem, Const) || elem->consttype != INT4OID || elem->constisnull)
+                continue;
+            
+            note_type_value(DatumGetInt32(elem->constvalue), &has_nodes, &has_ways, &has_relations);
         }
     }
+    else
+        return NULL;
     
     /* Build appropriate GOQL prefix
-     * Note: For ways, we use "wa" to include both linear ways and areas
+     * Note: Ways and relations both include areas, as above
      */
     if (has_nodes && has_ways && has_relations)
         return pstrdup("*");  /* All types */
     else if (has_nodes && has_ways)
         return pstrdup("nwa");  /* Nodes + ways (including areas) */
     else if (has_nodes && has_relations)
-        return pstrdup("nr");
+        return pstrdup("nar");  /* Nodes + relations (including areas) */
     else if (has_ways && has_relations)
         return pstrdup("war");  /* Ways (including areas) + relations */
     else if (has_nodes)
@@ -213,11 +236,47 @@ extract_type_in_list(Expr *expr)
     else if (has_ways)
         return pstrdup("wa");  /* Include both linear ways and areas */
     else if (has_relations)
-        return pstrdup("r");
+        return pstrdup("ar");  /* Include both other relations and areas */
     else
         return NULL;
 }
 
+/*
+ * Check whether a prefix from a type condition selects exactly the
+ * features of its types
+ *
+ * An area is a way or a relation, so a prefix with "a" but only one of
+ * "w" and "r" selects some features of the other type, and the condition
+ * must still be checked.
+ */
+bool
+type_prefix_is_exact(const char *prefix)
+{
+    if (strcmp(prefix, "*") == 0 || strchr(prefix, 'a') == NULL)
+        return true;
+    return strchr(prefix, 'w') != NULL && strchr(prefix, 'r') != NULL;
+}
+
+/*
+ * Convert a single type comparison (type = 1, type IN (0, 2)) to a GOQL
+ * prefix
+ * Returns allocated string or NULL if not a type filter
+ */
+char *
+extract_type_clause_prefix(Expr *expr)
+{
+    char *prefix;
+    
+    /* Try to extract type equality filter */
+    prefix = extract_type_equality(expr);
+    
+    /* Try to extract type IN list filter */
+    if (!prefix)
+        prefix = extract_type_in_list(expr);
+    
+    return prefix;
+}
+
 /*
  * Extract type filter from WHERE clauses and return GOQL prefix
  * Returns allocated string or NULL if no type filter found
@@ -231,18 +290,13 @@ extract_type_filter_prefix(List *clauses, List **pushed_clauses)
     foreach(lc, clauses)
     {
         RestrictInfo *rinfo = (RestrictInfo *)lfirst(lc);
-        Expr *expr = rinfo->clause;
-        
-        /* Try to extract type equality filter */
-        prefix = extract_type_equality(expr);
         
-        /* Try to extract type IN list filter */
-        if (!prefix)
-            prefix = extract_type_in_list(expr);
+        prefix = extract_type_clause_prefix(rinfo->clause);
         
         if (prefix)
         {
-            if (pushed_clauses)
+            /* Inexact prefixes only narrow the scan */
+            if (pushed_clauses && type_prefix_is_exact(prefix))
                 *pushed_clauses = lappend(*pushed_clauses, rinfo);
             
             ereport(DEBUG1,
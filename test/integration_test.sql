@@ -99,6 +99,469 @@ EXPLAIN (VERBOSE, COSTS OFF)
 SELECT * FROM test_full
 WHERE type IN (0, 1);
 
+-- Test 9: ANALYZE sampling
+SELECT 'Test 9: ANALYZE' AS test;
+ANALYZE test_full;
+SELECT reltuples > 0 AS has_reltuples FROM pg_class WHERE relname = 'test_full';
+SELECT attname, n_distinct <> 0 AS has_stats
+FROM pg_stats
+WHERE tablename = 'test_full' AND attname IN ('type', 'is_area')
+ORDER BY attname;
+
+-- Test 10: FID lookups
+SELECT 'Test 10: FID lookups' AS test;
+SET geodesk_fdw.enable_id_index = on;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM test_full WHERE fid = ANY(ARRAY[1, 2, 3]::bigint[]);
+-- The index lookup must agree with a full scan (fid + 0 is not pushed down)
+SELECT (SELECT COUNT(*) FROM test_basic WHERE fid = 1) =
+       (SELECT COUNT(*) FROM test_basic WHERE fid + 0 = 1) AS fid_lookup_matches;
+RESET geodesk_fdw.enable_id_index;
+
+-- Test 11: Parameterized spatial join
+SELECT 'Test 11: Parameterized spatial join' AS test;
+CREATE TEMP TABLE probe_areas AS
+SELECT ST_MakeEnvelope(0, 0, 100000, 100000, 3857) AS geom;
+ANALYZE probe_areas;
+SET enable_hashjoin = off;
+SET enable_mergejoin = off;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT COUNT(*) FROM probe_areas p JOIN test_full o ON o.geom && p.geom;
+SELECT (SELECT COUNT(*) FROM probe_areas p JOIN test_full o ON o.geom && p.geom) =
+       (SELECT COUNT(*) FROM test_full
+        WHERE geom && ST_MakeEnvelope(0, 0, 100000, 100000, 3857)) AS join_matches_filter;
+RESET enable_hashjoin;
+RESET enable_mergejoin;
+DROP TABLE probe_areas;
+
+-- Test 12: Spatial predicates as prefilters
+SELECT 'Test 12: Spatial predicates' AS test;
+SELECT (SELECT COUNT(*) FROM test_full
+        WHERE ST_DWithin(geom, ST_SetSRID(ST_MakePoint(50000, 50000), 3857), 5000)) =
+       (SELECT COUNT(*) FROM test_full
+        WHERE ST_Distance(geom, ST_SetSRID(ST_MakePoint(50000, 50000), 3857)) <= 5000)
+       AS dwithin_matches;
+SELECT (SELECT COUNT(*) FROM test_full
+        WHERE ST_Intersects(geom, ST_MakeEnvelope(0, 0, 100000, 100000, 3857))) =
+       (SELECT COUNT(*) FROM test_full
+        WHERE ST_Intersects(ST_MakeEnvelope(0, 0, 100000, 100000, 3857), geom))
+       AS intersects_symmetric;
+-- A function of the same name elsewhere doesn't narrow the scan
+CREATE SCHEMA test_predicates;
+CREATE FUNCTION test_predicates.st_intersects(geometry, geometry) RETURNS boolean
+    AS $$ BEGIN RETURN true; END $$ LANGUAGE plpgsql IMMUTABLE;
+SELECT (SELECT COUNT(*) FROM test_full
+        WHERE test_predicates.st_intersects(geom, ST_MakeEnvelope(0, 0, 1, 1, 3857))) =
+       (SELECT COUNT(*) FROM test_full) AS other_function_not_pushed;
+DROP SCHEMA test_predicates CASCADE;
+-- A constant in another SRID is left to PostGIS, which rejects it
+DO $$
+BEGIN
+    PERFORM COUNT(*) FROM test_full
+    WHERE ST_Intersects(geom, ST_MakeEnvelope(0, 0, 1, 1, 4326));
+    RAISE NOTICE 'mixed_srid_rejected: f';
+EXCEPTION WHEN OTHERS THEN
+    RAISE NOTICE 'mixed_srid_rejected: t';
+END
+$$;
+
+-- Test 13: Tag columns
+SELECT 'Test 13: Tag columns' AS test;
+CREATE FOREIGN TABLE test_tag_columns (
+    fid bigint,
+    name text OPTIONS (tag 'name'),
+    highway varchar OPTIONS (tag 'highway'),
+    lanes integer OPTIONS (tag 'lanes'),
+    tags jsonb
+) SERVER geodesk_test_server
+OPTIONS (
+    datasource 'test/data/test.gol'
+);
+SELECT COUNT(*) = COUNT(*) FILTER (WHERE name IS NOT DISTINCT FROM tags->>'name')
+       AS name_matches_tags
+FROM test_tag_columns;
+SELECT (SELECT COUNT(*) FROM test_tag_columns WHERE highway = 'primary') =
+       (SELECT COUNT(*) FROM test_basic WHERE tags->>'highway' = 'primary')
+       AS pushdown_matches;
+SELECT COUNT(*) AS lanes_with_tag FROM test_tag_columns WHERE lanes IS NOT NULL;
+DROP FOREIGN TABLE test_tag_columns;
+
+-- Test 14: Aggregate pushdown
+SELECT 'Test 14: Aggregate pushdown' AS test;
+EXPLAIN (COSTS OFF) SELECT COUNT(*) FROM test_full WHERE tags->>'building' = 'yes';
+SELECT (SELECT COUNT(*) FROM test_full WHERE tags->>'building' = 'yes') =
+       (SELECT COUNT(*) FROM test_full WHERE tags->>'building' || '' = 'yes')
+       AS count_matches_local;
+SELECT type, is_area, COUNT(*) FROM test_full GROUP BY type, is_area ORDER BY type, is_area;
+SELECT (SELECT SUM(n) FROM (SELECT COUNT(*) AS n FROM test_full GROUP BY type) g) =
+       (SELECT COUNT(*) FROM test_full) AS groups_add_up;
+
+-- Test 15: LIMIT/OFFSET pushdown
+SELECT 'Test 15: LIMIT pushdown' AS test;
+EXPLAIN (COSTS OFF) SELECT fid FROM test_basic WHERE type = 0 LIMIT 10;
+SELECT COUNT(*) <= 10 AS limit_respected
+FROM (SELECT fid FROM test_basic WHERE type = 0 LIMIT 10) s;
+SELECT (SELECT COUNT(*) FROM (SELECT fid FROM test_basic LIMIT 5 OFFSET 3) s) =
+       LEAST(5, GREATEST((SELECT COUNT(*) FROM test_basic) - 3, 0))
+       AS offset_respected;
+
+-- Test 16: Relation geometry cache
+SELECT 'Test 16: Relation geometry cache' AS test;
+CREATE TEMP TABLE relation_geoms AS
+SELECT fid, ST_AsBinary(geom) AS wkb FROM test_full WHERE type = 2;
+SELECT hits AS hits_before FROM geodesk_fdw_geometry_cache_stats() \gset
+SELECT COUNT(*) = 0 AS cached_geoms_match
+FROM relation_geoms r JOIN test_full t ON t.fid = r.fid AND t.type = 2
+WHERE ST_AsBinary(t.geom) IS DISTINCT FROM r.wkb;
+SELECT hits > :hits_before OR (SELECT COUNT(*) FROM relation_geoms WHERE wkb IS NOT NULL) = 0
+       AS cache_hit
+FROM geodesk_fdw_geometry_cache_stats();
+DROP TABLE relation_geoms;
+
+-- Test 17: Member arrays
+SELECT 'Test 17: Member arrays' AS test;
+CREATE FOREIGN TABLE test_member_arrays (
+    fid bigint,
+    type integer,
+    members jsonb,
+    member_ids bigint[],
+    member_types "char"[],
+    member_roles text[]
+) SERVER geodesk_test_server
+OPTIONS (
+    datasource 'test/data/test.gol'
+);
+SELECT COUNT(*) = 0 AS arrays_match_jsonb
+FROM test_member_arrays
+WHERE type = 2 AND members IS NOT NULL
+  AND (cardinality(member_ids) <> jsonb_array_length(members)
+       OR member_ids[1] <> (members->0->>'id')::bigint
+       OR member_roles[1] <> members->0->>'role'
+       OR cardinality(member_types) <> cardinality(member_roles));
+DROP FOREIGN TABLE test_member_arrays;
+
+-- Test 18: Parents of nodes in a bbox scan match per-feature lookups
+SELECT 'Test 18: Parent index' AS test;
+CREATE TEMP TABLE bbox_parents AS
+SELECT fid, parents FROM test_full
+WHERE type = 0 AND geom && ST_MakeEnvelope(0, 0, 100000, 100000, 3857);
+SELECT COUNT(*) = 0 AS parents_match
+FROM bbox_parents b
+JOIN LATERAL (SELECT parents FROM test_full t WHERE t.fid = b.fid AND t.type = 0) l ON true
+WHERE (SELECT array_agg(e::text ORDER BY e::text) FROM jsonb_array_elements(b.parents) e)
+      IS DISTINCT FROM
+      (SELECT array_agg(e::text ORDER BY e::text) FROM jsonb_array_elements(l.parents) e);
+DROP TABLE bbox_parents;
+
+-- Test 19: WGS 84 output matches transformed Web Mercator geometries
+SELECT 'Test 19: srid option' AS test;
+CREATE FOREIGN TABLE test_wgs84 (
+    fid bigint,
+    type integer,
+    geom geometry(Geometry, 4326)
+) SERVER geodesk_test_server
+OPTIONS (
+    datasource 'test/data/test.gol',
+    srid '4326'
+);
+SELECT COUNT(*) = 0 AS wgs84_matches
+FROM (SELECT fid, type, geom FROM test_full LIMIT 1000) m
+JOIN test_wgs84 w ON w.fid = m.fid AND w.type = m.type
+WHERE ST_SRID(w.geom) <> 4326
+   OR ST_HausdorffDistance(w.geom, ST_Transform(m.geom, 4326)) > 1e-7;
+SELECT COUNT(*) > 0 AS bbox_in_degrees
+FROM test_wgs84
+WHERE geom && ST_MakeEnvelope(-180, -85, 180, 85, 4326);
+DROP FOREIGN TABLE test_wgs84;
+
+-- Test 20: Simplified geometries have no more vertices than full ones
+SELECT 'Test 20: simplify_tolerance option' AS test;
+CREATE FOREIGN TABLE test_simplified (
+    fid bigint,
+    type integer,
+    geom geometry(Geometry, 3857)
+) SERVER geodesk_test_server
+OPTIONS (
+    datasource 'test/data/test.gol',
+    simplify_tolerance '50'
+);
+SELECT COUNT(*) = 0 AS simplified_within_full
+FROM (SELECT fid, type, geom FROM test_full WHERE type = 1 LIMIT 1000) f
+JOIN test_simplified s ON s.fid = f.fid AND s.type = f.type
+WHERE s.geom IS NOT NULL
+  AND (ST_NPoints(s.geom) > ST_NPoints(f.geom)
+       OR NOT ST_Covers(ST_Envelope(f.geom), ST_Envelope(s.geom)));
+SELECT COUNT(*) > 0 AS small_features_dropped
+FROM test_simplified
+WHERE type = 1 AND geom IS NULL;
+-- && is rechecked against the simplified geom, so small features drop out
+SELECT COUNT(*) = 0 AS simplified_overlap_rechecked
+FROM test_simplified
+WHERE geom && ST_Transform(ST_MakeEnvelope(14.4, 35.85, 14.55, 35.95, 4326), 3857)
+  AND (geom IS NULL OR NOT ST_Intersects(ST_Envelope(geom),
+       ST_Transform(ST_MakeEnvelope(14.4, 35.85, 14.55, 35.95, 4326), 3857)));
+DROP FOREIGN TABLE test_simplified;
+
+-- Test 21: Vector tiles
+SELECT 'Test 21: geodesk_mvt' AS test;
+SELECT length(geodesk_mvt('test/data/test.gol', 0, 0, 0)) > 0 AS world_tile_has_features;
+-- First byte is the key of field 3 (layers), length-delimited
+SELECT get_byte(geodesk_mvt('test/data/test.gol', 0, 0, 0, 'w', 'ways'), 0) = 26
+       AS starts_with_layer;
+SELECT length(geodesk_mvt('test/data/test.gol', 4, 0, 0, 'n[nonexistent_key_xyz]')) = 0
+       AS empty_tile;
+-- A query libgeodesk can't parse is an error, not a tile of all features
+DO $$
+BEGIN
+    PERFORM geodesk_mvt('test/data/test.gol', 0, 0, 0, 'n[name');
+    RAISE NOTICE 'invalid_goql_rejected: f';
+EXCEPTION WHEN invalid_parameter_value THEN
+    RAISE NOTICE 'invalid_goql_rejected: t';
+END
+$$;
+
+-- Test 22: Scan statistics
+SELECT 'Test 22: geodesk_stat_scans' AS test;
+SELECT geodesk_stat_reset();
+SELECT count(*) > 0 AS has_rows FROM (SELECT fid, tags FROM test_full LIMIT 100) s;
+SELECT scans >= 1 AS scanned,
+       features_returned > 0 AS returned_features,
+       features_visited >= features_returned AS visited_all
+FROM geodesk_stat_scans
+WHERE relid = 'test_full'::regclass;
+EXPLAIN (ANALYZE, COSTS OFF, SUMMARY OFF, TIMING OFF)
+SELECT fid FROM test_full WHERE type = 0 LIMIT 10;
+
+-- Test 23: OR, NOT, numeric and pattern conditions in GOQL
+-- Each count must match the same condition written so it isn't pushed down
+SELECT 'Test 23: Broader GOQL pushdown' AS test;
+SELECT (SELECT count(*) FROM test_basic
+        WHERE tags->>'highway' = 'primary' OR tags->>'highway' = 'secondary') =
+       (SELECT count(*) FROM test_basic
+        WHERE coalesce(tags->>'highway', '') IN ('primary', 'secondary')) AS or_same_key;
+SELECT (SELECT count(*) FROM test_basic
+        WHERE (type = 0 AND tags ? 'amenity') OR (type = 1 AND tags ? 'building')) =
+       (SELECT count(*) FROM test_basic
+        WHERE (type + 0 = 0 AND tags ?| ARRAY['amenity']) OR
+              (type + 0 = 1 AND tags ?| ARRAY['building'])) AS or_mixed_types;
+SELECT (SELECT count(*) FROM test_basic
+        WHERE tags ? 'highway' AND NOT (tags->>'highway' = 'residential')) =
+       (SELECT count(*) FROM test_basic
+        WHERE tags ?| ARRAY['highway'] AND coalesce(tags->>'highway', '') <> 'residential')
+       AS not_equal;
+SELECT (SELECT count(*) FROM test_basic
+        WHERE tags->>'building' LIKE 'ap%' OR tags->>'name' ~ 'Platz') =
+       (SELECT count(*) FROM test_basic
+        WHERE coalesce(tags->>'building', '') LIKE 'ap%' OR
+              coalesce(tags->>'name', '') ~ 'Platz') AS patterns;
+-- _ and . stand for characters, which may take several bytes
+SELECT (SELECT count(*) FROM test_basic WHERE tags->>'name' LIKE '%Stra_e%') =
+       (SELECT count(*) FROM test_basic
+        WHERE coalesce(tags->>'name', '') LIKE '%Stra_e%') AS like_multibyte;
+SELECT count(*) > 0 AS like_matches_eszett FROM test_basic
+WHERE tags->>'name' LIKE '%Stra_e%' AND tags->>'name' LIKE '%Straße%';
+SELECT (SELECT count(*) FROM test_basic WHERE tags->>'name' ~ 'Stra.e') =
+       (SELECT count(*) FROM test_basic
+        WHERE coalesce(tags->>'name', '') ~ 'Stra.e') AS regex_multibyte;
+SELECT (SELECT count(*) FROM test_basic
+        WHERE tags->>'height' ~ '^[0-9]+$' AND (tags->>'height')::numeric > 20) =
+       (SELECT count(*) FROM test_basic
+        WHERE coalesce(tags->>'height', '') ~ '^[0-9]+$' AND
+              coalesce(tags->>'height', '0')::numeric > 20) AS numeric_comparison;
+-- test.gol has features tagged wheelchair=no and access=no, which GOQL's
+-- [key] and [!key] read as missing tags
+SELECT (SELECT count(*) FROM test_basic WHERE tags ? 'wheelchair') =
+       (SELECT count(*) FROM test_basic WHERE tags ?| ARRAY['wheelchair']) AS exists_with_no;
+SELECT (SELECT count(*) FROM test_basic WHERE tags->>'access' IS NOT NULL) =
+       (SELECT count(*) FROM test_basic WHERE tags ?| ARRAY['access']) AS not_null_with_no;
+SELECT (SELECT count(*) FROM test_basic WHERE NOT (tags ? 'wheelchair')) =
+       (SELECT count(*) FROM test_basic WHERE NOT (tags ?| ARRAY['wheelchair'])) AS missing_with_no;
+SELECT (SELECT count(*) FROM test_basic WHERE tags->>'access' IS NULL) =
+       (SELECT count(*) FROM test_basic WHERE NOT (tags ?| ARRAY['access'])) AS null_with_no;
+SELECT (SELECT count(*) FROM test_basic WHERE tags->>'wheelchair' <> 'yes') =
+       (SELECT count(*) FROM test_basic
+        WHERE tags ?| ARRAY['wheelchair'] AND coalesce(tags->>'wheelchair', '') <> 'yes')
+       AS not_equal_with_no;
+-- GOQL areas are ways and relations alike
+SELECT (SELECT count(*) FROM test_full WHERE type = 1 AND tags ? 'building') =
+       (SELECT count(*) FROM test_full WHERE type + 0 = 1 AND tags ?| ARRAY['building'])
+       AS ways_without_relations;
+SELECT (SELECT count(*) FROM test_full WHERE type = 2) =
+       (SELECT count(*) FROM test_full WHERE type + 0 = 2) AS relations_with_areas;
+EXPLAIN (COSTS OFF)
+SELECT fid FROM test_basic
+WHERE (type = 0 AND tags->>'amenity' = 'cafe') OR (type = 1 AND tags ? 'building');
+
+-- Test 24: Bbox filters from parameters, evaluated when the scan starts
+SELECT 'Test 24: Runtime bbox pushdown' AS test;
+SET plan_cache_mode = force_generic_plan;
+PREPARE tile_count(integer, integer, integer) AS
+    SELECT count(*) FROM test_full WHERE geom && ST_TileEnvelope($1, $2, $3);
+EXPLAIN (ANALYZE, COSTS OFF, SUMMARY OFF, TIMING OFF) EXECUTE tile_count(0, 0, 0);
+EXECUTE tile_count(0, 0, 0);
+SELECT count(*) FROM test_full WHERE geom && ST_TileEnvelope(0, 0, 0);
+EXECUTE tile_count(20, 0, 0);
+DEALLOCATE tile_count;
+RESET plan_cache_mode;
+
+-- Test 25: Prewarming
+SELECT 'Test 25: geodesk_prewarm' AS test;
+SELECT geodesk_prewarm('test/data/test.gol') > 0 AS loaded_file;
+SELECT geodesk_prewarm('test/data/test.gol', threads => 4) =
+       geodesk_prewarm('test/data/test.gol') AS threads_load_same;
+SELECT geodesk_prewarm('test/data/test.gol', ST_MakeEnvelope(0, 0, 1, 1, 3857)) <=
+       geodesk_prewarm('test/data/test.gol') AS region_is_subset;
+DO $$
+BEGIN
+    PERFORM geodesk_prewarm('test/data/test.gol', goql => 'n[name');
+    RAISE NOTICE 'invalid_goql_rejected: f';
+EXCEPTION WHEN invalid_parameter_value THEN
+    RAISE NOTICE 'invalid_goql_rejected: t';
+END
+$$;
+SELECT geodesk_prewarm('test/data/test.gol', goql => 'n[nonexistent_key_xyz]') = 0
+       AS no_matching_tiles;
+
+-- Test 26: Pipelined and async scans
+SELECT 'Test 26: Pipelined and async scans' AS test;
+CREATE FOREIGN TABLE test_pipelined (
+    fid bigint,
+    type integer,
+    tags jsonb
+) SERVER geodesk_test_server
+OPTIONS (datasource 'test/data/test.gol', pipeline 'true');
+CREATE FOREIGN TABLE test_async (
+    fid bigint,
+    type integer,
+    tags jsonb
+) SERVER geodesk_test_server
+OPTIONS (datasource 'test/data/test.gol', async_capable 'true');
+SELECT (SELECT count(fid) FROM test_pipelined) =
+       (SELECT count(fid) FROM test_basic) AS pipelined_same_count;
+SELECT (SELECT count(fid) FROM test_pipelined WHERE tags ? 'highway') =
+       (SELECT count(fid) FROM test_basic WHERE tags ? 'highway') AS pipelined_filter_same_count;
+SELECT count(*) = 5 AS pipelined_limit FROM (SELECT fid FROM test_pipelined LIMIT 5) t;
+EXPLAIN (COSTS OFF)
+SELECT fid FROM test_async WHERE type = 0
+UNION ALL
+SELECT fid FROM test_async WHERE type = 1;
+SELECT (SELECT count(*) FROM (SELECT fid FROM test_async WHERE type = 0
+                              UNION ALL
+                              SELECT fid FROM test_async WHERE type = 1) u) =
+       (SELECT count(*) FROM test_basic WHERE type IN (0, 1)) AS async_union_same_count;
+DROP FOREIGN TABLE test_async;
+DROP FOREIGN TABLE test_pipelined;
+
+-- Test 27: Multi-file datasources
+SELECT 'Test 27: Multi-file datasources' AS test;
+CREATE FOREIGN TABLE test_directory (
+    fid bigint,
+    type integer,
+    tags jsonb,
+    source text
+) SERVER geodesk_test_server
+OPTIONS (datasource 'test/data');
+CREATE FOREIGN TABLE test_file_list (
+    fid bigint,
+    type integer,
+    tags jsonb,
+    geom geometry(Geometry, 3857),
+    source text
+) SERVER geodesk_test_server
+OPTIONS (datasource 'test/data/test.gol, test/data/test.gol');
+SELECT (SELECT count(fid) FROM test_directory) =
+       (SELECT count(fid) FROM test_basic) AS directory_same_count;
+SELECT DISTINCT source FROM test_directory;
+SELECT (SELECT count(*) FROM test_file_list) =
+       2 * (SELECT count(*) FROM test_basic) AS list_reads_each_file;
+SELECT (SELECT count(fid) FROM test_file_list) =
+       2 * (SELECT count(fid) FROM test_basic) AS list_scans_each_file;
+-- A box at the corner of the map, outside the footprint of the file
+EXPLAIN (COSTS OFF)
+SELECT fid FROM test_file_list
+WHERE geom && ST_MakeEnvelope(-20037000, -20037000, -20036000, -20036000, 3857);
+SELECT count(fid) = 0 AS outside_footprint FROM test_file_list
+WHERE geom && ST_MakeEnvelope(-20037000, -20037000, -20036000, -20036000, 3857);
+-- Files as partitions
+CREATE TABLE test_partitioned (
+    fid bigint,
+    type integer,
+    tags jsonb,
+    geom geometry(Geometry, 3857),
+    is_area boolean,
+    source text
+) PARTITION BY LIST (source);
+IMPORT FOREIGN SCHEMA "test/data" FROM SERVER geodesk_test_server INTO public
+    OPTIONS (partition_of 'test_partitioned');
+SELECT (SELECT count(fid) FROM test_partitioned) =
+       (SELECT count(fid) FROM test_basic) AS partitions_same_count;
+SET enable_partitionwise_aggregate = on;
+EXPLAIN (COSTS OFF) SELECT count(*) FROM test_partitioned;
+SELECT (SELECT count(*) FROM test_partitioned) =
+       (SELECT count(*) FROM test_basic) AS partitionwise_count;
+RESET enable_partitionwise_aggregate;
+DROP TABLE test_partitioned;
+DROP FOREIGN TABLE test_file_list;
+DROP FOREIGN TABLE test_directory;
+
+-- Test 28: Early filters
+SELECT 'Test 28: Early filters' AS test;
+EXPLAIN (COSTS OFF)
+SELECT fid, geom FROM test_full WHERE tags->>'name' ILIKE '%platz%';
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+SELECT fid, geom FROM test_full WHERE tags->>'name' ILIKE '%platz%';
+-- Without an expensive column, the same condition is an ordinary Filter
+SELECT (SELECT count(*) FROM test_full
+        WHERE tags->>'name' ILIKE '%platz%' AND (geom IS NULL OR geom IS NOT NULL)) =
+       (SELECT count(fid) FROM test_full WHERE tags->>'name' ILIKE '%platz%')
+       AS early_filter_same_rows;
+-- Leaky conditions don't move ahead of a security barrier's
+CREATE VIEW test_barrier WITH (security_barrier) AS
+SELECT fid, tags, geom FROM test_full WHERE ST_NPoints(geom) > 4;
+EXPLAIN (COSTS OFF)
+SELECT fid, geom FROM test_barrier WHERE tags->>'name' ILIKE '%platz%';
+DROP VIEW test_barrier;
+-- Conditions on the geometry stay in the Filter
+EXPLAIN (COSTS OFF)
+SELECT fid FROM test_full WHERE tags->>'name' ILIKE '%platz%' AND ST_NPoints(geom) > 4;
+
+-- Test 29: Bbox column
+SELECT 'Test 29: Bbox column' AS test;
+CREATE FOREIGN TABLE test_bbox (
+    fid bigint,
+    type integer,
+    geom geometry(Geometry, 3857),
+    bbox box2d
+) SERVER geodesk_test_server
+OPTIONS (datasource 'test/data/test.gol');
+CREATE FOREIGN TABLE test_bbox_geom (
+    fid bigint,
+    type integer,
+    bbox geometry(Geometry, 3857)
+) SERVER geodesk_test_server
+OPTIONS (datasource 'test/data/test.gol');
+SELECT count(*) FILTER (WHERE bbox IS NULL) = 0 AS bbox_always_set FROM test_bbox;
+SELECT bool_and(abs(ST_XMin(bbox) - ST_XMin(geom)) < 0.01 AND
+                abs(ST_YMin(bbox) - ST_YMin(geom)) < 0.01 AND
+                abs(ST_XMax(bbox) - ST_XMax(geom)) < 0.01 AND
+                abs(ST_YMax(bbox) - ST_YMax(geom)) < 0.01) AS bbox_matches_geometry
+FROM test_bbox WHERE type <> 2 AND geom IS NOT NULL;
+SELECT bool_and(ST_GeometryType(bbox) = CASE WHEN type = 0 THEN 'ST_Point' ELSE 'ST_Polygon' END)
+       AS bbox_geometry_types
+FROM test_bbox_geom;
+EXPLAIN (COSTS OFF)
+SELECT fid FROM test_bbox_geom WHERE bbox && ST_MakeEnvelope(0, 0, 100000, 100000, 3857);
+SELECT (SELECT count(*) FROM test_bbox_geom
+        WHERE bbox && ST_MakeEnvelope(0, 0, 100000, 100000, 3857)) =
+       (SELECT count(*) FROM (SELECT bbox FROM test_bbox OFFSET 0) s
+        WHERE s.bbox && ST_MakeEnvelope(0, 0, 100000, 100000, 3857)) AS bbox_filter_same_count;
+SELECT fid FROM test_bbox_geom
+WHERE bbox && ST_MakeEnvelope(0, 0, 100000, 100000, 3857)
+ORDER BY bbox <#> ST_Point(50000, 50000, 3857), fid
+LIMIT 5;
+DROP FOREIGN TABLE test_bbox_geom;
+DROP FOREIGN TABLE test_bbox;
+
 -- Cleanup
 DROP FOREIGN TABLE IF EXISTS test_basic;
 DROP FOREIGN TABLE IF EXISTS test_full;